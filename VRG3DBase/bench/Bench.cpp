@@ -0,0 +1,241 @@
+#include "Bench.H"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <new>
+#include <thread>
+
+using namespace G3D;
+
+
+namespace {
+
+std::atomic<G3D::int64> numAllocations(0);
+
+void*
+countedAlloc(size_t size)
+{
+  numAllocations.fetch_add(1, std::memory_order_relaxed);
+  void *p = ::malloc((size > 0) ? size : 1);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+double
+nowSeconds()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void
+appendJSONString(std::string &out, const std::string &s)
+{
+  out += '"';
+  for (size_t i=0;i<s.size();i++) {
+    char c = s[i];
+    if ((c == '"') || (c == '\\')) {
+      out += '\\';
+      out += c;
+    }
+    else if ((unsigned char)c < 0x20) {
+      out += format("\\u%04x", (int)c);
+    }
+    else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+/// JSON has no infinity or NaN
+std::string
+jsonNumber(double d)
+{
+  if (!(d == d) || (d > 1e300) || (d < -1e300)) {
+    return "null";
+  }
+  return format("%.6g", d);
+}
+
+} // end namespace
+
+
+// Count every allocation the benchmarks make through new
+void* operator new(size_t size)                  { return countedAlloc(size); }
+void* operator new[](size_t size)                { return countedAlloc(size); }
+void  operator delete(void *p) noexcept          { ::free(p); }
+void  operator delete[](void *p) noexcept        { ::free(p); }
+void  operator delete(void *p, size_t) noexcept   { ::free(p); }
+void  operator delete[](void *p, size_t) noexcept { ::free(p); }
+
+G3D::int64
+benchNumAllocations()
+{
+  return numAllocations.load(std::memory_order_relaxed);
+}
+
+
+BenchRunner::BenchRunner()
+{
+  _minTime = 0.5;
+  _minBatches = 5;
+}
+
+bool
+BenchRunner::enabled(const std::string &name) const
+{
+  return (_filter == "") || (name.find(_filter) != std::string::npos);
+}
+
+BenchRunner::Result&
+BenchRunner::findOrAddResult(const std::string &name)
+{
+  for (size_t i=0;i<_results.size();i++) {
+    if (_results[i].name == name) {
+      return _results[i];
+    }
+  }
+  Result r;
+  r.name = name;
+  r.iterations = 0;
+  r.medianNs = 0.0;
+  r.minNs = 0.0;
+  r.itemsPerIteration = 0.0;
+  r.allocsPerIteration = 0.0;
+  _results.push_back(r);
+  return _results.back();
+}
+
+bool
+BenchRunner::run(const std::string &name, double itemsPerIteration, const std::function<void()> &body,
+                 const std::function<void()> &setup)
+{
+  if (!enabled(name)) {
+    return false;
+  }
+
+  // Warm up, and find out roughly how long a call takes
+  if (setup) {
+    setup();
+  }
+  double t0 = nowSeconds();
+  body();
+  double single = G3D::max(nowSeconds() - t0, 1e-9);
+
+  G3D::int64 batchSize = G3D::iMax(1, (int)G3D::min(1e9, (_minTime / 10.0) / single));
+  std::vector<double> perIteration;
+  G3D::int64 iterations = 0;
+  G3D::int64 allocations = 0;
+  double spent = 0.0;
+  while ((spent < _minTime) || ((int)perIteration.size() < _minBatches)) {
+    if (setup) {
+      setup();
+    }
+    G3D::int64 allocationsBefore = benchNumAllocations();
+    double start = nowSeconds();
+    for (G3D::int64 i=0;i<batchSize;i++) {
+      body();
+    }
+    double elapsed = nowSeconds() - start;
+    allocations += benchNumAllocations() - allocationsBefore;
+    perIteration.push_back(elapsed / batchSize * 1e9);
+    iterations += batchSize;
+    spent += elapsed;
+  }
+
+  std::sort(perIteration.begin(), perIteration.end());
+  Result &r = findOrAddResult(name);
+  r.iterations = iterations;
+  r.medianNs = perIteration[perIteration.size() / 2];
+  r.minNs = perIteration[0];
+  r.itemsPerIteration = itemsPerIteration;
+  r.allocsPerIteration = (double)allocations / iterations;
+  fprintf(stderr, "  %-48s %14.1f ns\n", name.c_str(), r.medianNs);
+  return true;
+}
+
+void
+BenchRunner::addMetric(const std::string &name, const std::string &metric, double value)
+{
+  findOrAddResult(name).metrics.push_back(std::make_pair(metric, value));
+}
+
+std::string
+BenchRunner::toJSON() const
+{
+  std::string out = "{\n  \"context\": {";
+  out += format("\"hardwareThreads\": %d, ", (int)std::thread::hardware_concurrency());
+#ifdef NDEBUG
+  out += "\"build\": \"release\", ";
+#else
+  out += "\"build\": \"debug\", ";
+#endif
+  out += format("\"minTimeSeconds\": %s", jsonNumber(_minTime).c_str());
+  out += "},\n  \"benchmarks\": [";
+  for (size_t i=0;i<_results.size();i++) {
+    const Result &r = _results[i];
+    out += (i == 0) ? "\n    {" : ",\n    {";
+    out += "\"name\": ";
+    appendJSONString(out, r.name);
+    out += format(", \"iterations\": %lld, \"medianNs\": %s, \"minNs\": %s, \"allocsPerIteration\": %s",
+                  (long long)r.iterations, jsonNumber(r.medianNs).c_str(), jsonNumber(r.minNs).c_str(),
+                  jsonNumber(r.allocsPerIteration).c_str());
+    if ((r.itemsPerIteration > 0.0) && (r.medianNs > 0.0)) {
+      out += format(", \"itemsPerSecond\": %s",
+                    jsonNumber(r.itemsPerIteration / (r.medianNs * 1e-9)).c_str());
+    }
+    for (size_t m=0;m<r.metrics.size();m++) {
+      out += ", ";
+      appendJSONString(out, r.metrics[m].first);
+      out += ": " + jsonNumber(r.metrics[m].second);
+    }
+    out += "}";
+  }
+  out += "\n  ]\n}\n";
+  return out;
+}
+
+bool
+BenchRunner::writeJSON(const std::string &filename) const
+{
+  std::string json = toJSON();
+  FILE *f = fopen(filename.c_str(), "wb");
+  if (f == NULL) {
+    return false;
+  }
+  bool ok = (fwrite(json.data(), 1, json.size(), f) == json.size());
+  return (fclose(f) == 0) && ok;
+}
+
+void
+BenchRunner::printTable(FILE *f) const
+{
+  fprintf(f, "%-48s %14s %14s %10s %14s\n", "benchmark", "median ns", "min ns", "allocs", "items/s");
+  for (size_t i=0;i<_results.size();i++) {
+    const Result &r = _results[i];
+    fprintf(f, "%-48s %14.1f %14.1f %10.4g", r.name.c_str(), r.medianNs, r.minNs, r.allocsPerIteration);
+    if ((r.itemsPerIteration > 0.0) && (r.medianNs > 0.0)) {
+      fprintf(f, " %14.4g", r.itemsPerIteration / (r.medianNs * 1e-9));
+    }
+    for (size_t m=0;m<r.metrics.size();m++) {
+      fprintf(f, "  %s=%.4g", r.metrics[m].first.c_str(), r.metrics[m].second);
+    }
+    fprintf(f, "\n");
+  }
+}
+
+
+std::string
+benchTempDirectory()
+{
+  static std::string dir;
+  if (dir == "") {
+    std::filesystem::path p = std::filesystem::temp_directory_path() / "vrg3dbase_bench";
+    std::filesystem::create_directories(p);
+    dir = p.string();
+  }
+  return dir;
+}
@@ -0,0 +1,745 @@
+#include "Bench.H"
+#include "../include/EventMgr.H"
+#include "../include/StringUtils.H"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace G3D;
+
+
+namespace {
+
+/// Counts the arc callbacks, standing in for an application's handlers.
+class CallbackCounter
+{
+public:
+  CallbackCounter() : count(0) {}
+  void onArc(MinVR::EventRef e) { count++; }
+  int count;
+};
+
+/// Nanoseconds since the first call
+double
+latencyClockNs()
+{
+  static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// Records how long ago each event it gets was created, the event's data
+/// holding latencyClockNs() at the time.
+class LatencyRecorder
+{
+public:
+  LatencyRecorder() : samples(NULL) {}
+  void onSample(MinVR::EventRef e) {
+    samples->push_back(latencyClockNs() - e->get1DData());
+  }
+  std::vector<double> *samples;
+};
+
+/// The events of one frame of a recorded session: head and wand
+/// tracking, the mouse, a joystick axis, some button presses and now and
+/// then a network message
+void
+makeSessionFrame(int frame, int numFsas, int arcsPerState, BenchRandom &random, Array<MinVR::EventRef> &events)
+{
+  const char *trackers[] = {"Head_Tracker", "Wand_Tracker"};
+  for (int t=0;t<2;t++) {
+    Vector3 p((float)random.uniform(-1.0, 1.0), (float)random.uniform(1.0, 2.0), (float)random.uniform(-1.0, 1.0));
+    CoordinateFrame cf(Matrix3::fromAxisAngle(Vector3::unitY(), (float)random.uniform(0.0, 6.28)), p);
+    events.append(new MinVR::VRG3DEvent(trackers[t], cf));
+  }
+  events.append(new MinVR::VRG3DEvent("Mouse_Pointer", Vector2((float)random.uniform(), (float)random.uniform())));
+  events.append(new MinVR::VRG3DEvent("Joystick_X", random.uniform(-1.0, 1.0)));
+  int numButtons = random.integer(4);
+  for (int b=0;b<numButtons;b++) {
+    events.append(new MinVR::VRG3DEvent(format("Button%d_down", random.integer(numFsas * arcsPerState))));
+  }
+  if (frame % 60 == 0) {
+    events.append(new MinVR::VRG3DEvent("Network_Message", format("<status frame=\"%d\"/>", frame)));
+  }
+}
+
+/// A device level translator for one tracker and glove, standing in for
+/// the Fsas of a VR device driver: it smooths the tracker, turns the
+/// glove's bend into hand events and follows grabs and releases.  Each
+/// event costs work iterations of arithmetic.
+class DeviceTranslator
+{
+public:
+  DeviceTranslator() : eventMgr(NULL), device(0), work(0), smoothed(0.0f) {}
+
+  void onMove(MinVR::EventRef e) {
+    CoordinateFrame cf = e->getCoordinateFrameData();
+    cf.translation.x += filter(cf.translation.x);
+    eventMgr->queueEvent(new MinVR::VRG3DEvent(format("Hand%d_Move", device), cf));
+  }
+  void onBend(MinVR::EventRef e) {
+    double bend = e->get1DData() + filter((float)e->get1DData());
+    eventMgr->queueEvent(new MinVR::VRG3DEvent(format("Hand%d_Bend", device), bend));
+    if (e->get1DData() > 0.9) {
+      eventMgr->queueEventWithoutFilter(new MinVR::VRG3DEvent(format("Hand%d_Squeeze", device)));
+    }
+  }
+  void onGrab(MinVR::EventRef e)    { eventMgr->queueEvent(new MinVR::VRG3DEvent(format("Hand%d_Grab", device))); }
+  void onRelease(MinVR::EventRef e) { eventMgr->queueEvent(new MinVR::VRG3DEvent(format("Hand%d_Release", device))); }
+
+  /// The device's Fsa: Open and Closed states, each passing motion on
+  FsaRef makeFsa() {
+    FsaRef fsa = new Fsa(format("Device%d", device));
+    fsa->setDebug(false);
+    fsa->addState("Open");
+    fsa->addState("Closed");
+    for (int s=0;s<2;s++) {
+      Array<std::string> move, bend;
+      move.append(format("Tracker%d_Move", device));
+      bend.append(format("Glove%d_Bend", device));
+      fsa->addArc("Move", s, s, move);
+      fsa->addArc("Bend", s, s, bend);
+    }
+    Array<std::string> grab, release;
+    grab.append(format("Glove%d_Grab", device));
+    release.append(format("Glove%d_Release", device));
+    fsa->addArc("Grab", 0, 1, grab);
+    fsa->addArc("Release", 1, 0, release);
+    fsa->addArcCallback("Move", this, &DeviceTranslator::onMove);
+    fsa->addArcCallback("Bend", this, &DeviceTranslator::onBend);
+    fsa->addArcCallback("Grab", this, &DeviceTranslator::onGrab);
+    fsa->addArcCallback("Release", this, &DeviceTranslator::onRelease);
+    return fsa;
+  }
+
+  EventMgr *eventMgr;
+  int       device;
+  int       work;
+
+private:
+  /// Exponential smoothing run work times, deterministic so that the
+  /// output can be compared
+  float filter(float x) {
+    for (int i=0;i<work;i++) {
+      smoothed = 0.9f * smoothed + 0.1f * x;
+    }
+    return smoothed * 0.001f;
+  }
+  float smoothed;
+};
+
+/// A frame of input from numDevices trackers and gloves, interleaved
+void
+makeDeviceFrame(int numDevices, int movesPerDevice, BenchRandom &random, Array<MinVR::EventRef> &events)
+{
+  for (int d=0;d<numDevices;d++) {
+    for (int m=0;m<movesPerDevice;m++) {
+      events.append(new MinVR::VRG3DEvent(format("Tracker%d_Move", d),
+          CoordinateFrame(Vector3((float)random.uniform(), (float)random.uniform(), (float)random.uniform()))));
+      if (m % 2 == 0) {
+        events.append(new MinVR::VRG3DEvent(format("Glove%d_Bend", d), random.uniform()));
+      }
+    }
+    if (random.integer(4) == 0) {
+      events.append(new MinVR::VRG3DEvent(format((random.integer(2) == 0) ? "Glove%d_Grab" : "Glove%d_Release", d)));
+    }
+  }
+  for (int i=events.size()-1;i>0;i--) {
+    int j = random.integer(i + 1);
+    MinVR::EventRef e = events[i];
+    events[i] = events[j];
+    events[j] = e;
+  }
+}
+
+/// An EventMgr with a DeviceTranslator as device level Fsa for each of
+/// numDevices devices
+EventMgrRef
+makeDeviceEventMgr(int numDevices, int work, std::vector<DeviceTranslator> &translators)
+{
+  EventMgrRef eventMgr = new EventMgr(NULL);
+  translators.resize(numDevices);
+  for (int d=0;d<numDevices;d++) {
+    translators[d].eventMgr = eventMgr.pointer();
+    translators[d].device = d;
+    translators[d].work = work;
+    eventMgr->addDeviceLevelFsaRef(translators[d].makeFsa());
+  }
+  return eventMgr;
+}
+
+/** An Fsa shaped like a typical interaction technique: numStates states in
+    a cycle, each with arcsPerState arcs triggered by button and tracker
+    events, a few of which are shared across Fsas, and an ALL_2D arc. */
+FsaRef
+makeFsa(int index, int numStates, int arcsPerState, CallbackCounter *counter, Fsa *empty = NULL)
+{
+  FsaRef fsa = (empty != NULL) ? empty : new Fsa(format("BenchFsa%d", index));
+  fsa->setDebug(false);
+  for (int s=0;s<numStates;s++) {
+    fsa->addState(format("State%d", s));
+  }
+  for (int s=0;s<numStates;s++) {
+    for (int a=0;a<arcsPerState;a++) {
+      Array<std::string> triggers;
+      // a quarter of the buttons are shared by every Fsa
+      int button = (a % 4 == 0) ? a : (index * arcsPerState + a);
+      triggers.append(format("Button%d_down", button));
+      std::string arcName = format("Arc%d_%d", s, a);
+      int to = (a == 0) ? (s + 1) % numStates : s;
+      fsa->addArc(arcName, s, to, triggers);
+      fsa->addArcCallback(arcName, counter, &CallbackCounter::onArc);
+    }
+    Array<std::string> allTriggers;
+    allTriggers.append("ALL_2D");
+    fsa->addArc(format("Motion%d", s), s, s, allTriggers);
+  }
+  return fsa;
+}
+
+/// A frame's worth of input: mostly button presses, with tracker and
+/// mouse motion mixed in.
+void
+makeEvents(int n, int numFsas, int arcsPerState, BenchRandom &random, Array<MinVR::EventRef> &events)
+{
+  for (int i=0;i<n;i++) {
+    int kind = random.integer(10);
+    if (kind < 6) {
+      int button = random.integer(numFsas * arcsPerState);
+      events.append(new MinVR::VRG3DEvent(format("Button%d_down", button)));
+    }
+    else if (kind < 8) {
+      events.append(new MinVR::VRG3DEvent("Mouse_Pointer", Vector2((float)random.uniform(), (float)random.uniform())));
+    }
+    else {
+      events.append(new MinVR::VRG3DEvent(format("Tracker%d_Move", random.integer(4)),
+          CoordinateFrame(Vector3((float)random.uniform(), (float)random.uniform(), (float)random.uniform()))));
+    }
+  }
+}
+
+} // end namespace
+
+
+void
+runEventBenchmarks(BenchRunner &runner)
+{
+  const int numEvents = 1000;
+  const int arcsPerState = 8;
+  CallbackCounter counter;
+  BenchRandom random(3);
+
+  // One Fsa on its own
+  {
+    FsaRef fsa = makeFsa(0, 4, arcsPerState, &counter);
+    Array<MinVR::EventRef> events;
+    makeEvents(numEvents, 1, arcsPerState, random, events);
+    runner.run("Fsa/processEvent/4states", numEvents, [&] {
+      for (int i=0;i<events.size();i++) {
+        fsa->processEvent(events[i]);
+      }
+    });
+  }
+
+  // Whole frames through the EventMgr with more and more Fsas listening
+  int fsaCounts[] = {10, 50, 200};
+  for (int c=0;c<3;c++) {
+    int numFsas = fsaCounts[c];
+    std::string name = format("EventMgr/processEventQueue/%dfsas", numFsas);
+    if (!runner.enabled(name)) {
+      continue;
+    }
+    EventMgrRef eventMgr = new EventMgr(NULL);
+    for (int f=0;f<numFsas;f++) {
+      eventMgr->addFsaRef(makeFsa(f, 4, arcsPerState, &counter));
+    }
+    Array<MinVR::EventRef> events;
+    makeEvents(numEvents, numFsas, arcsPerState, random, events);
+    runner.run(name, numEvents, [&] {
+      for (int i=0;i<events.size();i++) {
+        eventMgr->queueEvent(events[i]);
+      }
+      eventMgr->processEventQueue();
+    });
+  }
+
+  // The trigger index with many arcs per state
+  {
+    const int numFsas = 200;
+    const int manyArcs = 50;
+    Array<MinVR::EventRef> events;
+    makeEvents(numEvents, numFsas, manyArcs, random, events);
+    std::string name = format("EventMgr/processEventQueue/%dfsas%darcs", numFsas, manyArcs);
+    if (runner.enabled(name)) {
+      EventMgrRef eventMgr = new EventMgr(NULL);
+      for (int f=0;f<numFsas;f++) {
+        eventMgr->addFsaRef(makeFsa(f, 4, manyArcs, &counter));
+      }
+      int count0 = counter.count;
+      G3D::int64 runs = 0;
+      if (runner.run(name, numEvents, [&] {
+            for (int i=0;i<events.size();i++) {
+              eventMgr->queueEvent(events[i]);
+            }
+            eventMgr->processEventQueue();
+            runs++;
+          })) {
+        runner.addMetric(name, "callbacksPerEvent", (counter.count - count0) / (runs * (double)events.size()));
+      }
+    }
+  }
+
+  // Routing events to the Fsas that can respond against giving every
+  // event to every Fsa
+  {
+    const int numFsas = 200;
+    const int manyArcs = 50;
+    Array<MinVR::EventRef> events;
+    makeEvents(numEvents, numFsas, manyArcs, random, events);
+    EventMgrRef eventMgrs[2];
+    for (int mode=0;mode<2;mode++) {
+      eventMgrs[mode] = new EventMgr(NULL);
+      eventMgrs[mode]->setBroadcastEvents(mode == 1);
+      for (int f=0;f<numFsas;f++) {
+        eventMgrs[mode]->addFsaRef(makeFsa(f, 4, manyArcs, &counter));
+      }
+    }
+
+    const char *modeNames[] = {"routed", "broadcast"};
+    for (int mode=0;mode<2;mode++) {
+      std::string name = format("EventMgr/dispatch/%s/%dfsas%darcs", modeNames[mode], numFsas, manyArcs);
+      G3D::int64 delivered0 = eventMgrs[mode]->getFsaRouter().numDelivered();
+      G3D::int64 runs = 0;
+      if (runner.run(name, numEvents, [&] {
+            for (int i=0;i<events.size();i++) {
+              eventMgrs[mode]->processEvent(events[i]);
+            }
+            runs++;
+          })) {
+        double delivered = (double)(eventMgrs[mode]->getFsaRouter().numDelivered() - delivered0);
+        runner.addMetric(name, "fsasPerEvent", delivered / (runs * (double)numEvents));
+      }
+    }
+  }
+
+  // Aliasing copies and renames every aliased event before dispatch
+  {
+    EventMgrRef eventMgr = new EventMgr(NULL);
+    for (int f=0;f<50;f++) {
+      eventMgr->addFsaRef(makeFsa(f, 4, arcsPerState, &counter));
+    }
+    for (int b=0;b<16;b++) {
+      Array<std::string> aliases;
+      aliases.append(format("Alias%d_down", b), format("OtherAlias%d_down", b));
+      eventMgr->addEventAliases(format("Button%d_down", b), aliases);
+    }
+    Array<MinVR::EventRef> events;
+    for (int i=0;i<numEvents;i++) {
+      events.append(new MinVR::VRG3DEvent(format("Button%d_down", random.integer(32))));
+    }
+    runner.run("EventMgr/queueEvent/aliased", numEvents, [&] {
+      for (int i=0;i<events.size();i++) {
+        eventMgr->queueEvent(events[i]);
+      }
+      eventMgr->processEventQueue();
+    });
+
+    // Each button also aliased through a chain eight deep
+    for (int b=0;b<16;b++) {
+      for (int d=0;d<8;d++) {
+        Array<std::string> aliases;
+        aliases.append(format("Chain%d_%d_down", b, d+1));
+        eventMgr->addEventAliases((d == 0) ? format("Alias%d_down", b) : format("Chain%d_%d_down", b, d), aliases);
+      }
+    }
+    runner.run("EventMgr/queueEvent/aliasChain8", numEvents, [&] {
+      for (int i=0;i<events.size();i++) {
+        eventMgr->queueEvent(events[i]);
+      }
+      eventMgr->processEventQueue();
+    });
+  }
+
+  // Timer events due this frame
+  {
+    EventMgrRef eventMgr = new EventMgr(NULL);
+    for (int f=0;f<10;f++) {
+      eventMgr->addFsaRef(makeFsa(f, 4, arcsPerState, &counter));
+    }
+    Array<MinVR::EventRef> events;
+    makeEvents(numEvents, 10, arcsPerState, random, events);
+    runner.run("EventMgr/queueTimerEvent/due", numEvents, [&] {
+      for (int i=0;i<events.size();i++) {
+        eventMgr->queueTimerEvent(events[i], 0.0);
+      }
+      eventMgr->processEventQueue();
+    });
+  }
+
+  // 100k timers pending, due over the next 100 seconds, with the clock
+  // moving on a 60 Hz frame at a time and every timer that fires added
+  // again.  The old pair of arrays scanned in full every frame for
+  // comparison.
+  {
+    const int numPending = 100000;
+    const double frameTime = 1.0 / 60.0;
+    Array<MinVR::EventRef> timerEvents;
+    Array<double> delays;
+    for (int i=0;i<numPending;i++) {
+      timerEvents.append(new MinVR::VRG3DEvent(format("Timer%d", i % 64)));
+      delays.append(random.uniform(0.0, 100.0));
+    }
+
+    std::string name = "TimerWheel/advance/100kPending";
+    if (runner.enabled(name)) {
+      TimerWheel wheel;
+      double now = 0.0;
+      for (int i=0;i<numPending;i++) {
+        wheel.add(timerEvents[i], now, delays[i]);
+      }
+      Array<MinVR::EventRef> due;
+      G3D::int64 fired = 0;
+      G3D::int64 frames = 0;
+      int next = 0;
+      runner.run(name, 1, [&] {
+        now += frameTime;
+        due.fastClear();
+        wheel.advance(now, due);
+        for (int i=0;i<due.size();i++) {
+          wheel.add(due[i], now, delays[next]);
+          next = (next + 1) % numPending;
+        }
+        fired += due.size();
+        frames++;
+      });
+      runner.addMetric(name, "firedPerFrame", (double)fired / frames);
+    }
+
+    name = "EventMgr/timers/arrayScan/100kPending";
+    if (runner.enabled(name)) {
+      Array<MinVR::EventRef> pendingEvents;
+      Array<double> pendingTimes;
+      double now = 0.0;
+      for (int i=0;i<numPending;i++) {
+        pendingEvents.append(timerEvents[i]);
+        pendingTimes.append(now + delays[i]);
+      }
+      Array<MinVR::EventRef> due;
+      int next = 0;
+      runner.run(name, 1, [&] {
+        now += frameTime;
+        due.fastClear();
+        int e = 0;
+        while (e < pendingEvents.size()) {
+          if (pendingTimes[e] <= now) {
+            due.append(pendingEvents[e]);
+            pendingEvents.fastRemove(e);
+            pendingTimes.fastRemove(e);
+          }
+          else {
+            e++;
+          }
+        }
+        for (int i=0;i<due.size();i++) {
+          pendingEvents.append(due[i]);
+          pendingTimes.append(now + delays[next]);
+          next = (next + 1) % numPending;
+        }
+      });
+    }
+  }
+
+  // Reading a recorded session back and replaying it as fast as possible:
+  // a session's worth of input through the Fsas with no devices
+  {
+    const int numFrames = 600;
+    const int numFsas = 50;
+    std::string logFile = benchTempDirectory() + "/session.vel";
+    double fakeTime = 5000.0;
+    EventMgrRef eventMgrs[2];
+    for (int m=0;m<2;m++) {
+      eventMgrs[m] = new EventMgr(NULL);
+      eventMgrs[m]->setClock([&fakeTime] { return fakeTime; });
+      for (int f=0;f<numFsas;f++) {
+        eventMgrs[m]->addFsaRef(makeFsa(f, 4, arcsPerState, &counter));
+      }
+    }
+
+    // Live, with a 60 Hz fake clock
+    Array<MinVR::EventRef> queued;
+    BenchRandom sessionRandom(11);
+    alwaysAssertM(eventMgrs[0]->startRecording(logFile), "Can't create " + logFile);
+    eventMgrs[0]->queuePeriodicTimerEvent(new MinVR::VRG3DEvent("Tick"), 0.25, 0.25);
+    for (int frame=0;frame<numFrames;frame++) {
+      int first = queued.size();
+      makeSessionFrame(frame, numFsas, arcsPerState, sessionRandom, queued);
+      for (int i=first;i<queued.size();i++) {
+        eventMgrs[0]->queueEvent(queued[i]);
+      }
+      fakeTime += 1.0 / 60.0;
+      eventMgrs[0]->processEventQueue();
+    }
+    alwaysAssertM(eventMgrs[0]->stopRecording(), "Couldn't write " + logFile);
+
+    Array<EventLogRecord> records;
+    std::string error;
+    alwaysAssertM(EventLogReader::read(logFile, records, error), error);
+
+    std::string name = "EventLog/read/600frames";
+    FILE *f = fopen(logFile.c_str(), "rb");
+    fseek(f, 0, SEEK_END);
+    double bytes = (double)ftell(f);
+    fclose(f);
+    if (runner.run(name, numFrames, [&] {
+          Array<EventLogRecord> r;
+          EventLogReader::read(logFile, r, error);
+          benchDoNotOptimize(r.size());
+        })) {
+      runner.addMetric(name, "bytesPerEvent", bytes / queued.size());
+    }
+
+    runner.run("EventMgr/replay/600frames50fsas", numFrames, [&] {
+      eventMgrs[1]->startReplay(records, false);
+      while (eventMgrs[1]->isReplaying()) {
+        eventMgrs[1]->processEventQueue();
+      }
+    });
+  }
+
+  // Real time per frame through 50 Fsas, with and without a budget, of a
+  // backlog of pointer events arriving amid frames of normal input
+  {
+    EventMgrRef eventMgrs[2];
+    for (int m=0;m<2;m++) {
+      eventMgrs[m] = new EventMgr(NULL);
+      for (int f=0;f<50;f++) {
+        eventMgrs[m]->addFsaRef(makeFsa(f, 4, arcsPerState, &counter));
+      }
+    }
+    eventMgrs[1]->setMaxEventsPerFrame(256);
+    Array<MinVR::EventRef> burst;
+    for (int i=0;i<5000;i++) {
+      burst.append(new MinVR::VRG3DEvent("Mouse_Pointer", Vector2((float)random.uniform(), (float)random.uniform())));
+    }
+    Array<MinVR::EventRef> frameEvents;
+    makeEvents(20, 50, arcsPerState, random, frameEvents);
+    for (int m=0;m<2;m++) {
+      std::string name = (m == 0) ? "EventMgr/burst5000/unbudgeted" : "EventMgr/burst5000/budget256";
+      double worstMs = 0.0;
+      int frames = 0;
+      if (runner.run(name, burst.size(), [&] {
+            for (int i=0;i<burst.size();i++) {
+              eventMgrs[m]->queueEvent(burst[i]);
+            }
+            frames = 0;
+            do {
+              for (int i=0;i<frameEvents.size();i++) {
+                eventMgrs[m]->queueEvent(frameEvents[i]);
+              }
+              std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+              eventMgrs[m]->processEventQueue();
+              worstMs = max(worstMs, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+              frames++;
+            } while (eventMgrs[m]->numDeferredEvents() > 0);
+          })) {
+        runner.addMetric(name, "worstFrameMs", worstMs);
+        runner.addMetric(name, "framesToDrain", frames);
+      }
+    }
+  }
+
+  // Device level Fsas in parallel: the time for a frame of the input of
+  // sixteen device translators, one after another and in parallel
+  {
+    const int numDevices = 16;
+    for (int m=0;m<2;m++) {
+      std::vector<DeviceTranslator> translators;
+      EventMgrRef eventMgr = makeDeviceEventMgr(numDevices, 2000, translators);
+      if (m == 1) {
+        eventMgr->setParallelDeviceLevelFsas(true);
+      }
+      BenchRandom deviceRandom(7);
+      Array<MinVR::EventRef> events;
+      makeDeviceFrame(numDevices, 8, deviceRandom, events);
+      runner.run((m == 0) ? "EventMgr/deviceLevel16/serial" : "EventMgr/deviceLevel16/parallel", events.size(), [&] {
+          for (int i=0;i<events.size();i++) {
+            eventMgr->queueEvent(events[i]);
+          }
+          eventMgr->processEventQueue();
+        });
+    }
+  }
+
+  // Events from several driver threads at once through the lock-free
+  // queue, drained concurrently the way processEventQueue() does.  Run
+  // with --filter EventQueue under ThreadSanitizer to check for races.
+  int producerCounts[] = {1, 2, 4};
+  for (int c=0;c<3;c++) {
+    const int numProducers = producerCounts[c];
+    const int perProducer = 250000;
+    std::string name = format("EventQueue/pushAndDrain/%dproducers", numProducers);
+    if (!runner.enabled(name)) {
+      continue;
+    }
+    Array< Array<MinVR::EventRef> > producerEvents;
+    producerEvents.resize(numProducers);
+    for (int p=0;p<numProducers;p++) {
+      for (int i=0;i<perProducer;i++) {
+        producerEvents[p].append(new MinVR::VRG3DEvent(format("Tracker%d_Move", p), (double)(p * perProducer + i)));
+      }
+    }
+    EventQueue queue;
+    Array<MinVR::EventRef> drained;
+    runner.run(name, numProducers * perProducer, [&] {
+      std::vector<std::thread> producers;
+      for (int p=0;p<numProducers;p++) {
+        producers.push_back(std::thread([&queue, &producerEvents, p, perProducer] {
+          for (int i=0;i<perProducer;i++) {
+            queue.push(producerEvents[p][i]);
+          }
+        }));
+      }
+      int total = 0;
+      while (total < numProducers * perProducer) {
+        drained.fastClear();
+        total += queue.drain(drained);
+      }
+      for (size_t p=0;p<producers.size();p++) {
+        producers[p].join();
+      }
+    });
+  }
+
+  // A frame with 10k pointer events queued, most of them compressed away:
+  // Mouse_Pointer keeps the latest, Mouse_Delta sums its deltas.  Then
+  // the compression pass on its own against the scan once per name that
+  // processEventQueue() used to do.
+  {
+    const int numPointerEvents = 10000;
+    Array<MinVR::EventRef> events;
+    for (int i=0;i<numPointerEvents;i++) {
+      int kind = random.integer(10);
+      if (kind < 5) {
+        events.append(new MinVR::VRG3DEvent("Mouse_Pointer", Vector2((float)random.uniform(), (float)random.uniform())));
+      }
+      else if (kind < 9) {
+        events.append(new MinVR::VRG3DEvent("Mouse_Delta", Vector2((float)random.uniform(), (float)random.uniform())));
+      }
+      else {
+        events.append(new MinVR::VRG3DEvent(format("Button%d_down", i)));
+      }
+    }
+
+    EventMgrRef eventMgr = new EventMgr(NULL);
+    eventMgr->addCompressionRule("Mouse_Pointer", EventMgr::COMPRESS_KEEP_LATEST);
+    eventMgr->addCompressionRule("Mouse_Delta", EventMgr::COMPRESS_ACCUMULATE);
+    for (int f=0;f<10;f++) {
+      eventMgr->addFsaRef(makeFsa(f, 4, arcsPerState, &counter));
+    }
+
+    runner.run("EventMgr/processEventQueue/compress10kPointer", numPointerEvents, [&] {
+      for (int i=0;i<events.size();i++) {
+        eventMgr->queueEvent(events[i]);
+      }
+      eventMgr->processEventQueue();
+    });
+
+    // Copying the queue in is part of the timing, it is small next to the
+    // name comparisons
+    Array<MinVR::EventRef> queue;
+    runner.run("EventMgr/compress/perNameScan/10kPointer", numPointerEvents, [&] {
+      queue = events;
+      Array<std::string> toCompress = MinVR::splitStringIntoArray("Mouse_Pointer Mouse_Delta");
+      for (int i=0;i<toCompress.size();i++) {
+        int j = queue.size()-1;
+        bool gotFirst = false;
+        while (j >= 0) {
+          if ((queue[j]->getName() == toCompress[i]) ||
+              (queue[j]->getName() == toCompress[i] + "_down") ||
+              (queue[j]->getName() == toCompress[i] + "up")) {
+            if (!gotFirst) {
+              gotFirst = true;
+            }
+            else {
+              queue.fastRemove(j);
+            }
+          }
+          j--;
+        }
+      }
+      benchDoNotOptimize(queue.size());
+    });
+  }
+
+  // Once the queue has seen a frame's worth of events, pushing and
+  // draining them again on the main thread must reuse the nodes
+  {
+    std::string name = "EventQueue/pushAndDrain/steadyState";
+    if (runner.enabled(name)) {
+      Array<MinVR::EventRef> events;
+      makeEvents(numEvents, 10, arcsPerState, random, events);
+      EventQueue queue;
+      Array<MinVR::EventRef> drained;
+      G3D::int64 nodes0 = 0;
+      G3D::int64 runs = -1;
+      runner.run(name, numEvents, [&] {
+        for (int i=0;i<events.size();i++) {
+          queue.push(events[i]);
+        }
+        drained.fastClear();
+        queue.drain(drained);
+        if (runs++ < 0) {
+          nodes0 = EventQueue::numNodeAllocations();
+        }
+      });
+      runner.addMetric(name, "nodeAllocsPerIteration",
+                       (EventQueue::numNodeAllocations() - nodes0) / (double)G3D::iMax(1, (int)runs));
+    }
+  }
+
+  // Latency from a driver thread queueing an event to its callback
+  // running, with the main thread calling processEventQueue() as fast as
+  // it can and the driver pushing one event every few microseconds
+  {
+    std::string name = "EventMgr/queueEventFromAnyThread/latency";
+    const int numSamples = 20000;
+    std::vector<double> samples;
+    LatencyRecorder recorder;
+    recorder.samples = &samples;
+    EventMgrRef eventMgr = new EventMgr(NULL);
+    for (int f=0;f<50;f++) {
+      eventMgr->addFsaRef(makeFsa(f, 4, arcsPerState, &counter));
+    }
+    FsaRef fsa = new Fsa("LatencyFsa");
+    fsa->setDebug(false);
+    fsa->addState("Start");
+    Array<std::string> triggers;
+    triggers.append("Latency_Sample");
+    fsa->addArc("Sample", 0, 0, triggers);
+    fsa->addArcCallback("Sample", &recorder, &LatencyRecorder::onSample);
+    eventMgr->addFsaRef(fsa);
+    samples.reserve(numSamples);
+
+    if (runner.run(name, numSamples, [&] {
+          size_t target = samples.size() + numSamples;
+          std::thread driver([&eventMgr, numSamples] {
+            for (int i=0;i<numSamples;i++) {
+              double wait = latencyClockNs() + 2000.0;
+              while (latencyClockNs() < wait) {
+              }
+              eventMgr->queueEventFromAnyThread(new MinVR::VRG3DEvent("Latency_Sample", latencyClockNs()));
+            }
+          });
+          while (samples.size() < target) {
+            eventMgr->processEventQueue();
+          }
+          driver.join();
+        })) {
+      std::sort(samples.begin(), samples.end());
+      runner.addMetric(name, "p50Ns", samples[samples.size() / 2]);
+      runner.addMetric(name, "p99Ns", samples[(samples.size() * 99) / 100]);
+    }
+  }
+
+  benchDoNotOptimize(counter.count);
+}
@@ -0,0 +1,70 @@
+/**
+   vrg3dbase_bench: micro- and macro-benchmarks for VRG3DBase that run
+   without a GPU or a display.
+
+   Usage: vrg3dbase_bench [--filter text] [--min-time seconds] [--quick]
+                          [--json results.json]
+
+   Results go to stdout as a table, and as JSON to the --json file for
+   comparing across commits.  All data is synthetic and generated from
+   fixed seeds, so runs on the same machine are comparable.
+*/
+
+#include "Bench.H"
+#include "../include/ConfigVal.H"
+
+using namespace G3D;
+
+
+int
+main(int argc, char **argv)
+{
+  BenchRunner runner;
+  std::string jsonFile;
+  for (int i=1;i<argc;i++) {
+    std::string arg = argv[i];
+    if ((arg == "--filter") && (i+1 < argc)) {
+      runner.setFilter(argv[++i]);
+    }
+    else if ((arg == "--min-time") && (i+1 < argc)) {
+      runner.setMinTime(atof(argv[++i]));
+    }
+    else if (arg == "--quick") {
+      runner.setMinTime(0.05);
+      runner.setMinBatches(3);
+    }
+    else if ((arg == "--json") && (i+1 < argc)) {
+      jsonFile = argv[++i];
+    }
+    else {
+      fprintf(stderr, "Usage: %s [--filter text] [--min-time seconds] [--quick] [--json results.json]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  // EventMgr and friends read ConfigVals, give them an empty map rather
+  // than one built from our command line
+  Log *log = new Log(benchTempDirectory() + "/log.txt");
+  char *configArgv[] = {argv[0], NULL};
+  MinVR::ConfigValMap::map = new MinVR::ConfigMap(1, configArgv, log, false);
+
+  fprintf(stderr, "Meshes\n");
+  runMeshBenchmarks(runner);
+  fprintf(stderr, "Events\n");
+  runEventBenchmarks(runner);
+  fprintf(stderr, "Parsing\n");
+  runParsingBenchmarks(runner);
+  fprintf(stderr, "Rendering\n");
+  runRenderingBenchmarks(runner);
+  fprintf(stderr, "Textures\n");
+  runTextureBenchmarks(runner);
+
+  runner.printTable(stdout);
+  if (jsonFile != "") {
+    if (!runner.writeJSON(jsonFile)) {
+      fprintf(stderr, "Can't write %s\n", jsonFile.c_str());
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,94 @@
+#include "Bench.H"
+#include "../include/SMesh.H"
+
+using namespace G3D;
+
+
+namespace {
+
+/// A bumpy n x n vertex height field on the unit square, two triangles per
+/// grid cell.
+void
+makeGrid(int n, BenchRandom &random, Array<Vector3> &verts, Array<Vector3> &normals, Array<int> &indices)
+{
+  verts.fastClear();
+  normals.fastClear();
+  indices.fastClear();
+  for (int j=0;j<n;j++) {
+    for (int i=0;i<n;i++) {
+      double x = (double)i / (n-1);
+      double z = (double)j / (n-1);
+      double y = 0.05 * sin(x * 20.0) * cos(z * 17.0) + random.uniform(-0.002, 0.002);
+      verts.append(Vector3((float)x, (float)y, (float)z));
+      normals.append(Vector3(0, 1, 0));
+    }
+  }
+  for (int j=0;j<n-1;j++) {
+    for (int i=0;i<n-1;i++) {
+      int v = j*n + i;
+      indices.append(v, v + n, v + 1);
+      indices.append(v + 1, v + n, v + n + 1);
+    }
+  }
+}
+
+} // end namespace
+
+
+void
+runMeshBenchmarks(BenchRunner &runner)
+{
+  // Meshes are built without VARs, those need a GL context
+  BenchRandom random(1);
+  Array<Vector3> verts, normals;
+  Array<int> indices;
+  makeGrid(256, random, verts, normals, indices);
+  int numTris = indices.size() / 3;
+
+  runner.run("SMesh/construct/grid256", numTris, [&] {
+    SMeshRef mesh = new SMesh(verts, normals, indices, false);
+    benchDoNotOptimize(mesh.pointer());
+  });
+
+  runner.run("SMesh/buildTriTree/grid256", numTris, [&] {
+    SMeshRef mesh = new SMesh(verts, normals, indices, false);
+    float t;
+    Vector3 p;
+    mesh->Intersection(Ray::fromOriginAndDirection(Vector3(0.5f, 1, 0.5f), Vector3(0, -1, 0)), t, p);
+    benchDoNotOptimize(t);
+  });
+
+  SMeshRef mesh = new SMesh(verts, normals, indices, false);
+  const int numRays = 1000;
+  Array<Ray> rays;
+  BenchRandom rayRandom(2);
+  for (int i=0;i<numRays;i++) {
+    Vector3 origin((float)rayRandom.uniform(-0.5, 1.5), 1.0f, (float)rayRandom.uniform(-0.5, 1.5));
+    Vector3 target((float)rayRandom.uniform(0, 1), 0.0f, (float)rayRandom.uniform(0, 1));
+    rays.append(Ray::fromOriginAndDirection(origin, (target - origin).direction()));
+  }
+  float t;
+  Vector3 p;
+  // Build the tree outside the timing
+  mesh->Intersection(rays[0], t, p);
+
+  int hits = 0;
+  runner.run("SMesh/intersect/grid256", numRays, [&] {
+    hits = 0;
+    for (int i=0;i<numRays;i++) {
+      if (mesh->Intersection(rays[i], t, p)) {
+        hits++;
+      }
+    }
+    benchDoNotOptimize(hits);
+  });
+  runner.addMetric("SMesh/intersect/grid256", "hitFraction", (double)hits / numRays);
+
+  runner.run("SMesh/surfaceArea/grid256", numTris, [&] {
+    benchDoNotOptimize(mesh->GetSurfaceArea());
+  });
+
+  runner.run("SMesh/pca/grid256", verts.size(), [&] {
+    mesh->PerformPCA();
+  });
+}
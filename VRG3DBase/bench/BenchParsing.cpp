@@ -0,0 +1,189 @@
+#include "Bench.H"
+#include "../include/ConfigVal.H"
+#include "../include/Fsa.H"
+#include "../include/StringUtils.H"
+#include "../include/TextFileReader.H"
+#include "../include/TextureManifest.H"
+
+using namespace G3D;
+
+
+namespace {
+
+void
+writeFile(const std::string &filename, const std::string &contents)
+{
+  FILE *f = fopen(filename.c_str(), "wb");
+  alwaysAssertM(f != NULL, "Can't write " + filename);
+  fwrite(contents.data(), 1, contents.size(), f);
+  fclose(f);
+}
+
+/// A QFSM machine description like the ones Fsa::fromQFSMFile() reads
+std::string
+makeQFSM(int numStates, int numTransitions, BenchRandom &random)
+{
+  std::string xml = "<?xml version='1.0'?>\n<qfsmproject version=\"0.52\">\n"
+                    "<machine name=\"BenchMachine\" nummooreout=\"0\" numbits=\"3\">\n";
+  for (int s=0;s<numStates;s++) {
+    xml += format("  <state description=\"\" code=\"%d\" xpos=\"%d\" ypos=\"%d\" radius=\"40\">State%d</state>\n",
+                  s, random.integer(800), random.integer(600), s);
+  }
+  for (int t=0;t<numTransitions;t++) {
+    xml += format("  <transition type=\"2\" description=\"Button%d_down Button%d_up\">\n"
+                  "    <from>%d</from>\n    <to>%d</to>\n    <inputs invert=\"0\" any=\"0\" default=\"0\">Arc%d</inputs>\n"
+                  "    <outputs></outputs>\n  </transition>\n",
+                  random.integer(64), random.integer(64), random.integer(numStates), random.integer(numStates), t);
+  }
+  xml += "</machine>\n</qfsmproject>\n";
+  return xml;
+}
+
+/// A LoadTextures value with n entries using every optional field
+std::string
+makeTextureList(int n, BenchRandom &random)
+{
+  const char *formats[] = {"RGB8", "RGBA8", "AUTO", "RGB_DXT1", "RGBA_DXT5"};
+  const char *wraps[] = {"TILE", "CLAMP", "ZERO"};
+  const char *interps[] = {"TRILINEAR_MIPMAP", "BILINEAR_NO_MIPMAP", "NEAREST_NO_MIPMAP"};
+  std::string list;
+  for (int i=0;i<n;i++) {
+    switch (random.integer(3)) {
+    case 0:
+      list += format("$(DATA)/textures/set%d/image%05d.png texture%05d ; \n", i % 17, i, i);
+      break;
+    case 1:
+      list += format("textures/image%05d.jpg,textures/image%05d-alpha.png   texture%05d %s ;\n",
+                     i, i, i, formats[random.integer(5)]);
+      break;
+    default:
+      list += format("textures/image%05d.tga texture%05d %s %s %s;\n", i, i, formats[random.integer(5)],
+                     wraps[random.integer(3)], interps[random.integer(3)]);
+      break;
+    }
+  }
+  return list;
+}
+
+} // end namespace
+
+
+void
+runParsingBenchmarks(BenchRunner &runner)
+{
+  BenchRandom random(4);
+  std::string dir = benchTempDirectory();
+
+  // XML through StringUtils, the way Fsa::fromQFSMFile() parses
+  std::string qfsm = makeQFSM(64, 512, random);
+  std::string qfsmFile = dir + "/bench.fsm";
+  writeFile(qfsmFile, qfsm);
+  runner.run("StringUtils/getXMLField/qfsm512", 512, [&] {
+    std::string input = convertNewlinesAndTabsToSpaces(qfsm);
+    Table<std::string, std::string> props;
+    std::string data;
+    int n = 0;
+    while (getXMLField(input, "transition", props, data, input)) {
+      n++;
+    }
+    benchDoNotOptimize(n);
+  });
+  runner.run("Fsa/fromQFSMFile/qfsm512", 512, [&] {
+    FsaRef fsa = Fsa::fromQFSMFile(qfsmFile);
+    benchDoNotOptimize(fsa.pointer());
+  });
+
+  // The streaming XML reader
+  std::string xml = "<scene>\n";
+  for (int i=0;i<5000;i++) {
+    xml += format("<object name=\"Object%d\" type=\"mesh\" visible=\"%d\">%f %f %f</object>\n",
+                  i, i & 1, random.uniform(), random.uniform(), random.uniform());
+  }
+  xml += "</scene>\n";
+  std::string xmlFile = dir + "/bench.xml";
+  writeFile(xmlFile, xml);
+  runner.run("TextFileReader/getXMLField/5000", 5000, [&] {
+    TextFileReader reader(xmlFile);
+    std::string name;
+    std::string data;
+    Table<std::string, std::string> props;
+    int n = 0;
+    while (reader.getXMLField(name, props, data)) {
+      n++;
+    }
+    benchDoNotOptimize(n);
+  });
+  runner.run("TextFileReader/getNextLine/5000", 5000, [&] {
+    TextFileReader reader(xmlFile);
+    std::string line;
+    int n = 0;
+    while (reader.getNextLine(line)) {
+      n++;
+    }
+    benchDoNotOptimize(n);
+  });
+
+  // Config files and ConfigVal lookups
+  std::string config;
+  for (int i=0;i<5000;i++) {
+    config += format("BenchKey%d   %d %f \"some words here\"\n", i, i, random.uniform());
+  }
+  std::string configFile = dir + "/bench.cfg";
+  writeFile(configFile, config);
+  // Reading into the global map, the keys don't clash with anything
+  runner.run("ConfigMap/readFile/5000keys", 5000, [&] {
+    MinVR::ConfigValMap::map->readFile(configFile);
+  });
+  Array<std::string> keys;
+  for (int i=0;i<1000;i++) {
+    keys.append(format("BenchKey%d", random.integer(5000)));
+  }
+  runner.run("ConfigVal/lookupInt/1000", 1000, [&] {
+    int sum = 0;
+    for (int i=0;i<keys.size();i++) {
+      sum += MinVR::ConfigVal(keys[i], 0, false);
+    }
+    benchDoNotOptimize(sum);
+  });
+
+  // Tokenizing
+  std::string tokens;
+  for (int i=0;i<10000;i++) {
+    tokens += format("token%d%s", i, (i % 10 == 9) ? ";\n" : ", ");
+  }
+  runner.run("StringUtils/popNextToken/10000", 10000, [&] {
+    std::string in = tokens;
+    std::string token;
+    int n = 0;
+    while (popNextToken(in, token)) {
+      n++;
+    }
+    benchDoNotOptimize(n);
+  });
+  std::string csv;
+  for (int r=0;r<1000;r++) {
+    csv += format("%d,\"name %d\",%f,%f,%f\n", r, r, random.uniform(), random.uniform(), random.uniform());
+  }
+  runner.run("StringUtils/readDelimitedData/1000rows", 1000, [&] {
+    Array< Array<std::string> > rows = readDelimitedData(csv, ",");
+    benchDoNotOptimize(rows.size());
+  });
+
+  // Texture manifests, text and pre-compiled
+  std::string list = makeTextureList(10000, random);
+  Array<TextureLoadRequest> requests;
+  std::string error;
+  runner.run("TextureManifest/parse/10000", 10000, [&] {
+    requests.fastClear();
+    bool ok = TextureManifest::parse(list, requests, error);
+    alwaysAssertM(ok, error);
+  });
+  Array<uint8> bytes;
+  TextureManifest::serialize(requests, bytes);
+  runner.run("TextureManifest/deserialize/10000", 10000, [&] {
+    requests.fastClear();
+    bool ok = TextureManifest::deserialize(bytes.getCArray(), bytes.size(), requests, error);
+    alwaysAssertM(ok, error);
+  });
+  runner.addMetric("TextureManifest/deserialize/10000", "bytes", bytes.size());
+}
@@ -0,0 +1,146 @@
+#include "Bench.H"
+#include "../include/FrameArena.H"
+#include "../include/GfxFrameGraph.H"
+#include "../include/RenderQueue.H"
+#include "../include/SurfaceCuller.H"
+
+using namespace G3D;
+
+
+namespace {
+
+/// A 2m wide screen 1m in front of an eye at the origin looking down -z,
+/// like one wall of a CAVE.
+CullView
+makeView(const Vector3 &eye)
+{
+  CullView view;
+  view.eye = eye;
+  view.topLeft  = Vector3(-1, 1, -1);
+  view.topRight = Vector3( 1, 1, -1);
+  view.botLeft  = Vector3(-1,-1, -1);
+  view.botRight = Vector3( 1,-1, -1);
+  view.nearClip = 0.01;
+  view.farClip = 100.0;
+  return view;
+}
+
+} // end namespace
+
+
+void
+runRenderingBenchmarks(BenchRunner &runner)
+{
+  BenchRandom random(5);
+
+  // Sorting a frame's draw items
+  {
+    const int numItems = 100000;
+    Array<uint32> stateKeys;
+    Array<float> depths;
+    Array<bool> transparent;
+    for (int i=0;i<numItems;i++) {
+      stateKeys.append((uint32)random.integer(256));
+      depths.append((float)random.uniform(0.1, 100.0));
+      transparent.append(random.integer(10) == 0);
+    }
+    FrameArena arena;
+    RenderQueue queue;
+    runner.run("RenderQueue/sort/100000", numItems, [&] {
+      arena.reset();
+      queue.begin(arena, numItems);
+      for (int i=0;i<numItems;i++) {
+        queue.add(i, stateKeys[i], depths[i], transparent[i]);
+      }
+      queue.sort();
+      benchDoNotOptimize(queue[0].index);
+    });
+  }
+
+  // Recording the frame once and replaying it per view
+  int viewCounts[] = {2, 4, 8};
+  for (int c=0;c<3;c++) {
+    int numViews = viewCounts[c];
+    GfxFrameGraph graph;
+    RecordingFrameGraphBackend backend;
+    runner.run(format("GfxFrameGraph/recordAndReplay/%dviews", numViews), numViews, [&] {
+      GfxFrameGraph::FrameData &data = graph.beginRecording();
+      data.backgroundRepeat = 1.0;
+      data.ambient = Color3(0.2f, 0.2f, 0.2f);
+      graph.record(GfxFrameGraph::OP_SURFACES);
+      graph.record(GfxFrameGraph::OP_DRAW_CALLBACKS);
+      graph.endRecording();
+      backend.reset();
+      for (int v=0;v<numViews;v++) {
+        graph.replay(&backend, Vector3(0, 0, -1));
+      }
+      benchDoNotOptimize(backend.numViews());
+    });
+  }
+
+  // Per-frame transient allocations, the arena against the heap
+  {
+    const int numAllocs = 10000;
+    Array<int> sizes;
+    for (int i=0;i<numAllocs;i++) {
+      sizes.append(16 + random.integer(240));
+    }
+    FrameArena arena;
+    runner.run("FrameArena/alloc/10000", numAllocs, [&] {
+      arena.reset();
+      for (int i=0;i<numAllocs;i++) {
+        char *p = (char*)arena.alloc(sizes[i]);
+        p[0] = (char)i;
+        benchDoNotOptimize(p);
+      }
+    });
+    Array<void*> blocks;
+    blocks.resize(numAllocs);
+    runner.run("malloc/alloc/10000", numAllocs, [&] {
+      for (int i=0;i<numAllocs;i++) {
+        char *p = (char*)malloc(sizes[i]);
+        p[0] = (char)i;
+        blocks[i] = p;
+      }
+      for (int i=0;i<numAllocs;i++) {
+        free(blocks[i]);
+      }
+    });
+  }
+
+  // Culling a scene of spheres behind a few walls
+  {
+    const int numSpheres = 20000;
+    Array<CullSphere> spheres;
+    for (int i=0;i<numSpheres;i++) {
+      CullSphere s;
+      s.center = Vector3((float)random.uniform(-30, 30), (float)random.uniform(-5, 5), (float)random.uniform(-60, 5));
+      s.radius = (float)random.uniform(0.05, 1.0);
+      spheres.append(s);
+    }
+    Array<Box> occluders;
+    for (int i=0;i<4;i++) {
+      float x = (float)random.uniform(-6, 4);
+      float z = (float)random.uniform(-15, -5);
+      occluders.append(Box(Vector3(x, -4, z), Vector3(x + 3, 4, z + 0.5f)));
+    }
+    Array<uint8> visible;
+    visible.resize(numSpheres);
+    CullView view = makeView(Vector3(0, 0, 0));
+    SurfaceCuller culler;
+
+    const char *modes[] = {"frustum", "occlusion"};
+    for (int occlusion=0;occlusion<2;occlusion++) {
+      culler.setOcclusionEnabled(occlusion == 1);
+      std::string name = format("SurfaceCuller/cull/%s/serial", modes[occlusion]);
+      runner.run(name, numSpheres, [&] {
+        culler.cull(view, spheres.getCArray(), numSpheres, occluders, visible.getCArray(), NULL);
+      });
+      runner.addMetric(name, "visibleFraction", (double)culler.getStats().numVisible / numSpheres);
+      runner.run(format("SurfaceCuller/cull/%s/pool", modes[occlusion]), numSpheres, [&] {
+        culler.cull(view, spheres.getCArray(), numSpheres, occluders, visible.getCArray(),
+                    WorkerPool::getDefault().pointer());
+      });
+    }
+  }
+}
@@ -0,0 +1,241 @@
+#include "Bench.H"
+#include "../include/BlockCompressor.H"
+#include "../include/TextureAtlas.H"
+#include "../include/TextureCache.H"
+#include "../include/TextureData.H"
+#include "../include/TextureRegistry.H"
+#include "../include/TextureResidency.H"
+#include "../include/VirtualTexture.H"
+#include "../include/VirtualTextureFile.H"
+
+using namespace G3D;
+
+
+namespace {
+
+/// Smooth gradients with some noise and a few hard edges, closer to a
+/// photograph than pure noise is, so the PSNR numbers mean something.
+void
+makeImage(int width, int height, bool alpha, BenchRandom &random, TextureData &data)
+{
+  data.allocate(alpha ? TextureFormat::RGBA8() : TextureFormat::RGB8(), width, height, 1);
+  int channels = alpha ? 4 : 3;
+  uint8 *p = data.levelData(0);
+  for (int y=0;y<height;y++) {
+    for (int x=0;x<width;x++) {
+      double u = (double)x / width;
+      double v = (double)y / height;
+      bool edge = ((x / 37) + (y / 29)) % 5 == 0;
+      double r = 0.5 + 0.5 * sin(u * 9.0 + v * 2.0);
+      double g = edge ? 0.1 : 0.5 + 0.5 * cos(v * 7.0);
+      double b = u * v;
+      p[0] = (uint8)iClamp((int)(r * 255.0) + random.integer(-6, 6), 0, 255);
+      p[1] = (uint8)iClamp((int)(g * 255.0) + random.integer(-6, 6), 0, 255);
+      p[2] = (uint8)iClamp((int)(b * 255.0) + random.integer(-6, 6), 0, 255);
+      if (alpha) {
+        p[3] = (uint8)iClamp((int)(u * 255.0), 0, 255);
+      }
+      p += channels;
+    }
+  }
+}
+
+/// Procedural source for building a .vtex without an image file
+class BenchTileSource : public VirtualTextureTileSource
+{
+public:
+  BenchTileSource(int width, int height) : _width(width), _height(height) {}
+  virtual ~BenchTileSource() {}
+
+  int width() const    { return _width; }
+  int height() const   { return _height; }
+  int channels() const { return 3; }
+
+  void readRegion(int x, int y, int w, int h, uint8 *out) {
+    for (int j=0;j<h;j++) {
+      int sy = iClamp(y + j, 0, _height - 1);
+      for (int i=0;i<w;i++) {
+        int sx = iClamp(x + i, 0, _width - 1);
+        out[0] = (uint8)(sx ^ sy);
+        out[1] = (uint8)(sx >> 4);
+        out[2] = (uint8)(sy >> 4);
+        out += 3;
+      }
+    }
+  }
+
+private:
+  int _width;
+  int _height;
+};
+
+} // end namespace
+
+
+void
+runTextureBenchmarks(BenchRunner &runner)
+{
+  BenchRandom random(6);
+  std::string dir = benchTempDirectory();
+
+  // The on disk cache of decoded textures
+  {
+    TextureData image;
+    makeImage(1024, 1024, true, random, image);
+    image.generateMipmaps();
+    TextureCacheRef cache = new TextureCache(dir + "/texturecache", 256 * 1024 * 1024);
+    runner.run("TextureCache/store/1024", 1, [&] {
+      cache->store("bench", image);
+    });
+    TextureData loaded;
+    runner.run("TextureCache/load/1024", 1, [&] {
+      bool ok = cache->load("bench", loaded);
+      alwaysAssertM(ok, "TextureCache lost the bench entry");
+    });
+    runner.addMetric("TextureCache/load/1024", "bytes", (double)image.totalSize());
+  }
+
+  // Looking textures up by ID against the old name lookups
+  {
+    const int numTextures = 2000;
+    const int numLookups = 10000;
+    TextureResidencyRef residency = new TextureResidency(NULL, 0);
+    TextureRegistryRef registry = new TextureRegistry(residency);
+    Table<std::string, TextureRef> table;
+    Array<std::string> names;
+    for (int i=0;i<numTextures;i++) {
+      names.append(format("textures/set%d/texture%05d", i % 17, i));
+      registry->bind(registry->intern(names[i]), residency->addPinned(TextureRef()));
+      table.set(names[i], TextureRef());
+    }
+    Array<std::string> lookupNames;
+    Array<TextureID> lookupIDs;
+    for (int i=0;i<numLookups;i++) {
+      int t = random.integer(numTextures);
+      lookupNames.append(names[t]);
+      lookupIDs.append(registry->find(names[t]));
+    }
+    runner.run("TextureRegistry/get/10000", numLookups, [&] {
+      int n = 0;
+      for (int i=0;i<numLookups;i++) {
+        n += registry->get(lookupIDs[i]).isNull() ? 1 : 0;
+      }
+      benchDoNotOptimize(n);
+    });
+    runner.run("Table/get/10000", numLookups, [&] {
+      int n = 0;
+      for (int i=0;i<numLookups;i++) {
+        n += table[lookupNames[i]].isNull() ? 1 : 0;
+      }
+      benchDoNotOptimize(n);
+    });
+  }
+
+  // DXT compression speed and quality for each encoder
+  {
+    TextureData rgb;
+    TextureData rgba;
+    makeImage(512, 512, false, random, rgb);
+    makeImage(512, 512, true, random, rgba);
+    const char *encoderNames[] = {"fast", "scalar", "reference"};
+    BlockCompressor::Encoder encoders[] = {BlockCompressor::ENCODER_FAST, BlockCompressor::ENCODER_SCALAR,
+                                           BlockCompressor::ENCODER_REFERENCE};
+    for (int e=0;e<3;e++) {
+      TextureData dst;
+      std::string name = format("BlockCompressor/BC1/%s/512", encoderNames[e]);
+      if (runner.run(name, 512 * 512, [&] {
+            BlockCompressor::compress(rgb, TextureFormat::RGB_DXT1(), dst, encoders[e]);
+          })) {
+        runner.addMetric(name, "psnr", BlockCompressor::computePSNR(rgb, dst));
+      }
+      name = format("BlockCompressor/BC3/%s/512", encoderNames[e]);
+      if (runner.run(name, 512 * 512, [&] {
+            BlockCompressor::compress(rgba, TextureFormat::RGBA_DXT5(), dst, encoders[e]);
+          })) {
+        runner.addMetric(name, "psnr", BlockCompressor::computePSNR(rgba, dst));
+      }
+    }
+  }
+
+  // Atlas packing of a spread of small textures
+  {
+    Array<Vector2int16> sizes;
+    for (int i=0;i<400;i++) {
+      sizes.append(Vector2int16(8 << random.integer(4), 8 << random.integer(4)));
+    }
+    SkylinePacker packer(2048, 2048, 2);
+    runner.run("SkylinePacker/pack/400", sizes.size(), [&] {
+      packer.reset();
+      int x, y;
+      for (int i=0;i<sizes.size();i++) {
+        packer.pack(sizes[i].x, sizes[i].y, x, y);
+      }
+    });
+    runner.addMetric("SkylinePacker/pack/400", "occupancy", packer.occupancy());
+    runner.addMetric("SkylinePacker/pack/400", "packed", packer.numPacked());
+  }
+
+  // Virtual texture tile selection as the view zooms and pans
+  {
+    std::string vtexFile = dir + "/bench.vtex";
+    std::string error;
+    BenchTileSource source(4096, 2048);
+    bool ok = VirtualTextureFile::build(source, vtexFile, 128, 4, error);
+    alwaysAssertM(ok, error);
+    VirtualTextureFileRef file = VirtualTextureFile::open(vtexFile, error);
+    alwaysAssertM(file.notNull(), error);
+    VirtualTextureRef vt = new VirtualTexture(file, 64, WorkerPool::getDefault().pointer());
+
+    Array<VirtualTextureView> views;
+    for (int i=0;i<64;i++) {
+      VirtualTextureView view;
+      double zoom = pow(2.0, random.uniform(0.0, 4.0));
+      double w = 4096.0 / zoom;
+      double h = w * 0.5;
+      view.x0 = random.uniform(0.0, 4096.0 - w);
+      view.y0 = random.uniform(0.0, 2048.0 - h);
+      view.x1 = view.x0 + w;
+      view.y1 = view.y0 + h;
+      view.screenWidth = 1920;
+      view.screenHeight = 960;
+      views.append(view);
+    }
+
+    Array<VirtualTextureTile> tiles;
+    runner.run("VirtualTexture/computeNeededTiles/64views", views.size(), [&] {
+      int n = 0;
+      for (int i=0;i<views.size();i++) {
+        tiles.fastClear();
+        vt->computeNeededTiles(views[i], tiles);
+        n += tiles.size();
+      }
+      benchDoNotOptimize(n);
+    });
+
+    // Steady state: the whole image in a small window every frame, so
+    // everything it needs stays cached
+    VirtualTextureView steady;
+    steady.x1 = 4096.0;
+    steady.y1 = 2048.0;
+    steady.screenWidth = 512;
+    steady.screenHeight = 256;
+    vt->update(steady, 1);
+    vt->waitForLoads();
+    vt->update(steady, 2);
+    uint64 frame = 3;
+    runner.run("VirtualTexture/update/steady", 1, [&] {
+      vt->update(steady, frame++);
+    });
+
+    Array<VirtualTexture::DrawTile> drawTiles;
+    runner.run("VirtualTexture/getDrawTiles/64views", views.size(), [&] {
+      int n = 0;
+      for (int i=0;i<views.size();i++) {
+        drawTiles.fastClear();
+        vt->getDrawTiles(views[i], drawTiles);
+        n += drawTiles.size();
+      }
+      benchDoNotOptimize(n);
+    });
+  }
+}
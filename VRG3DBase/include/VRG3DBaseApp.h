@@ -37,6 +37,8 @@ class VRG3DBaseApp : public MinVR::VRG3DApp
     GfxMgrRef         _gfxMgr;
     EventMgrRef       _eventMgr;
     MinVR::MouseToTrackerRef _mouseToTracker;
+    /// Set by input that moves things, the next frame calls poseFrame()
+    bool              _poseRequested;
 
 #ifdef WITH_PHOTON
 	MinVR::VRPhotonDevice * photon;
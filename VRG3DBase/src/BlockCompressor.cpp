@@ -0,0 +1,849 @@
+#include "../include/BlockCompressor.H"
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define BLOCKCOMPRESSOR_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace G3D;
+
+
+namespace {
+
+inline uint16
+to565(const int rgb[3])
+{
+  return (uint16)((((rgb[0] * 31 + 127) / 255) << 11) |
+                  (((rgb[1] * 63 + 127) / 255) << 5) |
+                  ((rgb[2] * 31 + 127) / 255));
+}
+
+inline void
+from565(uint16 c, int rgb[3])
+{
+  int r = (c >> 11) & 31;
+  int g = (c >> 5) & 63;
+  int b = c & 31;
+  rgb[0] = (r << 3) | (r >> 2);
+  rgb[1] = (g << 2) | (g >> 4);
+  rgb[2] = (b << 3) | (b >> 2);
+}
+
+inline uint16
+read16(const uint8 *p)
+{
+  return (uint16)(p[0] | (p[1] << 8));
+}
+
+/// The four colors of a BC1 block.  In three color mode the last one is
+/// transparent black.
+void
+colorPalette(uint16 c0, uint16 c1, bool fourColor, uint8 pal[4][4])
+{
+  int a[3], b[3];
+  from565(c0, a);
+  from565(c1, b);
+  for (int c=0;c<3;c++) {
+    pal[0][c] = (uint8)a[c];
+    pal[1][c] = (uint8)b[c];
+    if (fourColor) {
+      pal[2][c] = (uint8)((2*a[c] + b[c]) / 3);
+      pal[3][c] = (uint8)((a[c] + 2*b[c]) / 3);
+    }
+    else {
+      pal[2][c] = (uint8)((a[c] + b[c]) / 2);
+      pal[3][c] = 0;
+    }
+  }
+  pal[0][3] = 255;
+  pal[1][3] = 255;
+  pal[2][3] = 255;
+  pal[3][3] = fourColor ? 255 : 0;
+}
+
+/// The eight alphas of a BC3 block
+void
+alphaPalette(int a0, int a1, int pal[8])
+{
+  pal[0] = a0;
+  pal[1] = a1;
+  if (a0 > a1) {
+    for (int i=2;i<8;i++) {
+      pal[i] = ((8-i)*a0 + (i-1)*a1) / 7;
+    }
+  }
+  else {
+    for (int i=2;i<6;i++) {
+      pal[i] = ((6-i)*a0 + (i-1)*a1) / 5;
+    }
+    pal[6] = 0;
+    pal[7] = 255;
+  }
+}
+
+void
+writeColorBlock(uint16 c0, uint16 c1, uint32 indices, uint8 *block)
+{
+  block[0] = (uint8)(c0 & 0xFF);
+  block[1] = (uint8)(c0 >> 8);
+  block[2] = (uint8)(c1 & 0xFF);
+  block[3] = (uint8)(c1 >> 8);
+  for (int i=0;i<4;i++) {
+    block[4+i] = (uint8)((indices >> (8*i)) & 0xFF);
+  }
+}
+
+int
+colorError(const uint8 *rgba, const uint8 pal[4][4], uint32 indices)
+{
+  int err = 0;
+  for (int i=0;i<16;i++) {
+    const uint8 *p = pal[(indices >> (2*i)) & 3];
+    for (int c=0;c<3;c++) {
+      int d = rgba[4*i+c] - p[c];
+      err += d*d;
+    }
+  }
+  return err;
+}
+
+
+/***  Fast encoder, bounding box endpoints  ***/
+
+void
+blockMinMaxScalar(const uint8 *rgba, uint8 mn[4], uint8 mx[4])
+{
+  for (int c=0;c<4;c++) {
+    mn[c] = 255;
+    mx[c] = 0;
+  }
+  for (int i=0;i<16;i++) {
+    for (int c=0;c<4;c++) {
+      mn[c] = (uint8)iMin(mn[c], rgba[4*i+c]);
+      mx[c] = (uint8)iMax(mx[c], rgba[4*i+c]);
+    }
+  }
+}
+
+/// Nearest palette entry of each texel by the sum of absolute RGB
+/// differences, the lowest index on ties.
+uint32
+selectColorIndicesScalar(const uint8 *rgba, const uint8 pal[4][4])
+{
+  uint32 indices = 0;
+  for (int i=0;i<16;i++) {
+    int best = 0;
+    int bestDist = 1 << 30;
+    for (int k=0;k<4;k++) {
+      int d = iAbs(rgba[4*i] - pal[k][0]) + iAbs(rgba[4*i+1] - pal[k][1]) + iAbs(rgba[4*i+2] - pal[k][2]);
+      if (d < bestDist) {
+        bestDist = d;
+        best = k;
+      }
+    }
+    indices |= (uint32)best << (2*i);
+  }
+  return indices;
+}
+
+void
+selectAlphaIndicesScalar(const uint8 *rgba, const int pal[8], uint8 indices[16])
+{
+  for (int i=0;i<16;i++) {
+    int best = 0;
+    int bestDist = 1 << 30;
+    for (int k=0;k<8;k++) {
+      int d = iAbs(rgba[4*i+3] - pal[k]);
+      if (d < bestDist) {
+        bestDist = d;
+        best = k;
+      }
+    }
+    indices[i] = (uint8)best;
+  }
+}
+
+#ifdef BLOCKCOMPRESSOR_SSE2
+
+void
+blockMinMaxSSE2(const uint8 *rgba, uint8 mn[4], uint8 mx[4])
+{
+  __m128i r0 = _mm_loadu_si128((const __m128i*)rgba);
+  __m128i r1 = _mm_loadu_si128((const __m128i*)(rgba + 16));
+  __m128i r2 = _mm_loadu_si128((const __m128i*)(rgba + 32));
+  __m128i r3 = _mm_loadu_si128((const __m128i*)(rgba + 48));
+  __m128i lo = _mm_min_epu8(_mm_min_epu8(r0, r1), _mm_min_epu8(r2, r3));
+  __m128i hi = _mm_max_epu8(_mm_max_epu8(r0, r1), _mm_max_epu8(r2, r3));
+  // reduce the four texels in each register to one
+  lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(1,0,3,2)));
+  lo = _mm_min_epu8(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2,3,0,1)));
+  hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(1,0,3,2)));
+  hi = _mm_max_epu8(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2,3,0,1)));
+  uint32 l = (uint32)_mm_cvtsi128_si32(lo);
+  uint32 h = (uint32)_mm_cvtsi128_si32(hi);
+  System::memcpy(mn, &l, 4);
+  System::memcpy(mx, &h, 4);
+}
+
+uint32
+selectColorIndicesSSE2(const uint8 *rgba, const uint8 pal[4][4])
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  const __m128i rgbMask = _mm_set1_epi32(0x00FFFFFF);
+  __m128i p[4];
+  for (int k=0;k<4;k++) {
+    p[k] = _mm_set1_epi32(pal[k][0] | (pal[k][1] << 8) | (pal[k][2] << 16));
+  }
+
+  uint32 indices = 0;
+  for (int g=0;g<4;g++) {
+    // four texels at a time, alpha masked off
+    __m128i px = _mm_and_si128(_mm_loadu_si128((const __m128i*)(rgba + 16*g)), rgbMask);
+    __m128i best = zero;
+    __m128i bestIndex = zero;
+    for (int k=0;k<4;k++) {
+      __m128i d = _mm_or_si128(_mm_subs_epu8(px, p[k]), _mm_subs_epu8(p[k], px));
+      // sum the channels of each texel: madd gives (r+g, b+a) pairs,
+      // then the pairs are added with a shuffle
+      __m128 lo = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpacklo_epi8(d, zero), ones));
+      __m128 hi = _mm_castsi128_ps(_mm_madd_epi16(_mm_unpackhi_epi8(d, zero), ones));
+      __m128i dist = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2,0,2,0))),
+                                   _mm_castps_si128(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3,1,3,1))));
+      if (k == 0) {
+        best = dist;
+      }
+      else {
+        __m128i closer = _mm_cmplt_epi32(dist, best);
+        best = _mm_or_si128(_mm_and_si128(closer, dist), _mm_andnot_si128(closer, best));
+        bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(k)), _mm_andnot_si128(closer, bestIndex));
+      }
+    }
+    int32 idx[4];
+    _mm_storeu_si128((__m128i*)idx, bestIndex);
+    for (int i=0;i<4;i++) {
+      indices |= (uint32)idx[i] << (2*(4*g + i));
+    }
+  }
+  return indices;
+}
+
+void
+selectAlphaIndicesSSE2(const uint8 *rgba, const int pal[8], uint8 indices[16])
+{
+  int16 alpha[16];
+  for (int i=0;i<16;i++) {
+    alpha[i] = rgba[4*i+3];
+  }
+  const __m128i zero = _mm_setzero_si128();
+  for (int half=0;half<2;half++) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(alpha + 8*half));
+    __m128i best = zero;
+    __m128i bestIndex = zero;
+    for (int k=0;k<8;k++) {
+      __m128i d = _mm_sub_epi16(a, _mm_set1_epi16((int16)pal[k]));
+      d = _mm_max_epi16(d, _mm_sub_epi16(zero, d));
+      if (k == 0) {
+        best = d;
+      }
+      else {
+        __m128i closer = _mm_cmplt_epi16(d, best);
+        best = _mm_min_epi16(d, best);
+        bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi16((int16)k)), _mm_andnot_si128(closer, bestIndex));
+      }
+    }
+    int16 idx[8];
+    _mm_storeu_si128((__m128i*)idx, bestIndex);
+    for (int i=0;i<8;i++) {
+      indices[8*half + i] = (uint8)idx[i];
+    }
+  }
+}
+
+#endif
+
+inline void
+blockMinMax(const uint8 *rgba, uint8 mn[4], uint8 mx[4], bool simd)
+{
+#ifdef BLOCKCOMPRESSOR_SSE2
+  if (simd) {
+    blockMinMaxSSE2(rgba, mn, mx);
+    return;
+  }
+#endif
+  blockMinMaxScalar(rgba, mn, mx);
+}
+
+/// Orients the box diagonal between lo and hi along the direction the
+/// colors vary, by flipping red and blue if they go against green.
+void
+orientDiagonal(const uint8 *rgba, int lo[3], int hi[3], bool opaqueOnly)
+{
+  int mean[3];
+  for (int c=0;c<3;c++) {
+    mean[c] = (lo[c] + hi[c]) / 2;
+  }
+  int covRG = 0;
+  int covBG = 0;
+  for (int i=0;i<16;i++) {
+    if (opaqueOnly && (rgba[4*i+3] < 128)) {
+      continue;
+    }
+    int dr = rgba[4*i] - mean[0];
+    int dg = rgba[4*i+1] - mean[1];
+    int db = rgba[4*i+2] - mean[2];
+    covRG += dr * dg;
+    covBG += db * dg;
+  }
+  if (covRG < 0) {
+    std::swap(lo[0], hi[0]);
+  }
+  if (covBG < 0) {
+    std::swap(lo[2], hi[2]);
+  }
+}
+
+void
+encodeColorFast(const uint8 *rgba, uint8 *block, bool simd)
+{
+  uint8 mn[4], mx[4];
+  blockMinMax(rgba, mn, mx, simd);
+
+  // Inset the box a little, the extremes are rarely worth hitting exactly
+  int lo[3], hi[3];
+  for (int c=0;c<3;c++) {
+    int inset = (mx[c] - mn[c]) >> 4;
+    lo[c] = mn[c] + inset;
+    hi[c] = mx[c] - inset;
+  }
+  orientDiagonal(rgba, lo, hi, false);
+
+  uint16 c0 = to565(hi);
+  uint16 c1 = to565(lo);
+  if (c0 < c1) {
+    std::swap(c0, c1);
+  }
+  if (c0 == c1) {
+    writeColorBlock(c0, c1, 0, block);
+    return;
+  }
+
+  uint8 pal[4][4];
+  colorPalette(c0, c1, true, pal);
+  uint32 indices;
+#ifdef BLOCKCOMPRESSOR_SSE2
+  if (simd) {
+    indices = selectColorIndicesSSE2(rgba, pal);
+  }
+  else
+#endif
+  {
+    indices = selectColorIndicesScalar(rgba, pal);
+  }
+  writeColorBlock(c0, c1, indices, block);
+}
+
+/// BC1 three color mode, texels with alpha below 128 become transparent.
+void
+encodeColorPunchThrough(const uint8 *rgba, uint8 *block)
+{
+  int lo[3] = {255, 255, 255};
+  int hi[3] = {0, 0, 0};
+  bool anyOpaque = false;
+  for (int i=0;i<16;i++) {
+    if (rgba[4*i+3] >= 128) {
+      anyOpaque = true;
+      for (int c=0;c<3;c++) {
+        lo[c] = iMin(lo[c], rgba[4*i+c]);
+        hi[c] = iMax(hi[c], rgba[4*i+c]);
+      }
+    }
+  }
+  if (!anyOpaque) {
+    writeColorBlock(0, 0, 0xFFFFFFFF, block);
+    return;
+  }
+  orientDiagonal(rgba, lo, hi, true);
+
+  // three color mode needs c0 <= c1
+  uint16 c0 = to565(lo);
+  uint16 c1 = to565(hi);
+  if (c0 > c1) {
+    std::swap(c0, c1);
+  }
+  uint8 pal[4][4];
+  colorPalette(c0, c1, false, pal);
+
+  uint32 indices = 0;
+  for (int i=0;i<16;i++) {
+    int best = 3;
+    if (rgba[4*i+3] >= 128) {
+      int bestDist = 1 << 30;
+      for (int k=0;k<3;k++) {
+        int d = iAbs(rgba[4*i] - pal[k][0]) + iAbs(rgba[4*i+1] - pal[k][1]) + iAbs(rgba[4*i+2] - pal[k][2]);
+        if (d < bestDist) {
+          bestDist = d;
+          best = k;
+        }
+      }
+    }
+    indices |= (uint32)best << (2*i);
+  }
+  writeColorBlock(c0, c1, indices, block);
+}
+
+
+/***  Reference encoder, principal axis fit with least squares refinement  ***/
+
+struct ColorFit {
+  uint16 c0;
+  uint16 c1;
+  uint32 indices;
+  int    error;
+};
+
+void
+fitEndpoints(const uint8 *rgba, const int hi[3], const int lo[3], ColorFit &fit)
+{
+  fit.c0 = to565(hi);
+  fit.c1 = to565(lo);
+  if (fit.c0 < fit.c1) {
+    std::swap(fit.c0, fit.c1);
+  }
+  uint8 pal[4][4];
+  colorPalette(fit.c0, fit.c1, true, pal);
+  fit.indices = 0;
+  if (fit.c0 != fit.c1) {
+    for (int i=0;i<16;i++) {
+      int best = 0;
+      int bestErr = 1 << 30;
+      for (int k=0;k<4;k++) {
+        int err = 0;
+        for (int c=0;c<3;c++) {
+          int d = rgba[4*i+c] - pal[k][c];
+          err += d*d;
+        }
+        if (err < bestErr) {
+          bestErr = err;
+          best = k;
+        }
+      }
+      fit.indices |= (uint32)best << (2*i);
+    }
+  }
+  fit.error = colorError(rgba, pal, fit.indices);
+}
+
+/// Solves for the endpoints that best reproduce the block with fit's
+/// indices.  Returns false if the system is singular.
+bool
+refineEndpoints(const uint8 *rgba, const ColorFit &fit, int hi[3], int lo[3])
+{
+  static const float weight0[4] = {1.0f, 0.0f, 2.0f/3.0f, 1.0f/3.0f};
+  float aa = 0, ab = 0, bb = 0;
+  float ax[3] = {0, 0, 0};
+  float bx[3] = {0, 0, 0};
+  for (int i=0;i<16;i++) {
+    float a = weight0[(fit.indices >> (2*i)) & 3];
+    float b = 1.0f - a;
+    aa += a*a;
+    ab += a*b;
+    bb += b*b;
+    for (int c=0;c<3;c++) {
+      ax[c] += a * rgba[4*i+c];
+      bx[c] += b * rgba[4*i+c];
+    }
+  }
+  float det = aa*bb - ab*ab;
+  if (fabs(det) < 1e-6f) {
+    return false;
+  }
+  for (int c=0;c<3;c++) {
+    hi[c] = iClamp(iRound((bb*ax[c] - ab*bx[c]) / det), 0, 255);
+    lo[c] = iClamp(iRound((aa*bx[c] - ab*ax[c]) / det), 0, 255);
+  }
+  return true;
+}
+
+void
+encodeColorReference(const uint8 *rgba, uint8 *block)
+{
+  float mean[3] = {0, 0, 0};
+  for (int i=0;i<16;i++) {
+    for (int c=0;c<3;c++) {
+      mean[c] += rgba[4*i+c] / 16.0f;
+    }
+  }
+  float cov[3][3] = {{0,0,0},{0,0,0},{0,0,0}};
+  for (int i=0;i<16;i++) {
+    float d[3];
+    for (int c=0;c<3;c++) {
+      d[c] = rgba[4*i+c] - mean[c];
+    }
+    for (int r=0;r<3;r++) {
+      for (int c=0;c<3;c++) {
+        cov[r][c] += d[r] * d[c];
+      }
+    }
+  }
+
+  // principal axis by power iteration
+  float axis[3] = {1, 1, 1};
+  for (int iter=0;iter<8;iter++) {
+    float next[3];
+    for (int r=0;r<3;r++) {
+      next[r] = cov[r][0]*axis[0] + cov[r][1]*axis[1] + cov[r][2]*axis[2];
+    }
+    float len = sqrt(next[0]*next[0] + next[1]*next[1] + next[2]*next[2]);
+    if (len < 1e-6f) {
+      break;
+    }
+    for (int c=0;c<3;c++) {
+      axis[c] = next[c] / len;
+    }
+  }
+
+  // the texels furthest apart along the axis are the starting endpoints
+  int minI = 0, maxI = 0;
+  float minT = 0, maxT = 0;
+  for (int i=0;i<16;i++) {
+    float t = 0;
+    for (int c=0;c<3;c++) {
+      t += (rgba[4*i+c] - mean[c]) * axis[c];
+    }
+    if ((i == 0) || (t < minT)) {
+      minT = t;
+      minI = i;
+    }
+    if ((i == 0) || (t > maxT)) {
+      maxT = t;
+      maxI = i;
+    }
+  }
+  int hi[3], lo[3];
+  for (int c=0;c<3;c++) {
+    hi[c] = rgba[4*maxI+c];
+    lo[c] = rgba[4*minI+c];
+  }
+
+  ColorFit best;
+  fitEndpoints(rgba, hi, lo, best);
+  for (int iter=0;iter<2;iter++) {
+    if ((best.error == 0) || !refineEndpoints(rgba, best, hi, lo)) {
+      break;
+    }
+    ColorFit refined;
+    fitEndpoints(rgba, hi, lo, refined);
+    if (refined.error >= best.error) {
+      break;
+    }
+    best = refined;
+  }
+  writeColorBlock(best.c0, best.c1, best.indices, block);
+}
+
+
+/***  Alpha  ***/
+
+void
+encodeAlphaBlock(const uint8 *rgba, uint8 *block, BlockCompressor::Encoder encoder)
+{
+  bool simd = (encoder == BlockCompressor::ENCODER_FAST);
+  uint8 mn[4], mx[4];
+  blockMinMax(rgba, mn, mx, simd);
+
+  int a0 = mx[3];
+  int a1 = mn[3];
+  if (encoder != BlockCompressor::ENCODER_REFERENCE) {
+    int inset = (a0 - a1) >> 5;
+    a0 -= inset;
+    a1 += inset;
+  }
+  int pal[8];
+  alphaPalette(a0, a1, pal);
+
+  uint8 indices[16];
+#ifdef BLOCKCOMPRESSOR_SSE2
+  if (simd) {
+    selectAlphaIndicesSSE2(rgba, pal, indices);
+  }
+  else
+#endif
+  {
+    selectAlphaIndicesScalar(rgba, pal, indices);
+  }
+
+  block[0] = (uint8)a0;
+  block[1] = (uint8)a1;
+  uint64 bits = 0;
+  for (int i=0;i<16;i++) {
+    bits |= (uint64)indices[i] << (3*i);
+  }
+  for (int i=0;i<6;i++) {
+    block[2+i] = (uint8)((bits >> (8*i)) & 0xFF);
+  }
+}
+
+void
+decodeColorBlock(const uint8 *block, uint8 *rgba, bool forceFourColor)
+{
+  uint16 c0 = read16(block);
+  uint16 c1 = read16(block + 2);
+  uint8 pal[4][4];
+  colorPalette(c0, c1, forceFourColor || (c0 > c1), pal);
+  uint32 indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((uint32)block[7] << 24);
+  for (int i=0;i<16;i++) {
+    System::memcpy(rgba + 4*i, pal[(indices >> (2*i)) & 3], 4);
+  }
+}
+
+bool
+isByteFormat(const TextureFormat *format)
+{
+  return !format->compressed &&
+    ((format->code == TextureFormat::CODE_L8) || (format->code == TextureFormat::CODE_LA8) ||
+     (format->code == TextureFormat::CODE_RGB8) || (format->code == TextureFormat::CODE_RGBA8));
+}
+
+/// Reads the 4x4 block at bx,by of a level as RGBA.  Texels past the edge
+/// of the level repeat the last row or column.
+void
+readBlock(const TextureData &data, int level, int bx, int by, uint8 rgba[64])
+{
+  int w = data.levelWidth(level);
+  int h = data.levelHeight(level);
+  const uint8 *bytes = data.levelData(level);
+
+  if (data.format()->compressed) {
+    int bs = BlockCompressor::blockSize(data.format());
+    const uint8 *block = bytes + (by * ((w + 3) / 4) + bx) * bs;
+    switch (data.format()->code) {
+    case TextureFormat::CODE_RGBA_DXT3:
+      BlockCompressor::decodeBC2Block(block, rgba);
+      break;
+    case TextureFormat::CODE_RGBA_DXT5:
+      BlockCompressor::decodeBC3Block(block, rgba);
+      break;
+    default:
+      BlockCompressor::decodeBC1Block(block, rgba);
+      break;
+    }
+    return;
+  }
+
+  int channels = data.format()->packedBitsPerTexel / 8;
+  for (int y=0;y<4;y++) {
+    const uint8 *row = bytes + iMin(4*by + y, h-1) * w * channels;
+    for (int x=0;x<4;x++) {
+      const uint8 *src = row + iMin(4*bx + x, w-1) * channels;
+      uint8 *dst = rgba + 4*(4*y + x);
+      switch (channels) {
+      case 1:
+        dst[0] = dst[1] = dst[2] = src[0];
+        dst[3] = 255;
+        break;
+      case 2:
+        dst[0] = dst[1] = dst[2] = src[0];
+        dst[3] = src[1];
+        break;
+      case 3:
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst[3] = 255;
+        break;
+      default:
+        System::memcpy(dst, src, 4);
+        break;
+      }
+    }
+  }
+}
+
+} // end namespace
+
+
+bool
+BlockCompressor::canCompress(const TextureFormat *target)
+{
+  return (target->code == TextureFormat::CODE_RGB_DXT1) ||
+         (target->code == TextureFormat::CODE_RGBA_DXT1) ||
+         (target->code == TextureFormat::CODE_RGBA_DXT3) ||
+         (target->code == TextureFormat::CODE_RGBA_DXT5);
+}
+
+bool
+BlockCompressor::hasSIMD()
+{
+#ifdef BLOCKCOMPRESSOR_SSE2
+  return true;
+#else
+  return false;
+#endif
+}
+
+int
+BlockCompressor::blockSize(const TextureFormat *format)
+{
+  return ((format->code == TextureFormat::CODE_RGB_DXT1) ||
+          (format->code == TextureFormat::CODE_RGBA_DXT1)) ? 8 : 16;
+}
+
+void
+BlockCompressor::encodeBC1Block(const uint8 rgba[64], uint8 *block, bool punchThroughAlpha, Encoder encoder)
+{
+  if (punchThroughAlpha) {
+    for (int i=0;i<16;i++) {
+      if (rgba[4*i+3] < 128) {
+        encodeColorPunchThrough(rgba, block);
+        return;
+      }
+    }
+  }
+  if (encoder == ENCODER_REFERENCE) {
+    encodeColorReference(rgba, block);
+  }
+  else {
+    encodeColorFast(rgba, block, encoder == ENCODER_FAST);
+  }
+}
+
+void
+BlockCompressor::encodeBC2Block(const uint8 rgba[64], uint8 *block, Encoder encoder)
+{
+  for (int i=0;i<8;i++) {
+    int a0 = (rgba[4*(2*i)+3] * 15 + 127) / 255;
+    int a1 = (rgba[4*(2*i+1)+3] * 15 + 127) / 255;
+    block[i] = (uint8)(a0 | (a1 << 4));
+  }
+  encodeBC1Block(rgba, block + 8, false, encoder);
+}
+
+void
+BlockCompressor::encodeBC3Block(const uint8 rgba[64], uint8 *block, Encoder encoder)
+{
+  encodeAlphaBlock(rgba, block, encoder);
+  encodeBC1Block(rgba, block + 8, false, encoder);
+}
+
+void
+BlockCompressor::decodeBC1Block(const uint8 *block, uint8 rgba[64])
+{
+  decodeColorBlock(block, rgba, false);
+}
+
+void
+BlockCompressor::decodeBC2Block(const uint8 *block, uint8 rgba[64])
+{
+  decodeColorBlock(block + 8, rgba, true);
+  for (int i=0;i<16;i++) {
+    int a = (block[i/2] >> (4*(i & 1))) & 0xF;
+    rgba[4*i+3] = (uint8)(a * 17);
+  }
+}
+
+void
+BlockCompressor::decodeBC3Block(const uint8 *block, uint8 rgba[64])
+{
+  decodeColorBlock(block + 8, rgba, true);
+  int pal[8];
+  alphaPalette(block[0], block[1], pal);
+  uint64 bits = 0;
+  for (int i=0;i<6;i++) {
+    bits |= (uint64)block[2+i] << (8*i);
+  }
+  for (int i=0;i<16;i++) {
+    rgba[4*i+3] = (uint8)pal[(bits >> (3*i)) & 7];
+  }
+}
+
+void
+BlockCompressor::compress(const TextureData &src, const TextureFormat *target, TextureData &dst, Encoder encoder)
+{
+  alwaysAssertM(canCompress(target), "BlockCompressor can't encode to that format");
+  alwaysAssertM(isByteFormat(src.format()), "BlockCompressor needs L8, LA8, RGB8 or RGBA8 texels");
+
+  dst.allocate(target, src.width(), src.height(), src.numLevels());
+  int bs = blockSize(target);
+  bool punchThrough = (target->code == TextureFormat::CODE_RGBA_DXT1);
+
+  uint8 rgba[64];
+  for (int l=0;l<src.numLevels();l++) {
+    int bw = (src.levelWidth(l) + 3) / 4;
+    int bh = (src.levelHeight(l) + 3) / 4;
+    uint8 *block = dst.levelData(l);
+    for (int by=0;by<bh;by++) {
+      for (int bx=0;bx<bw;bx++) {
+        readBlock(src, l, bx, by, rgba);
+        switch (target->code) {
+        case TextureFormat::CODE_RGBA_DXT3:
+          encodeBC2Block(rgba, block, encoder);
+          break;
+        case TextureFormat::CODE_RGBA_DXT5:
+          encodeBC3Block(rgba, block, encoder);
+          break;
+        default:
+          encodeBC1Block(rgba, block, punchThrough, encoder);
+          break;
+        }
+        block += bs;
+      }
+    }
+  }
+}
+
+void
+BlockCompressor::decompress(const TextureData &src, TextureData &dst)
+{
+  alwaysAssertM(canCompress(src.format()), "BlockCompressor can only decode DXT formats");
+
+  dst.allocate(TextureFormat::RGBA8(), src.width(), src.height(), src.numLevels());
+  uint8 rgba[64];
+  for (int l=0;l<src.numLevels();l++) {
+    int w = src.levelWidth(l);
+    int h = src.levelHeight(l);
+    uint8 *out = dst.levelData(l);
+    for (int by=0;by<(h+3)/4;by++) {
+      for (int bx=0;bx<(w+3)/4;bx++) {
+        readBlock(src, l, bx, by, rgba);
+        int cols = iMin(4, w - 4*bx);
+        for (int y=0;(y<4) && (4*by+y<h);y++) {
+          System::memcpy(out + ((4*by + y) * w + 4*bx) * 4, rgba + 16*y, 4*cols);
+        }
+      }
+    }
+  }
+}
+
+double
+BlockCompressor::computePSNR(const TextureData &a, const TextureData &b)
+{
+  alwaysAssertM((a.width() == b.width()) && (a.height() == b.height()),
+                "computePSNR needs textures of the same size");
+
+  int channels = ((a.format()->alphaBits > 0) && (b.format()->alphaBits > 0)) ? 4 : 3;
+  int w = a.width();
+  int h = a.height();
+  uint8 ba[64], bb[64];
+  double sum = 0;
+  for (int by=0;by<(h+3)/4;by++) {
+    for (int bx=0;bx<(w+3)/4;bx++) {
+      readBlock(a, 0, bx, by, ba);
+      readBlock(b, 0, bx, by, bb);
+      for (int y=0;(y<4) && (4*by+y<h);y++) {
+        for (int x=0;(x<4) && (4*bx+x<w);x++) {
+          for (int c=0;c<channels;c++) {
+            double d = (double)ba[4*(4*y+x)+c] - (double)bb[4*(4*y+x)+c];
+            sum += d*d;
+          }
+        }
+      }
+    }
+  }
+  double mse = sum / ((double)w * (double)h * (double)channels);
+  if (mse == 0.0) {
+    return std::numeric_limits<double>::infinity();
+  }
+  return 10.0 * log10(255.0 * 255.0 / mse);
+}
@@ -0,0 +1,201 @@
+#include "../include/DrawCommandCache.H"
+
+using namespace G3D;
+
+
+/***  GLDisplayListCaptureDevice  ***/
+
+CommandBufferID
+GLDisplayListCaptureDevice::createBuffer()
+{
+  GLuint list = glGenLists(1);
+  alwaysAssertM(list != 0, "Could not allocate an OpenGL display list");
+  return (CommandBufferID)list;
+}
+
+void
+GLDisplayListCaptureDevice::destroyBuffer(CommandBufferID id)
+{
+  glDeleteLists((GLuint)id, 1);
+}
+
+void
+GLDisplayListCaptureDevice::beginCapture(CommandBufferID id)
+{
+  glNewList((GLuint)id, GL_COMPILE);
+}
+
+void
+GLDisplayListCaptureDevice::endCapture(CommandBufferID id)
+{
+  glEndList();
+}
+
+void
+GLDisplayListCaptureDevice::replay(CommandBufferID id)
+{
+  glCallList((GLuint)id);
+}
+
+
+
+/***  StandInCaptureDevice  ***/
+
+CommandBufferID
+StandInCaptureDevice::createBuffer()
+{
+  CommandBufferID id = _nextID++;
+  _captures.set(id, 0);
+  _replays.set(id, 0);
+  return id;
+}
+
+void
+StandInCaptureDevice::destroyBuffer(CommandBufferID id)
+{
+  alwaysAssertM(_captures.containsKey(id), "Destroying an unknown command buffer");
+  _captures.remove(id);
+  _replays.remove(id);
+}
+
+void
+StandInCaptureDevice::beginCapture(CommandBufferID id)
+{
+  alwaysAssertM(_capturing == 0, "Command buffer captures can't be nested");
+  alwaysAssertM(_captures.containsKey(id), "Capturing into an unknown command buffer");
+  _capturing = id;
+}
+
+void
+StandInCaptureDevice::endCapture(CommandBufferID id)
+{
+  alwaysAssertM(_capturing == id, "endCapture() doesn't match beginCapture()");
+  _captures[id]++;
+  _capturing = 0;
+}
+
+void
+StandInCaptureDevice::replay(CommandBufferID id)
+{
+  alwaysAssertM(_captures.containsKey(id), "Replaying an unknown command buffer");
+  _replays[id]++;
+}
+
+int
+StandInCaptureDevice::numCaptures(CommandBufferID id) const
+{
+  int n = 0;
+  _captures.get(id, n);
+  return n;
+}
+
+int
+StandInCaptureDevice::numReplays(CommandBufferID id) const
+{
+  int n = 0;
+  _replays.get(id, n);
+  return n;
+}
+
+
+
+/***  DrawCommandCache  ***/
+
+DrawCommandCache::DrawCommandCache()
+{
+  _device = NULL;
+}
+
+DrawCommandCache::~DrawCommandCache()
+{
+  // Buffers are not destroyed here, the GL context may already be gone
+  delete _device;
+}
+
+void
+DrawCommandCache::setDevice(CommandCaptureDevice *device)
+{
+  for (Table<int, Entry>::Iterator it = _entries.begin(); it != _entries.end(); ++it) {
+    if (_device && it->value.buffer) {
+      _device->destroyBuffer(it->value.buffer);
+    }
+    it->value.buffer = 0;
+    it->value.dirty = true;
+  }
+  delete _device;
+  _device = device;
+}
+
+void
+DrawCommandCache::setRetained(int id)
+{
+  Entry e;
+  e.buffer = 0;
+  e.dirty = true;
+  _entries.set(id, e);
+}
+
+void
+DrawCommandCache::remove(int id)
+{
+  Entry e;
+  if (_entries.get(id, e)) {
+    if (_device && e.buffer) {
+      _device->destroyBuffer(e.buffer);
+    }
+    _entries.remove(id);
+  }
+}
+
+void
+DrawCommandCache::markDirty(int id)
+{
+  if (_entries.containsKey(id)) {
+    _entries[id].dirty = true;
+  }
+}
+
+void
+DrawCommandCache::exec(int id, DrawMethodFunctor *f, RenderDevice *rd,
+                       const CoordinateFrame &virtualToRoomSpace)
+{
+  if (!_entries.containsKey(id)) {
+    f->exec(rd, virtualToRoomSpace);
+    return;
+  }
+
+  if (_device == NULL) {
+    _device = new GLDisplayListCaptureDevice();
+  }
+
+  Entry &e = _entries[id];
+  if (e.buffer == 0) {
+    e.buffer = _device->createBuffer();
+    e.dirty = true;
+  }
+
+  // Navigating changes virtualToRoomSpace, which the callback most likely
+  // baked into what it drew.
+  if (e.dirty || (e.virtualToRoomSpace != virtualToRoomSpace)) {
+    _device->beginCapture(e.buffer);
+    f->exec(rd, virtualToRoomSpace);
+    _device->endCapture(e.buffer);
+    e.virtualToRoomSpace = virtualToRoomSpace;
+    e.dirty = false;
+    e.stats.numCaptures++;
+  }
+  else {
+    e.stats.numReplays++;
+  }
+  _device->replay(e.buffer);
+}
+
+DrawCommandCache::Stats
+DrawCommandCache::getStats(int id) const
+{
+  Entry e;
+  if (_entries.get(id, e)) {
+    return e.stats;
+  }
+  return Stats();
+}
@@ -0,0 +1,356 @@
+#include "../include/EventLog.H"
+
+using namespace G3D;
+
+
+namespace {
+
+const char   LOG_MAGIC[8] = {'V','R','G','3','D','E','L','\0'};
+const uint32 LOG_VERSION = 1;
+
+// Event types as stored in the log, independent of MinVR's numbering.
+// Only append to these.
+enum {
+  DATA_NONE,
+  DATA_1D,
+  DATA_2D,
+  DATA_3D,
+  DATA_COORDINATEFRAME,
+  DATA_MESSAGE,
+  NUM_DATA_TYPES
+};
+
+void
+appendBytes(Array<uint8> &bytes, const void *data, size_t length)
+{
+  int start = bytes.size();
+  bytes.resize(start + (int)length, false);
+  System::memcpy(bytes.getCArray() + start, data, length);
+}
+
+void
+appendVarUInt(Array<uint8> &bytes, uint32 value)
+{
+  while (value >= 0x80) {
+    bytes.append((uint8)(value | 0x80));
+    value >>= 7;
+  }
+  bytes.append((uint8)value);
+}
+
+void
+appendString(Array<uint8> &bytes, const std::string &s)
+{
+  appendVarUInt(bytes, (uint32)s.size());
+  appendBytes(bytes, s.c_str(), s.size());
+}
+
+void
+appendFloats(Array<uint8> &bytes, const float *f, int n)
+{
+  appendBytes(bytes, f, n * sizeof(float));
+}
+
+
+/// Bounds checked reads from a log
+class LogReader
+{
+public:
+  LogReader(const uint8 *bytes, size_t length) : _p(bytes), _end(bytes + length) {}
+
+  bool atEnd() const { return _p == _end; }
+
+  bool read(void *data, size_t length) {
+    if ((size_t)(_end - _p) < length) {
+      return false;
+    }
+    System::memcpy(data, _p, length);
+    _p += length;
+    return true;
+  }
+
+  bool readVarUInt(uint32 &value) {
+    value = 0;
+    for (int shift=0;shift<35;shift+=7) {
+      if (_p == _end) {
+        return false;
+      }
+      uint8 b = *_p++;
+      value |= (uint32)(b & 0x7f) << shift;
+      if ((b & 0x80) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool readString(std::string &s) {
+    uint32 length;
+    if (!readVarUInt(length) || ((size_t)(_end - _p) < length)) {
+      return false;
+    }
+    s.assign((const char*)_p, length);
+    _p += length;
+    return true;
+  }
+
+private:
+  const uint8 *_p;
+  const uint8 *_end;
+};
+
+} // end namespace
+
+
+EventLogWriter::EventLogWriter()
+{
+  _file = NULL;
+  _ok = false;
+  _numNames = 0;
+}
+
+EventLogWriter::~EventLogWriter()
+{
+  close();
+}
+
+bool
+EventLogWriter::open(const std::string &filename)
+{
+  close();
+  _file = fopen(filename.c_str(), "wb");
+  if (_file == NULL) {
+    return false;
+  }
+  _ok = true;
+  _buffer.fastClear();
+  _logIndexOfName.clear();
+  _numNames = 0;
+  appendBytes(_buffer, LOG_MAGIC, sizeof(LOG_MAGIC));
+  appendBytes(_buffer, &LOG_VERSION, sizeof(LOG_VERSION));
+  return true;
+}
+
+void
+EventLogWriter::writeEvent(double time, MinVR::EventRef event, bool filtered)
+{
+  if (_file == NULL) {
+    return;
+  }
+  _buffer.append((uint8)(filtered ? EventLogRecord::EVENT : EventLogRecord::EVENT_WITHOUT_FILTER));
+  appendBytes(_buffer, &time, sizeof(time));
+
+  // Names are written out the first time they're seen, then referred to
+  // by index
+  int index;
+  if (_logIndexOfName.get(event->getName(), index)) {
+    appendVarUInt(_buffer, (uint32)index);
+  }
+  else {
+    _logIndexOfName.set(event->getName(), _numNames);
+    appendVarUInt(_buffer, (uint32)_numNames);
+    appendString(_buffer, event->getName());
+    _numNames++;
+  }
+
+  int type = event->getType();
+  if (type == MinVR::VRG3DEvent::EVENTTYPE_1D) {
+    _buffer.append((uint8)DATA_1D);
+    double d = event->get1DData();
+    appendBytes(_buffer, &d, sizeof(d));
+  }
+  else if (type == MinVR::VRG3DEvent::EVENTTYPE_2D) {
+    _buffer.append((uint8)DATA_2D);
+    Vector2 v = event->get2DData();
+    float f[2] = {v.x, v.y};
+    appendFloats(_buffer, f, 2);
+  }
+  else if (type == MinVR::VRG3DEvent::EVENTTYPE_3D) {
+    _buffer.append((uint8)DATA_3D);
+    Vector3 v = event->get3DData();
+    float f[3] = {v.x, v.y, v.z};
+    appendFloats(_buffer, f, 3);
+  }
+  else if (type == MinVR::VRG3DEvent::EVENTTYPE_COORDINATEFRAME) {
+    _buffer.append((uint8)DATA_COORDINATEFRAME);
+    CoordinateFrame cf = event->getCoordinateFrameData();
+    float f[12];
+    for (int r=0;r<3;r++) {
+      for (int c=0;c<3;c++) {
+        f[r*3 + c] = cf.rotation[r][c];
+      }
+    }
+    f[9] = cf.translation.x;
+    f[10] = cf.translation.y;
+    f[11] = cf.translation.z;
+    appendFloats(_buffer, f, 12);
+  }
+  else if (type == MinVR::VRG3DEvent::EVENTTYPE_MSG) {
+    _buffer.append((uint8)DATA_MESSAGE);
+    appendString(_buffer, event->getMsgData());
+  }
+  else {
+    _buffer.append((uint8)DATA_NONE);
+  }
+}
+
+void
+EventLogWriter::writeFrame(double time)
+{
+  if (_file == NULL) {
+    return;
+  }
+  _buffer.append((uint8)EventLogRecord::FRAME);
+  appendBytes(_buffer, &time, sizeof(time));
+  flush();
+}
+
+void
+EventLogWriter::flush()
+{
+  if (_buffer.size() > 0) {
+    _ok = (fwrite(_buffer.getCArray(), 1, _buffer.size(), _file) == (size_t)_buffer.size()) && _ok;
+    _buffer.fastClear();
+  }
+}
+
+bool
+EventLogWriter::close()
+{
+  if (_file == NULL) {
+    return _ok;
+  }
+  flush();
+  _ok = (fclose(_file) == 0) && _ok;
+  _file = NULL;
+  return _ok;
+}
+
+
+bool
+EventLogReader::read(const std::string &filename, Array<EventLogRecord> &records, std::string &error)
+{
+  FILE *f = fopen(filename.c_str(), "rb");
+  if (f == NULL) {
+    error = "Can't open event log " + filename;
+    return false;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  Array<uint8> bytes;
+  bytes.resize(iMax(0, (int)size));
+  bool ok = (size >= 0) && (fread(bytes.getCArray(), 1, bytes.size(), f) == (size_t)bytes.size());
+  fclose(f);
+  if (!ok) {
+    error = "Can't read event log " + filename;
+    return false;
+  }
+  if (!deserialize(bytes.getCArray(), bytes.size(), records, error)) {
+    error = filename + ": " + error;
+    return false;
+  }
+  return true;
+}
+
+bool
+EventLogReader::deserialize(const uint8 *bytes, size_t length, Array<EventLogRecord> &records,
+                            std::string &error)
+{
+  LogReader in(bytes, length);
+
+  char magic[sizeof(LOG_MAGIC)];
+  uint32 version;
+  if (!in.read(magic, sizeof(magic)) || (memcmp(magic, LOG_MAGIC, sizeof(magic)) != 0)) {
+    error = "Not an event log";
+    return false;
+  }
+  if (!in.read(&version, sizeof(version)) || (version != LOG_VERSION)) {
+    error = "Unsupported event log version";
+    return false;
+  }
+
+  Array<std::string> names;
+  int n = 0;
+  while (!in.atEnd()) {
+    n++;
+    uint8 tag;
+    double time;
+    if (!in.read(&tag, sizeof(tag)) || !in.read(&time, sizeof(time))) {
+      error = format("Truncated event log at record %d", n);
+      return false;
+    }
+    if (tag == EventLogRecord::FRAME) {
+      EventLogRecord &r = records.next();
+      r.type = EventLogRecord::FRAME;
+      r.time = time;
+      continue;
+    }
+    if ((tag != EventLogRecord::EVENT) && (tag != EventLogRecord::EVENT_WITHOUT_FILTER)) {
+      error = format("Corrupt record type in event log record %d", n);
+      return false;
+    }
+
+    uint32 nameIndex;
+    if (!in.readVarUInt(nameIndex) || (nameIndex > (uint32)names.size())) {
+      error = format("Corrupt event name in event log record %d", n);
+      return false;
+    }
+    if (nameIndex == (uint32)names.size()) {
+      std::string &name = names.next();
+      if (!in.readString(name)) {
+        error = format("Truncated event log at record %d", n);
+        return false;
+      }
+    }
+    const std::string &name = names[nameIndex];
+
+    uint8 dataType;
+    if (!in.read(&dataType, sizeof(dataType)) || (dataType >= NUM_DATA_TYPES)) {
+      error = format("Corrupt event type in event log record %d", n);
+      return false;
+    }
+    MinVR::EventRef event;
+    bool ok = true;
+    if (dataType == DATA_NONE) {
+      event = new MinVR::VRG3DEvent(name);
+    }
+    else if (dataType == DATA_1D) {
+      double d;
+      ok = in.read(&d, sizeof(d));
+      event = new MinVR::VRG3DEvent(name, d);
+    }
+    else if (dataType == DATA_2D) {
+      float f[2];
+      ok = in.read(f, sizeof(f));
+      event = new MinVR::VRG3DEvent(name, Vector2(f[0], f[1]));
+    }
+    else if (dataType == DATA_3D) {
+      float f[3];
+      ok = in.read(f, sizeof(f));
+      event = new MinVR::VRG3DEvent(name, Vector3(f[0], f[1], f[2]));
+    }
+    else if (dataType == DATA_COORDINATEFRAME) {
+      float f[12];
+      ok = in.read(f, sizeof(f));
+      Matrix3 rotation(f[0], f[1], f[2], f[3], f[4], f[5], f[6], f[7], f[8]);
+      event = new MinVR::VRG3DEvent(name, CoordinateFrame(rotation, Vector3(f[9], f[10], f[11])));
+    }
+    else {
+      std::string message;
+      ok = in.readString(message);
+      event = new MinVR::VRG3DEvent(name, message);
+    }
+    if (!ok) {
+      error = format("Truncated event log at record %d", n);
+      return false;
+    }
+
+    EventLogRecord &r = records.next();
+    r.type = (EventLogRecord::Type)tag;
+    r.time = time;
+    r.event = event;
+  }
+  return true;
+}
@@ -5,15 +5,37 @@
 #include "../include/ConfigVal.H"
 #include "../include/StringUtils.H"
 #include "SynchedSystem.h"
+#include <climits>
 
 using namespace G3D;
 
 EventMgr::EventMgr(Log *log)
 {
   _log = log;
+  _clock = MinVR::SynchedSystem::getLocalTime;
+  _processingDepth = 0;
+  _replaying = false;
+  _replayRealTime = false;
+  _replayNext = 0;
+  _replayTime = 0.0;
+  _replayStartTime = 0.0;
+  _replayClockStart = 0.0;
+  _frameTime = 0.0;
+  _secondsPerEvent = 0.0;
+  resetQueueStats();
   _fullDebug        = MinVR::ConfigVal("EventMgr_FullDebug", false, false);
   _printAsQueued    = MinVR::ConfigVal("EventMgr_PrintAsQueued", false, false);
   _printAsProcessed = MinVR::ConfigVal("EventMgr_PrintAsProcessed", false, false);
+  _broadcastEvents  = MinVR::ConfigVal("EventMgr_BroadcastEvents", false, false);
+  _parallelDeviceLevel = false;
+  if (MinVR::ConfigVal("EventMgr_ParallelDeviceLevelFsas", false, false)) {
+    setParallelDeviceLevelFsas(true);
+  }
+  _aliasClosureDirty = false;
+
+  // getCurrentHeadFrame() looks for the head tracker's events, so they
+  // are remembered from the start even if no Fsa responds to them
+  EventNames::intern(MinVR::ConfigVal("HeadTracker", "Head_Tracker", false));
 
   // Set aliases for events from the EventAliases ConfigVal
   std::string aliases = MinVR::ConfigVal("EventAliases","",false);
@@ -24,7 +46,8 @@ EventMgr::EventMgr(Log *log)
       Array<std::string> aliasedTo;
       aliasedTo = MinVR::splitStringIntoArray(thisAlias);
       if (aliasedTo.size()) {
-        addEventAliases(eventName, aliasedTo); 
+        bool added = addEventAliases(eventName, aliasedTo);
+        alwaysAssertM(added, "Aliases for event " + eventName + " form a cycle");
       }
       else {
         alwaysAssertM(false, "Empty list of aliases for event " + eventName);
@@ -34,6 +57,39 @@ EventMgr::EventMgr(Log *log)
       alwaysAssertM(false, "Expected alias description.");
     }
   }
+
+  Array<std::string> toCompress = MinVR::splitStringIntoArray(MinVR::ConfigVal("EventMgr_EventsToCompress","",false));
+  for (int i=0;i<toCompress.size();i++) {
+    addCompressionRule(toCompress[i], COMPRESS_KEEP_LATEST);
+  }
+  Array<std::string> toAccumulate = MinVR::splitStringIntoArray(MinVR::ConfigVal("EventMgr_EventsToAccumulate","",false));
+  for (int i=0;i<toAccumulate.size();i++) {
+    addCompressionRule(toAccumulate[i], COMPRESS_ACCUMULATE);
+  }
+
+  // The per frame budget, and the priorities of events it keeps to
+  _maxEventsPerFrame  = MinVR::ConfigVal("EventMgr_MaxEventsPerFrame", 0, false);
+  _maxSecondsPerFrame = MinVR::ConfigVal("EventMgr_MaxSecondsPerFrame", 0.0, false);
+  const char *priorityLists[NUM_PRIORITIES] = {"EventMgr_CriticalEvents", "EventMgr_NormalEvents",
+                                               "EventMgr_StreamEvents"};
+  for (int p=0;p<NUM_PRIORITIES;p++) {
+    Array<std::string> names = MinVR::splitStringIntoArray(MinVR::ConfigVal(priorityLists[p], "", false));
+    for (int i=0;i<names.size();i++) {
+      setEventPriority(names[i], (EventPriority)p);
+    }
+  }
+
+  // Record or replay a session
+  std::string recordTo = MinVR::ConfigVal("EventMgr_RecordEvents", "", false);
+  if (recordTo != "") {
+    alwaysAssertM(startRecording(recordTo), "Can't create event log " + recordTo);
+  }
+  std::string replayFrom = MinVR::ConfigVal("EventMgr_ReplayEvents", "", false);
+  if (replayFrom != "") {
+    std::string error;
+    bool replaying = startReplay(replayFrom, MinVR::ConfigVal("EventMgr_ReplayRealTime", false, false), error);
+    alwaysAssertM(replaying, error);
+  }
 }
 
 EventMgr::~EventMgr()
@@ -50,42 +106,59 @@ FsaRef
 EventMgr::getFsa(int i)
 {
   debugAssert(i < _fsas.size());
-  return _fsas[i];
+  return _fsas.get(i);
 }
 
 void
 EventMgr::addFsaRef(FsaRef fsa)
 {
-  _fsas.append(fsa);
+  debugAssert(!inParallelDispatch());
+  alwaysAssertM(!_deviceLevelFsas.contains(fsa.pointer()),
+                "Fsa " + fsa->getName() + " is already a device level Fsa");
+  _fsas.add(fsa);
   fsa->setDebug(_fullDebug);
 }
 
 void
 EventMgr::removeFsaRef(FsaRef fsa)
 {
-  int i = _fsas.findIndex(fsa);
-  if (i >= 0)
-    _fsas.remove(i);
+  debugAssert(!inParallelDispatch());
+  _fsas.remove(fsa);
 }
 
 void
 EventMgr::addDeviceLevelFsaRef(FsaRef fsa)
 {
-  _deviceLevelFsas.append(fsa);
+  debugAssert(!inParallelDispatch());
+  alwaysAssertM(!_fsas.contains(fsa.pointer()),
+                "Fsa " + fsa->getName() + " is already a normal Fsa");
+  _deviceLevelFsas.add(fsa);
   fsa->setDebug(_fullDebug);
 }
 
+void
+EventMgr::setParallelDeviceLevelFsas(bool parallel, WorkerPoolRef pool)
+{
+  debugAssert(!inParallelDispatch());
+  _parallelDeviceLevel = parallel;
+  _workerPool = pool;
+  if (parallel && _workerPool.isNull()) {
+    _workerPool = WorkerPool::getDefault();
+  }
+}
+
 void
 EventMgr::setFullDebug(bool debug)
 {
+  debugAssert(!inParallelDispatch());
   _fullDebug = debug;
   for (int i=0;i<_fsas.size();i++) {
-    _fsas[i]->setDebug(debug);
+    _fsas.get(i)->setDebug(debug);
   }
 }
 
-void
-EventMgr::queueEvent(MinVR::EventRef event)
+bool
+EventMgr::applyFilters(MinVR::EventRef event)
 {
   // apply any filters to pre-process events
   bool addToQueue = true;
@@ -93,35 +166,142 @@ EventMgr::queueEvent(MinVR::EventRef event)
     if (!_filters[i]->filter(event))
       addToQueue = false;
   }
-  if (!addToQueue) {
+  return addToQueue;
+}
+
+void
+EventMgr::queueEvent(MinVR::EventRef event)
+{
+  if (captureEvent(event, true)) {
+    return;
+  }
+  debugAssert(!inParallelDispatch());
+  if (_processingDepth == 0) {
+    // Input from outside, replaced by the log while replaying
+    if (_replaying) {
+      return;
+    }
+    if (_recorder.isOpen()) {
+      _recorder.writeEvent(getTime(), event, true);
+    }
+  }
+  if (!applyFilters(event)) {
     return;
   }
-  queueEventWithoutFilter(event);
+  queueUnfiltered(event);
 }
 
 void
-EventMgr::queueEventWithoutFilter(MinVR::EventRef event)
+EventMgr::enqueue(MinVR::EventRef event, EventNameID nameID)
 {
   // queue up the event
   if ((_printAsQueued) || (_fullDebug)) {
     cout << "Queueing event: " << event->toString() << endl;
   }
   _eventQueue.append(event);
-  
-  _recentEventTable.set(event->getName(), event);
+  _eventQueueNames.append(nameID);
+  _eventQueueTimes.append((_processingDepth > 0) ? _frameTime : getTime());
+
+  if (nameID < 0) {
+    return;
+  }
+  if (nameID >= _recentEvents.size()) {
+    _recentEvents.resize(nameID + 1);
+  }
+  _recentEvents[nameID] = event;
+}
+
+void
+EventMgr::queueEventWithoutFilter(MinVR::EventRef event)
+{
+  if (captureEvent(event, false)) {
+    return;
+  }
+  debugAssert(!inParallelDispatch());
+  if (_processingDepth == 0) {
+    if (_replaying) {
+      return;
+    }
+    if (_recorder.isOpen()) {
+      _recorder.writeEvent(getTime(), event, false);
+    }
+  }
+  queueUnfiltered(event);
+}
+
+void
+EventMgr::queueUnfiltered(MinVR::EventRef event)
+{
+  // Names only get ids when something refers to them, so arbitrary event
+  // names don't grow the table
+  EventNameID nameID = EventNames::find(event->getName());
+  enqueue(event, nameID);
 
   // if this event is aliased to something else, then create events for 
   // each alias and queue them as well
-  if (_eventAliases.containsKey(event->getName())) {
-    Array<std::string> aliases = _eventAliases[event->getName()];
-    for (int i=0;i<aliases.size();i++) {
-      MinVR::EventRef newevent = createCopyOfEvent(event);
-      newevent->rename(aliases[i]);
-      if (_fullDebug) {
-        cout << "Generating new event for alias: " << aliases[i] << endl;
-      }
-      queueEvent(newevent);
+  if (_aliasClosureDirty) {
+    rebuildAliasClosure();
+  }
+  const Array<Alias> *aliases = _aliasClosure.getPointer(nameID);
+  if (aliases == NULL) {
+    return;
+  }
+  if (_filters.size() > 0) {
+    queueAliasesFiltered(event, nameID);
+    return;
+  }
+  // With no filters to change the copies, each is just the event renamed
+  // to the next name of the closure
+  for (int i=0;i<aliases->size();i++) {
+    const Alias &alias = (*aliases)[i];
+    MinVR::EventRef newevent = createCopyOfEvent(event);
+    newevent->rename(alias.name);
+    if (_fullDebug) {
+      cout << "Generating new event for alias: " << alias.name << endl;
+    }
+    enqueue(newevent, alias.id);
+  }
+}
+
+void
+EventMgr::queueAliasesFiltered(MinVR::EventRef event, EventNameID nameID)
+{
+  // The copies of the aliases of each copy that gets through the
+  // filters, depth first, with the next alias to copy for each
+  struct Pending {
+    MinVR::EventRef event;
+    EventNameID     id;
+    int             next;
+  };
+  Array<Pending> stack;
+  Pending &root = stack.next();
+  root.event = event;
+  root.id = nameID;
+  root.next = 0;
+
+  while (stack.size() > 0) {
+    Pending &top = stack.last();
+    const Array<Alias> *aliases = _eventAliases.getPointer(top.id);
+    if ((aliases == NULL) || (top.next >= aliases->size())) {
+      stack.pop();
+      continue;
     }
+    std::string aliasName = (*aliases)[top.next++].name;
+    MinVR::EventRef newevent = createCopyOfEvent(top.event);
+    newevent->rename(aliasName);
+    if (_fullDebug) {
+      cout << "Generating new event for alias: " << aliasName << endl;
+    }
+    if (!applyFilters(newevent)) {
+      continue;
+    }
+    // A filter may have renamed it
+    EventNameID newID = EventNames::find(newevent->getName());
+    enqueue(newevent, newID);
+    Pending &p = stack.next();
+    p.event = newevent;
+    p.id = newID;
+    p.next = 0;
   }
 }
 
@@ -144,26 +324,55 @@ EventMgr::queueEventsFromNetMsg(EventBufferNetMsg &m)
 
 void
 EventMgr::processEvent(MinVR::EventRef event)
+{
+  debugAssert(!inParallelDispatch());
+  dispatchEvent(event, EventNames::find(event->getName()));
+}
+
+void
+EventMgr::processEventDeviceLevel(MinVR::EventRef event)
+{
+  debugAssert(!inParallelDispatch());
+  dispatchEventDeviceLevel(event, EventNames::find(event->getName()));
+}
+
+void
+EventMgr::dispatchEvent(MinVR::EventRef event, EventNameID nameID)
 {
   if ((_printAsProcessed) || (_fullDebug))
     cout << "Processing event: " << event->toString() << endl;
-  
-  // Copy the array so that changes made to the member during a processEvent() 
-  // call won't affect which fsa's get the event. All fsa's should be thought
-  // of as receiving the event simultaneously.
-  Array<FsaRef> fsas = _fsas;
-  for ( int i = 0; i < fsas.size(); i++ ) {
-    fsas[i]->processEvent(event);
+  if (nameID < 0) {
+    // Nothing referred to the name when the event was queued, but an Fsa
+    // created since may
+    nameID = EventNames::find(event->getName());
+  }
+  debugAssert(nameID == EventNames::find(event->getName()));
+
+  // Fsa's added or removed by callbacks during the call don't affect which
+  // fsa's get the event, the router applies those changes afterwards.  All
+  // fsa's should be thought of as receiving the event simultaneously.
+  if ((_broadcastEvents) || (_fullDebug)) {
+    _fsas.broadcast(event, nameID);
+  }
+  else {
+    _fsas.dispatch(event, nameID);
   }
 }
 
 void
-EventMgr::processEventDeviceLevel(MinVR::EventRef event)
+EventMgr::dispatchEventDeviceLevel(MinVR::EventRef event, EventNameID nameID)
 {
   if ((_printAsProcessed) || (_fullDebug))
     cout << "Processing event at device level: " << event->toString() << endl;
-  for (int i=0;i<_deviceLevelFsas.size();i++) {
-    _deviceLevelFsas[i]->processEvent(event);
+  if (nameID < 0) {
+    nameID = EventNames::find(event->getName());
+  }
+  debugAssert(nameID == EventNames::find(event->getName()));
+  if ((_broadcastEvents) || (_fullDebug)) {
+    _deviceLevelFsas.broadcast(event, nameID);
+  }
+  else {
+    _deviceLevelFsas.dispatch(event, nameID);
   }
 }
 
@@ -171,66 +380,629 @@ EventMgr::processEventDeviceLevel(MinVR::EventRef event)
 void
 EventMgr::processEventQueue()
 {
-  // Add any timer events whose time has come to the queue
-  double now = MinVR::SynchedSystem::getLocalTime();
-  int e=0;
-  while (e<_timerEvents.size()) {
-    if (_timerEventTimes[e] <= now) {
-      queueEvent(_timerEvents[e]);
-      _timerEvents.fastRemove(e);
-      _timerEventTimes.fastRemove(e);
-    }
-    else {
-      e++;
+  VRG3D_PROFILE_SCOPE("EventMgr::processEventQueue");
+  debugAssert(!inParallelDispatch());
+  _processingDepth++;
+  _frameTime = getTime();
+
+  if (_replaying) {
+    replayFrame();
+  }
+
+  // Bring in the events queued from other threads since the last frame.
+  // Filters and aliases aren't thread safe, so they run here.
+  if (_threadedEvents.drain(_threadedDrain)) {
+    for (int i=0;i<_threadedDrain.size();i++) {
+      if (_replaying) {
+        continue;
+      }
+      if (_recorder.isOpen()) {
+        _recorder.writeEvent(getTime(), _threadedDrain[i], true);
+      }
+      queueEvent(_threadedDrain[i]);
     }
+    _threadedDrain.fastClear();
+  }
+
+  // Everything queued so far belongs to this frame.  The timers run on
+  // the time recorded for it, so that they fire the same when replayed.
+  double now = getTime();
+  _frameTime = now;
+  if (_recorder.isOpen()) {
+    _recorder.writeFrame(now);
+  }
+
+  // Add any timer events whose time has come to the queue
+  _timers.advance(now, _dueTimerEvents);
+  for (int i=0;i<_dueTimerEvents.size();i++) {
+    queueEvent(_dueTimerEvents[i]);
   }
+  _dueTimerEvents.fastClear();
+
+  // Events left over from earlier frames come before this frame's
+  restoreDeferredEvents();
 
   // If an event name is listed as an event to compress, then if
   // multiple events of that name are generated in a single frame, we
   // only keep the last one.
-  Array<std::string> eventsToCompress = MinVR::splitStringIntoArray(MinVR::ConfigVal("EventMgr_EventsToCompress","",false));
-  for (int i=0;i<eventsToCompress.size();i++) {
-    int j = _eventQueue.size()-1;
-    bool gotFirst = false;
-    while (j >= 0) {
-      if ((_eventQueue[j]->getName() == eventsToCompress[i]) ||
-          (_eventQueue[j]->getName() == eventsToCompress[i] + "_down") ||
-          (_eventQueue[j]->getName() == eventsToCompress[i] + "up")) {
-        if (!gotFirst) {
-          gotFirst = true;
-        }
-        else {
-          _eventQueue.fastRemove(j);
-        }
-      }
-      j--;
-    }
-  }
-  
+  compressEventQueue();
+
+  // Leave what doesn't fit in the frame's budget for the next one
+  applyEventBudget();
+  updateQueueStats(now);
+  double dispatchStart = _clock();
+
   // First, device level Fsa's respond to Events.  Usually, these
   // device level Fsa's will generate additional Events and place
   // them on the Queue.
   if (_deviceLevelFsas.size()) {
-    int size = _eventQueue.size();
-    for (int i=0;i<size;i++) {
-      processEventDeviceLevel(_eventQueue[i]);
+    VRG3D_PROFILE_SCOPE("EventMgr::deviceLevelFsas");
+    if (_parallelDeviceLevel && !_fullDebug && !_printAsProcessed && (_deviceLevelFsas.size() > 1)) {
+      processDeviceLevelParallel();
+    }
+    else {
+      int size = _eventQueue.size();
+      for (int i=0;i<size;i++) {
+        dispatchEventDeviceLevel(_eventQueue[i], _eventQueueNames[i]);
+      }
     }
   }
 
   // Next, normal Fsa's respond to all events, including those generated
   // by device level Fsa's.
+  {
+    VRG3D_PROFILE_SCOPE("EventMgr::fsas");
+    for (int i=0;i<_eventQueue.size();i++) {
+      dispatchEvent(_eventQueue[i], _eventQueueNames[i]);
+    }
+  }
+
+  // How long the events took, for the time budget
+  _queueStats.processed = _eventQueue.size();
+  _queueStats.totalProcessed += _eventQueue.size();
+  _queueStats.dispatchSeconds = _clock() - dispatchStart;
+  if (_eventQueue.size() > 0) {
+    double perEvent = _queueStats.dispatchSeconds / _eventQueue.size();
+    _secondsPerEvent = (_secondsPerEvent > 0.0) ? (0.75 * _secondsPerEvent + 0.25 * perEvent) : perEvent;
+  }
+
+  // Keep the storage for the next frame
+  _eventQueue.fastClear();
+  _eventQueueNames.fastClear();
+  _eventQueueTimes.fastClear();
+  _processingDepth--;
+}
+
+EventMgr::DeviceCapture*&
+EventMgr::threadCapture()
+{
+  thread_local DeviceCapture *capture = NULL;
+  return capture;
+}
+
+bool
+EventMgr::captureEvent(MinVR::EventRef event, bool filtered)
+{
+  DeviceCapture *capture = threadCapture();
+  if ((capture == NULL) || (capture->owner != this)) {
+    return false;
+  }
+  GeneratedEvent &g = capture->out->next();
+  g.event = event;
+  g.source = capture->source;
+  g.filtered = filtered;
+  return true;
+}
+
+void
+EventMgr::processDeviceLevelParallel()
+{
+  int numFsas = _deviceLevelFsas.size();
+  int size = _eventQueue.size();
+  if (size == 0) {
+    return;
+  }
+  while (_deviceOutputs.size() < numFsas) {
+    _deviceOutputs.next();
+  }
+  // As dispatchEventDeviceLevel() does, in case an Fsa now responds to a
+  // name that had no id when its event was queued
+  for (int i=0;i<size;i++) {
+    if (_eventQueueNames[i] < 0) {
+      _eventQueueNames[i] = EventNames::find(_eventQueue[i]->getName());
+    }
+  }
+
+  // Each Fsa takes every event in turn on one thread, as dispatch would
+  // give it those it has an arc for.  The queue isn't changed until all
+  // are done.
+  _deviceLevelFsas.beginParallel();
+  _workerPool->parallelFor(numFsas, 1, [this, size](int begin, int end) {
+      DeviceCapture capture;
+      capture.owner = this;
+      DeviceCapture *outer = threadCapture();
+      threadCapture() = &capture;
+      for (int f=begin;f<end;f++) {
+        Fsa *fsa = _deviceLevelFsas.get(f).pointer();
+        capture.out = &_deviceOutputs[f];
+        capture.out->fastClear();
+        for (int i=0;i<size;i++) {
+          capture.source = i;
+          fsa->processEvent(_eventQueue[i], _eventQueueNames[i]);
+        }
+      }
+      threadCapture() = outer;
+    });
+  _deviceLevelFsas.endParallel((int64)numFsas * size);
+
+  // Queue what they generated in the order running them one after
+  // another would have: by the event that led to it, then by Fsa
+  _deviceMergePos.resize(numFsas, false);
+  for (int f=0;f<numFsas;f++) {
+    _deviceMergePos[f] = 0;
+  }
+  while (true) {
+    int source = INT_MAX;
+    for (int f=0;f<numFsas;f++) {
+      const Array<GeneratedEvent> &out = _deviceOutputs[f];
+      if (_deviceMergePos[f] < out.size()) {
+        source = iMin(source, out[_deviceMergePos[f]].source);
+      }
+    }
+    if (source == INT_MAX) {
+      break;
+    }
+    for (int f=0;f<numFsas;f++) {
+      Array<GeneratedEvent> &out = _deviceOutputs[f];
+      int &pos = _deviceMergePos[f];
+      while ((pos < out.size()) && (out[pos].source == source)) {
+        if (out[pos].filtered) {
+          queueEvent(out[pos].event);
+        }
+        else {
+          queueEventWithoutFilter(out[pos].event);
+        }
+        out[pos].event = NULL;
+        pos++;
+      }
+    }
+  }
+}
+
+void
+EventMgr::setEventPriority(const std::string &eventName, EventPriority priority)
+{
+  debugAssert(!inParallelDispatch());
+  EventNameID id = EventNames::intern(eventName);
+  while (_priorityOf.size() <= id) {
+    _priorityOf.append(-1);
+  }
+  _priorityOf[id] = priority;
+}
+
+EventMgr::EventPriority
+EventMgr::getEventPriority(MinVR::EventRef event) const
+{
+  return priorityOf(event, EventNames::find(event->getName()));
+}
+
+EventMgr::EventPriority
+EventMgr::priorityOf(MinVR::EventRef event, EventNameID nameID) const
+{
+  if ((nameID >= 0) && (nameID < _priorityOf.size()) && (_priorityOf[nameID] >= 0)) {
+    return (EventPriority)_priorityOf[nameID];
+  }
+  if (event->getType() == MinVR::VRG3DEvent::EVENTTYPE_STANDARD) {
+    return PRIORITY_CRITICAL;
+  }
+  if (event->getType() == MinVR::VRG3DEvent::EVENTTYPE_MSG) {
+    return PRIORITY_NORMAL;
+  }
+  return PRIORITY_STREAM;
+}
+
+void
+EventMgr::restoreDeferredEvents()
+{
+  if (_deferredEvents.size() == 0) {
+    return;
+  }
   for (int i=0;i<_eventQueue.size();i++) {
-    processEvent(_eventQueue[i]);
+    _deferredEvents.append(_eventQueue[i]);
+    _deferredNames.append(_eventQueueNames[i]);
+    _deferredTimes.append(_eventQueueTimes[i]);
   }
+  _eventQueue.fastClear();
+  _eventQueueNames.fastClear();
+  _eventQueueTimes.fastClear();
+  for (int i=0;i<_deferredEvents.size();i++) {
+    _eventQueue.append(_deferredEvents[i]);
+    _eventQueueNames.append(_deferredNames[i]);
+    _eventQueueTimes.append(_deferredTimes[i]);
+  }
+  _deferredEvents.fastClear();
+  _deferredNames.fastClear();
+  _deferredTimes.fastClear();
+}
 
-  _eventQueue.clear();
+void
+EventMgr::applyEventBudget()
+{
+  int budget = _eventQueue.size();
+  if (_maxEventsPerFrame > 0) {
+    budget = iMin(budget, _maxEventsPerFrame);
+  }
+  if ((_maxSecondsPerFrame > 0.0) && (_secondsPerEvent > 0.0)) {
+    budget = iMin(budget, iMax(1, (int)(_maxSecondsPerFrame / _secondsPerEvent)));
+  }
+  if (budget >= _eventQueue.size()) {
+    return;
+  }
+
+  // Count the events of each priority, then take all the critical ones
+  // and fill the rest of the budget from the others in priority order
+  int n = _eventQueue.size();
+  _budgetPriorities.resize(n, false);
+  int count[NUM_PRIORITIES] = {0};
+  for (int i=0;i<n;i++) {
+    int p = priorityOf(_eventQueue[i], _eventQueueNames[i]);
+    _budgetPriorities[i] = p;
+    count[p]++;
+  }
+  int take[NUM_PRIORITIES];
+  int left = budget;
+  for (int p=0;p<NUM_PRIORITIES;p++) {
+    take[p] = (p == PRIORITY_CRITICAL) ? count[p] : iClamp(left, 0, count[p]);
+    left -= take[p];
+  }
+
+  // Keep the first take[p] events of each priority in place, in order,
+  // and move the others out
+  int kept = 0;
+  for (int i=0;i<n;i++) {
+    int p = _budgetPriorities[i];
+    if (take[p] > 0) {
+      take[p]--;
+      _eventQueue[kept] = _eventQueue[i];
+      _eventQueueNames[kept] = _eventQueueNames[i];
+      _eventQueueTimes[kept] = _eventQueueTimes[i];
+      kept++;
+    }
+    else {
+      _deferredEvents.append(_eventQueue[i]);
+      _deferredNames.append(_eventQueueNames[i]);
+      _deferredTimes.append(_eventQueueTimes[i]);
+    }
+  }
+  _eventQueue.resize(kept, false);
+  _eventQueueNames.resize(kept, false);
+  _eventQueueTimes.resize(kept, false);
 }
 
+void
+EventMgr::updateQueueStats(double now)
+{
+  EventQueueStats &s = _queueStats;
+  s.depth = _eventQueue.size() + _deferredEvents.size();
+  s.deferred = _deferredEvents.size();
+  s.meanLatency = 0.0;
+  s.maxLatency = 0.0;
+  for (int i=0;i<_eventQueueTimes.size();i++) {
+    double latency = now - _eventQueueTimes[i];
+    s.meanLatency += latency;
+    s.maxLatency = max(s.maxLatency, latency);
+  }
+  if (_eventQueueTimes.size() > 0) {
+    s.meanLatency /= _eventQueueTimes.size();
+  }
+  s.frames++;
+  if (s.deferred > 0) {
+    s.framesOverBudget++;
+  }
+  s.maxDepth = iMax(s.maxDepth, s.depth);
+  s.peakLatency = max(s.peakLatency, s.maxLatency);
+}
 
 void
+EventMgr::resetQueueStats()
+{
+  EventQueueStats &s = _queueStats;
+  s.depth = 0;
+  s.processed = 0;
+  s.deferred = 0;
+  s.meanLatency = 0.0;
+  s.maxLatency = 0.0;
+  s.dispatchSeconds = 0.0;
+  s.frames = 0;
+  s.totalProcessed = 0;
+  s.framesOverBudget = 0;
+  s.maxDepth = 0;
+  s.peakLatency = 0.0;
+}
+
+bool
+EventMgr::startRecording(const std::string &filename)
+{
+  debugAssert(!inParallelDispatch());
+  return _recorder.open(filename);
+}
+
+bool
+EventMgr::stopRecording()
+{
+  debugAssert(!inParallelDispatch());
+  return _recorder.close();
+}
+
+bool
+EventMgr::startReplay(const std::string &filename, bool realTime, std::string &error)
+{
+  Array<EventLogRecord> records;
+  if (!EventLogReader::read(filename, records, error)) {
+    return false;
+  }
+  startReplay(records, realTime);
+  return true;
+}
+
+void
+EventMgr::startReplay(const Array<EventLogRecord> &records, bool realTime)
+{
+  debugAssert(!inParallelDispatch());
+  _replayRecords = records;
+  _replayNext = 0;
+  _replayRealTime = realTime;
+  _replayStartTime = 0.0;
+  for (int i=0;i<records.size();i++) {
+    if (records[i].type == EventLogRecord::FRAME) {
+      _replayStartTime = records[i].time;
+      break;
+    }
+  }
+  _replayTime = _replayStartTime;
+  _replayClockStart = _clock();
+  _replaying = true;
+}
+
+void
+EventMgr::stopReplay()
+{
+  debugAssert(!inParallelDispatch());
+  _replaying = false;
+  _replayRecords.clear();
+  _replayNext = 0;
+}
+
+void
+EventMgr::replayFrame()
+{
+  if (_replayNext >= _replayRecords.size()) {
+    // The last frame has been processed, back to live input
+    stopReplay();
+    return;
+  }
+  double target = _replayStartTime + (_clock() - _replayClockStart);
+  if (_replayRealTime) {
+    _replayTime = target;
+  }
+
+  while (_replayNext < _replayRecords.size()) {
+    // The events of a frame come before its FRAME record
+    int end = _replayNext;
+    while ((end < _replayRecords.size()) && (_replayRecords[end].type != EventLogRecord::FRAME)) {
+      end++;
+    }
+    if ((end < _replayRecords.size()) && _replayRealTime && (_replayRecords[end].time > target)) {
+      return;
+    }
+    for (int i=_replayNext;i<end;i++) {
+      if (_replayRecords[i].type == EventLogRecord::EVENT) {
+        queueEvent(_replayRecords[i].event);
+      }
+      else {
+        queueEventWithoutFilter(_replayRecords[i].event);
+      }
+    }
+    if (end == _replayRecords.size()) {
+      _replayNext = end;
+      return;
+    }
+    _replayNext = end + 1;
+    if (!_replayRealTime) {
+      _replayTime = _replayRecords[end].time;
+      return;
+    }
+  }
+}
+
+
+void
+EventMgr::addCompressionRule(const std::string &eventName, CompressionPolicy policy)
+{
+  debugAssert(!inParallelDispatch());
+  // The three names share one rule, of them only the very last event is
+  // kept.  "up" rather than "_up" is how compression has always matched.
+  EventNameID ids[3];
+  ids[0] = EventNames::intern(eventName);
+  ids[1] = EventNames::intern(eventName + "_down");
+  ids[2] = EventNames::intern(eventName + "up");
+
+  int r = (ids[0] < _compressionRuleOf.size()) ? _compressionRuleOf[ids[0]] : -1;
+  if (r >= 0) {
+    _compressionRules[r].policy = policy;
+    return;
+  }
+  r = _compressionRules.size();
+  CompressionRule &rule = _compressionRules.next();
+  rule.policy = policy;
+  for (int i=0;i<3;i++) {
+    while (_compressionRuleOf.size() <= ids[i]) {
+      _compressionRuleOf.append(-1);
+    }
+    _compressionRuleOf[ids[i]] = r;
+  }
+}
+
+void
+EventMgr::clearCompressionRules()
+{
+  debugAssert(!inParallelDispatch());
+  _compressionRules.clear();
+  _compressionRuleOf.clear();
+}
+
+void
+EventMgr::compressEventQueue()
+{
+  if (_compressionRules.size() == 0) {
+    return;
+  }
+  for (int r=0;r<_compressionRules.size();r++) {
+    CompressionRule &rule = _compressionRules[r];
+    rule.kept = -1;
+    rule.numDropped = 0;
+    rule.sum1D = 0.0;
+    rule.sum2D = Vector2::zero();
+  }
+
+  // Walking backwards, the first event seen for a rule is the latest, the
+  // one to keep
+  int n = _eventQueue.size();
+  _compressDropped.resize(n, false);
+  int numDropped = 0;
+  for (int j=n-1;j>=0;j--) {
+    EventNameID id = _eventQueueNames[j];
+    int r = ((id >= 0) && (id < _compressionRuleOf.size())) ? _compressionRuleOf[id] : -1;
+    _compressDropped[j] = false;
+    if (r < 0) {
+      continue;
+    }
+    CompressionRule &rule = _compressionRules[r];
+    if (rule.kept < 0) {
+      rule.kept = j;
+    }
+    else {
+      _compressDropped[j] = true;
+      rule.numDropped++;
+      numDropped++;
+    }
+    if ((rule.policy == COMPRESS_ACCUMULATE) &&
+        (_eventQueue[j]->getType() == _eventQueue[rule.kept]->getType())) {
+      if (_eventQueue[j]->getType() == MinVR::VRG3DEvent::EVENTTYPE_1D) {
+        rule.sum1D += _eventQueue[j]->get1DData();
+      }
+      else if (_eventQueue[j]->getType() == MinVR::VRG3DEvent::EVENTTYPE_2D) {
+        rule.sum2D += _eventQueue[j]->get2DData();
+      }
+    }
+  }
+  if (numDropped == 0) {
+    return;
+  }
+
+  // The kept events take the sums, as new events since the queued ones
+  // may be shared with other code
+  for (int r=0;r<_compressionRules.size();r++) {
+    const CompressionRule &rule = _compressionRules[r];
+    if ((rule.policy != COMPRESS_ACCUMULATE) || (rule.numDropped == 0)) {
+      continue;
+    }
+    MinVR::EventRef kept = _eventQueue[rule.kept];
+    if (kept->getType() == MinVR::VRG3DEvent::EVENTTYPE_1D) {
+      _eventQueue[rule.kept] = new MinVR::VRG3DEvent(kept->getName(), rule.sum1D);
+    }
+    else if (kept->getType() == MinVR::VRG3DEvent::EVENTTYPE_2D) {
+      _eventQueue[rule.kept] = new MinVR::VRG3DEvent(kept->getName(), rule.sum2D);
+    }
+    // getMostRecentEvent() should give what the Fsas get
+    EventNameID id = _eventQueueNames[rule.kept];
+    if ((id >= 0) && (id < _recentEvents.size()) && (_recentEvents[id] == kept)) {
+      _recentEvents[id] = _eventQueue[rule.kept];
+    }
+  }
+
+  // Close up the gaps, keeping the order of the rest
+  int out = 0;
+  for (int j=0;j<n;j++) {
+    if (!_compressDropped[j]) {
+      if (out != j) {
+        _eventQueue[out] = _eventQueue[j];
+        _eventQueueNames[out] = _eventQueueNames[j];
+        _eventQueueTimes[out] = _eventQueueTimes[j];
+      }
+      out++;
+    }
+  }
+  _eventQueue.resize(out, false);
+  _eventQueueNames.resize(out, false);
+  _eventQueueTimes.resize(out, false);
+}
+
+
+bool
+EventMgr::expandAliases(EventNameID root, Array<Alias> &out, std::string &cycle) const
+{
+  // The names from root down to the one being expanded, each with the
+  // index of its next alias to visit
+  Array< std::pair<EventNameID, int> > path;
+  Array<bool> onPath;
+  onPath.resize(EventNames::numNames());
+  for (int i=0;i<onPath.size();i++) {
+    onPath[i] = false;
+  }
+  path.append(std::make_pair(root, 0));
+  onPath[root] = true;
+
+  while (path.size() > 0) {
+    std::pair<EventNameID, int> &top = path.last();
+    const Array<Alias> *aliases = _eventAliases.getPointer(top.first);
+    if ((aliases == NULL) || (top.second >= aliases->size())) {
+      onPath[top.first] = false;
+      path.pop();
+      continue;
+    }
+    const Alias &alias = (*aliases)[top.second++];
+    if (onPath[alias.id]) {
+      int p = 0;
+      while (path[p].first != alias.id) {
+        p++;
+      }
+      cycle = "";
+      for (;p<path.size();p++) {
+        cycle += EventNames::getName(path[p].first) + " -> ";
+      }
+      cycle += alias.name;
+      return false;
+    }
+    out.append(alias);
+    path.append(std::make_pair(alias.id, 0));
+    onPath[alias.id] = true;
+  }
+  return true;
+}
+
+void
+EventMgr::rebuildAliasClosure()
+{
+  _aliasClosureDirty = false;
+  _aliasClosure.clear();
+  Array<EventNameID> names;
+  _eventAliases.getKeys(names);
+  for (int i=0;i<names.size();i++) {
+    Array<Alias> closure;
+    std::string cycle;
+    bool acyclic = expandAliases(names[i], closure, cycle);
+    debugAssert(acyclic);
+    (void)acyclic;
+    _aliasClosure.set(names[i], closure);
+  }
+}
+
+bool
 EventMgr::addEventAliases(const std::string &eventName,
                           const Array<std::string> &newEventNames)
 {
+  debugAssert(!inParallelDispatch());
   if (_log) {
     _log->print("Alias(es) for Event \"" + eventName + "\" are:  ");
     for (int i=0;i<newEventNames.size();i++) {
@@ -238,26 +1010,66 @@ EventMgr::addEventAliases(const std::string &eventName,
     }
     _log->println("");
   }
-  _eventAliases.set( eventName, newEventNames );
+
+  EventNameID nameID = EventNames::intern(eventName);
+  Array<Alias> aliases;
+  for (int i=0;i<newEventNames.size();i++) {
+    Alias &alias = aliases.next();
+    alias.name = newEventNames[i];
+    alias.id = EventNames::intern(newEventNames[i]);
+  }
+
+  // Any cycle the new aliases make passes through eventName
+  Array<Alias> previous;
+  bool hadPrevious = _eventAliases.get(nameID, previous);
+  _eventAliases.set(nameID, aliases);
+  Array<Alias> closure;
+  std::string cycle;
+  if (!expandAliases(nameID, closure, cycle)) {
+    if (hadPrevious) {
+      _eventAliases.set(nameID, previous);
+    }
+    else {
+      _eventAliases.remove(nameID);
+    }
+    if (_log) {
+      _log->println("Not adding aliases for Event \"" + eventName + "\", they form a cycle: " + cycle);
+    }
+    return false;
+  }
+  _aliasClosureDirty = true;
+  return true;
 }
 
 
 MinVR::EventRef
 EventMgr::getMostRecentEvent(const std::string &eventName)
 {
-  if (!_recentEventTable.containsKey(eventName)) {
+  debugAssert(!inParallelDispatch());
+  // Asking for the name refers to it, so its events are remembered from
+  // now on if they weren't already
+  EventNameID nameID = EventNames::intern(eventName);
+  if ((nameID < 0) || (nameID >= _recentEvents.size())) {
     return NULL;
   }
   else {
-    return _recentEventTable[eventName];
+    return _recentEvents[nameID];
   }
 }
 
-void
+TimerWheel::Handle
 EventMgr::queueTimerEvent(MinVR::EventRef event, double queueTime)
 {
-  _timerEvents.append(event);
-  _timerEventTimes.append(MinVR::SynchedSystem::getLocalTime() + queueTime);
+  debugAssert(!inParallelDispatch());
+  return _timers.add(event, getTime(), queueTime);
+}
+
+TimerWheel::Handle
+EventMgr::queuePeriodicTimerEvent(MinVR::EventRef event, double queueTime, double period)
+{
+  debugAssert(!inParallelDispatch());
+  debugAssert(period > 0.0);
+  return _timers.add(event, getTime(), queueTime, period);
 }
 
 #ifdef WITH_PHOTON
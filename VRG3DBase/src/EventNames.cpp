@@ -0,0 +1,70 @@
+#include "../include/EventNames.H"
+#include <mutex>
+#include <shared_mutex>
+
+using namespace G3D;
+
+
+struct EventNames::State
+{
+  std::shared_mutex                mutex;
+  Table<std::string, EventNameID>  ids;
+  Array<std::string>               names;
+};
+
+
+EventNames::State&
+EventNames::state()
+{
+  static State s;
+  return s;
+}
+
+EventNameID
+EventNames::intern(const std::string &name)
+{
+  State &s = state();
+  EventNameID id;
+  {
+    std::shared_lock<std::shared_mutex> lock(s.mutex);
+    if (s.ids.get(name, id)) {
+      return id;
+    }
+  }
+  std::unique_lock<std::shared_mutex> lock(s.mutex);
+  // Another thread may have added it between the locks
+  if (s.ids.get(name, id)) {
+    return id;
+  }
+  id = s.names.size();
+  s.ids.set(name, id);
+  s.names.append(name);
+  return id;
+}
+
+EventNameID
+EventNames::find(const std::string &name)
+{
+  State &s = state();
+  std::shared_lock<std::shared_mutex> lock(s.mutex);
+  EventNameID id = -1;
+  s.ids.get(name, id);
+  return id;
+}
+
+std::string
+EventNames::getName(EventNameID id)
+{
+  State &s = state();
+  std::shared_lock<std::shared_mutex> lock(s.mutex);
+  debugAssert((id >= 0) && (id < s.names.size()));
+  return s.names[id];
+}
+
+int
+EventNames::numNames()
+{
+  State &s = state();
+  std::shared_lock<std::shared_mutex> lock(s.mutex);
+  return s.names.size();
+}
@@ -0,0 +1,192 @@
+#include "../include/EventQueue.H"
+#include <thread>
+
+using namespace G3D;
+
+
+std::atomic<EventQueue::Node*> EventQueue::_recycled(NULL);
+std::atomic<int64>             EventQueue::_numNodeAllocations(0);
+
+namespace {
+
+/// Set once this thread's NodeCache is destroyed, queues torn down after
+/// that (statics of the main thread) go straight to the heap
+thread_local bool cacheDestroyed = false;
+
+} // end namespace
+
+/** Nodes this thread freed, handed back to _recycled in batches of
+    BATCH, and nodes it took from _recycled to allocate from. */
+struct EventQueue::NodeCache
+{
+  enum { BATCH = 64 };
+
+  NodeCache() : freed(NULL), freedLast(NULL), numFreed(0), spare(NULL) {}
+
+  ~NodeCache() {
+    cacheDestroyed = true;
+    if (freed != NULL) {
+      recycle(freed, freedLast);
+    }
+    if (spare != NULL) {
+      Node *last = spare;
+      while (last->next.load(std::memory_order_relaxed) != NULL) {
+        last = last->next.load(std::memory_order_relaxed);
+      }
+      recycle(spare, last);
+    }
+  }
+
+  Node *freed;
+  Node *freedLast;
+  int   numFreed;
+  Node *spare;
+};
+
+
+EventQueue::EventQueue()
+{
+  Node *dummy = allocNode();
+  _head.store(dummy, std::memory_order_relaxed);
+  _tail = dummy;
+}
+
+EventQueue::~EventQueue()
+{
+  MinVR::EventRef event;
+  while (pop(event)) {
+  }
+  freeNode(_tail);
+}
+
+int64
+EventQueue::numNodeAllocations()
+{
+  return _numNodeAllocations.load(std::memory_order_relaxed);
+}
+
+EventQueue::NodeCache&
+EventQueue::threadCache()
+{
+  thread_local NodeCache cache;
+  return cache;
+}
+
+EventQueue::Node*
+EventQueue::allocNode()
+{
+  if (cacheDestroyed) {
+    Node *node = new Node();
+    node->next.store(NULL, std::memory_order_relaxed);
+    return node;
+  }
+  NodeCache &cache = threadCache();
+  Node *node = NULL;
+  if (cache.freed != NULL) {
+    node = cache.freed;
+    cache.freed = node->next.load(std::memory_order_relaxed);
+    cache.numFreed--;
+    if (cache.freed == NULL) {
+      cache.freedLast = NULL;
+    }
+  }
+  else {
+    if (cache.spare == NULL) {
+      cache.spare = _recycled.exchange(NULL, std::memory_order_acquire);
+    }
+    if (cache.spare != NULL) {
+      node = cache.spare;
+      cache.spare = node->next.load(std::memory_order_relaxed);
+    }
+    else {
+      node = new Node();
+      _numNodeAllocations.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  node->next.store(NULL, std::memory_order_relaxed);
+  return node;
+}
+
+void
+EventQueue::freeNode(Node *node)
+{
+  debugAssert(node->event.isNull());
+  if (cacheDestroyed) {
+    delete node;
+    return;
+  }
+  NodeCache &cache = threadCache();
+  node->next.store(cache.freed, std::memory_order_relaxed);
+  if (cache.freed == NULL) {
+    cache.freedLast = node;
+  }
+  cache.freed = node;
+  if (++cache.numFreed >= NodeCache::BATCH) {
+    recycle(cache.freed, cache.freedLast);
+    cache.freed = NULL;
+    cache.freedLast = NULL;
+    cache.numFreed = 0;
+  }
+}
+
+void
+EventQueue::recycle(Node *first, Node *last)
+{
+  Node *head = _recycled.load(std::memory_order_relaxed);
+  do {
+    last->next.store(head, std::memory_order_relaxed);
+  } while (!_recycled.compare_exchange_weak(head, first, std::memory_order_release,
+                                            std::memory_order_relaxed));
+}
+
+void
+EventQueue::push(MinVR::EventRef event)
+{
+  Node *node = allocNode();
+  node->event = event;
+  Node *prev = _head.exchange(node, std::memory_order_acq_rel);
+  // The release publishes node->event to the consumer
+  prev->next.store(node, std::memory_order_release);
+}
+
+bool
+EventQueue::pop(MinVR::EventRef &event)
+{
+  Node *next = _tail->next.load(std::memory_order_acquire);
+  if (next == NULL) {
+    return false;
+  }
+  // next becomes the new dummy, its event moves out
+  event = next->event;
+  next->event = NULL;
+  freeNode(_tail);
+  _tail = next;
+  return true;
+}
+
+int
+EventQueue::drain(Array<MinVR::EventRef> &out)
+{
+  Node *last = _head.load(std::memory_order_acquire);
+  int n = 0;
+  while (_tail != last) {
+    Node *next = _tail->next.load(std::memory_order_acquire);
+    if (next == NULL) {
+      // A producer has swapped in its node but not linked it yet
+      std::this_thread::yield();
+      continue;
+    }
+    out.append(next->event);
+    next->event = NULL;
+    freeNode(_tail);
+    _tail = next;
+    n++;
+  }
+  return n;
+}
+
+bool
+EventQueue::isEmpty() const
+{
+  return _tail->next.load(std::memory_order_acquire) == NULL;
+}
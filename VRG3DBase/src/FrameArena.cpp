@@ -0,0 +1,105 @@
+#include "../include/FrameArena.H"
+
+using namespace G3D;
+
+FrameArena::FrameArena(size_t initialBlockSize)
+{
+  _numBlocks = 0;
+  _initialBlockSize = initialBlockSize;
+  addBlock(_initialBlockSize);
+  // The very first block is part of construction, not of any frame.
+  _frameStats.numHeapAllocs = 0;
+}
+
+FrameArena::~FrameArena()
+{
+  freeBlocks();
+}
+
+void
+FrameArena::addBlock(size_t minSize)
+{
+  alwaysAssertM(_numBlocks < MAX_BLOCKS, "FrameArena: too many blocks in a single frame.");
+
+  // Grow geometrically so that a frame that overflows needs only a few
+  // extra blocks before the next reset() coalesces them.
+  size_t size = _initialBlockSize;
+  if (_numBlocks) {
+    size = 2 * _blocks[_numBlocks-1].size;
+  }
+  while (size < minSize) {
+    size *= 2;
+  }
+
+  Block &b = _blocks[_numBlocks];
+  b.data = (char*)System::alignedMalloc(size, 16);
+  alwaysAssertM(b.data != NULL, "FrameArena: out of memory.");
+  b.size = size;
+  b.used = 0;
+  _numBlocks++;
+
+  _frameStats.numHeapAllocs++;
+  _frameStats.bytesReserved += size;
+}
+
+void
+FrameArena::freeBlocks()
+{
+  for (int i=0;i<_numBlocks;i++) {
+    System::alignedFree(_blocks[i].data);
+  }
+  _numBlocks = 0;
+  _frameStats.bytesReserved = 0;
+}
+
+size_t
+FrameArena::alignedOffset(const Block &b, size_t alignment)
+{
+  uintptr_t p = (uintptr_t)(b.data + b.used);
+  uintptr_t aligned = (p + alignment - 1) & ~(uintptr_t)(alignment - 1);
+  return b.used + (size_t)(aligned - p);
+}
+
+void*
+FrameArena::alloc(size_t size, size_t alignment)
+{
+  debugAssertM((alignment & (alignment - 1)) == 0, "FrameArena alignment must be a power of 2");
+
+  Block *b = &_blocks[_numBlocks-1];
+  size_t start = alignedOffset(*b, alignment);
+  if (start + size > b->size) {
+    addBlock(size + alignment);
+    b = &_blocks[_numBlocks-1];
+    start = alignedOffset(*b, alignment);
+  }
+
+  _frameStats.bytesUsed += (start - b->used) + size;
+  b->used = start + size;
+  return b->data + start;
+}
+
+void
+FrameArena::reset()
+{
+  _lastFrameStats = _frameStats;
+
+  if (_numBlocks > 1) {
+    // The frame overflowed the first block, replace the chain with one
+    // block that can hold everything so next frame needs no allocations.
+    size_t total = 0;
+    for (int i=0;i<_numBlocks;i++) {
+      total += _blocks[i].size;
+    }
+    freeBlocks();
+    _initialBlockSize = total;
+    addBlock(total);
+    // Account for the coalescing allocation in the frame that caused it.
+    _lastFrameStats.numHeapAllocs++;
+  }
+  else {
+    _blocks[0].used = 0;
+  }
+
+  _frameStats = Stats();
+  _frameStats.bytesReserved = _blocks[0].size;
+}
@@ -42,6 +42,9 @@ Fsa::addArc(const std::string &arcName,
 
   FsaArcRef arc = new FsaArc(arcName, toState, triggers);
   _states[fromState].addArcRef(arc);
+  if (fromState == _curState) {
+    notifyObservers();
+  }
   return true;
 }
 
@@ -222,9 +225,15 @@ Fsa::checkTriggerMatch(MinVR::EventRef event, const std::string &triggerName)
 void
 Fsa::processEvent(MinVR::EventRef event)
 {
-  // check all the triggers for all the arcs of the current state
-  // if a trigger matches this event then, follow that arc and call
-  // a callback function if one is specified.
+  processEvent(event, EventNames::find(event->getName()));
+}
+
+void
+Fsa::processEvent(MinVR::EventRef event, EventNameID nameID)
+{
+  // find the first arc of the current state with a trigger matching
+  // this event, in the order checkTriggerMatch() would check them, then
+  // follow that arc and call a callback function if one is specified.
 
 
   if (_debug) {
@@ -232,63 +241,50 @@ Fsa::processEvent(MinVR::EventRef event)
 	      << _states[_curState].getName() << "\""
 	      << "; Processing event \"" << event->getName() << "\"" << std::endl;
   }
-  
-  int a=0;
-  bool match=false;
-  while ((!match) && (a<_states[_curState].getNumArcs())) {
 
-    int t=0;
+  int a = _states[_curState].findArc(nameID, event->getType());
+  if (a < 0) {
     if (_debug) {
-      std::cout << "  > Checking arc \"" 
-		<< _states[_curState].getArcRef(a)->getName() 
-		<< "\"" << std::endl;
+      std::cout << "  > No arc is triggered by this event." << std::endl;
     }
+    return;
+  }
 
-    while ((!match) && (t<_states[_curState].getArcRef(a)->getNumTriggers())) {
-
-      if (_debug) {
-	std::cout << "    > Checking trigger \"" 
-		  << _states[_curState].getArcRef(a)->getTrigger(t)
-		  << "\" " << std::endl;
-      }
-
-      match = checkTriggerMatch(event, _states[_curState].getArcRef(a)->getTrigger(t));
+  // got match, transition on this arc..
+  int lastState = _curState;
+  _curState = _states[lastState].getArcRef(a)->getTo();
+  bool leavesState = (lastState != _curState);
+  // observers hear about it before any callback can queue or process
+  // more events
+  if (leavesState) {
+    notifyObservers();
+  }
 
-      if (match) {
-	// got match, transition on this arc..
-	match = true;
-	int lastState = _curState;
-	_curState = _states[lastState].getArcRef(a)->getTo();
-	bool leavesState = (lastState != _curState);
-
-	if (_debug) {
-	  std::cout << "      *** MATCH ***" << std::endl;
-	   if (leavesState)
-	     std::cout << "      > Setting current state to \"" 
-		       << _states[_curState].getName() << "\"" << std::endl;
-	   else 
-	     std::cout << "      > No state change for this arc." << std::endl;
-	}
+  if (_debug) {
+    std::cout << "  > Matched arc \"" 
+	      << _states[lastState].getArcRef(a)->getName() 
+	      << "\"" << std::endl;
+    if (leavesState)
+      std::cout << "      > Setting current state to \"" 
+		<< _states[_curState].getName() << "\"" << std::endl;
+    else 
+      std::cout << "      > No state change for this arc." << std::endl;
+  }
 	
-	if (leavesState) {
-	  if (_debug)
-	    std::cout << "      > Calling state exit callbacks.." << std::endl;
-	  _states[lastState].callExitCallbacks();
-	}
-
-	if (_debug)
-	  std::cout << "      > Calling arc transition callbacks.." << std::endl;
-	_states[lastState].getArcRef(a)->callCallbacks(event);
+  if (leavesState) {
+    if (_debug)
+      std::cout << "      > Calling state exit callbacks.." << std::endl;
+    _states[lastState].callExitCallbacks();
+  }
+
+  if (_debug)
+    std::cout << "      > Calling arc transition callbacks.." << std::endl;
+  _states[lastState].getArcRef(a)->callCallbacks(event);
 	
-	if (leavesState) {
-	  if (_debug)
-	    std::cout << "      > Calling state enter callbacks.." << std::endl;
-	  _states[_curState].callEnterCallbacks();
-	}
-      }
-      t++;
-    }
-    a++;
+  if (leavesState) {
+    if (_debug)
+      std::cout << "      > Calling state enter callbacks.." << std::endl;
+    _states[_curState].callEnterCallbacks();
   }
 }
 
@@ -316,11 +312,47 @@ Fsa::jumpToState(const std::string &toState)
       if (i != _curState) {
 	_states[_curState].callExitCallbacks();
 	_states[i].callEnterCallbacks();	  
+	_curState = i;
+	notifyObservers();
       }
-      _curState = i;
       return true;
     }
   }
   return false;
 }
 
+void
+Fsa::getCurrentTriggers(Array<EventNameID> &names, bool wildcards[FsaState::NUM_WILDCARDS])
+{
+  if (_states.size() == 0) {
+    names.fastClear();
+    for (int w=0;w<FsaState::NUM_WILDCARDS;w++) {
+      wildcards[w] = false;
+    }
+    return;
+  }
+  _states[_curState].getTriggers(names, wildcards);
+}
+
+void
+Fsa::addObserver(FsaObserver *observer)
+{
+  _observers.append(observer);
+}
+
+void
+Fsa::removeObserver(FsaObserver *observer)
+{
+  int i = _observers.findIndex(observer);
+  if (i >= 0) {
+    _observers.remove(i);
+  }
+}
+
+void
+Fsa::notifyObservers()
+{
+  for (int i=0;i<_observers.size();i++) {
+    _observers[i]->fsaTriggersChanged(this);
+  }
+}
@@ -5,6 +5,21 @@
 
 using namespace G3D;
 
+
+namespace {
+
+/// The earlier of two arc indices where -1 means none
+inline int
+firstArc(int a, int b)
+{
+  if (a < 0) {
+    return b;
+  }
+  return ((b >= 0) && (b < a)) ? b : a;
+}
+
+} // end namespace
+
 FsaArc::FsaArc(const std::string &arcName, 
 	       const int &toState, 
 	       const Array<std::string> &triggerEvents)
@@ -12,6 +27,11 @@ FsaArc::FsaArc(const std::string &arcName,
   _name = arcName;
   _to = toState;
   _triggers = triggerEvents;
+  // Interned now rather than when the state is indexed, so that an event
+  // named after a trigger always has an id by the time it is dispatched
+  for (int i=0;i<_triggers.size();i++) {
+    _triggerIDs.append(EventNames::intern(_triggers[i]));
+  }
 }
 
 FsaArc::FsaArc()
@@ -42,11 +62,13 @@ FsaArc::callCallbacks(MinVR::EventRef event)
 FsaState::FsaState(const std::string &stateName)
 {
   _name = stateName;
+  _indexed = false;
 }
 
 FsaState::FsaState()
 {
   _name = "default_state";
+  _indexed = false;
 }
 
 FsaState::~FsaState()
@@ -57,6 +79,101 @@ void
 FsaState::addArcRef(FsaArcRef a)
 {
   _arcs.append(a);
+  _indexed = false;
+}
+
+void
+FsaState::buildTriggerIndex()
+{
+  // Later arcs never replace earlier ones, the first match wins just as
+  // it does in Fsa::checkTriggerMatch() order
+  _arcByName.clear();
+  _triggerNames.fastClear();
+  for (int w=0;w<NUM_WILDCARDS;w++) {
+    _wildcardArcs[w] = -1;
+  }
+  for (int a=0;a<_arcs.size();a++) {
+    for (int t=0;t<_arcs[a]->getNumTriggers();t++) {
+      std::string trigger = _arcs[a]->getTrigger(t);
+      // A wildcard also matches an event that happens to have its name,
+      // so it goes in both places
+      EventNameID id = _arcs[a]->getTriggerID(t);
+      if (!_arcByName.containsKey(id)) {
+        _arcByName.set(id, a);
+        _triggerNames.append(id);
+      }
+      int w = -1;
+      if (trigger == "ALL") {
+        w = WILDCARD_ALL;
+      }
+      else if (trigger == "ALL_STANDARD") {
+        w = WILDCARD_STANDARD;
+      }
+      else if (trigger == "ALL_1D") {
+        w = WILDCARD_1D;
+      }
+      else if (trigger == "ALL_2D") {
+        w = WILDCARD_2D;
+      }
+      else if (trigger == "ALL_COORDINATEFRAME") {
+        w = WILDCARD_COORDINATEFRAME;
+      }
+      if ((w >= 0) && (_wildcardArcs[w] < 0)) {
+        _wildcardArcs[w] = a;
+      }
+    }
+  }
+  _indexed = true;
+}
+
+int
+FsaState::wildcardForEventType(int eventType)
+{
+  if (eventType == MinVR::VRG3DEvent::EVENTTYPE_STANDARD) {
+    return WILDCARD_STANDARD;
+  }
+  else if (eventType == MinVR::VRG3DEvent::EVENTTYPE_1D) {
+    return WILDCARD_1D;
+  }
+  else if (eventType == MinVR::VRG3DEvent::EVENTTYPE_2D) {
+    return WILDCARD_2D;
+  }
+  else if (eventType == MinVR::VRG3DEvent::EVENTTYPE_COORDINATEFRAME) {
+    return WILDCARD_COORDINATEFRAME;
+  }
+  return -1;
+}
+
+int
+FsaState::findArc(EventNameID nameID, int eventType)
+{
+  if (!_indexed) {
+    buildTriggerIndex();
+  }
+
+  int arc = _wildcardArcs[WILDCARD_ALL];
+  int w = wildcardForEventType(eventType);
+  if (w >= 0) {
+    arc = firstArc(arc, _wildcardArcs[w]);
+  }
+
+  int named;
+  if ((nameID >= 0) && _arcByName.get(nameID, named)) {
+    arc = firstArc(arc, named);
+  }
+  return arc;
+}
+
+void
+FsaState::getTriggers(Array<EventNameID> &names, bool wildcards[NUM_WILDCARDS])
+{
+  if (!_indexed) {
+    buildTriggerIndex();
+  }
+  names = _triggerNames;
+  for (int w=0;w<NUM_WILDCARDS;w++) {
+    wildcards[w] = (_wildcardArcs[w] >= 0);
+  }
 }
 
 void
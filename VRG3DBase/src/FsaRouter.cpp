@@ -0,0 +1,301 @@
+#include "../include/FsaRouter.H"
+#include <climits>
+
+using namespace G3D;
+
+
+namespace {
+
+void
+insertSorted(Array<int> &a, int value)
+{
+  int i = a.size();
+  a.append(value);
+  while ((i > 0) && (a[i-1] > value)) {
+    a[i] = a[i-1];
+    i--;
+  }
+  a[i] = value;
+}
+
+void
+removeSorted(Array<int> &a, int value)
+{
+  int i = a.findIndex(value);
+  if (i >= 0) {
+    a.remove(i);
+  }
+}
+
+/// Merges up to three ascending lists into out, without duplicates
+void
+mergeSlots(const Array<int> *lists[3], int numLists, Array<int> &out)
+{
+  out.fastClear();
+  int pos[3] = {0, 0, 0};
+  while (true) {
+    int next = INT_MAX;
+    for (int l=0;l<numLists;l++) {
+      if ((pos[l] < lists[l]->size()) && ((*lists[l])[pos[l]] < next)) {
+        next = (*lists[l])[pos[l]];
+      }
+    }
+    if (next == INT_MAX) {
+      return;
+    }
+    out.append(next);
+    for (int l=0;l<numLists;l++) {
+      if ((pos[l] < lists[l]->size()) && ((*lists[l])[pos[l]] == next)) {
+        pos[l]++;
+      }
+    }
+  }
+}
+
+} // end namespace
+
+
+FsaRouter::FsaRouter()
+{
+  _parallel = false;
+  _depth = 0;
+  _delivering = NULL;
+  _otherChanged = false;
+  _numDelivered = 0;
+  _numSkipped = 0;
+}
+
+FsaRouter::~FsaRouter()
+{
+  for (SlotMap::iterator it=_slotByFsa.begin();it!=_slotByFsa.end();++it) {
+    it->first->removeObserver(this);
+  }
+}
+
+void
+FsaRouter::add(FsaRef fsa)
+{
+  if (_depth > 0) {
+    _pending.append(std::make_pair(fsa, true));
+    return;
+  }
+  // An Fsa added twice gets each event twice, observing it once is enough
+  if (_slotByFsa.find(fsa.pointer()) == _slotByFsa.end()) {
+    fsa->addObserver(this);
+  }
+  int slot = _fsas.size();
+  _fsas.append(fsa);
+  _routes.next();
+  _slotByFsa.insert(std::make_pair(fsa.pointer(), slot));
+  addRoutes(slot);
+}
+
+void
+FsaRouter::remove(FsaRef fsa)
+{
+  if (_depth > 0) {
+    _pending.append(std::make_pair(fsa, false));
+    return;
+  }
+  int slot = _fsas.findIndex(fsa);
+  if (slot < 0) {
+    return;
+  }
+  _fsas.remove(slot);
+  _routes.remove(slot);
+  if (_fsas.findIndex(fsa) < 0) {
+    fsa->removeObserver(this);
+  }
+  // Every later slot moves down one
+  rebuildRoutes();
+}
+
+bool
+FsaRouter::contains(Fsa *fsa) const
+{
+  int count = (int)_slotByFsa.count(fsa);
+  for (int i=0;i<_pending.size();i++) {
+    if (_pending[i].first.pointer() == fsa) {
+      count += _pending[i].second ? 1 : ((count > 0) ? -1 : 0);
+    }
+  }
+  return count > 0;
+}
+
+void
+FsaRouter::addRoutes(int slot)
+{
+  Route &route = _routes[slot];
+  _fsas[slot]->getCurrentTriggers(route.names, route.wildcards);
+  for (int i=0;i<route.names.size();i++) {
+    insertSorted(_slotsByName[route.names[i]], slot);
+  }
+  for (int w=0;w<FsaState::NUM_WILDCARDS;w++) {
+    if (route.wildcards[w]) {
+      insertSorted(_slotsByWildcard[w], slot);
+    }
+  }
+}
+
+void
+FsaRouter::removeRoutes(int slot)
+{
+  Route &route = _routes[slot];
+  for (int i=0;i<route.names.size();i++) {
+    removeSorted(_slotsByName[route.names[i]], slot);
+  }
+  for (int w=0;w<FsaState::NUM_WILDCARDS;w++) {
+    if (route.wildcards[w]) {
+      removeSorted(_slotsByWildcard[w], slot);
+    }
+  }
+}
+
+void
+FsaRouter::rebuildRoutes()
+{
+  _slotByFsa.clear();
+  _slotsByName.clear();
+  for (int w=0;w<FsaState::NUM_WILDCARDS;w++) {
+    _slotsByWildcard[w].fastClear();
+  }
+  for (int slot=0;slot<_fsas.size();slot++) {
+    _slotByFsa.insert(std::make_pair(_fsas[slot].pointer(), slot));
+    addRoutes(slot);
+  }
+}
+
+void
+FsaRouter::beginParallel()
+{
+  debugAssert(_depth == 0);
+  _parallel = true;
+}
+
+void
+FsaRouter::endParallel(int64 numDelivered)
+{
+  _parallel = false;
+  for (int slot=0;slot<_fsas.size();slot++) {
+    removeRoutes(slot);
+    addRoutes(slot);
+  }
+  _numDelivered += numDelivered;
+}
+
+void
+FsaRouter::fsaTriggersChanged(Fsa *fsa)
+{
+  if (_parallel) {
+    // Called from the thread running fsa, endParallel() catches up
+    return;
+  }
+  std::pair<SlotMap::iterator, SlotMap::iterator> range = _slotByFsa.equal_range(fsa);
+  if (range.first == range.second) {
+    return;
+  }
+  for (SlotMap::iterator it=range.first;it!=range.second;++it) {
+    removeRoutes(it->second);
+    addRoutes(it->second);
+  }
+
+  // The Fsa taking the event moving on is expected.  Anything else, or
+  // any change inside an event processed from a callback, may make the
+  // targets of the events in progress stale.
+  if ((_depth > 0) && ((fsa != _delivering) || (_depth > 1))) {
+    _otherChanged = true;
+  }
+}
+
+bool
+FsaRouter::deliver(int slot, MinVR::EventRef event, EventNameID nameID)
+{
+  Fsa *outerDelivering = _delivering;
+  bool outerChanged = _otherChanged;
+  _delivering = _fsas[slot].pointer();
+  _otherChanged = false;
+
+  _fsas[slot]->processEvent(event, nameID);
+  _numDelivered++;
+
+  bool changed = _otherChanged;
+  _delivering = outerDelivering;
+  _otherChanged = outerChanged || changed;
+  return changed;
+}
+
+void
+FsaRouter::dispatch(MinVR::EventRef event, EventNameID nameID)
+{
+  const Array<int> *lists[3];
+  int numLists = 0;
+  if (nameID >= 0) {
+    std::unordered_map<EventNameID, Array<int> >::const_iterator it = _slotsByName.find(nameID);
+    if ((it != _slotsByName.end()) && (it->second.size() > 0)) {
+      lists[numLists++] = &it->second;
+    }
+  }
+  if (_slotsByWildcard[FsaState::WILDCARD_ALL].size() > 0) {
+    lists[numLists++] = &_slotsByWildcard[FsaState::WILDCARD_ALL];
+  }
+  int w = FsaState::wildcardForEventType(event->getType());
+  if ((w >= 0) && (_slotsByWildcard[w].size() > 0)) {
+    lists[numLists++] = &_slotsByWildcard[w];
+  }
+  if (numLists == 0) {
+    _numSkipped += _fsas.size();
+    return;
+  }
+
+  if ((int)_targets.size() <= _depth) {
+    _targets.resize(_depth + 1);
+  }
+  Array<int> &targets = _targets[_depth];
+  mergeSlots(lists, numLists, targets);
+
+  _depth++;
+  int numDelivered = 0;
+  for (int i=0;i<targets.size();i++) {
+    int slot = targets[i];
+    numDelivered++;
+    if (deliver(slot, event, nameID)) {
+      // The rest of the targets may be wrong, fall back on giving the
+      // event to every later Fsa
+      for (int s=slot+1;s<_fsas.size();s++) {
+        deliver(s, event, nameID);
+        numDelivered++;
+      }
+      break;
+    }
+  }
+  _numSkipped += _fsas.size() - numDelivered;
+  endDelivery();
+}
+
+void
+FsaRouter::broadcast(MinVR::EventRef event, EventNameID nameID)
+{
+  _depth++;
+  for (int slot=0;slot<_fsas.size();slot++) {
+    deliver(slot, event, nameID);
+  }
+  endDelivery();
+}
+
+void
+FsaRouter::endDelivery()
+{
+  _depth--;
+  if ((_depth == 0) && (_pending.size() > 0)) {
+    Array< std::pair<FsaRef, bool> > pending = _pending;
+    _pending.clear();
+    for (int i=0;i<pending.size();i++) {
+      if (pending[i].second) {
+        add(pending[i].first);
+      }
+      else {
+        remove(pending[i].first);
+      }
+    }
+  }
+}
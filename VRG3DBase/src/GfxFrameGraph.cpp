@@ -0,0 +1,92 @@
+#include "../include/GfxFrameGraph.H"
+
+using namespace G3D;
+
+GfxFrameGraph::GfxFrameGraph()
+{
+  _numOps = 0;
+  _recorded = false;
+  _numRecordings = 0;
+  _numReplays = 0;
+  _data.backgroundRepeat = 1.0;
+  _data.hasAmbientBottomLight = false;
+}
+
+GfxFrameGraph::FrameData&
+GfxFrameGraph::beginRecording()
+{
+  _numOps = 0;
+  _recorded = false;
+  _data.backgroundTex = NULL;
+  _data.backgroundVirtual = false;
+  _data.sky = NULL;
+  _data.lighting = NULL;
+  _data.hasAmbientBottomLight = false;
+  _data.lights.fastClear();
+  return _data;
+}
+
+void
+GfxFrameGraph::record(Op op)
+{
+  debugAssert(_numOps < NUM_OPS);
+  _ops[_numOps++] = op;
+}
+
+void
+GfxFrameGraph::endRecording()
+{
+  _recorded = true;
+  _numRecordings++;
+}
+
+void
+GfxFrameGraph::replay(FrameGraphBackend *backend, const Vector3 &lookVec)
+{
+  debugAssertM(_recorded, "GfxFrameGraph replayed before being recorded");
+  backend->beginView(_data, lookVec);
+  for (int i=0;i<_numOps;i++) {
+    backend->execute(_ops[i], _data, lookVec);
+  }
+  backend->endView(_data);
+  _numReplays++;
+}
+
+
+
+void
+RecordingFrameGraphBackend::reset()
+{
+  _numViews = 0;
+  for (int i=0;i<GfxFrameGraph::NUM_OPS;i++) {
+    _counts[i] = 0;
+  }
+  _log.fastClear();
+}
+
+void
+RecordingFrameGraphBackend::beginView(const GfxFrameGraph::FrameData &data, const Vector3 &lookVec)
+{
+  _numViews++;
+}
+
+void
+RecordingFrameGraphBackend::execute(GfxFrameGraph::Op op, const GfxFrameGraph::FrameData &data,
+                                    const Vector3 &lookVec)
+{
+  _counts[op]++;
+  _log.append(op);
+}
+
+const char*
+RecordingFrameGraphBackend::opName(GfxFrameGraph::Op op)
+{
+  switch (op) {
+  case GfxFrameGraph::OP_BACKGROUND:     return "Background";
+  case GfxFrameGraph::OP_SKY:            return "Sky";
+  case GfxFrameGraph::OP_SURFACES:       return "Surfaces";
+  case GfxFrameGraph::OP_DRAW_CALLBACKS: return "DrawCallbacks";
+  case GfxFrameGraph::OP_LENS_FLARE:     return "LensFlare";
+  default:                               return "Unknown";
+  }
+}
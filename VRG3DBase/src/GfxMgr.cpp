@@ -2,11 +2,43 @@
 #include "../include/GfxMgr.H"
 #include "../include/ConfigVal.H"
 #include "../include/StringUtils.H"
+#include <functional>
+#include <typeinfo>
 
 
 
 using namespace G3D;
 
+/// Loads textures for GfxMgr's TextureResidency the first time they are
+/// used, through the TextureCache when there is one.
+class GfxMgrTextureLoader : public TextureResidencyLoader
+{
+public:
+  GfxMgrTextureLoader(GfxMgr *gfxMgr) : _gfxMgr(gfxMgr) {}
+  virtual ~GfxMgrTextureLoader() {}
+
+  bool load(const TextureLoadRequest &request, TextureRef &tex, size_t &bytes) {
+    DecodedTexture decoded;
+    TextureLoadPipeline::decodeWithCache(request, _gfxMgr->getTextureCache().pointer(),
+                                         &TextureLoadPipeline::decodeImageFiles, decoded);
+    if (!decoded.ok) {
+      // Unlike loading up front, a bad file found mid-session leaves the
+      // texture NULL rather than stopping the program
+      cerr << "GfxMgr texture loading error. " << endl
+        << "  File:\t" << request.filename << endl
+        << "  Reason:\t" << decoded.error << endl;
+      return false;
+    }
+    tex = _gfxMgr->createTexture(decoded);
+    bytes = tex->sizeInMemory();
+    return true;
+  }
+
+private:
+  GfxMgr *_gfxMgr;
+};
+
+
  int GfxMgr::_nextPoseCallbackID = 0;
  int GfxMgr::_nextOneTimePoseCallbackID = 0;
  int GfxMgr::_nextDrawCallbackID = 0;
@@ -18,37 +50,202 @@ GfxMgr::GfxMgr(G3D::RenderDevice *renderDevice, MinVR::ProjectionVRCameraRef cam
   _roomToVirtualScale = 1.0;
   _lighting = Lighting::create();
   _skyLightingParams = SkyParameters(G3D::toSeconds(10, 00, 00, AM));
+  _posedModelsHighWater = 0;
+  _frameNumber = 0;
+  _frameBegun = false;
+  _explicitFrames = false;
+  _frameCullSpheres = NULL;
+  _arrayGrowths = 0;
+  _poseArenaHeapAllocs = 0;
+  _frameStatsCallback = NULL;
+  _frustumCullingEnabled = MinVR::ConfigVal("GfxMgr_FrustumCulling", false, false);
+  _culler.setOcclusionEnabled(MinVR::ConfigVal("GfxMgr_OcclusionCulling", false, false));
+  _culler.setMaxOccluders(MinVR::ConfigVal("GfxMgr_MaxOccluders", 16, false));
+  _backgroundRepeat = MinVR::ConfigVal("BackgroundImageRepeat", 1.0, false);
+  _texLoadPipeline = NULL;
+  _loadProgressCallback = NULL;
+  _atlasMaxSize = MinVR::ConfigVal("GfxMgr_TextureAtlasMaxSize", 0, false);
+  _atlasSize = MinVR::ConfigVal("GfxMgr_TextureAtlasSize", 1024, false);
+  _atlasPadding = MinVR::ConfigVal("GfxMgr_TextureAtlasPadding", 4, false);
+  _textures = new TextureRegistry(new TextureResidency(new GfxMgrTextureLoader(this),
+      (int64)MinVR::ConfigVal("GfxMgr_TextureBudgetMB", 0, false) * 1024 * 1024));
+  _backgroundTexID = _textures->intern("BackgroundImage");
+
+  _profiler = Profiler::getDefault();
+  if (MinVR::ConfigVal("Profiler_Enabled", false, false)) {
+    _profiler->setEnabled(true);
+  }
+  _profileTraceFile = trimWhitespace(MinVR::ConfigVal("Profiler_TraceFile", "", false));
+  if (_profileTraceFile != "") {
+    _profileTraceFile = MinVR::decygifyPath(MinVR::replaceEnvVars(_profileTraceFile));
+    _profiler->setEnabled(true);
+    _profiler->beginTrace();
+  }
+  _poseFrameZone = _profiler->intern("GfxMgr::poseFrame");
+  _drawFrameZone = _profiler->intern("GfxMgr::drawFrame");
+  const char *opNames[GfxFrameGraph::NUM_OPS] = {"Background", "Sky", "Surfaces", "DrawCallbacks", "LensFlare"};
+  for (int i=0;i<GfxFrameGraph::NUM_OPS;i++) {
+    _opZones[i] = _profiler->intern(std::string("GfxMgr::") + opNames[i]);
+  }
+
+  _backgroundVTFrame = -1;
+  _backgroundVTMaxUploads = MinVR::ConfigVal("GfxMgr_VirtualTextureMaxUploads", 16, false);
+  std::string vtFile = trimWhitespace(MinVR::ConfigVal("BackgroundVirtualTexture", "", false));
+  if (vtFile != "") {
+    vtFile = MinVR::decygifyPath(MinVR::replaceEnvVars(vtFile));
+    std::string error;
+    VirtualTextureFileRef file = VirtualTextureFile::open(vtFile, error);
+    alwaysAssertM(file.notNull(), error);
+    setBackgroundVirtualTexture(new VirtualTexture(file,
+        MinVR::ConfigVal("GfxMgr_VirtualTextureCacheTiles", 64, false), WorkerPool::getDefault().pointer()));
+  }
 }
 
 GfxMgr::~GfxMgr()
 {
+  if (_profileTraceFile != "") {
+    // Collect the samples of the last frame
+    _profiler->endFrame();
+    _profiler->endTrace();
+    if (!_profiler->writeChromeTrace(_profileTraceFile)) {
+      cerr << "GfxMgr: Problem writing profiler trace " << _profileTraceFile << endl;
+    }
+  }
+  delete _frameStatsCallback;
+  delete _loadProgressCallback;
+  delete _texLoadPipeline;
 }
 
 
-
-void
-GfxMgr::poseFrame()
+CoordinateFrame
+GfxMgr::computeVirtualToRoomSpace()
 {
   double scale = 1.0/getRoomToVirtualSpaceScale();
   Matrix3 scaleMat(scale,0,0, 0,scale,0, 0,0,scale);
-  CoordinateFrame virtualToRoomSpace = getRoomToVirtualSpaceFrame().inverse() * 
+  return getRoomToVirtualSpaceFrame().inverse() * 
       CoordinateFrame(scaleMat,Vector3::zero());
+}
+
+
+/// Copies the keys of a callback table into a per-frame array without
+/// touching the heap (Table::getKeys() allocates a new Array every call).
+template <class F>
+static void
+getCallbackIDs(const Table<int, F*> &callbacks, FrameArenaArray<int> &ids)
+{
+  ids.fastClear();
+  ids.reserve(callbacks.size());
+  for (typename Table<int, F*>::Iterator it = callbacks.begin(); it != callbacks.end(); ++it) {
+    ids.append(it->key);
+  }
+}
+
+
+void
+GfxMgr::beginFrame()
+{
+  if (_frameBegun) {
+    endFrame();
+  }
+  _frameBegun = true;
+  _explicitFrames = true;
+  _frameGraph.invalidate();
+}
 
-  _posedModels.clear();
+void
+GfxMgr::endFrame()
+{
+  const FrameArena::Stats &arenaStats = _frameArena.getFrameStats();
+  _lastFrameStats.frameNumber     = _frameNumber;
+  _lastFrameStats.arenaHeapAllocs = arenaStats.numHeapAllocs;
+  _lastFrameStats.arenaBytesUsed  = arenaStats.bytesUsed;
+  _lastFrameStats.arrayGrowths    = _arrayGrowths;
+  _lastFrameStats.numPosedModels  = _posedModels.size();
+
+  _frameArena.reset();
+  // reset() may have coalesced an overflowing frame into one new block,
+  // that allocation belongs to the frame that just ended.
+  _lastFrameStats.arenaHeapAllocs = _frameArena.getLastFrameStats().numHeapAllocs +
+    _poseArenaHeapAllocs;
+  _arrayGrowths = 0;
+  _poseArenaHeapAllocs = 0;
+  _frameCullSpheres = NULL;
+
+  _lastCullStats = _frameCullStats;
+  _frameCullStats = SurfaceCuller::Stats();
+
+  if (_frameStatsCallback) {
+    _frameStatsCallback->exec(_lastFrameStats);
+  }
+  _frameNumber++;
+  _textures->getResidency()->setFrameNumber(_frameNumber);
+  _profiler->endFrame();
+  _frameBegun = false;
+}
+
+ProfileZoneID
+GfxMgr::callbackZone(Table<int, ProfileZoneID> &zones, const char *kind, int id)
+{
+  ProfileZoneID zone;
+  if (!zones.get(id, zone)) {
+    zone = _profiler->intern(G3D::format("%s %d", kind, id));
+    zones.set(id, zone);
+  }
+  return zone;
+}
+
+
+void
+GfxMgr::poseFrame()
+{
+  if (!_explicitFrames) {
+    endFrame();
+  }
+  ProfileScope scope(_profiler.pointer(), _poseFrameZone);
+
+  CoordinateFrame virtualToRoomSpace = computeVirtualToRoomSpace();
+
+  // The new poses need a new recording
+  _frameGraph.invalidate();
+
+  // fastClear() keeps the array's storage around from frame to frame
+  _posedModels.fastClear();
+  _occluders.fastClear();
+  _frameCullSpheres = NULL;
+  // What the old poses kept in the pose arena goes with them.  Its heap
+  // allocations were counted at the end of the last poseFrame(), except
+  // the one reset() makes when it coalesces the blocks.
+  int poseArenaHeapAllocs = _poseArena.getFrameStats().numHeapAllocs;
+  _poseArena.reset();
+  _poseArenaHeapAllocs += _poseArena.getLastFrameStats().numHeapAllocs - poseArenaHeapAllocs;
+
+  FrameArenaArray<int> ids(_frameArena);
 
   if (_oneTimePoseCallbacks.size()) {
-    Array<int> ids1 = _oneTimePoseCallbacks.getKeys();
-    for (int i=0;i<ids1.size();i++) {
-      _oneTimePoseCallbacks[ids1[i]]->exec(_posedModels, virtualToRoomSpace);
-      delete _oneTimePoseCallbacks[ids1[i]];
+    getCallbackIDs(_oneTimePoseCallbacks, ids);
+    for (int i=0;i<ids.size();i++) {
+      ProfileScope callbackScope(_profiler.pointer(), callbackZone(_poseCallbackZones, "OneTimePoseCallback", ids[i]));
+      _oneTimePoseCallbacks[ids[i]]->exec(_posedModels, virtualToRoomSpace);
+      delete _oneTimePoseCallbacks[ids[i]];
     }
     _oneTimePoseCallbacks.clear();
   }  
 
-  Array<int> ids2 = _poseCallbacks.getKeys();
-  for (int i=0;i<ids2.size();i++) {
-    _poseCallbacks[ids2[i]]->exec(_posedModels, virtualToRoomSpace);
+  getCallbackIDs(_poseCallbacks, ids);
+  for (int i=0;i<ids.size();i++) {
+    PoseMethodFunctor *f = NULL;
+    // the callback may have been removed by one called earlier this frame
+    if (_poseCallbacks.get(ids[i], f)) {
+      ProfileScope callbackScope(_profiler.pointer(), callbackZone(_poseCallbackZones, "PoseCallback", ids[i]));
+      f->exec(_posedModels, virtualToRoomSpace);
+    }
+  }
+
+  if (_posedModels.size() > _posedModelsHighWater) {
+    _posedModelsHighWater = _posedModels.size();
+    _arrayGrowths++;
   }
+  _poseArenaHeapAllocs += _poseArena.getFrameStats().numHeapAllocs;
 }
 
 
@@ -56,6 +253,7 @@ void
 GfxMgr::drawFrame(Vector3 lookVec)
 {
   debugAssertGLOk();
+  ProfileScope scope(_profiler.pointer(), _drawFrameZone);
 
   // TODO: check to make sure RESCALE_NORMAL is supported before using it - it isn't on
   // my tablet
@@ -63,109 +261,343 @@ GfxMgr::drawFrame(Vector3 lookVec)
 
   glEnable(GL_NORMALIZE);
 
-  TextureRef bgTex = getTexture("BackgroundImage");
-  if (bgTex.notNull()) {
+  // The view-independent part of the frame is worked out once, the first
+  // time drawFrame is called for this frame, and then replayed for each eye.
+  if (!_frameGraph.isRecorded()) {
+    recordFrameGraph();
+  }
+  // Tiles are streamed once per rendered frame, for the first eye
+  if (_backgroundVT.notNull() && (_backgroundVTFrame != _frameNumber)) {
+    updateBackgroundVirtualTexture();
+  }
+  _frameGraph.replay(this, lookVec);
+
+  debugAssertGLOk();
+}
+
+void
+GfxMgr::replayFrame(FrameGraphBackend *backend, const Vector3 &lookVec)
+{
+  if (!_frameGraph.isRecorded()) {
+    recordFrameGraph();
+  }
+  _frameGraph.replay(backend, lookVec);
+}
+
+void
+GfxMgr::setBackgroundVirtualTexture(VirtualTextureRef vt)
+{
+  _backgroundVT = vt;
+  _backgroundVTCache = NULL;
+  _backgroundVTFrame = -1;
+  _backgroundVTDrawTiles.clear();
+  if (vt.notNull()) {
+    setBackgroundVirtualTextureView(0, 0, vt->info().width, vt->info().height);
+    VirtualTexture *v = vt.pointer();
+    vt->setUploadFunc([this, v](int slot, const uint8 *texels) {
+      const VirtualTextureInfo &vi = v->info();
+      int p = vi.paddedTileSize();
+      glBindTexture(_backgroundVTCache->openGLTextureTarget(), _backgroundVTCache->openGLID());
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      glTexSubImage2D(_backgroundVTCache->openGLTextureTarget(), 0,
+                      (slot % v->slotsPerRow()) * p, (slot / v->slotsPerRow()) * p, p, p,
+                      (vi.channels == 4) ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, texels);
+      glBindTexture(_backgroundVTCache->openGLTextureTarget(), 0);
+    });
+  }
+  _frameGraph.invalidate();
+}
+
+void
+GfxMgr::setBackgroundVirtualTextureView(double x0, double y0, double x1, double y1)
+{
+  _backgroundVTView.x0 = x0;
+  _backgroundVTView.y0 = y0;
+  _backgroundVTView.x1 = x1;
+  _backgroundVTView.y1 = y1;
+}
+
+void
+GfxMgr::updateBackgroundVirtualTexture()
+{
+  if (_backgroundVTCache.isNull()) {
+    const VirtualTextureInfo &vi = _backgroundVT->info();
+    Texture::Settings settings;
+    settings.interpolateMode = Texture::BILINEAR_NO_MIPMAP;
+    settings.wrapMode = WrapMode::CLAMP;
+    settings.autoMipMap = false;
+    int size = _backgroundVT->cacheTextureSize();
+    _backgroundVTCache = Texture::createEmpty("BackgroundVirtualTextureCache", size, size,
+        (vi.channels == 4) ? TextureFormat::RGBA8() : TextureFormat::RGB8(),
+        Texture::DIM_2D_NPOT, settings);
+    alwaysAssertM(_backgroundVTCache.notNull(), "Problem creating the virtual texture cache");
+  }
+
+  _backgroundVTView.screenWidth = _renderDevice->width();
+  _backgroundVTView.screenHeight = _renderDevice->height();
+  _backgroundVT->update(_backgroundVTView, _frameNumber, _backgroundVTMaxUploads);
+  _backgroundVTDrawTiles.fastClear();
+  _backgroundVT->getDrawTiles(_backgroundVTView, _backgroundVTDrawTiles);
+  _backgroundVTFrame = _frameNumber;
+}
+
+void
+GfxMgr::drawBackgroundVirtualTexture()
+{
+  const VirtualTextureView &view = _backgroundVTView;
+  double sx = _renderDevice->width() / (view.x1 - view.x0);
+  double sy = _renderDevice->height() / (view.y1 - view.y0);
+
+  _renderDevice->pushState();
+  _renderDevice->setDepthWrite(false);
+  _renderDevice->disableLighting();
+  _renderDevice->setTexture(0, _backgroundVTCache);
+  _renderDevice->push2D();
+  _renderDevice->beginPrimitive(PrimitiveType::QUADS);
+  for (int i=0;i<_backgroundVTDrawTiles.size();i++) {
+    const VirtualTexture::DrawTile &t = _backgroundVTDrawTiles[i];
+    Vector2 p0((t.x0 - view.x0) * sx, (t.y0 - view.y0) * sy);
+    Vector2 p1((t.x1 - view.x0) * sx, (t.y1 - view.y0) * sy);
+    _renderDevice->setTexCoord(0, Vector2(t.u0, t.v0));
+    _renderDevice->sendVertex(Vector2(p0.x, p0.y));
+    _renderDevice->setTexCoord(0, Vector2(t.u0, t.v1));
+    _renderDevice->sendVertex(Vector2(p0.x, p1.y));
+    _renderDevice->setTexCoord(0, Vector2(t.u1, t.v1));
+    _renderDevice->sendVertex(Vector2(p1.x, p1.y));
+    _renderDevice->setTexCoord(0, Vector2(t.u1, t.v0));
+    _renderDevice->sendVertex(Vector2(p1.x, p0.y));
+  }
+  _renderDevice->endPrimitive();
+  _renderDevice->pop2D();
+  _renderDevice->popState();
+}
+
+void
+GfxMgr::recordFrameGraph()
+{
+  GfxFrameGraph::FrameData &data = _frameGraph.beginRecording();
+
+  data.backgroundTex = _textures->get(_backgroundTexID);
+  data.backgroundRepeat = _backgroundRepeat;
+  data.backgroundVirtual = _backgroundVT.notNull();
+  data.sky = _sky;
+  data.skyParams = _skyLightingParams;
+  data.lighting = _lighting;
+  data.virtualToRoomSpace = computeVirtualToRoomSpace();
+
+  // Setup lights based on Lighting parameters
+  data.ambient = _lighting->ambientTop;
+  if (_lighting->ambientBottom != _lighting->ambientTop) {
+    data.hasAmbientBottomLight = true;
+    data.ambientBottomLight = GLight::directional(-Vector3::unitY(), 
+        _lighting->ambientBottom - _lighting->ambientTop, false);
+  }
+  for (int L = 0; L < iMin(8, _lighting->lightArray.size()); ++L) {
+    data.lights.append(_lighting->lightArray[L]);
+  }
+
+  // Snapshot the draw callbacks for this frame.  This is kept outside of
+  // the frame arena since the graph may be re-recorded several times
+  // between calls to poseFrame().
+  _frameDrawCallbackIDs.fastClear();
+  for (Table<int, DrawMethodFunctor*>::Iterator it = _drawCallbacks.begin(); it != _drawCallbacks.end(); ++it) {
+    _frameDrawCallbackIDs.append(it->key);
+  }
+
+  // Only record the passes that have something to do
+  if (data.backgroundTex.notNull() || data.backgroundVirtual) {
+    _frameGraph.record(GfxFrameGraph::OP_BACKGROUND);
+  }
+  if (data.sky.notNull()) {
+    _frameGraph.record(GfxFrameGraph::OP_SKY);
+  }
+  if (_posedModels.size()) {
+    _frameGraph.record(GfxFrameGraph::OP_SURFACES);
+  }
+  if (_frameDrawCallbackIDs.size()) {
+    _frameGraph.record(GfxFrameGraph::OP_DRAW_CALLBACKS);
+  }
+  if (data.sky.notNull()) {
+    _frameGraph.record(GfxFrameGraph::OP_LENS_FLARE);
+  }
+
+  _frameGraph.endRecording();
+}
+
+void
+GfxMgr::execute(GfxFrameGraph::Op op, const GfxFrameGraph::FrameData &data, const Vector3 &lookVec)
+{
+  ProfileScope scope(_profiler.pointer(), _opZones[op]);
+  switch (op) {
+
+  case GfxFrameGraph::OP_BACKGROUND: {
+    if (data.backgroundVirtual) {
+      drawBackgroundVirtualTexture();
+      break;
+    }
     _renderDevice->pushState();
     _renderDevice->setDepthWrite(false);
     _renderDevice->disableLighting();
-    _renderDevice->setTexture(0, bgTex);
+    _renderDevice->setTexture(0, data.backgroundTex);
     _renderDevice->setBlendFunc(RenderDevice::BLEND_SRC_ALPHA, RenderDevice::BLEND_ONE_MINUS_SRC_ALPHA);
     _renderDevice->push2D();
     Rect2D r(Rect2D::xywh(0, 0, _renderDevice->width(), _renderDevice->height()));
-    double scale = MinVR::ConfigVal("BackgroundImageRepeat", 1.0);
+    double scale = data.backgroundRepeat;
     Draw::rect2D(r, _renderDevice, Color3::white(), Rect2D::xywh(0, 0, scale, scale));
     _renderDevice->pop2D();
     _renderDevice->popState();
+    break;
   }
 
-
-  LightingRef lighting = _lighting;
-  SkyParameters skyParams = _skyLightingParams;
-
-  if (_sky.notNull()) {
+  case GfxFrameGraph::OP_SKY:
     _renderDevice->pushState();
     _renderDevice->setAmbientLightColor(Color3::white());
-    _sky->render(_renderDevice, skyParams);
+    data.sky->render(_renderDevice, data.skyParams);
     _renderDevice->popState();
-  }
+    break;
 
-  // Rendering of PosedModels via typical G3D style
-  // TODO: Add shadowed rendering
-  if (_posedModels.size()) {
+  case GfxFrameGraph::OP_SURFACES: {
+    // Rendering of PosedModels via typical G3D style
+    // TODO: Add shadowed rendering
     _renderDevice->pushState();
     _renderDevice->setAmbientLightColor(Color3(0.25, 0.25, 0.25));
 
-	for (int m = 0; m < _posedModels.size(); ++m) {
-      _posedModels[m]->renderNonShadowed(_renderDevice, lighting);
-    }
-
-	/*
+    // Culling and sorting depend on the eye, so they are redone per view.
+    // Opaque surfaces are drawn first, grouped by state and front-to-back,
+    // then transparent surfaces back-to-front.
     // TODO: This lookVec isn't always correct
-    Array<Surface::Ref> opaque, transparent;
-    Surface::sortFrontToBack(_posedModels, lookVec);
+    RenderQueue queue;
+    buildRenderQueue(getCameraCullView(), lookVec, queue);
 
     debugAssertGLOk();
-    // Opaque unshadowed
-    for (int m = 0; m < opaque.size(); ++m) {
-      opaque[m]->renderNonShadowed(_renderDevice, lighting);
+    for (int i = 0; i < queue.size(); ++i) {
+      _posedModels[queue[i].index]->renderNonShadowed(_renderDevice, data.lighting);
     }
-
     debugAssertGLOk();
-    // Transparent unshadowed
-    for (int m = 0; m < transparent.size(); ++m) {
-      transparent[m]->renderNonShadowed(_renderDevice, lighting);
-    }
 
-    debugAssertGLOk();
-	*/
     _renderDevice->popState();
+    break;
   }
 
-
-
-  Array<int> ids = _drawCallbacks.getKeys();
-  if (ids.size()) {
+  case GfxFrameGraph::OP_DRAW_CALLBACKS:
     _renderDevice->pushState();
- 
-    // Setup lights based on Lighting parameters
     _renderDevice->enableLighting();
-    // Ambient
-    _renderDevice->setAmbientLightColor(lighting->ambientTop);
-    if (lighting->ambientBottom != lighting->ambientTop) {
-      _renderDevice->setLight(0, GLight::directional(-Vector3::unitY(), 
-            lighting->ambientBottom - lighting->ambientTop, false)); 
+    _renderDevice->setAmbientLightColor(data.ambient);
+    if (data.hasAmbientBottomLight) {
+      _renderDevice->setLight(0, data.ambientBottomLight);
     }
-          
-    // Lights
-    for (int L = 0; L < iMin(8, _lighting->lightArray.size()); ++L) {
-      _renderDevice->setLight(L + 1, lighting->lightArray[L]);
+    for (int L = 0; L < data.lights.size(); ++L) {
+      _renderDevice->setLight(L + 1, data.lights[L]);
     }
 
-    // Compute virtualToRoom transformation
-    double scale = 1.0/getRoomToVirtualSpaceScale();
-    Matrix3 scaleMat(scale,0,0, 0,scale,0, 0,0,scale);
-    CoordinateFrame virtualToRoomSpace = getRoomToVirtualSpaceFrame().inverse() * 
-        CoordinateFrame(scaleMat,Vector3::zero());
-
-    // Call draw callbacks
-    for (int i=0;i<ids.size();i++) {
-      _drawCallbacks[ids[i]]->exec(_renderDevice, virtualToRoomSpace);
+    for (int i=0;i<_frameDrawCallbackIDs.size();i++) {
+      DrawMethodFunctor *f = NULL;
+      if (_drawCallbacks.get(_frameDrawCallbackIDs[i], f)) {
+        ProfileScope callbackScope(_profiler.pointer(),
+                                   callbackZone(_drawCallbackZones, "DrawCallback", _frameDrawCallbackIDs[i]));
+        _drawCommandCache.exec(_frameDrawCallbackIDs[i], f, _renderDevice, data.virtualToRoomSpace);
+      }
     }
 
     _renderDevice->popState();
-  }
+    break;
 
-  
-  if (_sky.notNull()) {
+  case GfxFrameGraph::OP_LENS_FLARE:
     _renderDevice->pushState();
     _renderDevice->setAmbientLightColor(Color3::white());
-    _sky->renderLensFlare(_renderDevice, skyParams);
+    data.sky->renderLensFlare(_renderDevice, data.skyParams);
     _renderDevice->popState();
+    break;
+
+  default:
+    break;
   }
+}
 
-  debugAssertGLOk();
+uint32
+GfxMgr::surfaceStateKey(const Surface::Ref &surface)
+{
+  // Generic Surfaces don't expose their material, but surfaces of the same
+  // concrete class render through the same code path and usually share
+  // shaders and state, so use the class as a proxy for the material.
+  size_t h = typeid(*surface.pointer()).hash_code();
+  return (uint32)(h ^ (h >> 24) ^ (h >> 48));
+}
+
+void
+GfxMgr::buildRenderQueue(const CullView &view, const Vector3 &lookVec, RenderQueue &queue)
+{
+  fillRenderQueue(queue, cullPosedModels(view), view.eye, lookVec);
+}
+
+CullView
+GfxMgr::getCameraCullView()
+{
+  CullView view;
+  view.eye      = _camera->getCameraPos();
+  view.topLeft  = _camera->tile.topLeft;
+  view.topRight = _camera->tile.topRight;
+  view.botLeft  = _camera->tile.botLeft;
+  view.botRight = _camera->tile.botRight;
+  view.nearClip = _camera->tile.nearClip;
+  view.farClip  = _camera->tile.farClip;
+  return view;
+}
+
+uint8*
+GfxMgr::cullPosedModels(const CullView &view)
+{
+  int n = _posedModels.size();
+  uint8 *visible = _frameArena.allocArray<uint8>(n);
+
+  if (!_frustumCullingEnabled) {
+    memset(visible, 1, n);
+    SurfaceCuller::Stats stats;
+    stats.numTested = n;
+    stats.numVisible = n;
+    _frameCullStats.add(stats);
+    return visible;
+  }
+
+  _culler.cull(view, getFrameCullSpheres(), n, _occluders, visible, WorkerPool::getDefault().pointer());
+  _frameCullStats.add(_culler.getStats());
+  return visible;
+}
+
+const CullSphere*
+GfxMgr::getFrameCullSpheres()
+{
+  if (_frameCullSpheres == NULL) {
+    int n = _posedModels.size();
+    _frameCullSpheres = _frameArena.allocArray<CullSphere>(n);
+    for (int m = 0; m < n; ++m) {
+      Sphere bounds;
+      _posedModels[m]->getWorldSpaceBoundingSphere(bounds);
+      _frameCullSpheres[m].center = bounds.center;
+      _frameCullSpheres[m].radius = bounds.radius;
+    }
+  }
+  return _frameCullSpheres;
 }
 
+void
+GfxMgr::fillRenderQueue(RenderQueue &queue, const uint8 *visible, const Vector3 &eyePos, const Vector3 &lookVec)
+{
+  queue.begin(_frameArena, _posedModels.size());
+  const CullSphere *spheres = getFrameCullSpheres();
+  Vector3 look = lookVec.direction();
+  for (int m = 0; m < _posedModels.size(); ++m) {
+    if (!visible[m]) {
+      continue;
+    }
+    const Surface::Ref &surface = _posedModels[m];
+    float depth = (spheres[m].center - eyePos).dot(look);
+    queue.add(m, surfaceStateKey(surface), depth, surface->hasTransparency());
+  }
+  queue.sort();
+}
+
+
 float 
 GfxMgr::secPerFrame()
 {
@@ -192,167 +624,161 @@ GfxMgr::drawStats(bool showFrameRate, bool showTriRate, bool showTrisPerFrame)
   _renderDevice->pop2D();
 }
 
+void
+GfxMgr::drawProfile(int maxZones)
+{
+  Array<ProfileZoneStats> stats;
+  _profiler->getAllStats(stats);
+
+  _renderDevice->push2D();
+  GFontRef font = getDefaultFont();
+  Vector2 pos(5, 25);
+  font->draw2D(_renderDevice, format("%-32s %8s %8s %8s %7s", "zone", "ms", "min", "max", "calls"),
+               pos, 10, Color3(0.61,0.72,0.92), Color4::clear());
+  for (int i=0;i<iMin(maxZones, stats.size());i++) {
+    pos.y += 14;
+    const ProfileZoneStats &z = stats[i];
+    font->draw2D(_renderDevice, format("%-32s %8.3f %8.3f %8.3f %7.1f", z.name.c_str(), z.meanMs,
+                                       z.minMs, z.maxMs, z.callsPerFrame),
+                 pos, 10, Color3(0.61,0.72,0.92), Color4::clear());
+  }
+  _renderDevice->pop2D();
+}
+
 
 
 /***  Begin Texture Management Routines   ***/
 
-TextureRef
+TextureHandle
 GfxMgr::getTexture(const std::string &keyName)
 {
-  if (_texMap.containsKey(keyName))
-    return _texMap[keyName];
+  TextureID id = _textures->find(keyName);
+  if (_textures->isBound(id))
+    return TextureHandle(_textures, id);
   else
-    return NULL;
+    return TextureHandle();
+}
+
+TextureHandle
+GfxMgr::getTexture(TextureID id)
+{
+  return TextureHandle(_textures, id);
+}
+
+TextureID
+GfxMgr::getTextureID(const std::string &keyName)
+{
+  return _textures->intern(keyName);
 }
 
 Array<TextureRef> 
 GfxMgr::getTextures(const Array<std::string> &keyNames)
 {
   Array<TextureRef> ta;
+  getTextures(keyNames, ta);
+  return ta;
+}
+
+void
+GfxMgr::getTextures(const Array<std::string> &keyNames, Array<TextureRef> &textures)
+{
+  textures.resize(keyNames.size(), false);
   for (int i=0;i<keyNames.size();i++) {
-    ta.append(getTexture(keyNames[i]));
+    textures[i] = _textures->get(_textures->find(keyNames[i]));
   }
-  return ta;
+}
+
+void
+GfxMgr::getTextures(const TextureID *ids, int n, TextureRef *textures)
+{
+  _textures->get(ids, n, textures);
+}
+
+void
+GfxMgr::setTextureSlot(const std::string &keyName, int slot)
+{
+  _textures->bind(_textures->intern(keyName), slot);
+  _frameGraph.invalidate();
 }
 
 void
 GfxMgr::setTextureEntry(const std::string &keyName, TextureRef tex)
 {
-  _texMap.set(keyName, tex);
+  setTextureSlot(keyName, _textures->getResidency()->addPinned(tex));
 }
 
 void
 GfxMgr::removeTextureEntry(const std::string &keyName)
 {
-  _texMap.remove(keyName);
+  TextureID id = _textures->find(keyName);
+  if (id >= 0) {
+    _textures->bind(id, -1);
+  }
+  _frameGraph.invalidate();
 }
 
 
 std::string
 GfxMgr::lookupTextureKeyName(TextureRef tex)
 {
-  Array<std::string> keys = _texMap.getKeys();
-  for (int i=0;i<keys.size();i++)
-    if (_texMap[keys[i]] == tex)
-      return keys[i];
+  // Textures that aren't resident can't be the one we're looking for
+  TextureID id = _textures->findTexture(tex);
+  if (id >= 0)
+    return _textures->keyName(id);
   return std::string("");
 }
 
 Array<std::string>
 GfxMgr::getAllTextureKeys()
 {
-  return _texMap.getKeys();
+  Array<std::string> keys;
+  _textures->getBoundKeyNames(keys);
+  return keys;
 }
 
 void
 GfxMgr::loadTexturesFromConfigVal(const std::string &configName, Log*log)
 {
-  Array<std::string> newTexKeys;
-
-  std::string in = MinVR::ConfigVal(configName,"");
-
-  while (in.size()) {
-    std::string               filename;
-    std::string               alphafilename;
-    std::string               keyname;
-    std::string               format("AUTO");
-    std::string               token;
-    WrapMode                  wrap   = WrapMode::TILE;
-    Texture::InterpolateMode  interp = Texture::TRILINEAR_MIPMAP;
-    Texture::Dimension        dim    = Texture::DIM_2D_NPOT;
-    double                    bright = 1.0;
-
-    int semicolonpos = in.find(";");
-    alwaysAssertM(semicolonpos >= 0, "Expected a ; to signal the end of "
-      "each texture in the LoadTextures ConfigVal.");
-
-    int commapos = in.find(",");
-    bool hasalpha = ((commapos >= 0) && (commapos <= semicolonpos));
-
-    if (!popNextToken(in, filename, true))
-      alwaysAssertM(false, "Expected filename while loading texture from ConfigVal");
-
-    if (hasalpha) {
-      // remove the , separating the filename from the alphafilename
-      in = in.substr(1);
-      if (!popNextToken(in, alphafilename, true))
-        alwaysAssertM(false, "TexMgr expected filename for alpha channel while loading texture from ConfigVal");
-      // assume format of RGBA8 if alpha is specified, AUTO doesn't seem to work by default.
-      format = std::string("RGBA8");
+  beginLoadingTexturesFromConfigVal(configName, log);
+  while (!updateTextureLoading(-1, true)) {
+  }
+}
+
+void
+GfxMgr::beginLoadingTexturesFromConfigVal(const std::string &configName, Log *log)
+{
+  alwaysAssertM(_texLoadPipeline == NULL, "Textures are already being loaded");
+
+  Array<TextureLoadRequest> requests;
+  std::string textureList = trimWhitespace(MinVR::ConfigVal(configName,""));
+  if (TextureManifest::isBinaryManifestName(textureList)) {
+    std::string error;
+    if (!TextureManifest::readBinary(MinVR::decygifyPath(MinVR::replaceEnvVars(textureList)), requests, error)) {
+      alwaysAssertM(false, error);
     }
+  }
+  else {
+    parseTextureList(textureList, requests);
+  }
 
-    if (!popNextToken(in, keyname, true))
-      alwaysAssertM(false, "TexMgr expected keyname while loading texture from ConfigVal");
-
-    // check for optional param TextureFormat
-    if (popNextToken(in, format, true)) {
-      // check for optional param WrapMode
-      if (popNextToken(in, token, true)) {
-        if (token == "TILE")
-          wrap = WrapMode::TILE;
-        else if (token == "CLAMP")
-          wrap = WrapMode::CLAMP;
-        else if (token == "IGNORE")
-          wrap = WrapMode::IGNORE;
-        else if (token == "ZERO")
-          wrap = WrapMode::ZERO;
-        else if (token == "ERROR")
-          wrap = WrapMode::ERROR;
-        else 
-          alwaysAssertM(false, "Invalid wrap mode while loading texture from ConfigVal: " + token);
-
-        // check for optional param InterpolateMode
-        if (popNextToken(in, token, true)) {
-	  if (token == "TRILINEAR_MIPMAP")
-	    interp = Texture::TRILINEAR_MIPMAP;
-	  else if (token == "BILINEAR_MIPMAP")
-	    interp = Texture::BILINEAR_MIPMAP;
-	  else if (token == "NEAREST_MIPMAP")
-	    interp = Texture::NEAREST_MIPMAP;
-	  else if (token == "BILINEAR_NO_MIPMAP")
-	    interp = Texture::BILINEAR_NO_MIPMAP;
-	  else if (token == "NEAREST_NO_MIPMAP")
-	    interp = Texture::NEAREST_NO_MIPMAP;
-	  else
-            alwaysAssertM(false, "Invalid interpolation mode for texture while loading from ConfigVal: " + token);
-
-          // check for optional param Dimension
-          if (popNextToken(in, token, true)) {
-            if (token == "DIM_2D")
-              dim = Texture::DIM_2D;
-            else if (token == "DIM_2D_RECT")
-              dim = Texture::DIM_2D_RECT;
-            else if (token == "DIM_CUBE_MAP")
-              dim = Texture::DIM_CUBE_MAP;
-            else
-              alwaysAssertM(false, "Invalid dimension while loading texture from ConfigVal: " + token);
-
-            // check for optional param Brightness
-            if (popNextToken(in, token, true)) {
-              std::istringstream istr(token.c_str());
-              istr >> bright;
-            } // end brightness
-
-          } // end dimension
-        } // end interpolate mode
-      } // end wrap mode
-    } // end format
-
-
-    filename = MinVR::decygifyPath(MinVR::replaceEnvVars(filename));
-    alphafilename = MinVR::decygifyPath(MinVR::replaceEnvVars(alphafilename));
-
-    if (!FileSystem::exists(filename))
-      alwaysAssertM(false, "Texture file does not exist: " + filename);
-    if ((hasalpha) && (!FileSystem::exists(alphafilename)))
-      alwaysAssertM(false, "Texture file does not exist: " + alphafilename);
+  for (int i=0;i<requests.size();i++) {
+    TextureLoadRequest &req = requests[i];
+    req.filename = MinVR::decygifyPath(MinVR::replaceEnvVars(req.filename));
+    req.alphaFilename = MinVR::decygifyPath(MinVR::replaceEnvVars(req.alphaFilename));
+
+    if (!FileSystem::exists(req.filename))
+      alwaysAssertM(false, "Texture file does not exist: " + req.filename);
+    if ((req.hasAlpha()) && (!FileSystem::exists(req.alphaFilename)))
+      alwaysAssertM(false, "Texture file does not exist: " + req.alphaFilename);
+    // check the format name now rather than after decoding
+    req.textureFormat();
 
     std::string msg;
-    if (hasalpha) {
-      msg = "Loading texture " + filename + " with alpha texture " + alphafilename + " and keyname " + keyname;
+    if (req.hasAlpha()) {
+      msg = "Adding texture " + req.filename + " with alpha texture " + req.alphaFilename + " and keyname " + req.keyName;
     }
     else {
-      msg = "Loading texture " + filename + " with keyname " + keyname;
+      msg = "Adding texture " + req.filename + " with keyname " + req.keyName;
     }
     if (log) {
       log->println(msg);
@@ -360,93 +786,175 @@ GfxMgr::loadTexturesFromConfigVal(const std::string &configName, Log*log)
     else {
       cout << msg << endl;
     }
+  }
 
+  if (MinVR::ConfigVal("GfxMgr_LazyTextureLoading", false, false)) {
+    // Nothing is loaded until it is first used
+    for (int i=0;i<requests.size();i++) {
+      setTextureSlot(requests[i].keyName, _textures->getResidency()->add(requests[i]));
+    }
+    return;
+  }
 
-    // Added by dlemmerm 3/18/05
-    // G3D nicely throws an exception if it can't load one of these. We should handle it.
-    TextureRef tex = NULL;
-    Texture::Settings settings;
-    settings.interpolateMode = interp;
-    settings.wrapMode = wrap;
-    Texture::Preprocess preProcess;
-    preProcess.modulate = Color4(bright,bright,bright);
-
-    try { 
-      if (hasalpha) {
-	if (format == "L8")
-	  tex = Texture::fromTwoFiles(filename,alphafilename,TextureFormat::L8(),dim, settings);
-	else if (format == "A8")
-	  tex = Texture::fromTwoFiles(filename,alphafilename,TextureFormat::A8(),dim, settings);
-	else if (format == "LA8")
-	  tex = Texture::fromTwoFiles(filename,alphafilename,TextureFormat::LA8(),dim, settings);
-	else if (format == "RGB5")
-	  tex = Texture::fromTwoFiles(filename,alphafilename,TextureFormat::RGB5(),dim, settings);
-	else if (format == "RGB5A1") 
-	  tex = Texture::fromTwoFiles(filename,alphafilename,TextureFormat::RGB5A1(),dim, settings);
-	else if (format == "RGB8")
-	  tex = Texture::fromTwoFiles(filename,alphafilename,TextureFormat::RGB8(),dim, settings);
-	else if (format == "RGBA8")
-	  tex = Texture::fromTwoFiles(filename,alphafilename,TextureFormat::RGBA8(),dim, settings);
-	else if (format == "RGB_DXT1") 
-	  tex = Texture::fromTwoFiles(filename,alphafilename,TextureFormat::RGB_DXT1(),dim, settings);
-	else if (format == "RGBA_DXT1")
-	  tex = Texture::fromTwoFiles(filename,alphafilename,TextureFormat::RGBA_DXT1(),dim, settings);
-	else if (format == "RGBA_DXT3")
-	  tex = Texture::fromTwoFiles(filename,alphafilename,TextureFormat::RGBA_DXT3(),dim, settings);
-	else if (format == "RGBA_DXT5")
-	  tex = Texture::fromTwoFiles(filename,alphafilename,TextureFormat::RGBA_DXT5(),dim, settings);
-	else if (format == "AUTO")
-	  tex = Texture::fromTwoFiles(filename,alphafilename,TextureFormat::AUTO(),dim, settings);
-	else if (format == "") // format not specified, assume AUTO
-	  tex = Texture::fromTwoFiles(filename,alphafilename,TextureFormat::AUTO(),dim, settings);
-	else
-	  alwaysAssertM(false, "Invalid texture format while loading texture from ConfigVal: " + format);
-      }
-      else {
-	if (format == "L8")
-	  tex = Texture::fromFile(filename,TextureFormat::L8(),dim, settings, preProcess);
-	else if (format == "A8")
-	  tex = Texture::fromFile(filename,TextureFormat::A8(),dim, settings, preProcess);
-	else if (format == "LA8")
-	  tex = Texture::fromFile(filename,TextureFormat::LA8(),dim, settings, preProcess);
-	else if (format == "RGB5")
-	  tex = Texture::fromFile(filename,TextureFormat::RGB5(),dim, settings, preProcess);
-	else if (format == "RGB5A1") 
-	  tex = Texture::fromFile(filename,TextureFormat::RGB5A1(),dim, settings, preProcess);
-	else if (format == "RGB8")
-	  tex = Texture::fromFile(filename,TextureFormat::RGB8(),dim, settings, preProcess);
-	else if (format == "RGBA8")
-	  tex = Texture::fromFile(filename,TextureFormat::RGBA8(),dim, settings, preProcess);
-	else if (format == "RGB_DXT1") 
-	  tex = Texture::fromFile(filename,TextureFormat::RGB_DXT1(),dim, settings, preProcess);
-	else if (format == "RGBA_DXT1")
-	  tex = Texture::fromFile(filename,TextureFormat::RGBA_DXT1(),dim, settings, preProcess);
-	else if (format == "RGBA_DXT3")
-	  tex = Texture::fromFile(filename,TextureFormat::RGBA_DXT3(),dim, settings, preProcess);
-	else if (format == "RGBA_DXT5")
-	  tex = Texture::fromFile(filename,TextureFormat::RGBA_DXT5(),dim, settings, preProcess);
-	else if (format == "AUTO")
-	  tex = Texture::fromFile(filename,TextureFormat::AUTO(),dim, settings, preProcess);
-	else if (format == "") // format not specified, assume AUTO
-	  tex = Texture::fromFile(filename,TextureFormat::AUTO(),dim, settings, preProcess);
-	else
-	  alwaysAssertM(false, "Invalid texture format while loading texture from ConfigVal: " + format);
-      }    
+  _texLoadPipeline = new TextureLoadPipeline(WorkerPool::getDefault().pointer(),
+                                             MinVR::ConfigVal("GfxMgr_TextureLoadQueueSize", 8, false));
+  _texLoadPipeline->setCache(getTextureCache().pointer());
+  _texLoadPipeline->start(requests);
+}
+
+bool
+GfxMgr::updateTextureLoading(int maxUploads, bool wait)
+{
+  if (_texLoadPipeline == NULL) {
+    return true;
+  }
+
+  _texLoadPipeline->update(std::bind(&GfxMgr::uploadDecodedTexture, this, std::placeholders::_1),
+                           maxUploads, wait);
+  double progress = _texLoadPipeline->getProgress();
+
+  bool done = _texLoadPipeline->isDone();
+  if (done) {
+    finishTextureAtlases();
+    delete _texLoadPipeline;
+    _texLoadPipeline = NULL;
+  }
+
+  if (_loadProgressCallback) {
+    _loadProgressCallback->exec(progress);
+  }
+  return done;
+}
+
+TextureCacheRef
+GfxMgr::getTextureCache()
+{
+  if (_textureCache.isNull()) {
+    std::string dir = MinVR::ConfigVal("GfxMgr_TextureCacheDir", std::string("TextureCache"), false);
+    if (dir != "") {
+      int64 maxMB = MinVR::ConfigVal("GfxMgr_TextureCacheMaxMB", 2048, false);
+      _textureCache = new TextureCache(MinVR::decygifyPath(MinVR::replaceEnvVars(dir)), maxMB * 1024 * 1024);
     }
-    catch ( G3D::GImage::Error& texErr ) {
+  }
+  return _textureCache;
+}
 
-      cerr << "GfxMgr texture loading error. " << endl
-        << "  File:\t" << texErr.filename << endl
-        << "  Reason:\t" << texErr.reason << endl;
+double
+GfxMgr::getTextureLoadProgress()
+{
+  if (_texLoadPipeline == NULL) {
+    return 100.0;
+  }
+  return _texLoadPipeline->getProgress();
+}
+
+void
+GfxMgr::uploadDecodedTexture(DecodedTexture &decoded)
+{
+  if (addToTextureAtlas(decoded)) {
+    return;
+  }
+  TextureRef tex = createTexture(decoded);
+  setTextureSlot(decoded.request.keyName,
+               _textures->getResidency()->addLoaded(decoded.request, tex, tex->sizeInMemory()));
+}
 
-      tex = NULL;
+TextureRef
+GfxMgr::createTexture(DecodedTexture &decoded)
+{
+  const TextureLoadRequest &req = decoded.request;
+
+  if (!decoded.ok) {
+    cerr << "GfxMgr texture loading error. " << endl
+      << "  File:\t" << req.filename << endl
+      << "  Reason:\t" << decoded.error << endl;
+  }
+  alwaysAssertM(decoded.ok, "Problem loading texture: " + req.filename);
+
+  TextureRef tex;
+  if (decoded.loadOnUpload) {
+    if (req.hasAlpha()) {
+      tex = Texture::fromTwoFiles(req.filename, req.alphaFilename, req.textureFormat(), req.dim, req.settings());
+    }
+    else {
+      tex = Texture::fromFile(req.filename, req.textureFormat(), req.dim, req.settings(), req.preprocess());
     }
+  }
+  else {
+    // The texels are final, brightness and mip levels are already done
+    Array< Array<const void*> > levels;
+    decoded.data.getLevelPointers(levels);
+    Texture::Settings settings = req.settings();
+    settings.autoMipMap = false;
+    tex = Texture::fromMemory(req.filename, levels, decoded.data.format(),
+                              decoded.data.width(), decoded.data.height(), 1,
+                              req.textureFormat(), req.dim, settings);
+  }
+  alwaysAssertM(tex.notNull(), "Problem loading texture: " + req.filename);
+  return tex;
+}
+
+bool
+GfxMgr::addToTextureAtlas(DecodedTexture &decoded)
+{
+  const TextureLoadRequest &req = decoded.request;
+  if ((_atlasMaxSize <= 0) || !decoded.ok || decoded.loadOnUpload ||
+      (req.wrap != WrapMode::CLAMP) ||
+      ((req.dim != Texture::DIM_2D) && (req.dim != Texture::DIM_2D_NPOT)) ||
+      (decoded.data.width() > _atlasMaxSize) || (decoded.data.height() > _atlasMaxSize) ||
+      (decoded.data.width() + 2*_atlasPadding > _atlasSize) ||
+      (decoded.data.height() + 2*_atlasPadding > _atlasSize) ||
+      !TextureAtlas::canHold(req.textureFormat(), decoded.data.format())) {
+    return false;
+  }
 
-    alwaysAssertM(tex.notNull(), "Problem loading texture: " + filename);
+  // Textures only share an atlas if they'd be created the same way
+  bool mipmaps = TextureLoadPipeline::usesMipmaps(req);
+  for (int i=0;i<_loadingAtlases.size();i++) {
+    const TextureLoadRequest &atlasReq = _loadingAtlasRequests[i];
+    if ((atlasReq.interp == req.interp) &&
+        (_loadingAtlases[i]->format() == decoded.data.format()) &&
+        _loadingAtlases[i]->add(req.keyName, decoded.data)) {
+      return true;
+    }
+  }
+
+  TextureAtlasRef atlas = new TextureAtlas(decoded.data.format(), _atlasSize, _atlasPadding, mipmaps);
+  alwaysAssertM(atlas->add(req.keyName, decoded.data), "Texture doesn't fit in an empty atlas: " + req.filename);
+  _loadingAtlases.append(atlas);
+  _loadingAtlasRequests.append(req);
+  return true;
+}
 
-    _texMap.set(keyname, tex);
-    newTexKeys.append(keyname);
+void
+GfxMgr::finishTextureAtlases()
+{
+  for (int i=0;i<_loadingAtlases.size();i++) {
+    TextureAtlasRef atlas = _loadingAtlases[i];
+    atlas->finish();
+
+    Array< Array<const void*> > levels;
+    atlas->data().getLevelPointers(levels);
+    Texture::Settings settings = _loadingAtlasRequests[i].settings();
+    settings.wrapMode = WrapMode::CLAMP;
+    settings.autoMipMap = false;
+    TextureRef tex = Texture::fromMemory(G3D::format("TextureAtlas%d", i), levels, atlas->format(),
+                                         atlas->width(), atlas->height(), 1,
+                                         atlas->format(), Texture::DIM_2D, settings);
+    alwaysAssertM(tex.notNull(), "Problem creating texture atlas");
+
+    int slot = _textures->getResidency()->addPinned(tex);
+    const Array<TextureAtlas::Entry> &entries = atlas->entries();
+    for (int e=0;e<entries.size();e++) {
+      TextureID id = _textures->intern(entries[e].keyName);
+      _textures->bind(id, slot);
+      Vector2 scale, offset;
+      atlas->getUVTransform(entries[e], scale, offset);
+      _textures->setUVTransform(id, scale, offset);
+    }
   }
+  _loadingAtlases.clear();
+  _loadingAtlasRequests.clear();
 }
 
 
@@ -475,12 +983,14 @@ void
 GfxMgr::setRoomToVirtualSpaceFrame(const CoordinateFrame &roomToVirtual)
 {
   _roomToVirtual = roomToVirtual;
+  _frameGraph.invalidate();
 }
 
 void
 GfxMgr::setRoomToVirtualSpaceScale(const double scale)
 {
   _roomToVirtualScale = scale;
+  _frameGraph.invalidate();
 }
 
 
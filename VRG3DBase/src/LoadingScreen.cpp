@@ -27,6 +27,12 @@ LoadingScreen::renderAndSwapBuffers(GfxMgrRef gfxMgr, double percentDone)
   }
 }
 
+void
+LoadingScreen::renderAndSwapBuffers(GfxMgrRef gfxMgr)
+{
+  renderAndSwapBuffers(gfxMgr, gfxMgr->getTextureLoadProgress());
+}
+
 void
 LoadingScreen::render(GfxMgrRef gfxMgr, double percentDone)
 {
@@ -0,0 +1,334 @@
+#include "../include/Profiler.H"
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+using namespace G3D;
+
+
+namespace {
+
+std::atomic<int> nextProfilerID(0);
+
+/// The buffers this thread has with each profiler, by profiler id.  A
+/// thread rarely records to more than one.
+thread_local std::vector< std::pair<int, void*> > threadBuffers;
+
+void
+appendJSONString(std::string &out, const std::string &s)
+{
+  out += '"';
+  for (size_t i=0;i<s.size();i++) {
+    char c = s[i];
+    if ((c == '"') || (c == '\\')) {
+      out += '\\';
+      out += c;
+    }
+    else if ((unsigned char)c < 0x20) {
+      out += format("\\u%04x", (int)c);
+    }
+    else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+bool
+slowerZone(const ProfileZoneStats &a, const ProfileZoneStats &b)
+{
+  return a.meanMs > b.meanMs;
+}
+
+} // end namespace
+
+
+Profiler::ThreadBuffer::ThreadBuffer(int size, int threadIndex) :
+  samples(size), head(0), tail(0), threadIndex(threadIndex), depth(0)
+{
+}
+
+
+Profiler::Profiler(int bufferSize, int historyFrames) :
+  _enabled(false),
+  _numDropped(0)
+{
+  _clock = &Profiler::steadyClockNanoseconds;
+  _bufferSize = iMax(1, bufferSize);
+  _historyFrames = iMax(1, historyFrames);
+  _frameIndex = 0;
+  _framesRecorded = 0;
+  _tracing = false;
+  _maxTraceSamples = 0;
+  _traceStart = 0;
+  _id = nextProfilerID++;
+}
+
+Profiler::~Profiler()
+{
+  // Threads still holding one of these in their threadBuffers never see
+  // this profiler's id again, so the pointer is just never used.
+  for (size_t i=0;i<_threadBuffers.size();i++) {
+    delete _threadBuffers[i];
+  }
+}
+
+ProfilerRef
+Profiler::getDefault()
+{
+  static ProfilerRef profiler = new Profiler();
+  return profiler;
+}
+
+int64
+Profiler::steadyClockNanoseconds()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ProfileZoneID
+Profiler::intern(const std::string &name)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (size_t i=0;i<_zones.size();i++) {
+    if (_zones[i].name == name) {
+      return (ProfileZoneID)i;
+    }
+  }
+  ZoneHistory z;
+  z.name = name;
+  z.ms.resize(_historyFrames, 0.0);
+  z.calls.resize(_historyFrames, 0);
+  z.frameMs = 0.0;
+  z.frameCalls = 0;
+  _zones.push_back(z);
+  return (ProfileZoneID)_zones.size() - 1;
+}
+
+std::string
+Profiler::getZoneName(ProfileZoneID zone)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _zones[zone].name;
+}
+
+int
+Profiler::numZones()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  return (int)_zones.size();
+}
+
+Profiler::ThreadBuffer*
+Profiler::getThreadBuffer()
+{
+  for (size_t i=0;i<threadBuffers.size();i++) {
+    if (threadBuffers[i].first == _id) {
+      return (ThreadBuffer*)threadBuffers[i].second;
+    }
+  }
+  std::lock_guard<std::mutex> lock(_mutex);
+  ThreadBuffer *buffer = new ThreadBuffer(_bufferSize, (int)_threadBuffers.size());
+  _threadBuffers.push_back(buffer);
+  threadBuffers.push_back(std::make_pair(_id, (void*)buffer));
+  return buffer;
+}
+
+void
+Profiler::push(ThreadBuffer *buffer, const ProfileSample &s)
+{
+  uint64 head = buffer->head.load(std::memory_order_relaxed);
+  if (head - buffer->tail.load(std::memory_order_acquire) >= buffer->samples.size()) {
+    _numDropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  buffer->samples[head % buffer->samples.size()] = s;
+  buffer->head.store(head + 1, std::memory_order_release);
+}
+
+void
+Profiler::record(ProfileZoneID zone, int depth, int64 start, int64 end)
+{
+  ProfileSample s;
+  s.zone = zone;
+  s.depth = depth;
+  s.start = start;
+  s.end = end;
+  push(getThreadBuffer(), s);
+}
+
+void
+Profiler::endFrame()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  for (size_t b=0;b<_threadBuffers.size();b++) {
+    ThreadBuffer *buffer = _threadBuffers[b];
+    uint64 head = buffer->head.load(std::memory_order_acquire);
+    uint64 tail = buffer->tail.load(std::memory_order_relaxed);
+    for (uint64 i=tail;i<head;i++) {
+      const ProfileSample &s = buffer->samples[i % buffer->samples.size()];
+      ZoneHistory &z = _zones[s.zone];
+      z.frameMs += (double)(s.end - s.start) / 1.0e6;
+      z.frameCalls++;
+      if (_tracing) {
+        addTraceSample(s, buffer->threadIndex);
+      }
+    }
+    buffer->tail.store(head, std::memory_order_release);
+  }
+
+  for (size_t i=0;i<_zones.size();i++) {
+    ZoneHistory &z = _zones[i];
+    z.ms[_frameIndex] = z.frameMs;
+    z.calls[_frameIndex] = z.frameCalls;
+    z.frameMs = 0.0;
+    z.frameCalls = 0;
+  }
+  _frameIndex = (_frameIndex + 1) % _historyFrames;
+  _framesRecorded = iMin(_framesRecorded + 1, _historyFrames);
+}
+
+ProfileZoneStats
+Profiler::getStats(ProfileZoneID zone) const
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  const ZoneHistory &z = _zones[zone];
+  ProfileZoneStats stats;
+  stats.name = z.name;
+  stats.lastMs = 0.0;
+  stats.meanMs = 0.0;
+  stats.minMs = 0.0;
+  stats.maxMs = 0.0;
+  stats.callsPerFrame = 0.0;
+  if (_framesRecorded == 0) {
+    return stats;
+  }
+
+  stats.lastMs = z.ms[(_frameIndex + _historyFrames - 1) % _historyFrames];
+  stats.minMs = stats.lastMs;
+  int calls = 0;
+  // The ring is only full once historyFrames frames have ended
+  for (int f=0;f<_framesRecorded;f++) {
+    int i = (_frameIndex + _historyFrames - 1 - f) % _historyFrames;
+    stats.meanMs += z.ms[i];
+    stats.minMs = G3D::min(stats.minMs, z.ms[i]);
+    stats.maxMs = G3D::max(stats.maxMs, z.ms[i]);
+    calls += z.calls[i];
+  }
+  stats.meanMs /= _framesRecorded;
+  stats.callsPerFrame = (double)calls / _framesRecorded;
+  return stats;
+}
+
+void
+Profiler::getAllStats(Array<ProfileZoneStats> &stats) const
+{
+  int n;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    n = (int)_zones.size();
+  }
+  for (int i=0;i<n;i++) {
+    ProfileZoneStats s = getStats(i);
+    if (s.callsPerFrame > 0.0) {
+      stats.append(s);
+    }
+  }
+  std::stable_sort(stats.getCArray(), stats.getCArray() + stats.size(), slowerZone);
+}
+
+void
+Profiler::beginTrace(int maxSamples)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  _trace.clear();
+  _traceThreads.clear();
+  _maxTraceSamples = maxSamples;
+  _traceStart = _clock();
+  _tracing = true;
+}
+
+void
+Profiler::endTrace()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  _tracing = false;
+}
+
+void
+Profiler::addTraceSample(const ProfileSample &s, int threadIndex)
+{
+  if ((_trace.size() < _maxTraceSamples) && (s.start >= _traceStart)) {
+    _trace.append(s);
+    _traceThreads.append(threadIndex);
+  }
+}
+
+std::string
+Profiler::getChromeTrace()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  std::string out;
+  out.reserve(64 + _trace.size() * 96);
+  out += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  for (size_t t=0;t<_threadBuffers.size();t++) {
+    if (t > 0) {
+      out += ",";
+    }
+    out += format("\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"Thread %d\"}}",
+                  (int)t, (int)t);
+  }
+  for (int i=0;i<_trace.size();i++) {
+    const ProfileSample &s = _trace[i];
+    if ((i > 0) || (_threadBuffers.size() > 0)) {
+      out += ",";
+    }
+    out += "\n{\"name\":";
+    appendJSONString(out, _zones[s.zone].name);
+    // Chrome wants microseconds
+    out += format(",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"depth\":%d}}",
+                  _traceThreads[i], (double)(s.start - _traceStart) / 1000.0,
+                  (double)(s.end - s.start) / 1000.0, s.depth);
+  }
+  out += "\n]}\n";
+  return out;
+}
+
+bool
+Profiler::writeChromeTrace(const std::string &filename)
+{
+  std::string trace = getChromeTrace();
+  FILE *f = fopen(filename.c_str(), "wb");
+  if (f == NULL) {
+    return false;
+  }
+  bool ok = (fwrite(trace.data(), 1, trace.size(), f) == trace.size());
+  return (fclose(f) == 0) && ok;
+}
+
+
+ProfileScope::ProfileScope(Profiler *profiler, ProfileZoneID zone)
+{
+  _profiler = profiler;
+  _buffer = NULL;
+  _zone = zone;
+  if (profiler->isEnabled()) {
+    _buffer = profiler->getThreadBuffer();
+    _buffer->depth++;
+    _start = profiler->now();
+  }
+}
+
+ProfileScope::~ProfileScope()
+{
+  if (_buffer) {
+    ProfileSample s;
+    s.zone = _zone;
+    s.start = _start;
+    s.end = _profiler->now();
+    s.depth = --_buffer->depth;
+    _profiler->push(_buffer, s);
+  }
+}
@@ -0,0 +1,121 @@
+#include "../include/RenderQueue.H"
+
+using namespace G3D;
+
+#define STATE_KEY_MASK 0xFFFFFF
+
+static inline uint32
+depthBits(float depth)
+{
+  // Negative depths (behind the eye) and NaNs sort as if they were at the eye.
+  if (!(depth > 0.0f)) {
+    depth = 0.0f;
+  }
+  uint32 bits;
+  memcpy(&bits, &depth, sizeof(bits));
+  return bits;
+}
+
+RenderQueue::RenderQueue()
+{
+  _items = NULL;
+  _scratch = NULL;
+  _size = 0;
+  _capacity = 0;
+  _numOpaque = 0;
+}
+
+uint64
+RenderQueue::makeOpaqueKey(uint32 stateKey, float depth)
+{
+  return ((uint64)(stateKey & STATE_KEY_MASK) << 39) |
+         ((uint64)depthBits(depth) << 7);
+}
+
+uint64
+RenderQueue::makeTransparentKey(uint32 stateKey, float depth)
+{
+  return ((uint64)1 << 63) |
+         ((uint64)(~depthBits(depth)) << 31) |
+         ((uint64)(stateKey & STATE_KEY_MASK) << 7);
+}
+
+void
+RenderQueue::begin(FrameArena &arena, int capacity)
+{
+  _items = arena.allocArray<Item>(capacity);
+  _scratch = arena.allocArray<Item>(capacity);
+  _capacity = capacity;
+  _size = 0;
+  _numOpaque = 0;
+}
+
+void
+RenderQueue::add(int index, uint32 stateKey, float depth, bool transparent)
+{
+  debugAssertM(_size < _capacity, "RenderQueue is full, call begin() with a larger capacity");
+  Item &item = _items[_size++];
+  item.index = index;
+  if (transparent) {
+    item.key = makeTransparentKey(stateKey, depth);
+  }
+  else {
+    item.key = makeOpaqueKey(stateKey, depth);
+    _numOpaque++;
+  }
+}
+
+void
+RenderQueue::sort()
+{
+  radixSort(_items, _scratch, _size);
+}
+
+void
+RenderQueue::radixSort(Item *items, Item *scratch, int n)
+{
+  if (n < 2) {
+    return;
+  }
+
+  // One pass over the data builds the histograms for all 8 digits
+  int counts[8][256];
+  memset(counts, 0, sizeof(counts));
+  for (int i=0;i<n;i++) {
+    uint64 k = items[i].key;
+    for (int d=0;d<8;d++) {
+      counts[d][(k >> (8*d)) & 0xFF]++;
+    }
+  }
+
+  Item *src = items;
+  Item *dst = scratch;
+  for (int d=0;d<8;d++) {
+    int *c = counts[d];
+
+    // If every key has the same value for this digit the pass is a no-op
+    if (c[(src[0].key >> (8*d)) & 0xFF] == n) {
+      continue;
+    }
+
+    int offset = 0;
+    for (int b=0;b<256;b++) {
+      int num = c[b];
+      c[b] = offset;
+      offset += num;
+    }
+
+    for (int i=0;i<n;i++) {
+      int b = (int)((src[i].key >> (8*d)) & 0xFF);
+      dst[c[b]++] = src[i];
+    }
+
+    Item *tmp = src;
+    src = dst;
+    dst = tmp;
+  }
+
+  if (src != items) {
+    memcpy(items, src, sizeof(Item) * n);
+  }
+}
@@ -555,6 +555,32 @@ SMesh::SetTexture(Texture::Ref texture, int textureImageUnit)
 	m_textureRefs.set(textureImageUnit, texture);
 }
 
+void
+SMesh::RemapTextureCoords(const Vector2 &scale, const Vector2 &offset, int textureImageUnit)
+{
+  if (!m_textureCoord.containsKey(textureImageUnit)) return;
+
+  Array<Vector2> coords = m_textureCoord[textureImageUnit];
+  for (int i=0;i<coords.size();i++) {
+    coords[i] = coords[i] * scale + offset;
+  }
+  Texture::Ref texture;
+  m_textureRefs.get(textureImageUnit, texture);
+  // rebuilds the VARs with the new coordinates
+  bool perVertexColor = m_perVertexColor;
+  ApplyTexturing(texture, coords, textureImageUnit);
+  m_perVertexColor = perVertexColor;
+}
+
+void
+SMesh::RemapTextureCoords(const TextureHandle &texture, int textureImageUnit)
+{
+  if (texture.isAtlased()) {
+    RemapTextureCoords(texture.uvScale(), texture.uvOffset(), textureImageUnit);
+  }
+  SetTexture(texture, textureImageUnit);
+}
+
 void
 SMesh::EnableTexture()
 {
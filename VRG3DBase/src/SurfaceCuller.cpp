@@ -0,0 +1,371 @@
+#include "../include/SurfaceCuller.H"
+#include <algorithm>
+#include <atomic>
+
+using namespace G3D;
+
+
+/***  ViewFrustum  ***/
+
+ViewFrustum::ViewFrustum(const CullView &view)
+{
+  Vector3 center = (view.topLeft + view.topRight + view.botLeft + view.botRight) / 4.0;
+  Vector3 filmNormal = (view.botRight - view.botLeft).cross(view.topLeft - view.botLeft).direction();
+  // make the filmplane normal point from the screen toward the eye
+  if (filmNormal.dot(view.eye - center) < 0) {
+    filmNormal = -filmNormal;
+  }
+  Vector3 forward = -filmNormal;
+
+  // Side planes pass through the eye and one edge of the tile
+  Vector3 edges[4][2] = { { view.botLeft,  view.topLeft  },
+                          { view.topLeft,  view.topRight },
+                          { view.topRight, view.botRight },
+                          { view.botRight, view.botLeft  } };
+  for (int i=0;i<4;i++) {
+    Vector3 n = (edges[i][0] - view.eye).cross(edges[i][1] - view.eye).direction();
+    if (n.dot(center - view.eye) < 0) {
+      n = -n;
+    }
+    _normals[i] = n;
+    _d[i] = -n.dot(view.eye);
+  }
+
+  // Near and far planes are parallel to the filmplane
+  _normals[4] = forward;
+  _d[4] = -forward.dot(view.eye + forward * view.nearClip);
+  _normals[5] = -forward;
+  _d[5] = forward.dot(view.eye + forward * view.farClip);
+}
+
+
+
+/***  OcclusionBuffer  ***/
+
+OcclusionBuffer::OcclusionBuffer(int width, int height)
+{
+  _width = width;
+  _height = height;
+
+  int w = width;
+  int h = height;
+  while (true) {
+    _levels.next().resize(w * h);
+    _levelWidths.append(w);
+    _levelHeights.append(h);
+    if ((w == 1) && (h == 1)) {
+      break;
+    }
+    w = iMax(1, (w + 1) / 2);
+    h = iMax(1, (h + 1) / 2);
+  }
+
+  _filmDist = 1.0;
+  _nearClip = 0.0;
+}
+
+void
+OcclusionBuffer::beginView(const CullView &view)
+{
+  _eye = view.eye;
+  _origin = view.botLeft;
+
+  Vector3 center = (view.topLeft + view.topRight + view.botLeft + view.botRight) / 4.0;
+  Vector3 xvec = view.botRight - view.botLeft;
+  Vector3 yvec = view.topLeft - view.botLeft;
+  _filmNormal = xvec.cross(yvec).direction();
+  if (_filmNormal.dot(view.eye - center) < 0) {
+    _filmNormal = -_filmNormal;
+  }
+  _forward = -_filmNormal;
+  _filmDist = (center - view.eye).dot(_forward);
+  _nearClip = (float)G3D::max(1e-4, view.nearClip);
+
+  // Scale the axes so that dot products give texel coordinates directly
+  _xAxis = xvec * ((float)_width / xvec.squaredLength());
+  _yAxis = yvec * ((float)_height / yvec.squaredLength());
+
+  Array<float> &level0 = _levels[0];
+  for (int i=0;i<level0.size();i++) {
+    level0[i] = inf();
+  }
+}
+
+bool
+OcclusionBuffer::project(const Vector3 &p, Vector2 &uv, float &depth) const
+{
+  Vector3 d = p - _eye;
+  depth = d.dot(_forward);
+  if (depth <= _nearClip) {
+    return false;
+  }
+  Vector3 q = _eye + d * (_filmDist / depth) - _origin;
+  uv = Vector2(q.dot(_xAxis), q.dot(_yAxis));
+  return true;
+}
+
+static inline float
+cross2(const Vector2 &o, const Vector2 &a, const Vector2 &b)
+{
+  return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
+
+static bool
+lessXY(const Vector2 &a, const Vector2 &b)
+{
+  return (a.x < b.x) || ((a.x == b.x) && (a.y < b.y));
+}
+
+/// Andrew's monotone chain, returns the number of hull points written to
+/// hull in counter-clockwise order.
+static int
+convexHull(Vector2 pts[8], Vector2 hull[16])
+{
+  std::sort(pts, pts + 8, lessXY);
+  int k = 0;
+  for (int i=0;i<8;i++) {
+    while ((k >= 2) && (cross2(hull[k-2], hull[k-1], pts[i]) <= 0)) k--;
+    hull[k++] = pts[i];
+  }
+  for (int i=6, t=k+1;i>=0;i--) {
+    while ((k >= t) && (cross2(hull[k-2], hull[k-1], pts[i]) <= 0)) k--;
+    hull[k++] = pts[i];
+  }
+  return k - 1;
+}
+
+void
+OcclusionBuffer::rasterizeOccluder(const Box &box)
+{
+  Vector2 pts[8];
+  float maxDepth = 0;
+  for (int i=0;i<8;i++) {
+    float depth;
+    if (!project(box.corner(i), pts[i], depth)) {
+      return;
+    }
+    maxDepth = G3D::max(maxDepth, depth);
+  }
+
+  Vector2 hull[16];
+  int n = convexHull(pts, hull);
+  if (n < 3) {
+    return;
+  }
+
+  Vector2 lo = hull[0], hi = hull[0];
+  for (int i=1;i<n;i++) {
+    lo = lo.min(hull[i]);
+    hi = hi.max(hull[i]);
+  }
+  int x0 = iMax(0, iFloor(lo.x));
+  int y0 = iMax(0, iFloor(lo.y));
+  int x1 = iMin(_width - 1, iCeil(hi.x) - 1);
+  int y1 = iMin(_height - 1, iCeil(hi.y) - 1);
+
+  Array<float> &level0 = _levels[0];
+  for (int y=y0;y<=y1;y++) {
+    for (int x=x0;x<=x1;x++) {
+      // A texel only counts as covered if all four of its corners are
+      // inside the (convex) silhouette, so coverage is never overestimated.
+      Vector2 c[4] = { Vector2(x, y), Vector2(x+1, y), Vector2(x, y+1), Vector2(x+1, y+1) };
+      bool inside = true;
+      for (int e=0;(e<n) && inside;e++) {
+        const Vector2 &a = hull[e];
+        const Vector2 &b = hull[(e+1) % n];
+        for (int j=0;j<4;j++) {
+          if (cross2(a, b, c[j]) < 0) {
+            inside = false;
+            break;
+          }
+        }
+      }
+      if (inside) {
+        float &texel = level0[y*_width + x];
+        texel = G3D::min(texel, maxDepth);
+      }
+    }
+  }
+}
+
+void
+OcclusionBuffer::buildHierarchy()
+{
+  for (int l=1;l<_levels.size();l++) {
+    const Array<float> &src = _levels[l-1];
+    Array<float> &dst = _levels[l];
+    int sw = _levelWidths[l-1];
+    int sh = _levelHeights[l-1];
+    int dw = _levelWidths[l];
+    int dh = _levelHeights[l];
+    for (int y=0;y<dh;y++) {
+      int sy0 = iMin(2*y, sh-1);
+      int sy1 = iMin(2*y+1, sh-1);
+      for (int x=0;x<dw;x++) {
+        int sx0 = iMin(2*x, sw-1);
+        int sx1 = iMin(2*x+1, sw-1);
+        dst[y*dw + x] = G3D::max(G3D::max(src[sy0*sw + sx0], src[sy0*sw + sx1]),
+                                 G3D::max(src[sy1*sw + sx0], src[sy1*sw + sx1]));
+      }
+    }
+  }
+}
+
+bool
+OcclusionBuffer::isOccluded(const Vector3 &center, float radius) const
+{
+  // Project the corners of the sphere's bounding cube, which encloses the
+  // sphere's projection.
+  Vector2 lo(inf(), inf());
+  Vector2 hi(-inf(), -inf());
+  for (int i=0;i<8;i++) {
+    Vector3 p = center + Vector3((i & 1) ? radius : -radius,
+                                 (i & 2) ? radius : -radius,
+                                 (i & 4) ? radius : -radius);
+    Vector2 uv;
+    float depth;
+    if (!project(p, uv, depth)) {
+      return false;
+    }
+    lo = lo.min(uv);
+    hi = hi.max(uv);
+  }
+
+  lo = lo.max(Vector2(0, 0));
+  hi = hi.min(Vector2(_width, _height));
+  if ((lo.x >= hi.x) || (lo.y >= hi.y)) {
+    // Entirely off screen, that's for the frustum test to decide
+    return false;
+  }
+
+  float nearestDepth = (center - _eye).dot(_forward) - radius;
+
+  // Pick the level where the footprint covers about 2x2 texels
+  float extent = G3D::max(hi.x - lo.x, hi.y - lo.y);
+  int level = 0;
+  while ((level < _levels.size() - 1) && (extent > 2.0f)) {
+    extent *= 0.5f;
+    level++;
+  }
+
+  int scale = 1 << level;
+  int lw = _levelWidths[level];
+  int lh = _levelHeights[level];
+  int x0 = iClamp(iFloor(lo.x) / scale, 0, lw - 1);
+  int y0 = iClamp(iFloor(lo.y) / scale, 0, lh - 1);
+  int x1 = iClamp((iCeil(hi.x) - 1) / scale, 0, lw - 1);
+  int y1 = iClamp((iCeil(hi.y) - 1) / scale, 0, lh - 1);
+
+  const Array<float> &depths = _levels[level];
+  for (int y=y0;y<=y1;y++) {
+    for (int x=x0;x<=x1;x++) {
+      if (depths[y*lw + x] >= nearestDepth) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+float
+OcclusionBuffer::projectedArea(const Box &box) const
+{
+  Vector2 lo(inf(), inf());
+  Vector2 hi(-inf(), -inf());
+  for (int i=0;i<8;i++) {
+    Vector2 uv;
+    float depth;
+    if (!project(box.corner(i), uv, depth)) {
+      return 0;
+    }
+    lo = lo.min(uv);
+    hi = hi.max(uv);
+  }
+  lo = lo.max(Vector2(0, 0));
+  hi = hi.min(Vector2(_width, _height));
+  if ((lo.x >= hi.x) || (lo.y >= hi.y)) {
+    return 0;
+  }
+  return (hi.x - lo.x) * (hi.y - lo.y) / (float)(_width * _height);
+}
+
+
+
+/***  SurfaceCuller  ***/
+
+SurfaceCuller::SurfaceCuller()
+{
+  _occlusionEnabled = false;
+  _maxOccluders = 16;
+}
+
+void
+SurfaceCuller::cull(const CullView &view, const CullSphere *spheres, int numSpheres,
+                    const Array<Box> &occluders, uint8 *visible, WorkerPool *pool)
+{
+  _stats = Stats();
+  _stats.numTested = numSpheres;
+
+  ViewFrustum frustum(view);
+
+  bool useOcclusion = false;
+  if (_occlusionEnabled && occluders.size()) {
+    _occlusionBuffer.beginView(view);
+
+    // Only the occluders that cover the most screen are worth rasterizing
+    std::vector< std::pair<float, int> > bySize;
+    for (int i=0;i<occluders.size();i++) {
+      float area = _occlusionBuffer.projectedArea(occluders[i]);
+      if (area > 0) {
+        bySize.push_back(std::make_pair(area, i));
+      }
+    }
+    std::sort(bySize.begin(), bySize.end(),
+              [](const std::pair<float, int> &a, const std::pair<float, int> &b) {
+                return a.first > b.first;
+              });
+    int n = iMin(_maxOccluders, (int)bySize.size());
+    for (int i=0;i<n;i++) {
+      _occlusionBuffer.rasterizeOccluder(occluders[bySize[i].second]);
+    }
+    _occlusionBuffer.buildHierarchy();
+    _stats.numOccluders = n;
+    useOcclusion = (n > 0);
+  }
+
+  std::atomic<int> frustumCulled(0);
+  std::atomic<int> occlusionCulled(0);
+  const OcclusionBuffer &occlusionBuffer = _occlusionBuffer;
+
+  std::function<void(int, int)> cullRange = [&](int begin, int end) {
+    int fc = 0;
+    int oc = 0;
+    for (int i=begin;i<end;i++) {
+      const CullSphere &s = spheres[i];
+      if (!frustum.intersectsSphere(s.center, s.radius)) {
+        visible[i] = 0;
+        fc++;
+      }
+      else if (useOcclusion && occlusionBuffer.isOccluded(s.center, s.radius)) {
+        visible[i] = 0;
+        oc++;
+      }
+      else {
+        visible[i] = 1;
+      }
+    }
+    frustumCulled += fc;
+    occlusionCulled += oc;
+  };
+
+  if (pool) {
+    pool->parallelFor(numSpheres, 1024, cullRange);
+  }
+  else {
+    cullRange(0, numSpheres);
+  }
+
+  _stats.numFrustumCulled = frustumCulled;
+  _stats.numOcclusionCulled = occlusionCulled;
+  _stats.numVisible = numSpheres - _stats.numFrustumCulled - _stats.numOcclusionCulled;
+}
@@ -10,6 +10,7 @@ TexPerFrameSMesh::TexPerFrameSMesh
 {
   m_texCoords = texCoords;
   m_texKey = textureKey;
+  m_texID = -1;
   m_startFrame = startFrame;
   m_stopFrame = stopFrame;
   if(m_startFrame > texCoords.size())
@@ -55,7 +56,9 @@ TexPerFrameSMesh::draw(RenderDevice *rd, int frame, GfxMgrRef gfxMgr)
   rd->pushState();
   rd->setShadeMode(RenderDevice::SHADE_SMOOTH);
   if(frameTexLoaded){
-    rd->setTexture(0, gfxMgr->getTexture(m_texKey));
+    if (m_texID < 0)
+      m_texID = gfxMgr->getTextureID(m_texKey);
+    rd->setTexture(0, gfxMgr->getTexture(m_texID));
     rd->setBlendFunc(RenderDevice::BLEND_SRC_ALPHA, RenderDevice::BLEND_ONE_MINUS_SRC_ALPHA, RenderDevice::BLENDEQ_ADD);
   }
   rd->beginIndexedPrimitives();
@@ -0,0 +1,197 @@
+#include "../include/TextureAtlas.H"
+
+using namespace G3D;
+
+
+SkylinePacker::SkylinePacker(int width, int height, int padding)
+{
+  _width = width;
+  _height = height;
+  _padding = padding;
+  reset();
+}
+
+void
+SkylinePacker::reset()
+{
+  _numPacked = 0;
+  _usedArea = 0;
+  _skyline.fastClear();
+  Segment s;
+  s.x = 0;
+  s.y = 0;
+  s.width = _width;
+  _skyline.append(s);
+}
+
+int
+SkylinePacker::fit(int i, int w, int h) const
+{
+  int x = _skyline[i].x;
+  if (x + w > _width) {
+    return -1;
+  }
+  // The rectangle rests on the highest segment it spans
+  int y = 0;
+  int widthLeft = w;
+  while (widthLeft > 0) {
+    y = iMax(y, _skyline[i].y);
+    if (y + h > _height) {
+      return -1;
+    }
+    widthLeft -= _skyline[i].width;
+    i++;
+  }
+  return y;
+}
+
+bool
+SkylinePacker::pack(int w, int h, int &x, int &y)
+{
+  int pw = w + 2*_padding;
+  int ph = h + 2*_padding;
+
+  int best = -1;
+  int bestTop = _height + 1;
+  int bestWidth = _width + 1;
+  int bestY = 0;
+  for (int i=0;i<_skyline.size();i++) {
+    int sy = fit(i, pw, ph);
+    if (sy < 0) {
+      continue;
+    }
+    // lowest top edge first, then the narrowest segment to leave the wide
+    // ones for bigger rectangles
+    if ((sy + ph < bestTop) || ((sy + ph == bestTop) && (_skyline[i].width < bestWidth))) {
+      best = i;
+      bestTop = sy + ph;
+      bestWidth = _skyline[i].width;
+      bestY = sy;
+    }
+  }
+  if (best < 0) {
+    return false;
+  }
+
+  int px = _skyline[best].x;
+  addSegment(best, px, bestY + ph, pw);
+  _numPacked++;
+  _usedArea += (int64)pw * (int64)ph;
+
+  x = px + _padding;
+  y = bestY + _padding;
+  return true;
+}
+
+void
+SkylinePacker::addSegment(int i, int x, int y, int w)
+{
+  Segment s;
+  s.x = x;
+  s.y = y;
+  s.width = w;
+  _skyline.insert(i, s);
+
+  // Trim the segments the new one now covers
+  int right = x + w;
+  int j = i + 1;
+  while (j < _skyline.size()) {
+    Segment &next = _skyline[j];
+    if (next.x >= right) {
+      break;
+    }
+    int shrink = right - next.x;
+    if (next.width <= shrink) {
+      _skyline.remove(j);
+    }
+    else {
+      next.x += shrink;
+      next.width -= shrink;
+      break;
+    }
+  }
+
+  // Merge neighbors at the same height
+  j = 0;
+  while (j + 1 < _skyline.size()) {
+    if (_skyline[j].y == _skyline[j+1].y) {
+      _skyline[j].width += _skyline[j+1].width;
+      _skyline.remove(j+1);
+    }
+    else {
+      j++;
+    }
+  }
+}
+
+
+TextureAtlas::TextureAtlas(const TextureFormat *format, int size, int padding, bool mipmaps) :
+  _packer(size, size, padding)
+{
+  alwaysAssertM(canHold(format, format), "TextureAtlas needs a format with one byte per channel");
+  _data.allocate(format, size, size, mipmaps ? TextureData::numMipLevels(size, size) : 1);
+  // Unused parts of the atlas are never sampled, but keep them from being
+  // garbage in the lower mip levels
+  System::memset(_data.bytes(), 0, _data.totalSize());
+}
+
+bool
+TextureAtlas::canHold(const TextureFormat *atlasFormat, const TextureFormat *format)
+{
+  return (format->code == atlasFormat->code) &&
+         (!format->compressed) &&
+         ((format->code == TextureFormat::CODE_RGB8) ||
+          (format->code == TextureFormat::CODE_RGBA8));
+}
+
+bool
+TextureAtlas::add(const std::string &keyName, const TextureData &image)
+{
+  alwaysAssertM(canHold(format(), image.format()), "Image format doesn't match the TextureAtlas: " + keyName);
+
+  int w = image.width();
+  int h = image.height();
+  int x, y;
+  if (!_packer.pack(w, h, x, y)) {
+    return false;
+  }
+
+  // Copy the image and repeat its edges out into the padding
+  int channels = format()->packedBitsPerTexel / 8;
+  int pad = _packer.padding();
+  int atlasW = width();
+  const uint8 *src = image.levelData(0);
+  uint8 *dst = _data.levelData(0);
+  for (int row=-pad;row<h+pad;row++) {
+    const uint8 *srcRow = src + iClamp(row, 0, h-1) * w * channels;
+    uint8 *dstRow = dst + ((y + row) * atlasW + x) * channels;
+    for (int col=-pad;col<0;col++) {
+      System::memcpy(dstRow + col*channels, srcRow, channels);
+    }
+    System::memcpy(dstRow, srcRow, w * channels);
+    for (int col=w;col<w+pad;col++) {
+      System::memcpy(dstRow + col*channels, srcRow + (w-1)*channels, channels);
+    }
+  }
+
+  Entry &e = _entries.next();
+  e.keyName = keyName;
+  e.x = x;
+  e.y = y;
+  e.width = w;
+  e.height = h;
+  return true;
+}
+
+void
+TextureAtlas::finish()
+{
+  _data.generateMipmaps();
+}
+
+void
+TextureAtlas::getUVTransform(const Entry &entry, Vector2 &scale, Vector2 &offset) const
+{
+  scale = Vector2((float)entry.width / (float)width(), (float)entry.height / (float)height());
+  offset = Vector2((float)entry.x / (float)width(), (float)entry.y / (float)height());
+}
@@ -0,0 +1,369 @@
+#include "../include/TextureCache.H"
+#include "../include/TextureLoader.H"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <thread>
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+using namespace G3D;
+namespace fs = std::filesystem;
+
+
+/// Bump when the layout of cache files or TextureData changes
+static const uint32 CACHE_FILE_VERSION = 1;
+/// Texel data starts here, a page boundary, so it can be mapped directly
+static const size_t CACHE_DATA_OFFSET = 4096;
+static const char   CACHE_FILE_EXT[] = ".vtc";
+
+struct CacheFileHeader
+{
+  char   magic[8];
+  uint32 version;
+  uint32 formatCode;
+  int32  width;
+  int32  height;
+  int32  numLevels;
+  uint32 reserved;
+  uint64 dataSize;
+};
+
+
+static const uint64 FNV_OFFSET = 14695981039346656037ULL;
+static const uint64 FNV_PRIME  = 1099511628211ULL;
+
+static inline uint64
+fnv1a(uint64 h, const uint8 *bytes, size_t n)
+{
+  for (size_t i=0;i<n;i++) {
+    h ^= bytes[i];
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+static const char*
+wrapModeName(WrapMode wrap)
+{
+  if (wrap == WrapMode::TILE)
+    return "TILE";
+  else if (wrap == WrapMode::CLAMP)
+    return "CLAMP";
+  else if (wrap == WrapMode::IGNORE)
+    return "IGNORE";
+  else if (wrap == WrapMode::ZERO)
+    return "ZERO";
+  return "ERROR";
+}
+
+
+TextureCache::TextureCache(const std::string &directory, int64 maxBytes)
+{
+  _directory = directory;
+  _maxBytes = maxBytes;
+  _totalBytes = 0;
+  _clock = 0;
+  _numHits = 0;
+  _numMisses = 0;
+  _numEvictions = 0;
+
+  std::error_code err;
+  fs::create_directories(_directory, err);
+
+  // Rebuild the LRU order of entries left by earlier runs from their
+  // modification times, which load() refreshes on every hit.
+  std::vector< std::pair<fs::file_time_type, std::string> > found;
+  for (fs::directory_iterator it(_directory, err), end; !err && (it != end); it.increment(err)) {
+    if (!it->is_regular_file() || (it->path().extension() != CACHE_FILE_EXT)) {
+      continue;
+    }
+    std::string key = it->path().stem().string();
+    Entry e;
+    e.size = (int64)it->file_size();
+    e.lastUsed = 0;
+    _entries.set(key, e);
+    _totalBytes += e.size;
+    found.push_back(std::make_pair(it->last_write_time(), key));
+  }
+  std::sort(found.begin(), found.end());
+  for (size_t i=0;i<found.size();i++) {
+    _entries[found[i].second].lastUsed = ++_clock;
+  }
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  evict("");
+}
+
+uint64
+TextureCache::hashFile(const std::string &filename)
+{
+  FILE *f = fopen(filename.c_str(), "rb");
+  if (f == NULL) {
+    return 0;
+  }
+  uint64 h = FNV_OFFSET;
+  static const size_t CHUNK = 1 << 20;
+  Array<uint8> buf;
+  buf.resize(CHUNK);
+  size_t n;
+  while ((n = fread(buf.getCArray(), 1, CHUNK, f)) > 0) {
+    h = fnv1a(h, buf.getCArray(), n);
+  }
+  fclose(f);
+  return h;
+}
+
+std::string
+TextureCache::computeKey(const TextureLoadRequest &request, int formatVersion)
+{
+  uint64 colorHash = hashFile(request.filename);
+  if (colorHash == 0) {
+    return "";
+  }
+  uint64 alphaHash = 0;
+  if (request.hasAlpha()) {
+    alphaHash = hashFile(request.alphaFilename);
+    if (alphaHash == 0) {
+      return "";
+    }
+  }
+
+  std::string settings = format("%s|%d|%s|%d|%.6g|%d|%d|%d", request.format.c_str(), (int)request.dim,
+                                wrapModeName(request.wrap), (int)request.interp, request.brightness,
+                                (int)request.hasAlpha(), CACHE_FILE_VERSION, formatVersion);
+
+  uint64 h = FNV_OFFSET;
+  h = fnv1a(h, (const uint8*)&colorHash, sizeof(colorHash));
+  h = fnv1a(h, (const uint8*)&alphaHash, sizeof(alphaHash));
+  h = fnv1a(h, (const uint8*)settings.c_str(), settings.size());
+  return format("%016llx", (unsigned long long)h);
+}
+
+std::string
+TextureCache::entryFilename(const std::string &key) const
+{
+  return (fs::path(_directory) / (key + CACHE_FILE_EXT)).string();
+}
+
+bool
+TextureCache::load(const std::string &key, TextureData &data)
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!_entries.containsKey(key)) {
+      _numMisses++;
+      return false;
+    }
+  }
+
+  std::string filename = entryFilename(key);
+  CacheFileHeader header;
+  const TextureFormat *fmt = NULL;
+  bool ok = false;
+
+#ifndef _WIN32
+  int fd = open(filename.c_str(), O_RDONLY);
+  struct stat st;
+  if ((fd >= 0) && (fstat(fd, &st) == 0) && ((size_t)st.st_size >= CACHE_DATA_OFFSET)) {
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base != MAP_FAILED) {
+      memcpy(&header, base, sizeof(header));
+      fmt = TextureFormat::fromCode((TextureFormat::Code)header.formatCode);
+      if ((memcmp(header.magic, "VRG3DTC", 8) == 0) && (header.version == CACHE_FILE_VERSION) && fmt &&
+          (header.dataSize == TextureData::computeTotalSize(fmt, header.width, header.height, header.numLevels)) &&
+          ((size_t)st.st_size >= CACHE_DATA_OFFSET + header.dataSize)) {
+        size_t mappedSize = st.st_size;
+        data.borrow(fmt, header.width, header.height, header.numLevels,
+                    (uint8*)base + CACHE_DATA_OFFSET,
+                    [base, mappedSize] { munmap(base, mappedSize); });
+        ok = true;
+      }
+      else {
+        munmap(base, st.st_size);
+      }
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+#else
+  FILE *f = fopen(filename.c_str(), "rb");
+  if (f && (fread(&header, sizeof(header), 1, f) == 1)) {
+    fmt = TextureFormat::fromCode((TextureFormat::Code)header.formatCode);
+    if ((memcmp(header.magic, "VRG3DTC", 8) == 0) && (header.version == CACHE_FILE_VERSION) && fmt &&
+        (header.dataSize == TextureData::computeTotalSize(fmt, header.width, header.height, header.numLevels))) {
+      data.allocate(fmt, header.width, header.height, header.numLevels);
+      ok = (fseek(f, CACHE_DATA_OFFSET, SEEK_SET) == 0) &&
+           (fread(data.bytes(), 1, data.totalSize(), f) == data.totalSize());
+      if (!ok) {
+        data.clear();
+      }
+    }
+  }
+  if (f) {
+    fclose(f);
+  }
+#endif
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (!ok) {
+    // unreadable or from an older version, get rid of it
+    _numMisses++;
+    Entry e;
+    if (_entries.get(key, e)) {
+      _totalBytes -= e.size;
+      _entries.remove(key);
+    }
+    std::error_code err;
+    fs::remove(filename, err);
+    return false;
+  }
+
+  _numHits++;
+  if (_entries.containsKey(key)) {
+    _entries[key].lastUsed = ++_clock;
+  }
+  // persist the use for the LRU order of later runs
+  std::error_code err;
+  fs::last_write_time(filename, fs::file_time_type::clock::now(), err);
+  return true;
+}
+
+void
+TextureCache::store(const std::string &key, const TextureData &data)
+{
+  if (key.empty() || data.isEmpty()) {
+    return;
+  }
+
+  CacheFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "VRG3DTC", 8);
+  header.version = CACHE_FILE_VERSION;
+  header.formatCode = (uint32)data.format()->code;
+  header.width = data.width();
+  header.height = data.height();
+  header.numLevels = data.numLevels();
+  header.dataSize = data.totalSize();
+
+  // Write to a temporary name and rename, so a reader (or a crash) never
+  // sees a partly written entry
+  static std::atomic<int> tmpCounter(0);
+  std::string filename = entryFilename(key);
+  std::string tmpFilename = filename + format(".tmp%d", (int)tmpCounter++);
+
+  FILE *f = fopen(tmpFilename.c_str(), "wb");
+  if (f == NULL) {
+    return;
+  }
+  Array<uint8> pad;
+  pad.resize(CACHE_DATA_OFFSET - sizeof(header));
+  memset(pad.getCArray(), 0, pad.size());
+  bool ok = (fwrite(&header, sizeof(header), 1, f) == 1) &&
+            (fwrite(pad.getCArray(), 1, pad.size(), f) == (size_t)pad.size()) &&
+            (fwrite(data.bytes(), 1, data.totalSize(), f) == data.totalSize());
+  ok = (fclose(f) == 0) && ok;
+
+  std::error_code err;
+  if (ok) {
+    fs::rename(tmpFilename, filename, err);
+  }
+  if (!ok || err) {
+    fs::remove(tmpFilename, err);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  Entry old;
+  if (_entries.get(key, old)) {
+    _totalBytes -= old.size;
+  }
+  Entry e;
+  e.size = (int64)(CACHE_DATA_OFFSET + data.totalSize());
+  e.lastUsed = ++_clock;
+  _entries.set(key, e);
+  _totalBytes += e.size;
+  evict(key);
+}
+
+void
+TextureCache::remove(const std::string &key)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  Entry e;
+  if (_entries.get(key, e)) {
+    _totalBytes -= e.size;
+    _entries.remove(key);
+  }
+  std::error_code err;
+  fs::remove(entryFilename(key), err);
+}
+
+void
+TextureCache::evict(const std::string &keep)
+{
+  if (_totalBytes <= _maxBytes) {
+    return;
+  }
+
+  std::vector< std::pair<uint64, std::string> > byAge;
+  for (Table<std::string, Entry>::Iterator it = _entries.begin(); it != _entries.end(); ++it) {
+    if (it->key != keep) {
+      byAge.push_back(std::make_pair(it->value.lastUsed, it->key));
+    }
+  }
+  std::sort(byAge.begin(), byAge.end());
+
+  for (size_t i=0;(i<byAge.size()) && (_totalBytes > _maxBytes);i++) {
+    const std::string &key = byAge[i].second;
+    _totalBytes -= _entries[key].size;
+    _entries.remove(key);
+    std::error_code err;
+    // On Windows this fails while another thread has the file open, it
+    // is then cleaned up by a later run.
+    fs::remove(entryFilename(key), err);
+    _numEvictions++;
+  }
+}
+
+int
+TextureCache::numEntries()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _entries.size();
+}
+
+int64
+TextureCache::totalBytes()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _totalBytes;
+}
+
+int
+TextureCache::numHits()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _numHits;
+}
+
+int
+TextureCache::numMisses()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _numMisses;
+}
+
+int
+TextureCache::numEvictions()
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _numEvictions;
+}
@@ -0,0 +1,150 @@
+#include "../include/TextureData.H"
+
+using namespace G3D;
+
+
+TextureData::TextureData()
+{
+  _format = NULL;
+  _width = 0;
+  _height = 0;
+  _bytes = NULL;
+  _size = 0;
+}
+
+TextureData::~TextureData()
+{
+  clear();
+}
+
+void
+TextureData::allocate(const TextureFormat *format, int width, int height, int numLevels)
+{
+  clear();
+  _format = format;
+  _width = width;
+  _height = height;
+  _size = computeTotalSize(format, width, height, numLevels, &_offsets);
+  _bytes = (uint8*)System::alignedMalloc(_size, 16);
+  alwaysAssertM(_bytes != NULL, "Out of memory allocating texture data");
+  uint8 *bytes = _bytes;
+  _release = [bytes] { System::alignedFree(bytes); };
+}
+
+void
+TextureData::borrow(const TextureFormat *format, int width, int height, int numLevels,
+                    uint8 *bytes, const std::function<void()> &release)
+{
+  clear();
+  _format = format;
+  _width = width;
+  _height = height;
+  _size = computeTotalSize(format, width, height, numLevels, &_offsets);
+  _bytes = bytes;
+  _release = release;
+}
+
+void
+TextureData::clear()
+{
+  if (_bytes && _release) {
+    _release();
+  }
+  _release = nullptr;
+  _bytes = NULL;
+  _size = 0;
+  _offsets.fastClear();
+  _format = NULL;
+  _width = 0;
+  _height = 0;
+}
+
+void
+TextureData::swap(TextureData &other)
+{
+  std::swap(_format, other._format);
+  std::swap(_width, other._width);
+  std::swap(_height, other._height);
+  std::swap(_offsets, other._offsets);
+  std::swap(_bytes, other._bytes);
+  std::swap(_size, other._size);
+  std::swap(_release, other._release);
+}
+
+void
+TextureData::generateMipmaps()
+{
+  alwaysAssertM(!_format->compressed, "Can't generate mipmaps for compressed texture data");
+  int channels = _format->packedBitsPerTexel / 8;
+
+  for (int l=1;l<numLevels();l++) {
+    const uint8 *src = levelData(l-1);
+    uint8 *dst = levelData(l);
+    int sw = levelWidth(l-1);
+    int sh = levelHeight(l-1);
+    int dw = levelWidth(l);
+    int dh = levelHeight(l);
+    for (int y=0;y<dh;y++) {
+      const uint8 *row0 = src + iMin(2*y, sh-1) * sw * channels;
+      const uint8 *row1 = src + iMin(2*y+1, sh-1) * sw * channels;
+      for (int x=0;x<dw;x++) {
+        int x0 = iMin(2*x, sw-1) * channels;
+        int x1 = iMin(2*x+1, sw-1) * channels;
+        for (int c=0;c<channels;c++) {
+          dst[(y*dw + x)*channels + c] = (uint8)((row0[x0+c] + row0[x1+c] + row1[x0+c] + row1[x1+c] + 2) / 4);
+        }
+      }
+    }
+  }
+}
+
+void
+TextureData::getLevelPointers(Array< Array<const void*> > &bytes) const
+{
+  bytes.resize(numLevels());
+  for (int l=0;l<numLevels();l++) {
+    bytes[l].fastClear();
+    bytes[l].append(levelData(l));
+  }
+}
+
+int
+TextureData::numMipLevels(int width, int height)
+{
+  int n = 1;
+  while ((width > 1) || (height > 1)) {
+    width = iMax(1, width / 2);
+    height = iMax(1, height / 2);
+    n++;
+  }
+  return n;
+}
+
+size_t
+TextureData::computeLevelSize(const TextureFormat *format, int width, int height)
+{
+  if (format->compressed) {
+    size_t blockBytes = ((format->code == TextureFormat::CODE_RGB_DXT1) ||
+                         (format->code == TextureFormat::CODE_RGBA_DXT1)) ? 8 : 16;
+    return (size_t)((width + 3) / 4) * (size_t)((height + 3) / 4) * blockBytes;
+  }
+  return (size_t)width * (size_t)height * (size_t)(format->packedBitsPerTexel / 8);
+}
+
+size_t
+TextureData::computeTotalSize(const TextureFormat *format, int width, int height,
+                              int numLevels, Array<size_t> *offsets)
+{
+  if (offsets) {
+    offsets->fastClear();
+  }
+  size_t size = 0;
+  for (int l=0;l<numLevels;l++) {
+    if (offsets) {
+      offsets->append(size);
+    }
+    size_t levelBytes = computeLevelSize(format, iMax(1, width >> l), iMax(1, height >> l));
+    size += (levelBytes + 15) & ~(size_t)15;
+  }
+  return size;
+}
@@ -0,0 +1,340 @@
+#include "../include/TextureLoader.H"
+#include "../include/TextureManifest.H"
+#include "../include/BlockCompressor.H"
+
+using namespace G3D;
+
+
+/***  TextureLoadRequest  ***/
+
+TextureLoadRequest::TextureLoadRequest()
+{
+  format = "AUTO";
+  wrap = WrapMode::TILE;
+  interp = Texture::TRILINEAR_MIPMAP;
+  dim = Texture::DIM_2D_NPOT;
+  brightness = 1.0;
+}
+
+Texture::Settings
+TextureLoadRequest::settings() const
+{
+  Texture::Settings s;
+  s.interpolateMode = interp;
+  s.wrapMode = wrap;
+  return s;
+}
+
+Texture::Preprocess
+TextureLoadRequest::preprocess() const
+{
+  Texture::Preprocess p;
+  if (!hasAlpha()) {
+    p.modulate = Color4(brightness, brightness, brightness);
+  }
+  return p;
+}
+
+const TextureFormat*
+TextureLoadRequest::textureFormat() const
+{
+  if (format == "L8")
+    return TextureFormat::L8();
+  else if (format == "A8")
+    return TextureFormat::A8();
+  else if (format == "LA8")
+    return TextureFormat::LA8();
+  else if (format == "RGB5")
+    return TextureFormat::RGB5();
+  else if (format == "RGB5A1")
+    return TextureFormat::RGB5A1();
+  else if (format == "RGB8")
+    return TextureFormat::RGB8();
+  else if (format == "RGBA8")
+    return TextureFormat::RGBA8();
+  else if (format == "RGB_DXT1")
+    return TextureFormat::RGB_DXT1();
+  else if (format == "RGBA_DXT1")
+    return TextureFormat::RGBA_DXT1();
+  else if (format == "RGBA_DXT3")
+    return TextureFormat::RGBA_DXT3();
+  else if (format == "RGBA_DXT5")
+    return TextureFormat::RGBA_DXT5();
+  else if (format == "AUTO")
+    return TextureFormat::AUTO();
+  else if (format == "") // format not specified, assume AUTO
+    return TextureFormat::AUTO();
+
+  alwaysAssertM(false, "Invalid texture format while loading texture from ConfigVal: " + format);
+  return NULL;
+}
+
+
+void
+parseTextureList(const std::string &textureList, Array<TextureLoadRequest> &requests)
+{
+  std::string error;
+  if (!TextureManifest::parse(textureList, requests, error)) {
+    alwaysAssertM(false, error);
+  }
+}
+
+
+
+/***  TextureLoadPipeline  ***/
+
+TextureLoadPipeline::TextureLoadPipeline(WorkerPool *pool, int queueCapacity)
+{
+  _pool = pool;
+  _capacity = iMax(1, queueCapacity);
+  _decode = &TextureLoadPipeline::decodeImageFiles;
+  _cache = NULL;
+  _started = false;
+  _nextToDecode = 0;
+  _nextToUpload = 0;
+  _numInFlight = 0;
+  _numDecoded = 0;
+  _numUploaded = 0;
+}
+
+TextureLoadPipeline::~TextureLoadPipeline()
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  _readyChanged.wait(lock, [this] { return _numInFlight == 0; });
+  for (size_t i=0;i<_ready.size();i++) {
+    delete _ready[i];
+  }
+}
+
+void
+TextureLoadPipeline::start(const Array<TextureLoadRequest> &requests)
+{
+  alwaysAssertM(!_started, "TextureLoadPipeline::start() can only be called once");
+  _started = true;
+  _requests = requests;
+  _ready.assign(_capacity, (DecodedTexture*)NULL);
+
+  std::unique_lock<std::mutex> lock(_mutex);
+  submitDecodes(lock);
+}
+
+void
+TextureLoadPipeline::submitDecodes(std::unique_lock<std::mutex> &lock)
+{
+  if ((_pool == NULL) || (_pool->numThreads() == 0)) {
+    // decoded on the calling thread in update()
+    return;
+  }
+  // Everything from _nextToUpload on is being decoded or waiting
+  while ((_nextToDecode < _requests.size()) &&
+         (_nextToDecode - _nextToUpload < _capacity)) {
+    int index = _nextToDecode++;
+    _numInFlight++;
+    _pool->submit([this, index] { runDecode(index); });
+  }
+}
+
+DecodedTexture*
+TextureLoadPipeline::decode(int index)
+{
+  DecodedTexture *decoded = new DecodedTexture();
+  decodeWithCache(_requests[index], _cache, _decode, *decoded);
+  return decoded;
+}
+
+void
+TextureLoadPipeline::decodeWithCache(const TextureLoadRequest &request, TextureCache *cache,
+                                     const DecodeFunc &decode, DecodedTexture &decoded)
+{
+  decoded.request = request;
+
+  std::string key;
+  if (cache && (request.dim != Texture::DIM_CUBE_MAP)) {
+    // compressed textures are stored as the BlockCompressor produced them
+    key = TextureCache::computeKey(request, request.textureFormat()->compressed ? BlockCompressor::VERSION : 0);
+    if (!key.empty() && cache->load(key, decoded.data)) {
+      decoded.ok = true;
+      decoded.fromCache = true;
+      return;
+    }
+  }
+
+  decode(request, decoded);
+
+  if (!key.empty() && decoded.ok && !decoded.loadOnUpload) {
+    cache->store(key, decoded.data);
+  }
+}
+
+void
+TextureLoadPipeline::runDecode(int index)
+{
+  DecodedTexture *decoded = decode(index);
+
+  // Notify while holding the lock, the destructor may be waiting to run
+  std::lock_guard<std::mutex> lock(_mutex);
+  _ready[index % _capacity] = decoded;
+  _numInFlight--;
+  _numDecoded++;
+  _readyChanged.notify_all();
+}
+
+int
+TextureLoadPipeline::update(const UploadFunc &upload, int maxUploads, bool wait)
+{
+  bool decodeInline = (_pool == NULL) || (_pool->numThreads() == 0);
+  int numUploaded = 0;
+
+  while ((maxUploads < 0) || (numUploaded < maxUploads)) {
+    DecodedTexture *decoded = NULL;
+
+    if (decodeInline) {
+      if (_nextToDecode == _requests.size()) {
+        break;
+      }
+      decoded = decode(_nextToDecode++);
+      _numDecoded++;
+    }
+    else {
+      std::unique_lock<std::mutex> lock(_mutex);
+      if (_nextToUpload == _requests.size()) {
+        break;
+      }
+      // Later images may be done already, but they wait their turn
+      DecodedTexture *&next = _ready[_nextToUpload % _capacity];
+      if (wait && (numUploaded == 0)) {
+        _readyChanged.wait(lock, [&next] { return next != NULL; });
+      }
+      if (next == NULL) {
+        break;
+      }
+      decoded = next;
+      next = NULL;
+      _nextToUpload++;
+      // a slot just freed up
+      submitDecodes(lock);
+    }
+
+    // Uploading happens outside the lock so the workers keep going
+    upload(*decoded);
+    delete decoded;
+    _numUploaded++;
+    numUploaded++;
+  }
+
+  return numUploaded;
+}
+
+double
+TextureLoadPipeline::getProgress() const
+{
+  if (_requests.size() == 0) {
+    return 100.0;
+  }
+  // decoding is by far the slower stage
+  return 100.0 * (0.8 * _numDecoded + 0.2 * _numUploaded) / (double)_requests.size();
+}
+
+bool
+TextureLoadPipeline::usesMipmaps(const TextureLoadRequest &request)
+{
+  return (request.dim != Texture::DIM_2D_RECT) &&
+         ((request.interp == Texture::TRILINEAR_MIPMAP) ||
+          (request.interp == Texture::BILINEAR_MIPMAP) ||
+          (request.interp == Texture::NEAREST_MIPMAP));
+}
+
+void
+TextureLoadPipeline::decodeImageFiles(const TextureLoadRequest &request, DecodedTexture &decoded)
+{
+  if (request.dim == Texture::DIM_CUBE_MAP) {
+    // the six faces are found by the upload stage from the filename pattern
+    decoded.loadOnUpload = true;
+    decoded.ok = true;
+    return;
+  }
+
+  try {
+    GImage color(request.filename);
+    GImage alpha;
+    if (request.hasAlpha()) {
+      alpha = GImage(request.alphaFilename);
+      if ((alpha.width() != color.width()) || (alpha.height() != color.height())) {
+        decoded.ok = false;
+        decoded.error = "Alpha image " + request.alphaFilename + " is not the same size as " + request.filename;
+        return;
+      }
+    }
+
+    int cc = color.channels();
+    const TextureFormat *bytesFormat;
+    int channels;
+    if (request.hasAlpha() || (cc == 4)) {
+      bytesFormat = TextureFormat::RGBA8();
+      channels = 4;
+    }
+    else if (cc == 3) {
+      bytesFormat = TextureFormat::RGB8();
+      channels = 3;
+    }
+    else if (cc == 2) {
+      bytesFormat = TextureFormat::LA8();
+      channels = 2;
+    }
+    else {
+      bytesFormat = TextureFormat::L8();
+      channels = 1;
+    }
+
+    int w = color.width();
+    int h = color.height();
+    int numLevels = usesMipmaps(request) ? TextureData::numMipLevels(w, h) : 1;
+    decoded.data.allocate(bytesFormat, w, h, numLevels);
+
+    // Same as Texture::Preprocess::modulate, which is not applied to two
+    // file textures.  Alpha is left alone.
+    int scale = iRound(256.0 * request.preprocess().modulate.r);
+    int numColorChannels = ((channels == 2) || (channels == 4)) ? channels - 1 : channels;
+
+    int n = w * h;
+    const uint8 *src = color.byte();
+    const uint8 *a = request.hasAlpha() ? alpha.byte() : NULL;
+    int ac = request.hasAlpha() ? alpha.channels() : 0;
+    uint8 *dst = decoded.data.levelData(0);
+    for (int i=0;i<n;i++) {
+      for (int c=0;c<channels;c++) {
+        int v;
+        if (a && (c == 3)) {
+          v = a[ac*i];
+        }
+        else if (a && (cc < 3)) {
+          v = src[cc*i];
+        }
+        else {
+          v = src[cc*i + c];
+        }
+        if ((c < numColorChannels) && (scale != 256)) {
+          v = iMin(255, (v * scale) >> 8);
+        }
+        dst[channels*i + c] = (uint8)v;
+      }
+    }
+
+    decoded.data.generateMipmaps();
+
+    // Compress here on the worker thread rather than in the driver when
+    // the texture is uploaded
+    const TextureFormat *target = request.textureFormat();
+    if (target->compressed && BlockCompressor::canCompress(target)) {
+      TextureData compressed;
+      BlockCompressor::compress(decoded.data, target, compressed);
+      decoded.data.swap(compressed);
+    }
+    decoded.ok = true;
+  }
+  catch (GImage::Error &texErr) {
+    decoded.ok = false;
+    decoded.error = texErr.reason;
+    decoded.data.clear();
+  }
+}
@@ -0,0 +1,444 @@
+#include "../include/TextureManifest.H"
+#include <stdio.h>
+
+using namespace G3D;
+
+
+namespace {
+
+struct WrapName {
+  const char *name;
+  WrapMode    mode;
+};
+
+struct InterpName {
+  const char                  *name;
+  Texture::InterpolateMode     mode;
+};
+
+struct DimName {
+  const char          *name;
+  Texture::Dimension   dim;
+};
+
+// The binary form stores indices into these tables, only append to them
+const WrapName wrapNames[] = {
+  {"TILE",   WrapMode::TILE},
+  {"CLAMP",  WrapMode::CLAMP},
+  {"IGNORE", WrapMode::IGNORE},
+  {"ZERO",   WrapMode::ZERO},
+  {"ERROR",  WrapMode::ERROR}
+};
+
+const InterpName interpNames[] = {
+  {"TRILINEAR_MIPMAP",   Texture::TRILINEAR_MIPMAP},
+  {"BILINEAR_MIPMAP",    Texture::BILINEAR_MIPMAP},
+  {"NEAREST_MIPMAP",     Texture::NEAREST_MIPMAP},
+  {"BILINEAR_NO_MIPMAP", Texture::BILINEAR_NO_MIPMAP},
+  {"NEAREST_NO_MIPMAP",  Texture::NEAREST_NO_MIPMAP}
+};
+
+const DimName dimNames[] = {
+  {"DIM_2D",       Texture::DIM_2D},
+  {"DIM_2D_RECT",  Texture::DIM_2D_RECT},
+  {"DIM_CUBE_MAP", Texture::DIM_CUBE_MAP},
+  {"DIM_2D_NPOT",  Texture::DIM_2D_NPOT}
+};
+
+/// The formats TextureLoadRequest::textureFormat() accepts
+const char *formatNames[] = {
+  "L8", "A8", "LA8", "RGB5", "RGB5A1", "RGB8", "RGBA8",
+  "RGB_DXT1", "RGBA_DXT1", "RGBA_DXT3", "RGBA_DXT5", "AUTO"
+};
+
+const int numWrapNames = sizeof(wrapNames) / sizeof(wrapNames[0]);
+const int numInterpNames = sizeof(interpNames) / sizeof(interpNames[0]);
+const int numDimNames = sizeof(dimNames) / sizeof(dimNames[0]);
+const int numFormatNames = sizeof(formatNames) / sizeof(formatNames[0]);
+
+inline bool
+tokenEquals(const char *token, size_t length, const char *name)
+{
+  // The token may hold a \0, so don't let strncmp() stop early
+  return (strlen(name) == length) && (memcmp(token, name, length) == 0);
+}
+
+
+/// Single pass parser for the LoadTextures format.
+class ManifestParser
+{
+public:
+  ManifestParser(const char *text, size_t length, std::string &error) :
+    _begin(text), _p(text), _end(text + length), _entry(0), _error(error) {}
+
+  bool parse(Array<TextureLoadRequest> &requests) {
+    skipSpace();
+    while (_p < _end) {
+      _entry++;
+      TextureLoadRequest &req = requests.next();
+      if (!parseEntry(req)) {
+        requests.pop();
+        return false;
+      }
+      skipSpace();
+    }
+    return true;
+  }
+
+private:
+  static bool isSpace(char c) {
+    return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r');
+  }
+
+  void skipSpace() {
+    while ((_p < _end) && isSpace(*_p)) {
+      _p++;
+    }
+  }
+
+  /// Reads the token at _p, which ends at whitespace, ; or ,.  Returns
+  /// false if there isn't one.
+  bool token(const char *&start, size_t &length) {
+    skipSpace();
+    start = _p;
+    while ((_p < _end) && !isSpace(*_p) && (*_p != ';') && (*_p != ',')) {
+      _p++;
+    }
+    length = _p - start;
+    return length > 0;
+  }
+
+  bool fail(const char *at, const std::string &msg) {
+    _error = format("LoadTextures entry %d, offset %d: ", _entry, (int)(at - _begin)) + msg;
+    return false;
+  }
+
+  bool parseEntry(TextureLoadRequest &req) {
+    const char *s;
+    size_t n;
+    if (!token(s, n)) {
+      return fail(s, "Expected a filename");
+    }
+    req.filename.assign(s, n);
+
+    skipSpace();
+    if ((_p < _end) && (*_p == ',')) {
+      _p++;
+      if (!token(s, n)) {
+        return fail(s, "Expected a filename for the alpha channel after the ,");
+      }
+      req.alphaFilename.assign(s, n);
+      // assume format of RGBA8 if alpha is specified, AUTO doesn't seem to work by default.
+      req.format = "RGBA8";
+    }
+
+    if (!token(s, n)) {
+      return fail(s, "Expected a keyname");
+    }
+    req.keyName.assign(s, n);
+
+    // Optional settings in order: format, wrap mode, interpolate mode,
+    // dimension and brightness
+    for (int field=0; ;field++) {
+      skipSpace();
+      if (_p == _end) {
+        return fail(_p, "Expected a ; to signal the end of each texture");
+      }
+      if (*_p == ';') {
+        break;
+      }
+      if (!token(s, n)) {
+        return fail(s, "Unexpected ,");
+      }
+      if (field == 5) {
+        return fail(s, "Unexpected " + std::string(s, n) + " after the brightness, expected a ;");
+      }
+      if (!parseField(req, field, s, n)) {
+        return false;
+      }
+    }
+    // skip the ;
+    _p++;
+    return true;
+  }
+
+  bool parseField(TextureLoadRequest &req, int field, const char *s, size_t n) {
+    switch (field) {
+    case 0:
+      for (int i=0;i<numFormatNames;i++) {
+        if (tokenEquals(s, n, formatNames[i])) {
+          req.format = formatNames[i];
+          return true;
+        }
+      }
+      return fail(s, "Invalid texture format: " + std::string(s, n));
+    case 1:
+      for (int i=0;i<numWrapNames;i++) {
+        if (tokenEquals(s, n, wrapNames[i].name)) {
+          req.wrap = wrapNames[i].mode;
+          return true;
+        }
+      }
+      return fail(s, "Invalid wrap mode: " + std::string(s, n));
+    case 2:
+      for (int i=0;i<numInterpNames;i++) {
+        if (tokenEquals(s, n, interpNames[i].name)) {
+          req.interp = interpNames[i].mode;
+          return true;
+        }
+      }
+      return fail(s, "Invalid interpolation mode: " + std::string(s, n));
+    case 3:
+      for (int i=0;i<numDimNames;i++) {
+        if (tokenEquals(s, n, dimNames[i].name)) {
+          req.dim = dimNames[i].dim;
+          return true;
+        }
+      }
+      return fail(s, "Invalid dimension: " + std::string(s, n));
+    default: {
+      // strtod needs a terminated string, the token is short
+      std::string number(s, n);
+      char *numberEnd;
+      double brightness = strtod(number.c_str(), &numberEnd);
+      if (numberEnd != number.c_str() + n) {
+        return fail(s, "Invalid brightness: " + number);
+      }
+      req.brightness = brightness;
+      return true;
+    }
+    }
+  }
+
+  const char   *_begin;
+  const char   *_p;
+  const char   *_end;
+  int           _entry;
+  std::string  &_error;
+};
+
+
+const char   MANIFEST_MAGIC[8] = {'V','R','G','3','D','T','M','\0'};
+const uint32 MANIFEST_VERSION = 1;
+
+template <class T>
+int
+findIndex(const T *names, int numNames, const char *name)
+{
+  for (int i=0;i<numNames;i++) {
+    if (strcmp(names[i].name, name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void
+appendBytes(Array<uint8> &bytes, const void *data, size_t length)
+{
+  int start = bytes.size();
+  bytes.resize(start + (int)length);
+  System::memcpy(bytes.getCArray() + start, data, length);
+}
+
+void
+appendUInt32(Array<uint8> &bytes, uint32 value)
+{
+  appendBytes(bytes, &value, sizeof(value));
+}
+
+void
+appendString(Array<uint8> &bytes, const std::string &s)
+{
+  appendUInt32(bytes, (uint32)s.size());
+  appendBytes(bytes, s.c_str(), s.size());
+}
+
+
+/// Bounds checked reads from a serialized manifest
+class ManifestReader
+{
+public:
+  ManifestReader(const uint8 *bytes, size_t length) : _p(bytes), _end(bytes + length) {}
+
+  bool read(void *data, size_t length) {
+    if ((size_t)(_end - _p) < length) {
+      return false;
+    }
+    System::memcpy(data, _p, length);
+    _p += length;
+    return true;
+  }
+
+  bool readUInt32(uint32 &value) { return read(&value, sizeof(value)); }
+
+  bool readString(std::string &s) {
+    uint32 length;
+    if (!readUInt32(length) || ((size_t)(_end - _p) < length)) {
+      return false;
+    }
+    s.assign((const char*)_p, length);
+    _p += length;
+    return true;
+  }
+
+private:
+  const uint8 *_p;
+  const uint8 *_end;
+};
+
+} // end namespace
+
+
+bool
+TextureManifest::parse(const std::string &text, Array<TextureLoadRequest> &requests, std::string &error)
+{
+  return parse(text.c_str(), text.size(), requests, error);
+}
+
+bool
+TextureManifest::parse(const char *text, size_t length, Array<TextureLoadRequest> &requests, std::string &error)
+{
+  ManifestParser parser(text, length, error);
+  return parser.parse(requests);
+}
+
+void
+TextureManifest::serialize(const Array<TextureLoadRequest> &requests, Array<uint8> &bytes)
+{
+  bytes.fastClear();
+  appendBytes(bytes, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+  appendUInt32(bytes, MANIFEST_VERSION);
+  appendUInt32(bytes, (uint32)requests.size());
+
+  for (int i=0;i<requests.size();i++) {
+    const TextureLoadRequest &req = requests[i];
+    appendString(bytes, req.filename);
+    appendString(bytes, req.alphaFilename);
+    appendString(bytes, req.keyName);
+    appendString(bytes, req.format);
+
+    uint8 codes[3] = {0, 0, 0};
+    for (int w=0;w<numWrapNames;w++) {
+      if (wrapNames[w].mode == req.wrap) {
+        codes[0] = (uint8)w;
+      }
+    }
+    for (int m=0;m<numInterpNames;m++) {
+      if (interpNames[m].mode == req.interp) {
+        codes[1] = (uint8)m;
+      }
+    }
+    for (int d=0;d<numDimNames;d++) {
+      if (dimNames[d].dim == req.dim) {
+        codes[2] = (uint8)d;
+      }
+    }
+    appendBytes(bytes, codes, sizeof(codes));
+    appendBytes(bytes, &req.brightness, sizeof(req.brightness));
+  }
+}
+
+bool
+TextureManifest::deserialize(const uint8 *bytes, size_t length, Array<TextureLoadRequest> &requests,
+                             std::string &error)
+{
+  ManifestReader in(bytes, length);
+
+  char magic[sizeof(MANIFEST_MAGIC)];
+  uint32 version, count;
+  if (!in.read(magic, sizeof(magic)) || (memcmp(magic, MANIFEST_MAGIC, sizeof(magic)) != 0)) {
+    error = "Not a pre-compiled texture manifest";
+    return false;
+  }
+  if (!in.readUInt32(version) || (version != MANIFEST_VERSION)) {
+    error = "Unsupported texture manifest version, compile it again";
+    return false;
+  }
+  if (!in.readUInt32(count)) {
+    error = "Truncated texture manifest";
+    return false;
+  }
+
+  for (uint32 i=0;i<count;i++) {
+    TextureLoadRequest req;
+    uint8 codes[3];
+    if (!in.readString(req.filename) || !in.readString(req.alphaFilename) ||
+        !in.readString(req.keyName) || !in.readString(req.format) ||
+        !in.read(codes, sizeof(codes)) || !in.read(&req.brightness, sizeof(req.brightness))) {
+      error = format("Truncated texture manifest at entry %d", (int)i + 1);
+      return false;
+    }
+    if ((codes[0] >= numWrapNames) || (codes[1] >= numInterpNames) || (codes[2] >= numDimNames)) {
+      error = format("Corrupt settings in texture manifest entry %d", (int)i + 1);
+      return false;
+    }
+    req.wrap = wrapNames[codes[0]].mode;
+    req.interp = interpNames[codes[1]].mode;
+    req.dim = dimNames[codes[2]].dim;
+    requests.append(req);
+  }
+  return true;
+}
+
+bool
+TextureManifest::writeBinary(const std::string &filename, const Array<TextureLoadRequest> &requests)
+{
+  Array<uint8> bytes;
+  serialize(requests, bytes);
+
+  FILE *f = fopen(filename.c_str(), "wb");
+  if (f == NULL) {
+    return false;
+  }
+  bool ok = (fwrite(bytes.getCArray(), 1, bytes.size(), f) == (size_t)bytes.size());
+  ok = (fclose(f) == 0) && ok;
+  return ok;
+}
+
+bool
+TextureManifest::readBinary(const std::string &filename, Array<TextureLoadRequest> &requests, std::string &error)
+{
+  FILE *f = fopen(filename.c_str(), "rb");
+  if (f == NULL) {
+    error = "Can't open texture manifest " + filename;
+    return false;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  Array<uint8> bytes;
+  bytes.resize(iMax(0, (int)size));
+  bool ok = (size >= 0) && (fread(bytes.getCArray(), 1, bytes.size(), f) == (size_t)bytes.size());
+  fclose(f);
+  if (!ok) {
+    error = "Can't read texture manifest " + filename;
+    return false;
+  }
+  if (!deserialize(bytes.getCArray(), bytes.size(), requests, error)) {
+    error = filename + ": " + error;
+    return false;
+  }
+  return true;
+}
+
+bool
+TextureManifest::compile(const std::string &text, const std::string &filename, std::string &error)
+{
+  Array<TextureLoadRequest> requests;
+  if (!parse(text, requests, error)) {
+    return false;
+  }
+  if (!writeBinary(filename, requests)) {
+    error = "Can't write texture manifest " + filename;
+    return false;
+  }
+  return true;
+}
+
+bool
+TextureManifest::isBinaryManifestName(const std::string &filename)
+{
+  return (filename.size() > 4) && (filename.compare(filename.size() - 4, 4, ".vtm") == 0);
+}
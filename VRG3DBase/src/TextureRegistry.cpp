@@ -0,0 +1,117 @@
+#include "../include/TextureRegistry.H"
+
+using namespace G3D;
+
+
+TextureRegistry::TextureRegistry(TextureResidencyRef residency)
+{
+  _residency = residency;
+}
+
+TextureID
+TextureRegistry::intern(const std::string &keyName)
+{
+  TextureID id;
+  if (_ids.get(keyName, id)) {
+    return id;
+  }
+  id = _names.size();
+  _ids.set(keyName, id);
+  _names.append(keyName);
+  _slots.append(-1);
+  UVTransform &uv = _uvTransforms.next();
+  uv.scale = Vector2(1,1);
+  uv.offset = Vector2(0,0);
+  uv.atlased = false;
+  return id;
+}
+
+TextureID
+TextureRegistry::find(const std::string &keyName) const
+{
+  TextureID id = -1;
+  _ids.get(keyName, id);
+  return id;
+}
+
+void
+TextureRegistry::bind(TextureID id, int slot)
+{
+  UVTransform &uv = _uvTransforms[id];
+  uv.scale = Vector2(1,1);
+  uv.offset = Vector2(0,0);
+  uv.atlased = false;
+
+  int oldSlot = _slots[id];
+  if (oldSlot == slot) {
+    return;
+  }
+  _slots[id] = slot;
+
+  if (oldSlot >= 0) {
+    _slotUsers[oldSlot]--;
+    if (_slotUsers[oldSlot] == 0) {
+      _residency->remove(oldSlot);
+      _idBySlot[oldSlot] = -1;
+    }
+    else if (_idBySlot[oldSlot] == id) {
+      // Only atlases are shared, find another id still using it
+      for (int i=0;i<_slots.size();i++) {
+        if (_slots[i] == oldSlot) {
+          _idBySlot[oldSlot] = i;
+          break;
+        }
+      }
+    }
+  }
+
+  if (slot >= 0) {
+    while (_idBySlot.size() <= slot) {
+      _idBySlot.append(-1);
+      _slotUsers.append(0);
+    }
+    _idBySlot[slot] = id;
+    _slotUsers[slot]++;
+  }
+}
+
+void
+TextureRegistry::setUVTransform(TextureID id, const Vector2 &scale, const Vector2 &offset)
+{
+  UVTransform &uv = _uvTransforms[id];
+  uv.scale = scale;
+  uv.offset = offset;
+  uv.atlased = true;
+}
+
+void
+TextureRegistry::get(const TextureID *ids, int n, TextureRef *out)
+{
+  for (int i=0;i<n;i++) {
+    out[i] = get(ids[i]);
+  }
+}
+
+void
+TextureRegistry::intern(const Array<std::string> &keyNames, TextureID *out)
+{
+  for (int i=0;i<keyNames.size();i++) {
+    out[i] = intern(keyNames[i]);
+  }
+}
+
+TextureID
+TextureRegistry::findTexture(const TextureRef &tex) const
+{
+  return findBySlot(_residency->findLoaded(tex));
+}
+
+void
+TextureRegistry::getBoundKeyNames(Array<std::string> &keyNames) const
+{
+  for (int i=0;i<_names.size();i++) {
+    if (_slots[i] >= 0) {
+      keyNames.append(_names[i]);
+    }
+  }
+}
@@ -0,0 +1,254 @@
+#include "../include/TextureResidency.H"
+
+using namespace G3D;
+
+
+TextureResidency::TextureResidency(TextureResidencyLoader *loader, int64 budgetBytes)
+{
+  _loader = loader;
+  _lruHead = -1;
+  _lruTail = -1;
+  _frame = 0;
+  _budget = budgetBytes;
+  _residentBytes = 0;
+  _numLoads = 0;
+  _numEvictions = 0;
+  _numFailures = 0;
+}
+
+TextureResidency::~TextureResidency()
+{
+  delete _loader;
+}
+
+int
+TextureResidency::newSlot()
+{
+  Slot &s = _slots.next();
+  s.request = TextureLoadRequest();
+  s.tex = NULL;
+  s.bytes = 0;
+  s.valid = true;
+  s.resident = false;
+  s.pinned = false;
+  s.failed = false;
+  s.lastUsed = 0;
+  s.prev = -1;
+  s.next = -1;
+  return _slots.size() - 1;
+}
+
+int
+TextureResidency::add(const TextureLoadRequest &request)
+{
+  int id = newSlot();
+  _slots[id].request = request;
+  return id;
+}
+
+int
+TextureResidency::addLoaded(const TextureLoadRequest &request, TextureRef tex, size_t bytes)
+{
+  int id = add(request);
+  setTexture(id, tex);
+  Slot &s = _slots[id];
+  s.bytes = bytes;
+  s.resident = true;
+  s.lastUsed = _frame;
+  _residentBytes += bytes;
+  linkAtTail(id);
+  evictOverBudget();
+  return id;
+}
+
+int
+TextureResidency::addPinned(TextureRef tex)
+{
+  int id = newSlot();
+  setTexture(id, tex);
+  Slot &s = _slots[id];
+  s.resident = true;
+  s.pinned = true;
+  s.lastUsed = _frame;
+  return id;
+}
+
+void
+TextureResidency::remove(int id)
+{
+  if (!isValid(id)) {
+    return;
+  }
+  Slot &s = _slots[id];
+  if (s.resident && !s.pinned) {
+    unlink(id);
+    _residentBytes -= s.bytes;
+  }
+  setTexture(id, NULL);
+  s.request = TextureLoadRequest();
+  s.resident = false;
+  s.valid = false;
+}
+
+TextureRef
+TextureResidency::get(int id)
+{
+  if (!isValid(id)) {
+    return NULL;
+  }
+
+  Slot &s = _slots[id];
+  s.lastUsed = _frame;
+  if (s.pinned) {
+    return s.tex;
+  }
+
+  if (s.resident) {
+    // move to the most recently used end
+    unlink(id);
+    linkAtTail(id);
+    return s.tex;
+  }
+  if (s.failed) {
+    return NULL;
+  }
+
+  TextureLoadRequest request = s.request;
+  TextureRef tex;
+  size_t bytes = 0;
+  if (!_loader->load(request, tex, bytes)) {
+    // don't decode a broken file again every time it's drawn
+    _slots[id].failed = true;
+    _numFailures++;
+    return NULL;
+  }
+  _numLoads++;
+
+  // the loader may have added textures, re-fetch the slot
+  setTexture(id, tex);
+  Slot &loaded = _slots[id];
+  loaded.bytes = bytes;
+  loaded.resident = true;
+  _residentBytes += bytes;
+  linkAtTail(id);
+  evictOverBudget();
+  return tex;
+}
+
+TextureRef
+TextureResidency::peek(int id) const
+{
+  if (!isValid(id) || !_slots[id].resident) {
+    return NULL;
+  }
+  return _slots[id].tex;
+}
+
+int
+TextureResidency::findLoaded(const TextureRef &tex) const
+{
+  if (tex.isNull()) {
+    return -1;
+  }
+  std::unordered_map<const Texture*, int>::const_iterator it = _idByTexture.find(tex.pointer());
+  return (it == _idByTexture.end()) ? -1 : it->second;
+}
+
+void
+TextureResidency::setTexture(int id, const TextureRef &tex)
+{
+  Slot &s = _slots[id];
+  if (s.tex.notNull()) {
+    _idByTexture.erase(s.tex.pointer());
+  }
+  s.tex = tex;
+  if (tex.notNull()) {
+    _idByTexture[tex.pointer()] = id;
+  }
+}
+
+bool
+TextureResidency::isValid(int id) const
+{
+  return (id >= 0) && (id < _slots.size()) && _slots[id].valid;
+}
+
+bool
+TextureResidency::isResident(int id) const
+{
+  return isValid(id) && _slots[id].resident;
+}
+
+uint64
+TextureResidency::lastUsedFrame(int id) const
+{
+  return isValid(id) ? _slots[id].lastUsed : 0;
+}
+
+void
+TextureResidency::setBudget(int64 budgetBytes)
+{
+  _budget = budgetBytes;
+  evictOverBudget();
+}
+
+void
+TextureResidency::linkAtTail(int id)
+{
+  Slot &s = _slots[id];
+  s.prev = _lruTail;
+  s.next = -1;
+  if (_lruTail >= 0) {
+    _slots[_lruTail].next = id;
+  }
+  else {
+    _lruHead = id;
+  }
+  _lruTail = id;
+}
+
+void
+TextureResidency::unlink(int id)
+{
+  Slot &s = _slots[id];
+  if (s.prev >= 0) {
+    _slots[s.prev].next = s.next;
+  }
+  else {
+    _lruHead = s.next;
+  }
+  if (s.next >= 0) {
+    _slots[s.next].prev = s.prev;
+  }
+  else {
+    _lruTail = s.prev;
+  }
+  s.prev = -1;
+  s.next = -1;
+}
+
+void
+TextureResidency::evictOverBudget()
+{
+  if (_budget <= 0) {
+    return;
+  }
+  // Textures used this frame are needed for drawing it, so they stay even
+  // if that means going over budget until the next frame.
+  while ((_residentBytes > _budget) && (_lruHead >= 0) &&
+         (_slots[_lruHead].lastUsed < _frame)) {
+    release(_lruHead);
+    _numEvictions++;
+  }
+}
+
+void
+TextureResidency::release(int id)
+{
+  Slot &s = _slots[id];
+  unlink(id);
+  _residentBytes -= s.bytes;
+  setTexture(id, NULL);
+  s.bytes = 0;
+  s.resident = false;
+}
@@ -0,0 +1,264 @@
+#include "../include/TimerWheel.H"
+#include <algorithm>
+
+using namespace G3D;
+
+
+TimerWheel::TimerWheel(double tickSeconds)
+{
+  debugAssert(tickSeconds > 0.0);
+  _tickSeconds = tickSeconds;
+  _started = false;
+  _origin = 0.0;
+  _tick = 0;
+  _nextSeq = 0;
+  _free = -1;
+  for (int l=0;l<NUM_LISTS;l++) {
+    _heads[l] = -1;
+  }
+  for (int l=0;l<LEVELS;l++) {
+    _levelCount[l] = 0;
+  }
+  _numPending = 0;
+}
+
+TimerWheel::~TimerWheel()
+{
+}
+
+int64
+TimerWheel::tickOf(double time) const
+{
+  // Monotonic in time, so a timer due by now is never in a later tick
+  // than now
+  return (int64)floor((time - _origin) / _tickSeconds);
+}
+
+TimerWheel::Handle
+TimerWheel::add(MinVR::EventRef event, double now, double delay, double period)
+{
+  if (!_started) {
+    _started = true;
+    _origin = now;
+  }
+
+  int i;
+  if (_free >= 0) {
+    i = _free;
+    _free = _timers[i].next;
+  }
+  else {
+    i = _timers.size();
+    Timer &t = _timers.next();
+    t.generation = 0;
+  }
+  Timer &t = _timers[i];
+  t.time = now + delay;
+  t.tick = tickOf(t.time);
+  t.seq = _nextSeq++;
+  t.period = period;
+  t.event = event;
+  insert(i);
+  _numPending++;
+
+  Handle h;
+  h.index = i;
+  h.generation = t.generation;
+  return h;
+}
+
+bool
+TimerWheel::isPending(Handle handle) const
+{
+  return (handle.index >= 0) && (handle.index < _timers.size()) &&
+    (_timers[handle.index].generation == handle.generation) &&
+    (_timers[handle.index].list >= 0);
+}
+
+bool
+TimerWheel::cancel(Handle handle)
+{
+  if (!isPending(handle)) {
+    return false;
+  }
+  unlink(handle.index);
+  release(handle.index);
+  _numPending--;
+  return true;
+}
+
+void
+TimerWheel::insert(int i)
+{
+  Timer &t = _timers[i];
+  int64 delta = t.tick - _tick;
+  if (delta <= 0) {
+    link(i, HOLD_LIST);
+    return;
+  }
+  int level = 0;
+  while ((level < LEVELS-1) && (delta >= ((int64)1 << (LEVEL_BITS * (level+1))))) {
+    level++;
+  }
+  int64 tick = t.tick;
+  if (delta >= ((int64)1 << (LEVEL_BITS * LEVELS))) {
+    // Beyond the last wheel, it is placed again when this slot comes round
+    tick = _tick + ((int64)1 << (LEVEL_BITS * LEVELS)) - 1;
+  }
+  int slot = (int)((tick >> (LEVEL_BITS * level)) & (SLOTS-1));
+  link(i, level * SLOTS + slot);
+}
+
+void
+TimerWheel::link(int i, int list)
+{
+  Timer &t = _timers[i];
+  t.list = list;
+  t.prev = -1;
+  t.next = _heads[list];
+  if (t.next >= 0) {
+    _timers[t.next].prev = i;
+  }
+  _heads[list] = i;
+  if (list < HOLD_LIST) {
+    _levelCount[list / SLOTS]++;
+  }
+}
+
+void
+TimerWheel::unlink(int i)
+{
+  Timer &t = _timers[i];
+  if (t.prev >= 0) {
+    _timers[t.prev].next = t.next;
+  }
+  else {
+    _heads[t.list] = t.next;
+  }
+  if (t.next >= 0) {
+    _timers[t.next].prev = t.prev;
+  }
+  if (t.list < HOLD_LIST) {
+    _levelCount[t.list / SLOTS]--;
+  }
+  t.list = -1;
+}
+
+void
+TimerWheel::release(int i)
+{
+  Timer &t = _timers[i];
+  t.event = NULL;
+  t.generation++;
+  t.list = -1;
+  t.next = _free;
+  _free = i;
+}
+
+void
+TimerWheel::cascade(int level, int slot)
+{
+  int list = level * SLOTS + slot;
+  int i = _heads[list];
+  _heads[list] = -1;
+  while (i >= 0) {
+    int next = _timers[i].next;
+    _levelCount[level]--;
+    insert(i);
+    i = next;
+  }
+}
+
+void
+TimerWheel::advance(double now, Array<MinVR::EventRef> &due)
+{
+  if (!_started) {
+    _started = true;
+    _origin = now;
+  }
+  int64 target = tickOf(now);
+
+  while (_tick < target) {
+    // Skip ahead over stretches where the lower wheels are empty, up to
+    // the next tick where a higher wheel may cascade into them
+    int empty = 0;
+    while ((empty < LEVELS) && (_levelCount[empty] == 0)) {
+      empty++;
+    }
+    if (empty == LEVELS) {
+      _tick = target;
+      break;
+    }
+    if (empty > 0) {
+      int64 next = ((_tick >> (LEVEL_BITS * empty)) + 1) << (LEVEL_BITS * empty);
+      if (next > target) {
+        _tick = target;
+        break;
+      }
+      _tick = next - 1;
+    }
+
+    _tick++;
+    for (int l=1;l<LEVELS;l++) {
+      if ((_tick & (((int64)1 << (LEVEL_BITS * l)) - 1)) != 0) {
+        break;
+      }
+      cascade(l, (int)((_tick >> (LEVEL_BITS * l)) & (SLOTS-1)));
+    }
+    // Everything in this tick's slot is due by the end of the tick
+    int list = (int)(_tick & (SLOTS-1));
+    int i = _heads[list];
+    while (i >= 0) {
+      int next = _timers[i].next;
+      unlink(i);
+      link(i, HOLD_LIST);
+      i = next;
+    }
+  }
+
+  // The hold list has the timers of earlier ticks and of this one, some
+  // of which may not be due until later in the tick
+  _fired.fastClear();
+  int h = _heads[HOLD_LIST];
+  while (h >= 0) {
+    int next = _timers[h].next;
+    if (_timers[h].time <= now) {
+      unlink(h);
+      _fired.append(h);
+    }
+    h = next;
+  }
+  if (_fired.size() == 0) {
+    return;
+  }
+
+  const Array<Timer> &timers = _timers;
+  std::sort(_fired.getCArray(), _fired.getCArray() + _fired.size(), [&timers](int a, int b) {
+      if (timers[a].time != timers[b].time) {
+        return timers[a].time < timers[b].time;
+      }
+      return timers[a].seq < timers[b].seq;
+    });
+
+  for (int f=0;f<_fired.size();f++) {
+    int i = _fired[f];
+    Timer &t = _timers[i];
+    due.append(t.event);
+    if (t.period > 0.0) {
+      t.time += t.period;
+      if (t.time <= now) {
+        t.time += t.period * (floor((now - t.time) / t.period) + 1.0);
+        while (t.time <= now) {
+          t.time += t.period;
+        }
+      }
+      t.tick = tickOf(t.time);
+      t.seq = _nextSeq++;
+      insert(i);
+    }
+    else {
+      release(i);
+      _numPending--;
+    }
+  }
+}
@@ -31,6 +31,7 @@
     _gfxMgr->getLighting()->ambientBottom = MinVR::ConfigVal("AmbientBottom", defaultLtCol, false);
     _gfxMgr->getLighting()->lightArray.append(G3D::GLight::directional(G3D::Vector3(0, 1, 1).unit(), G3D::Color3(0.5, 0.5, 0.5)));
     _gfxMgr->loadTexturesFromConfigVal("LoadTextures", _log);
+    _poseRequested = true;
 
     // Startup the event mgr
     _eventMgr = new EventMgr(_log);
@@ -71,6 +72,14 @@
 		}
 #endif
     }
+    // The GfxMgr's frames follow the rendered frames, whether or not
+    // anything was posed.  Input only asks for a new pose, which is done
+    // here once per frame after its events have been processed.
+    _gfxMgr->beginFrame();
+    if (_poseRequested) {
+      _poseRequested = false;
+      _gfxMgr->poseFrame();
+    }
     VRG3DApp::onRenderGraphicsContext(state);
   }
 
@@ -109,14 +118,14 @@
          _eventMgr->queueEvent(events[i]);
        }
        
-       _gfxMgr->poseFrame();
+       _poseRequested = true;
      }
    }
 
    void VRG3DBaseApp::onAnalogChange(const MinVR::VRAnalogEvent &event)
    {
      _eventMgr->queueEvent(new MinVR::VRG3DEvent(event.getName(), event.getValue()));
-     _gfxMgr->poseFrame();
+     _poseRequested = true;
    }
 
 
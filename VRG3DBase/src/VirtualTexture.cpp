@@ -0,0 +1,391 @@
+#include "../include/VirtualTexture.H"
+
+using namespace G3D;
+
+
+/***  VirtualTextureTileCache  ***/
+
+VirtualTextureTileCache::VirtualTextureTileCache(int numSlots)
+{
+  _lruHead = -1;
+  _lruTail = -1;
+  _numEvictions = 0;
+  _slots.resize(numSlots);
+  for (int i=0;i<numSlots;i++) {
+    Slot &s = _slots[i];
+    s.key = 0;
+    s.lastUsed = 0;
+    s.used = false;
+    s.pinned = false;
+    s.prev = -1;
+    s.next = -1;
+  }
+}
+
+int
+VirtualTextureTileCache::find(uint64 key) const
+{
+  std::unordered_map<uint64, int>::const_iterator it = _slotByKey.find(key);
+  return (it == _slotByKey.end()) ? -1 : it->second;
+}
+
+int
+VirtualTextureTileCache::allocate(uint64 key, uint64 frame, bool &evicted, uint64 &evictedKey)
+{
+  evicted = false;
+  int slot = -1;
+  if ((int)_slotByKey.size() < _slots.size()) {
+    // slots are only ever freed by reusing them, so the unused ones are
+    // the ones after the last used
+    slot = (int)_slotByKey.size();
+  }
+  else if ((_lruHead >= 0) && (_slots[_lruHead].lastUsed < frame)) {
+    slot = _lruHead;
+    unlink(slot);
+    evicted = true;
+    evictedKey = _slots[slot].key;
+    _slotByKey.erase(evictedKey);
+    _numEvictions++;
+  }
+  else {
+    return -1;
+  }
+
+  Slot &s = _slots[slot];
+  s.key = key;
+  s.lastUsed = frame;
+  s.used = true;
+  _slotByKey[key] = slot;
+  linkAtTail(slot);
+  return slot;
+}
+
+void
+VirtualTextureTileCache::touch(int slot, uint64 frame)
+{
+  Slot &s = _slots[slot];
+  s.lastUsed = frame;
+  if (!s.pinned) {
+    unlink(slot);
+    linkAtTail(slot);
+  }
+}
+
+void
+VirtualTextureTileCache::pin(int slot)
+{
+  if (!_slots[slot].pinned) {
+    unlink(slot);
+    _slots[slot].pinned = true;
+  }
+}
+
+void
+VirtualTextureTileCache::linkAtTail(int slot)
+{
+  Slot &s = _slots[slot];
+  s.prev = _lruTail;
+  s.next = -1;
+  if (_lruTail >= 0) {
+    _slots[_lruTail].next = slot;
+  }
+  else {
+    _lruHead = slot;
+  }
+  _lruTail = slot;
+}
+
+void
+VirtualTextureTileCache::unlink(int slot)
+{
+  Slot &s = _slots[slot];
+  if (s.prev >= 0) {
+    _slots[s.prev].next = s.next;
+  }
+  else {
+    _lruHead = s.next;
+  }
+  if (s.next >= 0) {
+    _slots[s.next].prev = s.prev;
+  }
+  else {
+    _lruTail = s.prev;
+  }
+  s.prev = -1;
+  s.next = -1;
+}
+
+
+/***  VirtualTexturePageTable  ***/
+
+VirtualTexturePageTable::VirtualTexturePageTable(const VirtualTextureInfo &info)
+{
+  _info = info;
+  _levels.resize(info.numLevels);
+  for (int l=0;l<info.numLevels;l++) {
+    _levels[l].resize(info.tilesX(l) * info.tilesY(l));
+    for (int i=0;i<_levels[l].size();i++) {
+      _levels[l][i] = -1;
+    }
+  }
+}
+
+int
+VirtualTexturePageTable::resolve(int level, int x, int y, int &resolvedLevel) const
+{
+  for (int l=level;l<_info.numLevels;l++) {
+    int slot = get(l, x >> (l - level), y >> (l - level));
+    if (slot >= 0) {
+      resolvedLevel = l;
+      return slot;
+    }
+  }
+  return -1;
+}
+
+
+/***  VirtualTexture  ***/
+
+VirtualTexture::VirtualTexture(VirtualTextureFileRef file, int cacheSlots, WorkerPool *pool) :
+  _file(file),
+  _pool(pool),
+  _slotsPerRow(iCeil(sqrt((double)iMax(1, cacheSlots)))),
+  _cache(_slotsPerRow * _slotsPerRow),
+  _pageTable(file->info())
+{
+  _numInFlight = 0;
+  _numLoads = 0;
+}
+
+VirtualTexture::~VirtualTexture()
+{
+  waitForLoads();
+  while (!_loaded.empty()) {
+    delete _loaded.front();
+    _loaded.pop_front();
+  }
+}
+
+int
+VirtualTexture::selectLevel(const VirtualTextureView &view) const
+{
+  double texelsPerPixel = G3D::max(fabs(view.x1 - view.x0) / iMax(1, view.screenWidth),
+                                   fabs(view.y1 - view.y0) / iMax(1, view.screenHeight));
+  if (texelsPerPixel <= 1.0) {
+    return 0;
+  }
+  return iClamp(iFloor(log(texelsPerPixel) / log(2.0)), 0, info().numLevels - 1);
+}
+
+void
+VirtualTexture::computeNeededTiles(const VirtualTextureView &view, Array<VirtualTextureTile> &tiles) const
+{
+  const VirtualTextureInfo &vi = info();
+  int level = selectLevel(view);
+  double tileExtent = (double)vi.tileSize * (double)(1 << level);
+
+  double x0 = G3D::max(0.0, G3D::min(view.x0, view.x1));
+  double y0 = G3D::max(0.0, G3D::min(view.y0, view.y1));
+  double x1 = G3D::min((double)vi.width, G3D::max(view.x0, view.x1));
+  double y1 = G3D::min((double)vi.height, G3D::max(view.y0, view.y1));
+  if ((x1 <= x0) || (y1 <= y0)) {
+    return;
+  }
+
+  int tx0 = iClamp(iFloor(x0 / tileExtent), 0, vi.tilesX(level) - 1);
+  int tx1 = iClamp(iCeil(x1 / tileExtent) - 1, 0, vi.tilesX(level) - 1);
+  int ty0 = iClamp(iFloor(y0 / tileExtent), 0, vi.tilesY(level) - 1);
+  int ty1 = iClamp(iCeil(y1 / tileExtent) - 1, 0, vi.tilesY(level) - 1);
+  for (int ty=ty0;ty<=ty1;ty++) {
+    for (int tx=tx0;tx<=tx1;tx++) {
+      tiles.append(VirtualTextureTile(level, tx, ty));
+    }
+  }
+}
+
+void
+VirtualTexture::update(const VirtualTextureView &view, uint64 frame, int maxUploads)
+{
+  const VirtualTextureInfo &vi = info();
+
+  if (_cache.numResident() == 0) {
+    // The coarsest tile is always there to fall back on
+    LoadedTile *coarsest = new LoadedTile();
+    coarsest->key = VirtualTextureTile(vi.numLevels - 1, 0, 0).key();
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _numInFlight++;
+    }
+    _pending.insert(coarsest->key);
+    runLoad(coarsest);
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _loaded.pop_back();
+    }
+    G3D::uint64 key = coarsest->key;
+    uploadTile(coarsest, frame);
+    if (_cache.find(key) >= 0) {
+      _cache.pin(_cache.find(key));
+    }
+  }
+
+  // Feedback: keep what the view needs (or the coarser tiles standing in
+  // for it) from being evicted, and read what is missing
+  _neededTiles.fastClear();
+  computeNeededTiles(view, _neededTiles);
+  for (int i=0;i<_neededTiles.size();i++) {
+    const VirtualTextureTile &t = _neededTiles[i];
+    int resolvedLevel;
+    int slot = _pageTable.resolve(t.level, t.x, t.y, resolvedLevel);
+    if (slot >= 0) {
+      _cache.touch(slot, frame);
+    }
+    if ((slot < 0) || (resolvedLevel != t.level)) {
+      requestTile(t);
+    }
+  }
+
+  // Reads for another level were started before the view zoomed, they
+  // aren't worth a slot or an upload any more
+  int level = selectLevel(view);
+  int numUploaded = 0;
+  while ((maxUploads < 0) || (numUploaded < maxUploads)) {
+    LoadedTile *loaded = NULL;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (_loaded.empty()) {
+        break;
+      }
+      loaded = _loaded.front();
+      _loaded.pop_front();
+    }
+    if (VirtualTextureTile::fromKey(loaded->key).level != level) {
+      _pending.erase(loaded->key);
+      delete loaded;
+      continue;
+    }
+    uploadTile(loaded, frame);
+    numUploaded++;
+  }
+}
+
+void
+VirtualTexture::requestTile(const VirtualTextureTile &tile)
+{
+  uint64 key = tile.key();
+  // Never have more reads going than there are slots to put them in
+  if ((_pending.count(key) > 0) || ((int)_pending.size() >= _cache.numSlots())) {
+    return;
+  }
+  _pending.insert(key);
+
+  LoadedTile *loaded = new LoadedTile();
+  loaded->key = key;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _numInFlight++;
+  }
+  if ((_pool == NULL) || (_pool->numThreads() == 0)) {
+    runLoad(loaded);
+  }
+  else {
+    _pool->submit([this, loaded] { runLoad(loaded); });
+  }
+}
+
+void
+VirtualTexture::runLoad(LoadedTile *loaded)
+{
+  VirtualTextureTile t = VirtualTextureTile::fromKey(loaded->key);
+  loaded->texels.resize((int)info().tileBytes());
+  loaded->ok = _file->readTile(t.level, t.x, t.y, loaded->texels.getCArray());
+
+  // Notify while holding the lock, the destructor may be waiting to run
+  std::lock_guard<std::mutex> lock(_mutex);
+  _loaded.push_back(loaded);
+  _numInFlight--;
+  _loadedChanged.notify_all();
+}
+
+void
+VirtualTexture::uploadTile(LoadedTile *loaded, uint64 frame)
+{
+  _pending.erase(loaded->key);
+  if (!loaded->ok) {
+    VirtualTextureTile t = VirtualTextureTile::fromKey(loaded->key);
+    cerr << "VirtualTexture: Problem reading tile " << t.level << "," << t.x << "," << t.y
+         << " of " << _file->filename() << endl;
+  }
+  else if (_cache.find(loaded->key) < 0) {
+    bool evicted;
+    uint64 evictedKey;
+    int slot = _cache.allocate(loaded->key, frame, evicted, evictedKey);
+    // If every slot is in use this frame the tile is dropped, it will be
+    // asked for again if it is still needed
+    if (slot >= 0) {
+      if (evicted) {
+        VirtualTextureTile e = VirtualTextureTile::fromKey(evictedKey);
+        _pageTable.set(e.level, e.x, e.y, -1);
+      }
+      if (_upload) {
+        _upload(slot, loaded->texels.getCArray());
+      }
+      VirtualTextureTile t = VirtualTextureTile::fromKey(loaded->key);
+      _pageTable.set(t.level, t.x, t.y, slot);
+      _numLoads++;
+    }
+  }
+  delete loaded;
+}
+
+void
+VirtualTexture::waitForLoads()
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  _loadedChanged.wait(lock, [this] { return _numInFlight == 0; });
+}
+
+void
+VirtualTexture::getDrawTiles(const VirtualTextureView &view, Array<DrawTile> &drawTiles) const
+{
+  const VirtualTextureInfo &vi = info();
+  Array<VirtualTextureTile> tiles;
+  computeNeededTiles(view, tiles);
+
+  for (int i=0;i<tiles.size();i++) {
+    const VirtualTextureTile &t = tiles[i];
+    int resolvedLevel;
+    int slot = _pageTable.resolve(t.level, t.x, t.y, resolvedLevel);
+    if (slot < 0) {
+      continue;
+    }
+    double extent = (double)vi.tileSize * (double)(1 << t.level);
+    DrawTile &dt = drawTiles.next();
+    dt.x0 = t.x * extent;
+    dt.y0 = t.y * extent;
+    dt.x1 = G3D::min((t.x + 1) * extent, (double)vi.width);
+    dt.y1 = G3D::min((t.y + 1) * extent, (double)vi.height);
+    dt.level = resolvedLevel;
+    computeTexCoords(dt.x0, dt.y0, dt.x1, dt.y1, resolvedLevel, slot, dt);
+  }
+}
+
+void
+VirtualTexture::computeTexCoords(double x0, double y0, double x1, double y1, int resolvedLevel,
+                                 int slot, DrawTile &dt) const
+{
+  const VirtualTextureInfo &vi = info();
+  double scale = 1.0 / (double)(1 << resolvedLevel);
+  // the tile at resolvedLevel containing the rectangle
+  int ax = iFloor(x0 * scale / vi.tileSize);
+  int ay = iFloor(y0 * scale / vi.tileSize);
+  // its texels in the cache texture start here, past the border
+  double sx = (slot % _slotsPerRow) * vi.paddedTileSize() + vi.border - ax * vi.tileSize;
+  double sy = (slot / _slotsPerRow) * vi.paddedTileSize() + vi.border - ay * vi.tileSize;
+  double size = cacheTextureSize();
+
+  dt.u0 = (float)((sx + x0 * scale) / size);
+  dt.v0 = (float)((sy + y0 * scale) / size);
+  dt.u1 = (float)((sx + x1 * scale) / size);
+  dt.v1 = (float)((sy + y1 * scale) / size);
+}
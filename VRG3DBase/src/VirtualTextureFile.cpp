@@ -0,0 +1,296 @@
+#include "../include/VirtualTextureFile.H"
+
+using namespace G3D;
+
+
+namespace {
+
+const char VTEX_MAGIC[8] = {'V','R','G','3','D','V','T','\0'};
+const int  VTEX_VERSION = 1;
+/// Tiles start at this offset, the header is padded out to it
+const int  VTEX_HEADER_SIZE = 64;
+
+struct VirtualTextureFileHeader {
+  char  magic[8];
+  int32 version;
+  int32 width;
+  int32 height;
+  int32 tileSize;
+  int32 border;
+  int32 channels;
+  int32 numLevels;
+};
+
+int
+seek64(FILE *f, int64 offset)
+{
+#ifdef _WIN32
+  return _fseeki64(f, offset, SEEK_SET);
+#else
+  return fseeko(f, (off_t)offset, SEEK_SET);
+#endif
+}
+
+int64
+tileOffset(const VirtualTextureInfo &info, int level, int x, int y)
+{
+  return VTEX_HEADER_SIZE + info.tileIndex(level, x, y) * (int64)info.tileBytes();
+}
+
+/// Reads a level that has already been written to the file being built,
+/// for building the next level from it.
+class FileLevelSource : public VirtualTextureTileSource
+{
+public:
+  FileLevelSource(FILE *f, const VirtualTextureInfo &info, int level) :
+    _file(f), _info(info), _level(level), _ok(true) {}
+
+  int width() const    { return _info.levelWidth(_level); }
+  int height() const   { return _info.levelHeight(_level); }
+  int channels() const { return _info.channels; }
+  bool ok() const      { return _ok; }
+
+  void readRegion(int x, int y, int w, int h, uint8 *out) {
+    int ts = _info.tileSize;
+    int c = _info.channels;
+    int p = _info.paddedTileSize();
+    int b = _info.border;
+
+    // The tiles the clamped region touches, at most 3x3 when building
+    int tx0 = iClamp(x, 0, width()-1) / ts;
+    int tx1 = iClamp(x + w - 1, 0, width()-1) / ts;
+    int ty0 = iClamp(y, 0, height()-1) / ts;
+    int ty1 = iClamp(y + h - 1, 0, height()-1) / ts;
+    int ntx = tx1 - tx0 + 1;
+    _tiles.resize(ntx * (ty1 - ty0 + 1) * (int)_info.tileBytes());
+    for (int ty=ty0;ty<=ty1;ty++) {
+      for (int tx=tx0;tx<=tx1;tx++) {
+        uint8 *tile = _tiles.getCArray() + ((ty - ty0) * ntx + (tx - tx0)) * _info.tileBytes();
+        if ((seek64(_file, tileOffset(_info, _level, tx, ty)) != 0) ||
+            (fread(tile, 1, _info.tileBytes(), _file) != _info.tileBytes())) {
+          _ok = false;
+          return;
+        }
+      }
+    }
+
+    for (int r=0;r<h;r++) {
+      int ly = iClamp(y + r, 0, height()-1);
+      int ty = ly / ts;
+      int iy = ly - ty*ts + b;
+      for (int col=0;col<w;col++) {
+        int lx = iClamp(x + col, 0, width()-1);
+        int tx = lx / ts;
+        int ix = lx - tx*ts + b;
+        const uint8 *tile = _tiles.getCArray() + ((ty - ty0) * ntx + (tx - tx0)) * _info.tileBytes();
+        System::memcpy(out + (r*w + col)*c, tile + (iy*p + ix)*c, c);
+      }
+    }
+  }
+
+private:
+  FILE                     *_file;
+  const VirtualTextureInfo &_info;
+  int                       _level;
+  bool                      _ok;
+  Array<uint8>              _tiles;
+};
+
+} // end namespace
+
+
+VirtualTextureInfo::VirtualTextureInfo(int width, int height, int tileSize, int border, int channels)
+{
+  this->width = width;
+  this->height = height;
+  this->tileSize = tileSize;
+  this->border = border;
+  this->channels = channels;
+  numLevels = computeNumLevels(width, height, tileSize);
+}
+
+int64
+VirtualTextureInfo::tileIndex(int level, int x, int y) const
+{
+  int64 index = 0;
+  for (int l=0;l<level;l++) {
+    index += (int64)tilesX(l) * (int64)tilesY(l);
+  }
+  if (level < numLevels) {
+    index += (int64)y * (int64)tilesX(level) + x;
+  }
+  return index;
+}
+
+int
+VirtualTextureInfo::computeNumLevels(int width, int height, int tileSize)
+{
+  int n = 1;
+  while ((width > tileSize) || (height > tileSize)) {
+    width = iMax(1, width / 2);
+    height = iMax(1, height / 2);
+    n++;
+  }
+  return n;
+}
+
+
+GImageTileSource::GImageTileSource(const GImage &image) : _image(image)
+{
+}
+
+void
+GImageTileSource::readRegion(int x, int y, int w, int h, uint8 *out)
+{
+  int cc = _image.channels();
+  int c = channels();
+  const uint8 *bytes = _image.byte();
+  for (int r=0;r<h;r++) {
+    const uint8 *row = bytes + iClamp(y + r, 0, height()-1) * width() * cc;
+    for (int col=0;col<w;col++) {
+      const uint8 *src = row + iClamp(x + col, 0, width()-1) * cc;
+      uint8 *dst = out + (r*w + col) * c;
+      if (cc < 3) {
+        dst[0] = dst[1] = dst[2] = src[0];
+      }
+      else {
+        System::memcpy(dst, src, c);
+      }
+    }
+  }
+}
+
+
+VirtualTextureFile::VirtualTextureFile(FILE *f, const std::string &filename, const VirtualTextureInfo &info)
+{
+  _file = f;
+  _filename = filename;
+  _info = info;
+}
+
+VirtualTextureFile::~VirtualTextureFile()
+{
+  fclose(_file);
+}
+
+VirtualTextureFileRef
+VirtualTextureFile::open(const std::string &filename, std::string &error)
+{
+  FILE *f = fopen(filename.c_str(), "rb");
+  if (f == NULL) {
+    error = "Can't open virtual texture " + filename;
+    return NULL;
+  }
+
+  VirtualTextureFileHeader header;
+  if ((fread(&header, sizeof(header), 1, f) != 1) ||
+      (memcmp(header.magic, VTEX_MAGIC, sizeof(VTEX_MAGIC)) != 0)) {
+    fclose(f);
+    error = filename + " is not a virtual texture";
+    return NULL;
+  }
+  if (header.version != VTEX_VERSION) {
+    fclose(f);
+    error = filename + " was written by a different version of the tiler, build it again";
+    return NULL;
+  }
+
+  VirtualTextureInfo info(header.width, header.height, header.tileSize, header.border, header.channels);
+  if ((header.width <= 0) || (header.height <= 0) || (header.tileSize <= 0) || (header.border < 0) ||
+      ((header.channels != 3) && (header.channels != 4)) || (header.numLevels != info.numLevels)) {
+    fclose(f);
+    error = filename + " has a corrupt header";
+    return NULL;
+  }
+  return new VirtualTextureFile(f, filename, info);
+}
+
+bool
+VirtualTextureFile::readTile(int level, int x, int y, uint8 *out)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+  return (seek64(_file, tileOffset(_info, level, x, y)) == 0) &&
+         (fread(out, 1, _info.tileBytes(), _file) == _info.tileBytes());
+}
+
+bool
+VirtualTextureFile::build(VirtualTextureTileSource &source, const std::string &filename,
+                          int tileSize, int border, std::string &error)
+{
+  if ((source.channels() != 3) && (source.channels() != 4)) {
+    error = "Virtual textures must have 3 or 4 channels";
+    return false;
+  }
+  if ((tileSize <= 0) || (border < 0) || (border > tileSize/2)) {
+    error = "Invalid virtual texture tile size or border";
+    return false;
+  }
+
+  VirtualTextureInfo info(source.width(), source.height(), tileSize, border, source.channels());
+  // read back while building the lower levels
+  FILE *f = fopen(filename.c_str(), "w+b");
+  if (f == NULL) {
+    error = "Can't create virtual texture " + filename;
+    return false;
+  }
+
+  uint8 headerBytes[VTEX_HEADER_SIZE];
+  System::memset(headerBytes, 0, sizeof(headerBytes));
+  VirtualTextureFileHeader header;
+  System::memcpy(header.magic, VTEX_MAGIC, sizeof(VTEX_MAGIC));
+  header.version = VTEX_VERSION;
+  header.width = info.width;
+  header.height = info.height;
+  header.tileSize = info.tileSize;
+  header.border = info.border;
+  header.channels = info.channels;
+  header.numLevels = info.numLevels;
+  System::memcpy(headerBytes, &header, sizeof(header));
+  bool ok = (fwrite(headerBytes, 1, sizeof(headerBytes), f) == sizeof(headerBytes));
+
+  int p = info.paddedTileSize();
+  int c = info.channels;
+  Array<uint8> tile;
+  tile.resize((int)info.tileBytes());
+  Array<uint8> region;
+  region.resize(4 * (int)info.tileBytes());
+
+  for (int level=0;ok && (level<info.numLevels);level++) {
+    FileLevelSource previous(f, info, iMax(0, level-1));
+    for (int ty=0;ok && (ty<info.tilesY(level));ty++) {
+      for (int tx=0;ok && (tx<info.tilesX(level));tx++) {
+        int x = tx*tileSize - border;
+        int y = ty*tileSize - border;
+        if (level == 0) {
+          source.readRegion(x, y, p, p, tile.getCArray());
+        }
+        else {
+          // 2x2 box filter of the level above
+          previous.readRegion(2*x, 2*y, 2*p, 2*p, region.getCArray());
+          ok = previous.ok();
+          const uint8 *src = region.getCArray();
+          uint8 *dst = tile.getCArray();
+          for (int j=0;j<p;j++) {
+            const uint8 *row0 = src + (2*j) * 2*p * c;
+            const uint8 *row1 = row0 + 2*p * c;
+            for (int i=0;i<p;i++) {
+              for (int k=0;k<c;k++) {
+                dst[(j*p + i)*c + k] = (uint8)((row0[2*i*c + k] + row0[(2*i+1)*c + k] +
+                                                row1[2*i*c + k] + row1[(2*i+1)*c + k] + 2) / 4);
+              }
+            }
+          }
+        }
+        ok = ok && (seek64(f, tileOffset(info, level, tx, ty)) == 0) &&
+          (fwrite(tile.getCArray(), 1, tile.size(), f) == (size_t)tile.size());
+      }
+    }
+  }
+
+  ok = (fclose(f) == 0) && ok;
+  if (!ok) {
+    remove(filename.c_str());
+    error = "Problem writing virtual texture " + filename;
+  }
+  return ok;
+}
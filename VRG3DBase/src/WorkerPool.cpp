@@ -0,0 +1,146 @@
+#include "../include/WorkerPool.H"
+#include <memory>
+
+using namespace G3D;
+
+WorkerPool::WorkerPool(int numThreads)
+{
+  _numActive = 0;
+  _shuttingDown = false;
+
+  if (numThreads <= 0) {
+    numThreads = (int)std::thread::hardware_concurrency() - 1;
+  }
+  for (int i=0;i<numThreads;i++) {
+    _threads.push_back(std::thread(&WorkerPool::workerLoop, this));
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _shuttingDown = true;
+  }
+  _taskAvailable.notify_all();
+  for (size_t i=0;i<_threads.size();i++) {
+    _threads[i].join();
+  }
+}
+
+WorkerPoolRef
+WorkerPool::getDefault()
+{
+  static WorkerPoolRef pool = new WorkerPool();
+  return pool;
+}
+
+void
+WorkerPool::submit(const std::function<void()> &task)
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _tasks.push_back(task);
+  }
+  _taskAvailable.notify_one();
+}
+
+void
+WorkerPool::waitForAll()
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+  _allDone.wait(lock, [this] { return _tasks.empty() && (_numActive == 0); });
+}
+
+void
+WorkerPool::workerLoop()
+{
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _taskAvailable.wait(lock, [this] { return _shuttingDown || !_tasks.empty(); });
+      if (_tasks.empty()) {
+        return;
+      }
+      task = _tasks.front();
+      _tasks.pop_front();
+      _numActive++;
+    }
+
+    task();
+
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _numActive--;
+      if (_tasks.empty() && (_numActive == 0)) {
+        _allDone.notify_all();
+      }
+    }
+  }
+}
+
+
+/// Shared between the caller of parallelFor and the helper tasks it queues.
+/// Helpers may start after the caller has returned, so this lives on the
+/// heap and helpers only touch fn after successfully claiming a chunk.
+struct ParallelForState
+{
+  const std::function<void(int, int)> *fn;
+  int                     n;
+  int                     grainSize;
+  int                     numChunks;
+  std::atomic<int>        nextChunk;
+  std::atomic<int>        chunksDone;
+  std::mutex              mutex;
+  std::condition_variable done;
+
+  // Runs chunks until none are left to claim
+  void run() {
+    int c;
+    while ((c = nextChunk.fetch_add(1)) < numChunks) {
+      int begin = c * grainSize;
+      int end = iMin(n, begin + grainSize);
+      (*fn)(begin, end);
+      if (chunksDone.fetch_add(1) + 1 == numChunks) {
+        std::lock_guard<std::mutex> lock(mutex);
+        done.notify_all();
+      }
+    }
+  }
+};
+
+void
+WorkerPool::parallelFor(int n, int grainSize, const std::function<void(int, int)> &fn)
+{
+  if (n <= 0) {
+    return;
+  }
+  if (grainSize < 1) {
+    grainSize = 1;
+  }
+  int numChunks = (n + grainSize - 1) / grainSize;
+  if ((numChunks == 1) || (_threads.size() == 0)) {
+    fn(0, n);
+    return;
+  }
+
+  std::shared_ptr<ParallelForState> state(new ParallelForState());
+  state->fn = &fn;
+  state->n = n;
+  state->grainSize = grainSize;
+  state->numChunks = numChunks;
+  state->nextChunk = 0;
+  state->chunksDone = 0;
+
+  int numHelpers = iMin((int)_threads.size(), numChunks - 1);
+  for (int i=0;i<numHelpers;i++) {
+    submit([state] { state->run(); });
+  }
+
+  // The calling thread works too rather than sitting idle
+  state->run();
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->done.wait(lock, [&state] { return state->chunksDone.load() == state->numChunks; });
+}
@@ -0,0 +1,48 @@
+#include "Test.H"
+#include <filesystem>
+
+using namespace G3D;
+
+
+namespace {
+
+int numChecks = 0;
+int numFailures = 0;
+
+} // end namespace
+
+
+void
+testCheck(bool ok, const char *expr, const char *file, int line)
+{
+  numChecks++;
+  if (!ok) {
+    numFailures++;
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+  }
+}
+
+int
+testNumChecks()
+{
+  return numChecks;
+}
+
+int
+testNumFailures()
+{
+  return numFailures;
+}
+
+std::string
+testTempDirectory()
+{
+  static std::string dir;
+  if (dir == "") {
+    std::filesystem::path p = std::filesystem::temp_directory_path() / "vrg3dbase_tests";
+    std::filesystem::remove_all(p);
+    std::filesystem::create_directories(p);
+    dir = p.string();
+  }
+  return dir;
+}
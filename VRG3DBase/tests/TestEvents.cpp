@@ -0,0 +1,1298 @@
+#include "Test.H"
+#include "../include/EventMgr.H"
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+using namespace G3D;
+
+
+namespace {
+
+/// Records the events its arc callbacks get
+class EventRecorder
+{
+public:
+  void onEvent(MinVR::EventRef e) { events.append(e); }
+
+  Array<MinVR::EventRef> events;
+};
+
+/// An Fsa with one state and an arc, named after its trigger, for each of
+/// triggers, all calling recorder
+FsaRef
+makeRecordingFsa(const std::string &name, const Array<std::string> &triggers, EventRecorder *recorder)
+{
+  FsaRef fsa = new Fsa(name);
+  fsa->setDebug(false);
+  fsa->addState("Start");
+  for (int i=0;i<triggers.size();i++) {
+    Array<std::string> trigger;
+    trigger.append(triggers[i]);
+    fsa->addArc(triggers[i], 0, 0, trigger);
+    fsa->addArcCallback(triggers[i], recorder, &EventRecorder::onEvent);
+  }
+  return fsa;
+}
+
+FsaRef
+makeRecordingFsa(const std::string &name, const std::string &trigger, EventRecorder *recorder)
+{
+  Array<std::string> triggers;
+  triggers.append(trigger);
+  return makeRecordingFsa(name, triggers, recorder);
+}
+
+/// Counts the arc callbacks.  If log is set, also appends id to it for
+/// each callback.
+class CallbackCounter
+{
+public:
+  CallbackCounter() : count(0), id(0), log(NULL) {}
+  void onArc(MinVR::EventRef e) {
+    count++;
+    if (log != NULL) {
+      log->push_back(id);
+    }
+  }
+  int               count;
+  int               id;
+  std::vector<int> *log;
+};
+
+/** An Fsa shaped like a typical interaction technique: numStates states in
+    a cycle, each with arcsPerState arcs triggered by button events, a
+    quarter of them shared across Fsas, and an ALL_2D arc. */
+FsaRef
+makeInteractionFsa(int index, int numStates, int arcsPerState, CallbackCounter *counter, Fsa *empty = NULL)
+{
+  FsaRef fsa = (empty != NULL) ? empty : new Fsa(format("InteractionFsa%d", index));
+  fsa->setDebug(false);
+  for (int s=0;s<numStates;s++) {
+    fsa->addState(format("State%d", s));
+  }
+  for (int s=0;s<numStates;s++) {
+    for (int a=0;a<arcsPerState;a++) {
+      Array<std::string> triggers;
+      int button = (a % 4 == 0) ? a : (index * arcsPerState + a);
+      triggers.append(format("Button%d_down", button));
+      std::string arcName = format("Arc%d_%d", s, a);
+      int to = (a == 0) ? (s + 1) % numStates : s;
+      fsa->addArc(arcName, s, to, triggers);
+      fsa->addArcCallback(arcName, counter, &CallbackCounter::onArc);
+    }
+    Array<std::string> allTriggers;
+    allTriggers.append("ALL_2D");
+    fsa->addArc(format("Motion%d", s), s, s, allTriggers);
+  }
+  return fsa;
+}
+
+/// Mostly button presses for makeInteractionFsa()'s Fsas, with tracker
+/// and mouse motion mixed in
+void
+makeInteractionEvents(int n, int numFsas, int arcsPerState, TestRandom &random, Array<MinVR::EventRef> &events)
+{
+  for (int i=0;i<n;i++) {
+    int kind = random.integer(10);
+    if (kind < 6) {
+      events.append(new MinVR::VRG3DEvent(format("Button%d_down", random.integer(numFsas * arcsPerState))));
+    }
+    else if (kind < 8) {
+      events.append(new MinVR::VRG3DEvent("Mouse_Pointer", Vector2((float)random.uniform(), (float)random.uniform())));
+    }
+    else {
+      events.append(new MinVR::VRG3DEvent(format("Tracker%d_Move", random.integer(4)),
+          CoordinateFrame(Vector3((float)random.uniform(), (float)random.uniform(), (float)random.uniform()))));
+    }
+  }
+}
+
+/// Compares Fsa's trigger index with a scan of every trigger of every arc
+class CheckedFsa : public Fsa
+{
+public:
+  CheckedFsa(const std::string &name) : Fsa(name) {}
+
+  int linearArc(MinVR::EventRef event) {
+    for (int a=0;a<_states[_curState].getNumArcs();a++) {
+      FsaArcRef arc = _states[_curState].getArcRef(a);
+      for (int t=0;t<arc->getNumTriggers();t++) {
+        if (checkTriggerMatch(event, arc->getTrigger(t))) {
+          return a;
+        }
+      }
+    }
+    return -1;
+  }
+
+  int indexedArc(MinVR::EventRef event) {
+    return _states[_curState].findArc(EventNames::find(event->getName()), event->getType());
+  }
+};
+
+/// Sees what is left of a frame of pointer events after compression
+class CompressionChecker
+{
+public:
+  CompressionChecker() : numPointer(0), numDelta(0), numButton(0), lastButton(-1), inOrder(true) {}
+  void onPointer(MinVR::EventRef e) { numPointer++; pointer = e->get2DData(); }
+  void onDelta(MinVR::EventRef e)   { numDelta++; delta = e->get2DData(); }
+  void onButton(MinVR::EventRef e)  {
+    int button = atoi(e->getName().c_str() + 6);
+    inOrder = inOrder && (button > lastButton);
+    lastButton = button;
+    numButton++;
+  }
+  int     numPointer;
+  int     numDelta;
+  int     numButton;
+  int     lastButton;
+  bool    inOrder;
+  Vector2 pointer;
+  Vector2 delta;
+};
+
+/// Logs the names of the events it gets
+class NameLogger
+{
+public:
+  void onEvent(MinVR::EventRef e) { names.push_back(e->getName()); }
+  std::vector<std::string> names;
+};
+
+/// A timer for checkTimerWheel() to check TimerWheel against
+struct ReferenceTimer {
+  double      time;
+  G3D::uint64 seq;
+  double      period;
+  bool        pending;
+};
+
+/** Runs random adds, cancels and clock steps (small, large and huge)
+    through a TimerWheel and through a plain list of timers that is
+    sorted every frame, and checks both fire the same timers in the same
+    order. */
+void
+checkTimerWheel(double tickSeconds, TestRandom &random)
+{
+  TimerWheel wheel(tickSeconds);
+  std::vector<ReferenceTimer> reference;
+  std::vector<TimerWheel::Handle> handles;
+  G3D::uint64 seq = 0;
+  double now = 1000.0 + random.uniform(0.0, 100.0);
+  Array<MinVR::EventRef> due;
+  std::vector<int> expected;
+  int numWrongCancels = 0;
+  int numWrongCounts = 0;
+  int numWrongOrders = 0;
+  int numWrongSizes = 0;
+  for (int frame=0;frame<2000;frame++) {
+    int numAdds = random.integer(8);
+    for (int a=0;a<numAdds;a++) {
+      int kind = random.integer(10);
+      double delay = (kind < 5) ? random.uniform() : ((kind < 8) ? random.uniform(0.0, 1000.0) :
+                                                      ((kind < 9) ? 0.0 : 1e7 * random.integer(3)));
+      double period = (random.integer(6) == 0) ? random.uniform(0.001, 2.0) : 0.0;
+      int id = (int)reference.size();
+      handles.push_back(wheel.add(new MinVR::VRG3DEvent("Timer", (double)id), now, delay, period));
+      ReferenceTimer r = {now + delay, seq++, period, true};
+      reference.push_back(r);
+    }
+    if ((random.integer(3) == 0) && (handles.size() > 0)) {
+      int id = random.integer((int)handles.size());
+      numWrongCancels += (wheel.cancel(handles[id]) != reference[id].pending) ? 1 : 0;
+      reference[id].pending = false;
+    }
+
+    int step = random.integer(100);
+    now += (step < 90) ? random.uniform(0.0, 0.04) : ((step < 98) ? random.uniform(0.0, 100.0) : random.uniform(0.0, 1e5));
+    due.fastClear();
+    wheel.advance(now, due);
+
+    expected.clear();
+    for (size_t i=0;i<reference.size();i++) {
+      if (reference[i].pending && (reference[i].time <= now)) {
+        expected.push_back((int)i);
+      }
+    }
+    std::sort(expected.begin(), expected.end(), [&reference](int a, int b) {
+        if (reference[a].time != reference[b].time) {
+          return reference[a].time < reference[b].time;
+        }
+        return reference[a].seq < reference[b].seq;
+      });
+    if ((int)expected.size() != due.size()) {
+      numWrongCounts++;
+      continue;
+    }
+    for (size_t i=0;i<expected.size();i++) {
+      numWrongOrders += ((int)due[(int)i]->get1DData() != expected[i]) ? 1 : 0;
+      ReferenceTimer &r = reference[expected[i]];
+      if (r.period > 0.0) {
+        r.time += r.period;
+        if (r.time <= now) {
+          r.time += r.period * (floor((now - r.time) / r.period) + 1.0);
+          while (r.time <= now) {
+            r.time += r.period;
+          }
+        }
+        r.seq = seq++;
+      }
+      else {
+        r.pending = false;
+      }
+    }
+    int numPending = 0;
+    for (size_t i=0;i<reference.size();i++) {
+      numPending += reference[i].pending ? 1 : 0;
+    }
+    numWrongSizes += (wheel.size() != numPending) ? 1 : 0;
+  }
+  TEST_CHECK_EQUAL(numWrongCancels, 0);
+  TEST_CHECK_EQUAL(numWrongCounts, 0);
+  TEST_CHECK_EQUAL(numWrongOrders, 0);
+  TEST_CHECK_EQUAL(numWrongSizes, 0);
+}
+
+/// The events of one frame of a recorded session: head and wand
+/// tracking, the mouse, a joystick axis, some button presses and now and
+/// then a network message
+void
+makeSessionFrame(int frame, int numButtons, TestRandom &random, Array<MinVR::EventRef> &events)
+{
+  const char *trackers[] = {"Head_Tracker", "Wand_Tracker"};
+  for (int t=0;t<2;t++) {
+    Vector3 p((float)random.uniform(-1.0, 1.0), (float)random.uniform(1.0, 2.0), (float)random.uniform(-1.0, 1.0));
+    CoordinateFrame cf(Matrix3::fromAxisAngle(Vector3::unitY(), (float)random.uniform(0.0, 6.28)), p);
+    events.append(new MinVR::VRG3DEvent(trackers[t], cf));
+  }
+  events.append(new MinVR::VRG3DEvent("Mouse_Pointer", Vector2((float)random.uniform(), (float)random.uniform())));
+  events.append(new MinVR::VRG3DEvent("Joystick_X", random.uniform(-1.0, 1.0)));
+  int numPresses = random.integer(4);
+  for (int b=0;b<numPresses;b++) {
+    events.append(new MinVR::VRG3DEvent(format("Button%d_down", random.integer(numButtons))));
+  }
+  if (frame % 60 == 0) {
+    events.append(new MinVR::VRG3DEvent("Network_Message", format("<status frame=\"%d\"/>", frame)));
+  }
+}
+
+/// Whether b has the same name, type and data as a
+bool
+sameEvent(MinVR::EventRef a, MinVR::EventRef b)
+{
+  if ((a->getName() != b->getName()) || (a->getType() != b->getType())) {
+    return false;
+  }
+  switch (a->getType()) {
+  case MinVR::VRG3DEvent::EVENTTYPE_1D:
+    return a->get1DData() == b->get1DData();
+  case MinVR::VRG3DEvent::EVENTTYPE_2D:
+    return a->get2DData() == b->get2DData();
+  case MinVR::VRG3DEvent::EVENTTYPE_3D:
+    return a->get3DData() == b->get3DData();
+  case MinVR::VRG3DEvent::EVENTTYPE_COORDINATEFRAME:
+    return (a->getCoordinateFrameData().rotation == b->getCoordinateFrameData().rotation) &&
+      (a->getCoordinateFrameData().translation == b->getCoordinateFrameData().translation);
+  case MinVR::VRG3DEvent::EVENTTYPE_MSG:
+    return a->getMsgData() == b->getMsgData();
+  default:
+    return true;
+  }
+}
+
+/// Logs, for the event budget check, the frame each event is processed
+/// in.  Tracker and message events carry their sequence number, button
+/// presses are named for the frame they were queued in.  Each tracker
+/// event may also move a fake clock on, as if it took that long.
+class BudgetChecker
+{
+public:
+  BudgetChecker() : frame(0), clock(NULL), trackerSeconds(0.0), numInFrame(0),
+                    lastTracker(-1), lastMessage(-1), numTrackers(0), numMessages(0),
+                    numPresses(0), inOrder(true), pressesOnTime(true), messagesOnTime(true) {}
+  void onTracker(MinVR::EventRef e) {
+    int seq = (int)e->getCoordinateFrameData().translation.x;
+    inOrder = inOrder && (seq == lastTracker + 1);
+    lastTracker = seq;
+    numTrackers++;
+    numInFrame++;
+    if (clock != NULL) {
+      *clock += trackerSeconds;
+    }
+  }
+  void onPress(MinVR::EventRef e) {
+    pressesOnTime = pressesOnTime && (atoi(e->getName().c_str() + 5) == frame);
+    numPresses++;
+    numInFrame++;
+  }
+  void onMessage(MinVR::EventRef e) {
+    int seq = atoi(e->getMsgData().c_str());
+    inOrder = inOrder && (seq == lastMessage + 1);
+    messagesOnTime = messagesOnTime && (seq == frame);
+    lastMessage = seq;
+    numMessages++;
+    numInFrame++;
+  }
+  int     frame;
+  double *clock;
+  double  trackerSeconds;
+  int     numInFrame;
+  int     lastTracker;
+  int     lastMessage;
+  int     numTrackers;
+  int     numMessages;
+  int     numPresses;
+  bool    inOrder;
+  bool    pressesOnTime;
+  bool    messagesOnTime;
+};
+
+/// An EventMgr on a fake clock whose one Fsa gives checker the
+/// Wand_Tracker, Network_Message and other standard events
+EventMgrRef
+makeBudgetEventMgr(BudgetChecker *checker, double *clock)
+{
+  EventMgrRef eventMgr = new EventMgr(NULL);
+  eventMgr->setClock([clock] { return *clock; });
+  FsaRef fsa = new Fsa("BudgetFsa");
+  fsa->setDebug(false);
+  fsa->addState("Start");
+  const char *triggers[3] = {"Wand_Tracker", "Network_Message", "ALL_STANDARD"};
+  const char *arcs[3] = {"Tracker", "Message", "Press"};
+  void (BudgetChecker::*callbacks[3])(MinVR::EventRef) = {&BudgetChecker::onTracker, &BudgetChecker::onMessage,
+                                                          &BudgetChecker::onPress};
+  for (int a=0;a<3;a++) {
+    Array<std::string> t;
+    t.append(triggers[a]);
+    fsa->addArc(arcs[a], 0, 0, t);
+    fsa->addArcCallback(arcs[a], checker, callbacks[a]);
+  }
+  eventMgr->addFsaRef(fsa);
+  return eventMgr;
+}
+
+/// Queues the frame's input for the budget check: trackers tracker
+/// events, three button presses and a message
+void
+queueBudgetFrame(EventMgrRef eventMgr, int frame, int trackers, int &nextTracker)
+{
+  for (int i=0;i<trackers;i++) {
+    eventMgr->queueEvent(new MinVR::VRG3DEvent("Wand_Tracker", CoordinateFrame(Vector3((float)nextTracker++, 0, 0))));
+    if (i % (trackers / 3 + 1) == 0) {
+      eventMgr->queueEvent(new MinVR::VRG3DEvent(format("Press%d", frame)));
+    }
+  }
+  eventMgr->queueEvent(new MinVR::VRG3DEvent("Network_Message", format("%d", frame)));
+}
+
+/// Blocks the events with one name
+class BlockingFilter : public EventFilter
+{
+public:
+  BlockingFilter(const std::string &blocked) : _blocked(blocked) {}
+  bool filter(MinVR::EventRef e) { return e->getName() != _blocked; }
+private:
+  std::string _blocked;
+};
+
+
+/// Events pushed by several threads while the consumer drains them all
+/// arrive, each producer's in the order it pushed them
+void
+testEventQueueProducers()
+{
+  const int perProducer = 50000;
+  int producerCounts[] = {1, 2, 4};
+  for (int c=0;c<3;c++) {
+    const int numProducers = producerCounts[c];
+    EventQueue queue;
+    std::vector<std::thread> producers;
+    for (int p=0;p<numProducers;p++) {
+      producers.push_back(std::thread([&queue, p, perProducer] {
+        for (int i=0;i<perProducer;i++) {
+          queue.push(new MinVR::VRG3DEvent("Tracker_Move", (double)(p * perProducer + i)));
+        }
+      }));
+    }
+    Array<int> lastSeq;
+    for (int p=0;p<numProducers;p++) {
+      lastSeq.append(-1);
+    }
+    Array<MinVR::EventRef> drained;
+    int total = 0;
+    bool inOrder = true;
+    while (total < numProducers * perProducer) {
+      drained.fastClear();
+      queue.drain(drained);
+      for (int i=0;i<drained.size();i++) {
+        int value = (int)drained[i]->get1DData();
+        int p = value / perProducer;
+        inOrder = inOrder && (value % perProducer == lastSeq[p] + 1);
+        lastSeq[p] = value % perProducer;
+      }
+      total += drained.size();
+    }
+    for (size_t p=0;p<producers.size();p++) {
+      producers[p].join();
+    }
+    TEST_CHECK(inOrder);
+    TEST_CHECK_EQUAL(total, numProducers * perProducer);
+    TEST_CHECK(queue.isEmpty());
+  }
+}
+
+/// Events queued from other threads reach the Fsas after the main
+/// thread's, each thread's in order
+void
+testQueueEventFromAnyThread()
+{
+  const int numProducers = 3;
+  const int perProducer = 2000;
+  EventMgrRef eventMgr = new EventMgr(NULL);
+  EventRecorder recorder;
+  eventMgr->addFsaRef(makeRecordingFsa("All", "ALL", &recorder));
+
+  std::vector<std::thread> producers;
+  for (int p=0;p<numProducers;p++) {
+    producers.push_back(std::thread([&eventMgr, p, perProducer] {
+      for (int i=0;i<perProducer;i++) {
+        eventMgr->queueEventFromAnyThread(new MinVR::VRG3DEvent(format("Producer%d", p), (double)i));
+      }
+    }));
+  }
+  for (size_t p=0;p<producers.size();p++) {
+    producers[p].join();
+  }
+  eventMgr->queueEvent(new MinVR::VRG3DEvent("MainThread"));
+  eventMgr->processEventQueue();
+
+  TEST_CHECK_EQUAL(recorder.events.size(), numProducers * perProducer + 1);
+  if (recorder.events.size() > 0) {
+    TEST_CHECK_EQUAL(recorder.events[0]->getName(), std::string("MainThread"));
+  }
+  int next[numProducers] = {0, 0, 0};
+  bool inOrder = true;
+  for (int i=1;i<recorder.events.size();i++) {
+    int p = atoi(recorder.events[i]->getName().c_str() + 8);
+    inOrder = inOrder && ((int)recorder.events[i]->get1DData() == next[p]++);
+  }
+  TEST_CHECK(inOrder);
+}
+
+/// Every event takes the arc the trigger index finds, the first one a
+/// scan of the current state's triggers matches
+void
+testTriggerIndex()
+{
+  const int numFsas = 50;
+  const int manyArcs = 50;
+  TestRandom random(3);
+  Array<MinVR::EventRef> events;
+  makeInteractionEvents(2000, numFsas, manyArcs, random, events);
+  CallbackCounter counter;
+  Array<CheckedFsa*> checked;
+  Array<FsaRef> checkedRefs;
+  for (int f=0;f<numFsas;f++) {
+    CheckedFsa *fsa = new CheckedFsa(format("CheckedFsa%d", f));
+    checkedRefs.append(makeInteractionFsa(f, 4, manyArcs, &counter, fsa));
+    checked.append(fsa);
+  }
+  int numMatched = 0;
+  int numDifferent = 0;
+  for (int i=0;i<events.size();i++) {
+    for (int f=0;f<numFsas;f++) {
+      int expected = checked[f]->linearArc(events[i]);
+      numDifferent += (checked[f]->indexedArc(events[i]) != expected) ? 1 : 0;
+      numMatched += (expected >= 0) ? 1 : 0;
+      checked[f]->processEvent(events[i]);
+    }
+  }
+  TEST_CHECK_EQUAL(numDifferent, 0);
+  TEST_CHECK(numMatched > 0);
+  TEST_CHECK(counter.count > 0);
+}
+
+/// Routing events to the Fsas that can respond runs the same callbacks
+/// in the same order as giving every event to every Fsa, and leaves every
+/// Fsa in the same state
+void
+testRoutedDispatch()
+{
+  const int numFsas = 50;
+  const int manyArcs = 50;
+  TestRandom random(4);
+  Array<MinVR::EventRef> events;
+  makeInteractionEvents(2000, numFsas, manyArcs, random, events);
+  std::vector<CallbackCounter> counters(2 * numFsas);
+  std::vector<int> logs[2];
+  EventMgrRef eventMgrs[2];
+  for (int mode=0;mode<2;mode++) {
+    eventMgrs[mode] = new EventMgr(NULL);
+    eventMgrs[mode]->setBroadcastEvents(mode == 1);
+    for (int f=0;f<numFsas;f++) {
+      CallbackCounter &c = counters[mode * numFsas + f];
+      c.id = f;
+      c.log = &logs[mode];
+      eventMgrs[mode]->addFsaRef(makeInteractionFsa(f, 4, manyArcs, &c));
+    }
+    for (int i=0;i<events.size();i++) {
+      eventMgrs[mode]->queueEvent(events[i]);
+    }
+    eventMgrs[mode]->processEventQueue();
+    // and straight through processEvent()
+    for (int i=0;i<events.size();i++) {
+      eventMgrs[mode]->processEvent(events[i]);
+    }
+  }
+  TEST_CHECK(logs[0].size() > 0);
+  TEST_CHECK(logs[0] == logs[1]);
+  for (int f=0;f<numFsas;f++) {
+    TEST_CHECK_EQUAL(eventMgrs[0]->getFsa(f)->getCurrentState(), eventMgrs[1]->getFsa(f)->getCurrentState());
+  }
+  TEST_CHECK(eventMgrs[0]->getFsaRouter().numSkipped() > 0);
+  TEST_CHECK(eventMgrs[0]->getFsaRouter().numDelivered() < eventMgrs[1]->getFsaRouter().numDelivered());
+}
+
+/// Timer events against a fake clock: firing order for due times that
+/// fall in one frame and for equal due times, periodic timers,
+/// cancellation, and a timer far in the future that stays pending
+void
+testTimerEvents()
+{
+  double fakeTime = 1000.0;
+  EventMgrRef eventMgr = new EventMgr(NULL);
+  eventMgr->setClock([&fakeTime] { return fakeTime; });
+  NameLogger logger;
+  FsaRef fsa = new Fsa("TimerFsa");
+  fsa->setDebug(false);
+  fsa->addState("Start");
+  Array<std::string> triggers;
+  triggers.append("ALL_STANDARD");
+  fsa->addArc("Timer", 0, 0, triggers);
+  fsa->addArcCallback("Timer", &logger, &NameLogger::onEvent);
+  eventMgr->addFsaRef(fsa);
+
+  // Multiples of 1/8 s, so the clock lands exactly on the due times
+  eventMgr->queueTimerEvent(new MinVR::VRG3DEvent("A"), 0.5);
+  eventMgr->queueTimerEvent(new MinVR::VRG3DEvent("B"), 0.25);
+  eventMgr->queueTimerEvent(new MinVR::VRG3DEvent("C"), 0.5);
+  TimerWheel::Handle periodic = eventMgr->queuePeriodicTimerEvent(new MinVR::VRG3DEvent("D"), 0.375, 0.375);
+  TimerWheel::Handle cancelled = eventMgr->queueTimerEvent(new MinVR::VRG3DEvent("E"), 0.375);
+  eventMgr->queueTimerEvent(new MinVR::VRG3DEvent("F"), 1e6);
+  TEST_CHECK(eventMgr->cancelTimerEvent(cancelled));
+  TEST_CHECK(!eventMgr->cancelTimerEvent(cancelled));
+  for (int frame=1;frame<=8;frame++) {
+    fakeTime = 1000.0 + frame * 0.125;
+    eventMgr->processEventQueue();
+  }
+  const char *expected[] = {"B", "D", "A", "C", "D"};
+  TEST_CHECK_EQUAL(logger.names.size(), 5u);
+  for (int i=0;i<iMin(5, (int)logger.names.size());i++) {
+    TEST_CHECK_EQUAL(logger.names[i], std::string(expected[i]));
+  }
+  TEST_CHECK_EQUAL(eventMgr->numPendingTimerEvents(), 2);
+  TEST_CHECK(eventMgr->cancelTimerEvent(periodic));
+  TEST_CHECK_EQUAL(eventMgr->numPendingTimerEvents(), 1);
+}
+
+/// TimerWheel against a sorted list of timers, with ticks shorter and
+/// longer than a frame
+void
+testTimerWheel()
+{
+  TestRandom random(6);
+  checkTimerWheel(0.001, random);
+  checkTimerWheel(0.0173, random);
+  checkTimerWheel(1.0, random);
+}
+
+/// An EventMgr whose one Fsa logs every standard event into logger
+EventMgrRef
+makeLoggingEventMgr(NameLogger *logger)
+{
+  EventMgrRef eventMgr = new EventMgr(NULL);
+  FsaRef fsa = new Fsa("LoggingFsa");
+  fsa->setDebug(false);
+  fsa->addState("Start");
+  Array<std::string> triggers;
+  triggers.append("ALL_STANDARD");
+  fsa->addArc("Log", 0, 0, triggers);
+  fsa->addArcCallback("Log", logger, &NameLogger::onEvent);
+  eventMgr->addFsaRef(fsa);
+  return eventMgr;
+}
+
+/// Queues an event called name and returns the names of the events that
+/// come out, aliases included
+std::vector<std::string>
+aliasesOf(EventMgrRef eventMgr, NameLogger &logger, const std::string &name)
+{
+  logger.names.clear();
+  eventMgr->queueEvent(new MinVR::VRG3DEvent(name));
+  eventMgr->processEventQueue();
+  return logger.names;
+}
+
+/// Alias expansion: the order of a diamond, a deep chain, cycles turned
+/// away, and the same order through filters, which expand one copy at a
+/// time
+void
+testAliases()
+{
+  NameLogger logger;
+  EventMgrRef eventMgr = makeLoggingEventMgr(&logger);
+  Array<std::string> aliases;
+  aliases.append("Y", "Z");
+  TEST_CHECK(eventMgr->addEventAliases("X", aliases));
+  aliases.clear();
+  aliases.append("W");
+  TEST_CHECK(eventMgr->addEventAliases("Y", aliases));
+  TEST_CHECK(eventMgr->addEventAliases("Z", aliases));
+  std::vector<std::string> diamond;
+  diamond.push_back("X");
+  diamond.push_back("Y");
+  diamond.push_back("W");
+  diamond.push_back("Z");
+  diamond.push_back("W");
+  TEST_CHECK(aliasesOf(eventMgr, logger, "X") == diamond);
+
+  // Cycles, including an event aliased to itself, are turned away and
+  // leave the aliases as they were
+  aliases.clear();
+  aliases.append("X");
+  TEST_CHECK(!eventMgr->addEventAliases("W", aliases));
+  aliases.clear();
+  aliases.append("Q", "Q2");
+  TEST_CHECK(!eventMgr->addEventAliases("Q", aliases));
+  TEST_CHECK(aliasesOf(eventMgr, logger, "X") == diamond);
+  TEST_CHECK_EQUAL(aliasesOf(eventMgr, logger, "Q").size(), 1u);
+  TEST_CHECK_EQUAL(aliasesOf(eventMgr, logger, "W").size(), 1u);
+
+  // A chain far deeper than recursion would manage, and its end led
+  // back to its start
+  const int chainLength = 2000;
+  bool chainAdded = true;
+  for (int i=0;i<chainLength;i++) {
+    aliases.clear();
+    aliases.append(format("Chain%d", i+1));
+    chainAdded = eventMgr->addEventAliases(format("Chain%d", i), aliases) && chainAdded;
+  }
+  TEST_CHECK(chainAdded);
+  aliases.clear();
+  aliases.append("Chain0");
+  TEST_CHECK(!eventMgr->addEventAliases(format("Chain%d", chainLength), aliases));
+  std::vector<std::string> chain = aliasesOf(eventMgr, logger, "Chain0");
+  TEST_CHECK_EQUAL((int)chain.size(), chainLength + 1);
+  bool chainInOrder = true;
+  for (int i=0;i<(int)chain.size();i++) {
+    chainInOrder = chainInOrder && (chain[i] == format("Chain%d", i));
+  }
+  TEST_CHECK(chainInOrder);
+
+  // With a filter the copies are made one at a time, in the same order,
+  // and an alias the filter blocks has none of its own aliases queued
+  eventMgr->addEventFilter(new BlockingFilter("Nothing"));
+  TEST_CHECK(aliasesOf(eventMgr, logger, "X") == diamond);
+  TEST_CHECK_EQUAL((int)aliasesOf(eventMgr, logger, "Chain0").size(), chainLength + 1);
+  eventMgr->addEventFilter(new BlockingFilter("Y"));
+  std::vector<std::string> blocked;
+  blocked.push_back("X");
+  blocked.push_back("Z");
+  blocked.push_back("W");
+  TEST_CHECK(aliasesOf(eventMgr, logger, "X") == blocked);
+}
+
+/// A tracker reconnecting with a backlog of 3000 events, on a fake clock.
+/// With a budget of 100 events a frame the backlog is worked off over the
+/// next frames in order, while the button presses and messages queued
+/// meanwhile are still processed in the frame they're queued for.  With a
+/// time budget of 2 ms, and tracker events taking 0.1 ms each, each frame
+/// takes 20 of them.  Without a budget it all goes at once.
+void
+testEventBudget()
+{
+  const int backlog = 3000;
+  for (int mode=0;mode<3;mode++) {
+    BudgetChecker checker;
+    double fakeTime = 100.0;
+    EventMgrRef eventMgr = makeBudgetEventMgr(&checker, &fakeTime);
+    if (mode == 0) {
+      eventMgr->setMaxEventsPerFrame(100);
+    }
+    else if (mode == 1) {
+      eventMgr->setMaxSecondsPerFrame(0.002);
+      checker.clock = &fakeTime;
+      checker.trackerSeconds = 0.0001;
+    }
+    int nextTracker = 0;
+    int frame = 0;
+    bool withinBudget = true;
+    bool statsCounted = true;
+    for (;((frame < 5) || (eventMgr->numDeferredEvents() > 0)) && (frame < 1000);frame++) {
+      queueBudgetFrame(eventMgr, frame, (frame == 2) ? backlog : 10, nextTracker);
+      checker.frame = frame;
+      checker.numInFrame = 0;
+      fakeTime += 1.0 / 60.0;
+      eventMgr->processEventQueue();
+      const EventQueueStats &stats = eventMgr->getQueueStats();
+      statsCounted = statsCounted && (stats.processed == checker.numInFrame);
+      if (mode == 0) {
+        withinBudget = withinBudget && (checker.numInFrame <= 100);
+      }
+      else if (mode == 1) {
+        // The time each event takes is learnt from the frames before
+        withinBudget = withinBudget && (stats.dispatchSeconds <= 0.003);
+      }
+    }
+    const EventQueueStats &stats = eventMgr->getQueueStats();
+    TEST_CHECK(frame < 1000);
+    TEST_CHECK(statsCounted);
+    TEST_CHECK(checker.inOrder);
+    TEST_CHECK(checker.pressesOnTime);
+    TEST_CHECK_EQUAL(checker.numPresses, 3 * frame);
+    TEST_CHECK(checker.messagesOnTime);
+    TEST_CHECK_EQUAL(checker.numMessages, frame);
+    TEST_CHECK_EQUAL(checker.numTrackers, nextTracker);
+    TEST_CHECK(withinBudget);
+    TEST_CHECK_EQUAL(stats.frames, frame);
+    TEST_CHECK(stats.maxDepth >= backlog);
+    if (mode == 2) {
+      TEST_CHECK_EQUAL(frame, 5);
+      TEST_CHECK_EQUAL(stats.framesOverBudget, 0);
+      TEST_CHECK(stats.peakLatency < 1.5 / 60.0);
+    }
+    else {
+      TEST_CHECK(stats.framesOverBudget >= 10);
+      TEST_CHECK(stats.peakLatency > 10.0 / 60.0);
+    }
+  }
+}
+
+/// Queueing events doesn't intern their names, only what refers to a
+/// name does
+void
+testEventNamesOnlyReferenced()
+{
+  EventMgrRef eventMgr = new EventMgr(NULL);
+  EventRecorder recorder;
+  eventMgr->addFsaRef(makeRecordingFsa("Referenced", "Known_Event", &recorder));
+  TEST_CHECK(EventNames::find("Known_Event") >= 0);
+
+  int numNames = EventNames::numNames();
+  for (int frame=0;frame<10;frame++) {
+    for (int i=0;i<100;i++) {
+      eventMgr->queueEvent(new MinVR::VRG3DEvent(format("Unreferenced%d_%d", frame, i)));
+    }
+    eventMgr->queueEvent(new MinVR::VRG3DEvent("Known_Event"));
+    eventMgr->processEventQueue();
+  }
+  TEST_CHECK_EQUAL(EventNames::numNames(), numNames);
+  TEST_CHECK_EQUAL(EventNames::find("Unreferenced0_0"), -1);
+  TEST_CHECK_EQUAL(recorder.events.size(), 10);
+
+  // The most recent event is only kept for names with an id.  Asking for
+  // one gives it an id.
+  TEST_CHECK(eventMgr->getMostRecentEvent("Known_Event").notNull());
+  TEST_CHECK(eventMgr->getMostRecentEvent("Unreferenced9_0").isNull());
+  TEST_CHECK(EventNames::find("Unreferenced9_0") >= 0);
+  MinVR::EventRef event = new MinVR::VRG3DEvent("Unreferenced9_0");
+  eventMgr->queueEvent(event);
+  TEST_CHECK(eventMgr->getMostRecentEvent("Unreferenced9_0") == event);
+  eventMgr->processEventQueue();
+
+  // The head tracker's events are kept from the start
+  TEST_CHECK(EventNames::find("Head_Tracker") >= 0);
+  eventMgr->queueEvent(new MinVR::VRG3DEvent("Head_Tracker", CoordinateFrame(Vector3(1, 2, 3))));
+  TEST_CHECK_CLOSE((eventMgr->getCurrentHeadFrame().translation - Vector3(1, 2, 3)).length(), 0.0, 1e-6);
+  eventMgr->processEventQueue();
+}
+
+/// Events with no name id go through compression, the budget and
+/// dispatch like any other
+void
+testUnreferencedEventNames()
+{
+  EventMgrRef eventMgr = new EventMgr(NULL);
+  EventRecorder recorder;
+  Array<std::string> triggers;
+  triggers.append("Pointer_Delta");
+  triggers.append("Button_Press");
+  eventMgr->addFsaRef(makeRecordingFsa("Pointer", triggers, &recorder));
+  EventRecorder all;
+  eventMgr->addFsaRef(makeRecordingFsa("All", "ALL_STANDARD", &all));
+  eventMgr->addCompressionRule("Pointer_Delta", EventMgr::COMPRESS_ACCUMULATE);
+
+  for (int i=0;i<5;i++) {
+    eventMgr->queueEvent(new MinVR::VRG3DEvent("Pointer_Delta", Vector2(1, 2)));
+    eventMgr->queueEvent(new MinVR::VRG3DEvent(format("Nobody_Listens%d", i)));
+  }
+  eventMgr->processEventQueue();
+  TEST_CHECK_EQUAL(recorder.events.size(), 1);
+  if (recorder.events.size() == 1) {
+    TEST_CHECK(recorder.events[0]->get2DData() == Vector2(5, 10));
+  }
+  // ALL_STANDARD still sees the events nothing refers to by name
+  TEST_CHECK_EQUAL(all.events.size(), 5);
+  TEST_CHECK_EQUAL(eventMgr->getEventPriority(new MinVR::VRG3DEvent("Nobody_Listens0")),
+                   EventMgr::PRIORITY_CRITICAL);
+
+  // Over the budget, unnamed stream events wait behind critical ones
+  recorder.events.fastClear();
+  all.events.fastClear();
+  eventMgr->setMaxEventsPerFrame(2);
+  eventMgr->queueEvent(new MinVR::VRG3DEvent("Nobody_Streams", 1.0));
+  eventMgr->queueEvent(new MinVR::VRG3DEvent("Nobody_Streams", 2.0));
+  eventMgr->queueEvent(new MinVR::VRG3DEvent("Button_Press"));
+  eventMgr->queueEvent(new MinVR::VRG3DEvent("Button_Press"));
+  eventMgr->processEventQueue();
+  TEST_CHECK_EQUAL(recorder.events.size(), 2);
+  TEST_CHECK_EQUAL(eventMgr->numDeferredEvents(), 2);
+  eventMgr->setMaxEventsPerFrame(0);
+  eventMgr->processEventQueue();
+  TEST_CHECK_EQUAL(eventMgr->numDeferredEvents(), 0);
+
+  // An Fsa made after an event was queued still gets it
+  EventRecorder late;
+  eventMgr->queueEvent(new MinVR::VRG3DEvent("Late_Trigger"));
+  TEST_CHECK_EQUAL(EventNames::find("Late_Trigger"), -1);
+  eventMgr->addFsaRef(makeRecordingFsa("Late", "Late_Trigger", &late));
+  eventMgr->processEventQueue();
+  TEST_CHECK_EQUAL(late.events.size(), 1);
+}
+
+/// A frame of pointer events: Mouse_Pointer keeps only the latest,
+/// Mouse_Delta sums its deltas, and the buttons in between are untouched
+void
+testCompression()
+{
+  TestRandom random(5);
+  Array<MinVR::EventRef> events;
+  Vector2 deltaSum = Vector2::zero();
+  Vector2 lastPointer;
+  int numButtons = 0;
+  for (int i=0;i<10000;i++) {
+    int kind = random.integer(10);
+    if (kind < 5) {
+      lastPointer = Vector2((float)random.uniform(), (float)random.uniform());
+      events.append(new MinVR::VRG3DEvent("Mouse_Pointer", lastPointer));
+    }
+    else if (kind < 9) {
+      // Multiples of 1/64 add up exactly in floats
+      Vector2 delta((float)random.integer(-64, 64) / 64.0f, (float)random.integer(-64, 64) / 64.0f);
+      deltaSum += delta;
+      events.append(new MinVR::VRG3DEvent("Mouse_Delta", delta));
+    }
+    else {
+      events.append(new MinVR::VRG3DEvent(format("Button%d_down", numButtons++)));
+    }
+  }
+
+  EventMgrRef eventMgr = new EventMgr(NULL);
+  eventMgr->addCompressionRule("Mouse_Pointer", EventMgr::COMPRESS_KEEP_LATEST);
+  eventMgr->addCompressionRule("Mouse_Delta", EventMgr::COMPRESS_ACCUMULATE);
+  CompressionChecker checker;
+  FsaRef fsa = new Fsa("CompressionFsa");
+  fsa->setDebug(false);
+  fsa->addState("Start");
+  Array<std::string> triggers;
+  triggers.append("Mouse_Pointer");
+  fsa->addArc("Pointer", 0, 0, triggers);
+  fsa->addArcCallback("Pointer", &checker, &CompressionChecker::onPointer);
+  triggers[0] = "Mouse_Delta";
+  fsa->addArc("Delta", 0, 0, triggers);
+  fsa->addArcCallback("Delta", &checker, &CompressionChecker::onDelta);
+  triggers[0] = "ALL_STANDARD";
+  fsa->addArc("Button", 0, 0, triggers);
+  fsa->addArcCallback("Button", &checker, &CompressionChecker::onButton);
+  eventMgr->addFsaRef(fsa);
+
+  for (int i=0;i<events.size();i++) {
+    eventMgr->queueEvent(events[i]);
+  }
+  eventMgr->processEventQueue();
+  TEST_CHECK_EQUAL(checker.numPointer, 1);
+  TEST_CHECK(checker.pointer == lastPointer);
+  TEST_CHECK_EQUAL(checker.numDelta, 1);
+  TEST_CHECK(checker.delta == deltaSum);
+  TEST_CHECK_EQUAL(checker.numButton, numButtons);
+  TEST_CHECK(checker.inOrder);
+}
+
+/// The most recent event of an accumulated name is the one the Fsas get,
+/// with the sum of the frame's data
+void
+testAccumulatedRecentEvent()
+{
+  EventMgrRef eventMgr = new EventMgr(NULL);
+  EventRecorder recorder;
+  Array<std::string> triggers;
+  triggers.append("Wheel_Delta");
+  triggers.append("Drag_Delta");
+  eventMgr->addFsaRef(makeRecordingFsa("Accumulated", triggers, &recorder));
+  eventMgr->addCompressionRule("Wheel_Delta", EventMgr::COMPRESS_ACCUMULATE);
+  eventMgr->addCompressionRule("Drag_Delta", EventMgr::COMPRESS_ACCUMULATE);
+
+  for (int frame=1;frame<=3;frame++) {
+    recorder.events.fastClear();
+    for (int i=0;i<4;i++) {
+      eventMgr->queueEvent(new MinVR::VRG3DEvent("Wheel_Delta", (double)frame));
+      eventMgr->queueEvent(new MinVR::VRG3DEvent("Drag_Delta", Vector2((float)frame, 1)));
+    }
+    eventMgr->processEventQueue();
+
+    TEST_CHECK_EQUAL(recorder.events.size(), 2);
+    MinVR::EventRef wheel = eventMgr->getMostRecentEvent("Wheel_Delta");
+    MinVR::EventRef drag = eventMgr->getMostRecentEvent("Drag_Delta");
+    TEST_CHECK_EQUAL(wheel->get1DData(), 4.0 * frame);
+    TEST_CHECK(drag->get2DData() == Vector2(4.0f * frame, 4));
+    if (recorder.events.size() == 2) {
+      TEST_CHECK(recorder.events[0] == wheel);
+      TEST_CHECK(recorder.events[1] == drag);
+    }
+  }
+}
+
+/// A device level translator for one tracker and glove, standing in for
+/// the Fsas of a VR device driver: it smooths the tracker, turns the
+/// glove's bend into hand events and follows grabs and releases
+class DeviceTranslator
+{
+public:
+  DeviceTranslator() : eventMgr(NULL), device(0), smoothed(0.0f) {}
+
+  void onMove(MinVR::EventRef e) {
+    CoordinateFrame cf = e->getCoordinateFrameData();
+    cf.translation.x += filter(cf.translation.x);
+    eventMgr->queueEvent(new MinVR::VRG3DEvent(format("Hand%d_Move", device), cf));
+  }
+  void onBend(MinVR::EventRef e) {
+    double bend = e->get1DData() + filter((float)e->get1DData());
+    eventMgr->queueEvent(new MinVR::VRG3DEvent(format("Hand%d_Bend", device), bend));
+    if (e->get1DData() > 0.9) {
+      eventMgr->queueEventWithoutFilter(new MinVR::VRG3DEvent(format("Hand%d_Squeeze", device)));
+    }
+  }
+  void onGrab(MinVR::EventRef e)    { eventMgr->queueEvent(new MinVR::VRG3DEvent(format("Hand%d_Grab", device))); }
+  void onRelease(MinVR::EventRef e) { eventMgr->queueEvent(new MinVR::VRG3DEvent(format("Hand%d_Release", device))); }
+
+  /// The device's Fsa: Open and Closed states, each passing motion on
+  FsaRef makeFsa() {
+    FsaRef fsa = new Fsa(format("Device%d", device));
+    fsa->setDebug(false);
+    fsa->addState("Open");
+    fsa->addState("Closed");
+    for (int s=0;s<2;s++) {
+      Array<std::string> move, bend;
+      move.append(format("Tracker%d_Move", device));
+      bend.append(format("Glove%d_Bend", device));
+      fsa->addArc("Move", s, s, move);
+      fsa->addArc("Bend", s, s, bend);
+    }
+    Array<std::string> grab, release;
+    grab.append(format("Glove%d_Grab", device));
+    release.append(format("Glove%d_Release", device));
+    fsa->addArc("Grab", 0, 1, grab);
+    fsa->addArc("Release", 1, 0, release);
+    fsa->addArcCallback("Move", this, &DeviceTranslator::onMove);
+    fsa->addArcCallback("Bend", this, &DeviceTranslator::onBend);
+    fsa->addArcCallback("Grab", this, &DeviceTranslator::onGrab);
+    fsa->addArcCallback("Release", this, &DeviceTranslator::onRelease);
+    return fsa;
+  }
+
+  EventMgr *eventMgr;
+  int       device;
+
+private:
+  /// Exponential smoothing, so each event's output depends on the ones
+  /// before it
+  float filter(float x) {
+    smoothed = 0.9f * smoothed + 0.1f * x;
+    return smoothed * 0.001f;
+  }
+  float smoothed;
+};
+
+/// Logs every event it gets with its data
+class DataLogger
+{
+public:
+  void onEvent(MinVR::EventRef e) {
+    std::string data;
+    if (e->getType() == MinVR::VRG3DEvent::EVENTTYPE_1D) {
+      data = format("%.17g", e->get1DData());
+    }
+    else if (e->getType() == MinVR::VRG3DEvent::EVENTTYPE_COORDINATEFRAME) {
+      data = format("%.9g", e->getCoordinateFrameData().translation.x);
+    }
+    log.push_back(e->getName() + " " + data);
+  }
+  std::vector<std::string> log;
+};
+
+/// A frame of input from numDevices trackers and gloves, interleaved
+void
+makeDeviceFrame(int numDevices, int movesPerDevice, TestRandom &random, Array<MinVR::EventRef> &events)
+{
+  for (int d=0;d<numDevices;d++) {
+    for (int m=0;m<movesPerDevice;m++) {
+      events.append(new MinVR::VRG3DEvent(format("Tracker%d_Move", d),
+          CoordinateFrame(Vector3((float)random.uniform(), (float)random.uniform(), (float)random.uniform()))));
+      if (m % 2 == 0) {
+        events.append(new MinVR::VRG3DEvent(format("Glove%d_Bend", d), random.uniform()));
+      }
+    }
+    if (random.integer(4) == 0) {
+      events.append(new MinVR::VRG3DEvent(format((random.integer(2) == 0) ? "Glove%d_Grab" : "Glove%d_Release", d)));
+    }
+  }
+  for (int i=events.size()-1;i>0;i--) {
+    int j = random.integer(i + 1);
+    MinVR::EventRef e = events[i];
+    events[i] = events[j];
+    events[j] = e;
+  }
+}
+
+/// An EventMgr with a DeviceTranslator as device level Fsa for each of
+/// numDevices devices and a normal Fsa logging all events to logger
+EventMgrRef
+makeDeviceEventMgr(int numDevices, std::vector<DeviceTranslator> &translators, DataLogger *logger)
+{
+  EventMgrRef eventMgr = new EventMgr(NULL);
+  translators.resize(numDevices);
+  for (int d=0;d<numDevices;d++) {
+    translators[d].eventMgr = eventMgr.pointer();
+    translators[d].device = d;
+    eventMgr->addDeviceLevelFsaRef(translators[d].makeFsa());
+  }
+  FsaRef fsa = new Fsa("LoggingFsa");
+  fsa->setDebug(false);
+  fsa->addState("Start");
+  Array<std::string> triggers;
+  triggers.append("ALL");
+  fsa->addArc("Log", 0, 0, triggers);
+  fsa->addArcCallback("Log", logger, &DataLogger::onEvent);
+  eventMgr->addFsaRef(fsa);
+  return eventMgr;
+}
+
+/// Sixteen device translators run in parallel must give the normal Fsas
+/// exactly the events, in exactly the order, that running them one after
+/// another does, frame after frame, with aliases and a filter on the
+/// generated events and whatever the threads' timing, and leave each in
+/// the same state
+void
+testParallelDeviceLevelFsas()
+{
+  const int numDevices = 16;
+  WorkerPoolRef pool = new WorkerPool(4);
+  for (int run=0;run<3;run++) {
+    std::vector<DeviceTranslator> translators[2];
+    DataLogger loggers[2];
+    EventMgrRef eventMgrs[2];
+    for (int m=0;m<2;m++) {
+      eventMgrs[m] = makeDeviceEventMgr(numDevices, translators[m], &loggers[m]);
+      Array<std::string> aliases;
+      aliases.append("AnyGrab");
+      eventMgrs[m]->addEventAliases("Hand3_Grab", aliases);
+      eventMgrs[m]->addEventFilter(new BlockingFilter("Hand5_Bend"));
+    }
+    eventMgrs[1]->setParallelDeviceLevelFsas(true, pool);
+    TestRandom random(100 + run);
+    for (int frame=0;frame<100;frame++) {
+      Array<MinVR::EventRef> events;
+      makeDeviceFrame(numDevices, 1 + random.integer(4), random, events);
+      for (int m=0;m<2;m++) {
+        for (int i=0;i<events.size();i++) {
+          eventMgrs[m]->queueEvent(events[i]);
+        }
+        eventMgrs[m]->processEventQueue();
+      }
+    }
+    TEST_CHECK(loggers[0].log.size() > 5000);
+    TEST_CHECK(loggers[1].log == loggers[0].log);
+    for (int d=0;d<numDevices;d++) {
+      TEST_CHECK_EQUAL(eventMgrs[0]->getDeviceLevelFsaRouter().get(d)->getCurrentState(),
+                       eventMgrs[1]->getDeviceLevelFsaRouter().get(d)->getCurrentState());
+    }
+    TEST_CHECK(eventMgrs[1]->getDeviceLevelFsaRouter().numDelivered() > 0);
+  }
+}
+
+/// Each event queued from outside is recorded once, as queued, and
+/// replaying the log gives the Fsas each one once, as live
+void
+testRecordReplayRoundTrip()
+{
+  std::string logFile = testTempDirectory() + "/roundtrip.vel";
+  const int numFrames = 10;
+  double fakeTime = 100.0;
+  EventMgrRef eventMgrs[2];
+  EventRecorder recorders[2];
+  for (int m=0;m<2;m++) {
+    eventMgrs[m] = new EventMgr(NULL);
+    eventMgrs[m]->setClock([&fakeTime] { return fakeTime; });
+    eventMgrs[m]->addEventFilter(new BlockingFilter("Blocked"));
+    eventMgrs[m]->addFsaRef(makeRecordingFsa("All", "ALL", &recorders[m]));
+  }
+
+  TEST_CHECK(eventMgrs[0]->startRecording(logFile));
+  for (int frame=0;frame<numFrames;frame++) {
+    eventMgrs[0]->queueEvent(new MinVR::VRG3DEvent(format("Filtered%d", frame)));
+    eventMgrs[0]->queueEvent(new MinVR::VRG3DEvent("Blocked"));
+    eventMgrs[0]->queueEventWithoutFilter(new MinVR::VRG3DEvent("Blocked"));
+    eventMgrs[0]->queueEventWithoutFilter(new MinVR::VRG3DEvent(format("Unfiltered%d", frame)));
+    fakeTime += 1.0 / 60.0;
+    eventMgrs[0]->processEventQueue();
+  }
+  TEST_CHECK(eventMgrs[0]->stopRecording());
+  TEST_CHECK_EQUAL(recorders[0].events.size(), 3 * numFrames);
+
+  Array<EventLogRecord> records;
+  std::string error;
+  TEST_CHECK(EventLogReader::read(logFile, records, error));
+  int counts[3] = {0, 0, 0};
+  for (int i=0;i<records.size();i++) {
+    counts[records[i].type]++;
+  }
+  TEST_CHECK_EQUAL(counts[EventLogRecord::FRAME], numFrames);
+  TEST_CHECK_EQUAL(counts[EventLogRecord::EVENT], 2 * numFrames);
+  TEST_CHECK_EQUAL(counts[EventLogRecord::EVENT_WITHOUT_FILTER], 2 * numFrames);
+
+  TEST_CHECK(eventMgrs[1]->startReplay(logFile, false, error));
+  int calls = 0;
+  while (eventMgrs[1]->isReplaying() && (calls < 2 * numFrames)) {
+    eventMgrs[1]->processEventQueue();
+    calls++;
+  }
+  TEST_CHECK_EQUAL(calls, numFrames + 1);
+  TEST_CHECK_EQUAL(recorders[1].events.size(), recorders[0].events.size());
+  for (int i=0;i<iMin(recorders[0].events.size(), recorders[1].events.size());i++) {
+    TEST_CHECK_EQUAL(recorders[1].events[i]->getName(), recorders[0].events[i]->getName());
+  }
+}
+
+/// Recording a session and replaying it, as fast as possible and in
+/// real time.  The replay must give every Fsa the same events in the
+/// same order, timers included, so the callbacks run as they did live.
+void
+testRecordReplaySession()
+{
+  const int numFrames = 600;
+  const int numFsas = 20;
+  const int arcsPerState = 8;
+  std::string logFile = testTempDirectory() + "/session.vel";
+  std::vector<CallbackCounter> counters(3 * numFsas);
+  std::vector<int> logs[3];
+  NameLogger ticks[3];
+  double fakeTime[3] = {5000.0, 5000.0, 5000.0};
+  EventMgrRef eventMgrs[3];
+  for (int m=0;m<3;m++) {
+    eventMgrs[m] = new EventMgr(NULL);
+    double *clock = &fakeTime[m];
+    eventMgrs[m]->setClock([clock] { return *clock; });
+    for (int f=0;f<numFsas;f++) {
+      CallbackCounter &c = counters[m * numFsas + f];
+      c.id = f;
+      c.log = &logs[m];
+      eventMgrs[m]->addFsaRef(makeInteractionFsa(f, 4, arcsPerState, &c));
+    }
+    FsaRef fsa = new Fsa("TickFsa");
+    fsa->setDebug(false);
+    fsa->addState("Start");
+    Array<std::string> triggers;
+    triggers.append("Tick");
+    fsa->addArc("Tick", 0, 0, triggers);
+    fsa->addArcCallback("Tick", &ticks[m], &NameLogger::onEvent);
+    eventMgrs[m]->addFsaRef(fsa);
+  }
+
+  // Live, with a 60 Hz fake clock
+  Array<MinVR::EventRef> queued;
+  TestRandom random(11);
+  TEST_CHECK(eventMgrs[0]->startRecording(logFile));
+  eventMgrs[0]->queuePeriodicTimerEvent(new MinVR::VRG3DEvent("Tick"), 0.25, 0.25);
+  for (int frame=0;frame<numFrames;frame++) {
+    int first = queued.size();
+    makeSessionFrame(frame, numFsas * arcsPerState, random, queued);
+    for (int i=first;i<queued.size();i++) {
+      eventMgrs[0]->queueEvent(queued[i]);
+    }
+    fakeTime[0] += 1.0 / 60.0;
+    eventMgrs[0]->processEventQueue();
+  }
+  TEST_CHECK(eventMgrs[0]->stopRecording());
+  TEST_CHECK(logs[0].size() > 0);
+  TEST_CHECK(ticks[0].names.size() > 0);
+
+  // The log holds each queued event once, exactly as queued
+  Array<EventLogRecord> records;
+  std::string error;
+  TEST_CHECK(EventLogReader::read(logFile, records, error));
+  int numFrameRecords = 0;
+  int numEvents = 0;
+  int numDifferent = 0;
+  for (int i=0;i<records.size();i++) {
+    if (records[i].type == EventLogRecord::FRAME) {
+      numFrameRecords++;
+    }
+    else {
+      numDifferent += ((numEvents >= queued.size()) || !sameEvent(queued[numEvents], records[i].event)) ? 1 : 0;
+      numEvents++;
+    }
+  }
+  TEST_CHECK_EQUAL(numFrameRecords, numFrames);
+  TEST_CHECK_EQUAL(numEvents, queued.size());
+  TEST_CHECK_EQUAL(numDifferent, 0);
+
+  // Replayed one recorded frame per call, with live input dropped
+  // meanwhile
+  eventMgrs[1]->queuePeriodicTimerEvent(new MinVR::VRG3DEvent("Tick"), 0.25, 0.25);
+  TEST_CHECK(eventMgrs[1]->startReplay(logFile, false, error));
+  int calls = 0;
+  while (eventMgrs[1]->isReplaying() && (calls < 2 * numFrames)) {
+    eventMgrs[1]->queueEvent(new MinVR::VRG3DEvent("Button0_down"));
+    eventMgrs[1]->processEventQueue();
+    calls++;
+  }
+  TEST_CHECK_EQUAL(calls, numFrames + 1);
+  TEST_CHECK(logs[1] == logs[0]);
+  TEST_CHECK(ticks[1].names == ticks[0].names);
+
+  // In real time against a clock ticking twice per recorded frame
+  eventMgrs[2]->startReplay(records, true);
+  calls = 0;
+  while (eventMgrs[2]->isReplaying() && (calls < 4 * numFrames)) {
+    fakeTime[2] += 1.0 / 120.0;
+    eventMgrs[2]->processEventQueue();
+    calls++;
+  }
+  TEST_CHECK(abs(calls - 2 * numFrames) <= 2);
+  TEST_CHECK(logs[2] == logs[0]);
+}
+
+} // end namespace
+
+
+void
+runEventTests()
+{
+  testEventQueueProducers();
+  testQueueEventFromAnyThread();
+  testTriggerIndex();
+  testRoutedDispatch();
+  testTimerEvents();
+  testTimerWheel();
+  testAliases();
+  testEventBudget();
+  testEventNamesOnlyReferenced();
+  testUnreferencedEventNames();
+  testCompression();
+  testAccumulatedRecentEvent();
+  testParallelDeviceLevelFsas();
+  testRecordReplayRoundTrip();
+  testRecordReplaySession();
+}
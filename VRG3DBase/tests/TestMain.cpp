@@ -0,0 +1,52 @@
+/**
+   vrg3dbase_tests: unit tests for VRG3DBase that run without a GPU or a
+   display.
+
+   Usage: vrg3dbase_tests [suite]
+
+   Runs every suite, or just the named one (Events, Rendering, Textures,
+   ...).  Exits
+   with 1 if any check failed.
+*/
+
+#include "Test.H"
+#include "../include/ConfigVal.H"
+#include <filesystem>
+
+using namespace G3D;
+
+
+int
+main(int argc, char **argv)
+{
+  std::string only = (argc > 1) ? argv[1] : "";
+
+  // GfxMgr and friends read ConfigVals, give them an empty map rather
+  // than one built from our command line
+  Log *log = new Log(testTempDirectory() + "/log.txt");
+  char *configArgv[] = {argv[0], NULL};
+  MinVR::ConfigValMap::map = new MinVR::ConfigMap(1, configArgv, log, false);
+  // and keep the files GfxMgr writes relative to the working directory,
+  // like its TextureCache, out of the source tree
+  std::filesystem::current_path(testTempDirectory());
+
+  struct Suite {
+    const char *name;
+    void      (*run)();
+  };
+  Suite suites[] = {
+    {"Events",    &runEventTests},
+    {"Rendering", &runRenderingTests},
+    {"Textures",  &runTextureTests},
+  };
+  int numSuites = sizeof(suites) / sizeof(suites[0]);
+  for (int i=0;i<numSuites;i++) {
+    if ((only == "") || (only == suites[i].name)) {
+      fprintf(stderr, "%s\n", suites[i].name);
+      suites[i].run();
+    }
+  }
+
+  printf("%d checks, %d failed\n", testNumChecks(), testNumFailures());
+  return (testNumFailures() == 0) ? 0 : 1;
+}
@@ -0,0 +1,1132 @@
+#include "Test.H"
+#include "../include/DrawCommandCache.H"
+#include "../include/FrameArena.H"
+#include "../include/GfxFrameGraph.H"
+#include "../include/GfxMgr.H"
+#include "../include/RenderQueue.H"
+#include "../include/SurfaceCuller.H"
+#include "../include/VirtualTexture.H"
+#include "../include/VirtualTextureFile.H"
+#include "../include/WorkerPool.H"
+#include <algorithm>
+#include <limits>
+#include <thread>
+
+using namespace G3D;
+
+
+namespace {
+
+/// A 2m wide screen 1m in front of an eye at the origin looking down -z,
+/// like one wall of a CAVE.
+CullView
+makeView(const Vector3 &eye)
+{
+  CullView view;
+  view.eye = eye;
+  view.topLeft  = Vector3(-1, 1, -1);
+  view.topRight = Vector3( 1, 1, -1);
+  view.botLeft  = Vector3(-1,-1, -1);
+  view.botRight = Vector3( 1,-1, -1);
+  view.nearClip = 0.01;
+  view.farClip = 100.0;
+  return view;
+}
+
+/// Stands in for an app's pose callback, keeping data its poses point
+/// to in the pose arena the way callbacks are allowed to.
+class ArenaPoser
+{
+public:
+  ArenaPoser(GfxMgr *gfxMgr, int poseSize) : numPoses(0), poseSize(poseSize), posed(NULL), _gfxMgr(gfxMgr) {}
+
+  void pose(Array<Surface::Ref> &posedModels, const CoordinateFrame &virtualToRoomSpace) {
+    posed = _gfxMgr->getPoseArena().allocArray<int>(poseSize);
+    for (int i=0;i<poseSize;i++) {
+      posed[i] = numPoses + i;
+    }
+    numPoses++;
+  }
+
+  /// True if what the last pose wrote is still there
+  bool posedIntact() const {
+    for (int i=0;i<poseSize;i++) {
+      if (posed[i] != numPoses - 1 + i) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  int  numPoses;
+  int  poseSize;
+  int *posed;
+
+private:
+  GfxMgr *_gfxMgr;
+};
+
+
+/// Frames that aren't posed still end, so the arena is reset every
+/// rendered frame and stops going to the heap once it has warmed up.  The
+/// pose arena isn't, what the one pose keeps there outlives every frame.
+void
+testFrameArenaWithoutPosing()
+{
+  GfxMgrRef gfx = new GfxMgr(NULL, MinVR::ProjectionVRCameraRef());
+  ArenaPoser poser(gfx.pointer(), 2048);
+  gfx->addPoseCallback(&poser, &ArenaPoser::pose);
+
+  CullView views[2] = {makeView(Vector3(-0.03f, 0, 0)), makeView(Vector3(0.03f, 0, 0))};
+  const int numFrames = 1000;
+  const int numWarmUpFrames = 2;
+  int heapAllocs = 0;
+  for (int f=0;f<numFrames;f++) {
+    gfx->beginFrame();
+    if (f == 0) {
+      gfx->poseFrame();
+    }
+    for (int eye=0;eye<2;eye++) {
+      RenderQueue queue;
+      gfx->buildRenderQueue(views[eye], Vector3(0, 0, -1), queue);
+      // What a draw callback might keep for the eye, without a reset
+      // these overflow the arena's first block within a few frames
+      float *scratch = gfx->getFrameArena().allocArray<float>(4096);
+      System::memset(scratch, 0, 4096 * sizeof(float));
+    }
+    gfx->endFrame();
+    if (f >= numWarmUpFrames) {
+      heapAllocs += gfx->getLastFrameStats().arenaHeapAllocs;
+    }
+  }
+  TEST_CHECK_EQUAL(poser.numPoses, 1);
+  TEST_CHECK(poser.posedIntact());
+  // Frame numbers, which key the virtual texture streaming, count
+  // rendered frames rather than poses
+  TEST_CHECK_EQUAL(gfx->getLastFrameStats().frameNumber, numFrames - 1);
+  TEST_CHECK_EQUAL(heapAllocs, 0);
+  TEST_CHECK(gfx->getLastFrameStats().arenaBytesUsed < 64 * 1024);
+}
+
+/// Apps that never call beginFrame() get a new frame from each pose, and
+/// the pose arena is reset by each pose.  Poses bigger than its first
+/// block count in the frame stats until it has warmed up.
+void
+testFrameArenaPosedFrames()
+{
+  GfxMgrRef gfx = new GfxMgr(NULL, MinVR::ProjectionVRCameraRef());
+  ArenaPoser poser(gfx.pointer(), 100000);
+  gfx->addPoseCallback(&poser, &ArenaPoser::pose);
+  int heapAllocs = 0;
+  for (int f=0;f<100;f++) {
+    gfx->poseFrame();
+    TEST_CHECK(poser.posedIntact());
+    // The stats are the frame before this pose's: the first pose
+    // overflowed the arena's block and the second coalesced them
+    if (f == 1) {
+      TEST_CHECK(gfx->getLastFrameStats().arenaHeapAllocs > 0);
+    }
+    if (f > 2) {
+      heapAllocs += gfx->getLastFrameStats().arenaHeapAllocs;
+    }
+  }
+  TEST_CHECK_EQUAL(poser.numPoses, 100);
+  TEST_CHECK_EQUAL(heapAllocs, 0);
+  TEST_CHECK(gfx->getPoseArena().getFrameStats().bytesUsed >= 100000 * sizeof(int));
+}
+
+/// The depth a queued item sorts by, surfaces behind the eye and NaNs
+/// sorting as if at the eye
+float
+sortDepth(float depth)
+{
+  return (depth > 0.0f) ? depth : 0.0f;
+}
+
+/// Synthetic surfaces through the queue: opaque first, grouped by state
+/// and front-to-back within one, then transparent back-to-front, in the
+/// same order std::stable_sort gives the keys.
+void
+testRenderQueueSort()
+{
+  TestRandom random(27);
+  const int n = 5000;
+  Array<uint32> stateKeys;
+  Array<float> depths;
+  Array<bool> transparent;
+  for (int i=0;i<n;i++) {
+    // Few states so they repeat, some with bits above the 24 used
+    stateKeys.append((uint32)random.integer(40) | ((random.integer(8) == 0) ? 0xFF000000u : 0u));
+    int kind = random.integer(20);
+    if (kind == 0) {
+      depths.append(-(float)random.integer(1, 100));
+    }
+    else if (kind == 1) {
+      depths.append(std::numeric_limits<float>::quiet_NaN());
+    }
+    else if (kind == 2) {
+      depths.append(0.0f);
+    }
+    else {
+      // Repeated depths check the sort is stable
+      depths.append((float)random.integer(1, 2000) * 0.125f);
+    }
+    transparent.append(random.integer(4) == 0);
+  }
+
+  FrameArena arena;
+  RenderQueue queue;
+  queue.begin(arena, n);
+  for (int i=0;i<n;i++) {
+    queue.add(i, stateKeys[i], depths[i], transparent[i]);
+  }
+  Array<RenderQueue::Item> expected;
+  for (int i=0;i<n;i++) {
+    expected.append(queue[i]);
+  }
+  queue.sort();
+  std::stable_sort(expected.getCArray(), expected.getCArray() + n,
+                   [](const RenderQueue::Item &a, const RenderQueue::Item &b) { return a.key < b.key; });
+
+  int numOpaque = 0;
+  for (int i=0;i<n;i++) {
+    numOpaque += transparent[i] ? 0 : 1;
+  }
+  TEST_CHECK_EQUAL(queue.size(), n);
+  TEST_CHECK_EQUAL(queue.numOpaque(), numOpaque);
+  int numMisplaced = 0;
+  int numOutOfOrder = 0;
+  int numUnlikeStableSort = 0;
+  for (int i=0;i<n;i++) {
+    int index = queue[i].index;
+    numMisplaced += (transparent[index] != (i >= numOpaque)) ? 1 : 0;
+    numMisplaced += (transparent[index] != RenderQueue::isTransparentKey(queue[i].key)) ? 1 : 0;
+    numUnlikeStableSort += (index != expected[i].index) ? 1 : 0;
+    if ((i == 0) || (i == numOpaque)) {
+      continue;
+    }
+    int prev = queue[i-1].index;
+    uint32 state = stateKeys[index] & 0xFFFFFF;
+    uint32 prevState = stateKeys[prev] & 0xFFFFFF;
+    float depth = sortDepth(depths[index]);
+    float prevDepth = sortDepth(depths[prev]);
+    if (i < numOpaque) {
+      // By state, then front-to-back
+      bool ok = (prevState < state) || ((prevState == state) && (prevDepth <= depth));
+      numOutOfOrder += ok ? 0 : 1;
+    }
+    else {
+      // Back-to-front, then by state
+      bool ok = (prevDepth > depth) || ((prevDepth == depth) && (prevState <= state));
+      numOutOfOrder += ok ? 0 : 1;
+    }
+    // Equal keys keep the order they were added in
+    if (queue[i-1].key == queue[i].key) {
+      numOutOfOrder += (prev < index) ? 0 : 1;
+    }
+  }
+  TEST_CHECK_EQUAL(numMisplaced, 0);
+  TEST_CHECK_EQUAL(numOutOfOrder, 0);
+  TEST_CHECK_EQUAL(numUnlikeStableSort, 0);
+
+  // Behind the eye and NaN are at the eye
+  float nan = std::numeric_limits<float>::quiet_NaN();
+  TEST_CHECK_EQUAL(RenderQueue::makeOpaqueKey(7, -3.0f), RenderQueue::makeOpaqueKey(7, 0.0f));
+  TEST_CHECK_EQUAL(RenderQueue::makeOpaqueKey(7, nan), RenderQueue::makeOpaqueKey(7, 0.0f));
+  TEST_CHECK_EQUAL(RenderQueue::makeOpaqueKey(7, -0.0f), RenderQueue::makeOpaqueKey(7, 0.0f));
+  TEST_CHECK_EQUAL(RenderQueue::makeTransparentKey(7, -3.0f), RenderQueue::makeTransparentKey(7, 0.0f));
+  TEST_CHECK_EQUAL(RenderQueue::makeTransparentKey(7, nan), RenderQueue::makeTransparentKey(7, 0.0f));
+  TEST_CHECK(RenderQueue::makeOpaqueKey(7, 0.0f) < RenderQueue::makeOpaqueKey(7, 0.001f));
+  TEST_CHECK(RenderQueue::makeTransparentKey(7, 0.0f) > RenderQueue::makeTransparentKey(7, 0.001f));
+  TEST_CHECK(RenderQueue::makeOpaqueKey(0xFFFFFF, 1e30f) < RenderQueue::makeTransparentKey(0, 1e30f));
+}
+
+/// The radix sort on its own, against std::stable_sort, for keys that
+/// differ in every byte, in only a few and not at all
+void
+testRadixSort()
+{
+  TestRandom random(28);
+  int sizes[] = {0, 1, 2, 17, 1000};
+  uint64 masks[] = {~(uint64)0, 0x00FF00000000FF00ull, 0};
+  for (int s=0;s<5;s++) {
+    for (int m=0;m<3;m++) {
+      int n = sizes[s];
+      Array<RenderQueue::Item> items;
+      Array<RenderQueue::Item> scratch;
+      for (int i=0;i<n;i++) {
+        RenderQueue::Item item;
+        // Few distinct values in the varying bytes, so keys repeat
+        item.key = (random.next() & masks[m] & 0x0303030303030303ull) | 0x4000000000000000ull;
+        item.index = i;
+        items.append(item);
+      }
+      scratch.resize(n);
+      Array<RenderQueue::Item> expected = items;
+      std::stable_sort(expected.getCArray(), expected.getCArray() + n,
+                       [](const RenderQueue::Item &a, const RenderQueue::Item &b) { return a.key < b.key; });
+      RenderQueue::radixSort(items.getCArray(), scratch.getCArray(), n);
+      int numDifferent = 0;
+      for (int i=0;i<n;i++) {
+        numDifferent += ((items[i].index != expected[i].index) || (items[i].key != expected[i].key)) ? 1 : 0;
+      }
+      TEST_CHECK_EQUAL(numDifferent, 0);
+    }
+  }
+}
+
+/// The profiler's frames are GfxMgr's rendered frames, posed or not, so
+/// per-frame numbers count each eye once per frame.
+void
+testProfilerFrames()
+{
+  GfxMgrRef gfx = new GfxMgr(NULL, MinVR::ProjectionVRCameraRef());
+  ProfilerRef profiler = gfx->getProfiler();
+  bool wasEnabled = profiler->isEnabled();
+  profiler->setEnabled(true);
+  ProfileZoneID zone = profiler->intern("TestRendering::eye");
+  gfx->beginFrame();
+  gfx->poseFrame();
+  // Fill the whole history, the default profiler has seen other tests
+  for (int f=0;f<profiler->historyFrames();f++) {
+    if (f > 0) {
+      gfx->beginFrame();
+    }
+    for (int eye=0;eye<2;eye++) {
+      ProfileScope scope(profiler.pointer(), zone);
+    }
+    gfx->endFrame();
+  }
+  TEST_CHECK_CLOSE(profiler->getStats(zone).callsPerFrame, 2.0, 1e-9);
+  profiler->setEnabled(wasEnabled);
+}
+
+CullSphere
+makeSphere(const Vector3 &center, float radius)
+{
+  CullSphere s;
+  s.center = center;
+  s.radius = radius;
+  return s;
+}
+
+void
+testFrustumCulling()
+{
+  ViewFrustum frustum(makeView(Vector3(0, 0, 0)));
+  // The screen's edges are at 45 degrees, so at z=-5 it spans x in [-5,5]
+  TEST_CHECK(frustum.intersectsSphere(Vector3(0, 0, -5), 0.5f));
+  TEST_CHECK(frustum.intersectsSphere(Vector3(5.2f, 0, -5), 0.5f));
+  TEST_CHECK(frustum.intersectsSphere(Vector3(0, 0, -100.2f), 0.5f));
+  TEST_CHECK(!frustum.intersectsSphere(Vector3(0, 0, 5), 0.5f));
+  TEST_CHECK(!frustum.intersectsSphere(Vector3(10, 0, -5), 0.5f));
+  TEST_CHECK(!frustum.intersectsSphere(Vector3(0, -6, -5), 0.5f));
+  TEST_CHECK(!frustum.intersectsSphere(Vector3(0, 0, -101), 0.5f));
+
+  // The culler agrees, on one thread or spread over a pool
+  CullSphere spheres[] = {
+    makeSphere(Vector3(0, 0, -5), 0.5f),
+    makeSphere(Vector3(10, 0, -5), 0.5f),
+    makeSphere(Vector3(-4, 3, -6), 1.0f),
+    makeSphere(Vector3(0, 0, 5), 0.5f),
+  };
+  uint8 expected[] = {1, 0, 1, 0};
+  SurfaceCuller culler;
+  Array<Box> occluders;
+  uint8 visible[4];
+  culler.cull(makeView(Vector3(0, 0, 0)), spheres, 4, occluders, visible, NULL);
+  TEST_CHECK(memcmp(visible, expected, 4) == 0);
+  TEST_CHECK_EQUAL(culler.getStats().numFrustumCulled, 2);
+  TEST_CHECK_EQUAL(culler.getStats().numVisible, 2);
+
+  WorkerPool pool(4);
+  Array<CullSphere> many;
+  Array<uint8> serialVisible, poolVisible;
+  for (int i=0;i<5000;i++) {
+    many.append(makeSphere(Vector3((float)(i % 41) - 20, (float)(i % 13) - 6, -(float)(i % 97)), 0.25f));
+  }
+  serialVisible.resize(many.size());
+  poolVisible.resize(many.size());
+  culler.cull(makeView(Vector3(0, 0, 0)), many.getCArray(), many.size(), occluders, serialVisible.getCArray(), NULL);
+  int numVisible = culler.getStats().numVisible;
+  culler.cull(makeView(Vector3(0, 0, 0)), many.getCArray(), many.size(), occluders, poolVisible.getCArray(), &pool);
+  TEST_CHECK(memcmp(serialVisible.getCArray(), poolVisible.getCArray(), many.size()) == 0);
+  TEST_CHECK_EQUAL(culler.getStats().numVisible, numVisible);
+}
+
+void
+testHierarchicalZ()
+{
+  // A 6x6m wall, half a meter thick, 5m in front of the eye
+  Box wall(Vector3(-3, -3, -5.5f), Vector3(3, 3, -5));
+  OcclusionBuffer buffer(128, 64);
+  buffer.beginView(makeView(Vector3(0, 0, 0)));
+  buffer.rasterizeOccluder(wall);
+  buffer.buildHierarchy();
+
+  // The wall spans x in [-0.6,0.6] of the [-1,1] screen, the texels it
+  // covers get its far depth and the rest stay empty
+  TEST_CHECK_CLOSE(buffer.depthAt(64, 32), 5.5, 1e-4);
+  TEST_CHECK_CLOSE(buffer.depthAt(30, 32), 5.5, 1e-4);
+  TEST_CHECK(buffer.depthAt(20, 32) == inf());
+  TEST_CHECK(buffer.depthAt(0, 0) == inf());
+  TEST_CHECK(buffer.depthAt(64, 0) == inf());
+
+  // Hidden: well inside the silhouette and behind the wall
+  TEST_CHECK(buffer.isOccluded(Vector3(0, 0, -10), 0.5f));
+  TEST_CHECK(buffer.isOccluded(Vector3(-4, 3, -20), 2.0f));
+  // In front of the wall, or reaching in front of its far side
+  TEST_CHECK(!buffer.isOccluded(Vector3(0, 0, -3), 0.5f));
+  TEST_CHECK(!buffer.isOccluded(Vector3(0, 0, -5.3f), 0.1f));
+  // Beside it, or poking out past its edge; a coarse mip level that mixes
+  // covered and empty texels must not hide the sphere
+  TEST_CHECK(!buffer.isOccluded(Vector3(8, 0, -10), 0.5f));
+  TEST_CHECK(!buffer.isOccluded(Vector3(6, 0, -10), 1.0f));
+  TEST_CHECK(!buffer.isOccluded(Vector3(0, 0, -40), 30.0f));
+
+  // Occluders crossing the near plane can't be bounded and are skipped
+  OcclusionBuffer nearBuffer(128, 64);
+  nearBuffer.beginView(makeView(Vector3(0, 0, 0)));
+  nearBuffer.rasterizeOccluder(Box(Vector3(-3, -3, -5), Vector3(3, 3, 1)));
+  nearBuffer.buildHierarchy();
+  TEST_CHECK(nearBuffer.depthAt(64, 32) == inf());
+  TEST_CHECK(!nearBuffer.isOccluded(Vector3(0, 0, -10), 0.5f));
+
+  // Through the culler, with the frustum test first
+  SurfaceCuller culler;
+  culler.setOcclusionEnabled(true);
+  Array<Box> occluders;
+  occluders.append(wall);
+  CullSphere spheres[] = {
+    makeSphere(Vector3(0, 0, -10), 0.5f),
+    makeSphere(Vector3(8, 0, -10), 0.5f),
+    makeSphere(Vector3(20, 0, -10), 0.5f),
+    makeSphere(Vector3(0, 0, -3), 0.5f),
+  };
+  uint8 expected[] = {0, 1, 0, 1};
+  uint8 visible[4];
+  culler.cull(makeView(Vector3(0, 0, 0)), spheres, 4, occluders, visible, NULL);
+  TEST_CHECK(memcmp(visible, expected, 4) == 0);
+  TEST_CHECK_EQUAL(culler.getStats().numOccluders, 1);
+  TEST_CHECK_EQUAL(culler.getStats().numOcclusionCulled, 1);
+  TEST_CHECK_EQUAL(culler.getStats().numFrustumCulled, 1);
+}
+
+/// Adds one occluder when posed
+class OccluderPoser
+{
+public:
+  OccluderPoser(GfxMgr *gfxMgr) : _gfxMgr(gfxMgr) {}
+
+  void pose(Array<Surface::Ref> &posedModels, const CoordinateFrame &virtualToRoomSpace) {
+    _gfxMgr->addOccluder(Box(Vector3(-3, -3, -5.5f), Vector3(3, 3, -5)));
+  }
+
+private:
+  GfxMgr *_gfxMgr;
+};
+
+/// GfxMgr's cull stats cover every eye of the last frame.
+void
+testGfxMgrCullStats()
+{
+  GfxMgrRef gfx = new GfxMgr(NULL, MinVR::ProjectionVRCameraRef());
+  OccluderPoser poser(gfx.pointer());
+  gfx->addPoseCallback(&poser, &OccluderPoser::pose);
+  gfx->setOcclusionCullingEnabled(true);
+
+  // Culling is opt in, until then everything posed is drawn
+  TEST_CHECK(!gfx->getFrustumCullingEnabled());
+  gfx->beginFrame();
+  gfx->poseFrame();
+  RenderQueue unculled;
+  gfx->buildRenderQueue(makeView(Vector3(0, 0, 0)), Vector3(0, 0, -1), unculled);
+  gfx->endFrame();
+  TEST_CHECK_EQUAL(gfx->getCullStats().numOccluders, 0);
+  TEST_CHECK_EQUAL(gfx->getCullStats().numVisible, gfx->getCullStats().numTested);
+
+  gfx->setFrustumCullingEnabled(true);
+  gfx->beginFrame();
+  gfx->poseFrame();
+  for (int eye=0;eye<2;eye++) {
+    RenderQueue queue;
+    gfx->buildRenderQueue(makeView(Vector3(eye ? 0.03f : -0.03f, 0, 0)), Vector3(0, 0, -1), queue);
+  }
+  gfx->endFrame();
+  TEST_CHECK_EQUAL(gfx->getCullStats().numOccluders, 2);
+
+  // A frame with one view is counted on its own
+  gfx->beginFrame();
+  RenderQueue queue;
+  gfx->buildRenderQueue(makeView(Vector3(0, 0, 0)), Vector3(0, 0, -1), queue);
+  gfx->endFrame();
+  TEST_CHECK_EQUAL(gfx->getCullStats().numOccluders, 1);
+
+  SurfaceCuller::Stats a, b;
+  a.numTested = 10;
+  a.numVisible = 4;
+  a.numFrustumCulled = 6;
+  b.numTested = 10;
+  b.numVisible = 3;
+  b.numOcclusionCulled = 7;
+  a.add(b);
+  TEST_CHECK_EQUAL(a.numTested, 20);
+  TEST_CHECK_EQUAL(a.numVisible, 7);
+  TEST_CHECK_EQUAL(a.numFrustumCulled, 6);
+  TEST_CHECK_EQUAL(a.numOcclusionCulled, 7);
+}
+
+/// The passes the direct drawFrame(), from before frames were recorded
+/// once and replayed, ran for each eye.
+void
+directRenderingOps(bool background, bool sky, bool surfaces, bool drawCallbacks,
+                   Array<GfxFrameGraph::Op> &ops)
+{
+  if (background) {
+    ops.append(GfxFrameGraph::OP_BACKGROUND);
+  }
+  if (sky) {
+    ops.append(GfxFrameGraph::OP_SKY);
+  }
+  if (surfaces) {
+    ops.append(GfxFrameGraph::OP_SURFACES);
+  }
+  if (drawCallbacks) {
+    ops.append(GfxFrameGraph::OP_DRAW_CALLBACKS);
+  }
+  if (sky) {
+    ops.append(GfxFrameGraph::OP_LENS_FLARE);
+  }
+}
+
+/// Draws each view the direct way, running every pass for every view.
+void
+drawDirect(const Array<GfxFrameGraph::Op> &ops, int numViews, FrameGraphBackend &backend)
+{
+  GfxFrameGraph::FrameData data;
+  for (int v=0;v<numViews;v++) {
+    backend.beginView(data, Vector3(0, 0, -1));
+    for (int i=0;i<ops.size();i++) {
+      backend.execute(ops[i], data, Vector3(0, 0, -1));
+    }
+    backend.endView(data);
+  }
+}
+
+template <class T>
+bool
+sameElements(const Array<T> &a, const Array<T> &b)
+{
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (int i=0;i<a.size();i++) {
+    if (a[i] != b[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Recording a frame once and replaying it on 2, 4 and 8 views runs the
+/// same passes, in the same order, as drawing every view directly.
+void
+testFrameGraphReplay()
+{
+  int viewCounts[] = {2, 4, 8};
+  for (int state=0;state<16;state++) {
+    Array<GfxFrameGraph::Op> ops;
+    directRenderingOps((state & 1) != 0, (state & 2) != 0, (state & 4) != 0, (state & 8) != 0, ops);
+    for (int c=0;c<3;c++) {
+      int numViews = viewCounts[c];
+      GfxFrameGraph graph;
+      GfxFrameGraph::FrameData &data = graph.beginRecording();
+      data.backgroundRepeat = 2.0;
+      for (int i=0;i<ops.size();i++) {
+        graph.record(ops[i]);
+      }
+      graph.endRecording();
+
+      RecordingFrameGraphBackend replayed;
+      for (int v=0;v<numViews;v++) {
+        graph.replay(&replayed, Vector3(0, 0, -1));
+      }
+      RecordingFrameGraphBackend direct;
+      drawDirect(ops, numViews, direct);
+
+      TEST_CHECK(sameElements(replayed.getLog(), direct.getLog()));
+      TEST_CHECK_EQUAL(replayed.numViews(), numViews);
+      TEST_CHECK_EQUAL(graph.numRecordings(), 1);
+      TEST_CHECK_EQUAL(graph.numReplays(), numViews);
+      TEST_CHECK(graph.getFrameData().backgroundRepeat == 2.0);
+    }
+  }
+}
+
+class NullDrawer
+{
+public:
+  void draw(RenderDevice *rd, const CoordinateFrame &virtualToRoomSpace) {}
+};
+
+/// What GfxMgr records for a frame, replayed on a recording backend,
+/// matches the passes the direct drawFrame() ran in the same state.
+void
+testGfxMgrFrameGraph()
+{
+  GImage image(256, 256, 3);
+  GImageTileSource source(image);
+  std::string vtexFile = testTempDirectory() + "/background.vtex";
+  std::string error;
+  bool built = VirtualTextureFile::build(source, vtexFile, 128, 4, error);
+  TEST_CHECK(built);
+  VirtualTextureFileRef file = VirtualTextureFile::open(vtexFile, error);
+  TEST_CHECK(file.notNull());
+  if (file.isNull()) {
+    return;
+  }
+
+  NullDrawer drawer;
+  int viewCounts[] = {2, 4, 8};
+  for (int state=0;state<4;state++) {
+    bool background = (state & 1) != 0;
+    bool drawCallbacks = (state & 2) != 0;
+    GfxMgrRef gfx = new GfxMgr(NULL, MinVR::ProjectionVRCameraRef());
+    if (background) {
+      gfx->setBackgroundVirtualTexture(new VirtualTexture(file, 16, NULL));
+    }
+    if (drawCallbacks) {
+      gfx->addDrawCallback(&drawer, &NullDrawer::draw);
+    }
+    Array<GfxFrameGraph::Op> ops;
+    directRenderingOps(background, false, false, drawCallbacks, ops);
+
+    for (int c=0;c<3;c++) {
+      int numViews = viewCounts[c];
+      gfx->beginFrame();
+      int numRecordings = gfx->getFrameGraph().numRecordings();
+      RecordingFrameGraphBackend replayed;
+      for (int v=0;v<numViews;v++) {
+        gfx->replayFrame(&replayed);
+      }
+      gfx->endFrame();
+      RecordingFrameGraphBackend direct;
+      drawDirect(ops, numViews, direct);
+
+      TEST_CHECK(sameElements(replayed.getLog(), direct.getLog()));
+      TEST_CHECK_EQUAL(gfx->getFrameGraph().numRecordings(), numRecordings + 1);
+    }
+  }
+
+  // Changing what is drawn mid-frame records again
+  GfxMgrRef gfx = new GfxMgr(NULL, MinVR::ProjectionVRCameraRef());
+  RecordingFrameGraphBackend backend;
+  gfx->beginFrame();
+  gfx->replayFrame(&backend);
+  TEST_CHECK_EQUAL(backend.getLog().size(), 0);
+  int id = gfx->addDrawCallback(&drawer, &NullDrawer::draw);
+  gfx->replayFrame(&backend);
+  TEST_CHECK_EQUAL(backend.numExecuted(GfxFrameGraph::OP_DRAW_CALLBACKS), 1);
+  TEST_CHECK_EQUAL(gfx->getFrameGraph().numRecordings(), 2);
+  gfx->removeDrawCallback(id);
+  gfx->endFrame();
+}
+
+/// Procedural source for building a .vtex without an image file.  Every
+/// texel is different enough that a misplaced tile shows up.
+class PatternTileSource : public VirtualTextureTileSource
+{
+public:
+  PatternTileSource(int width, int height) : _width(width), _height(height) {}
+  virtual ~PatternTileSource() {}
+
+  int width() const    { return _width; }
+  int height() const   { return _height; }
+  int channels() const { return 3; }
+
+  void readRegion(int x, int y, int w, int h, uint8 *out) {
+    for (int j=0;j<h;j++) {
+      int sy = iClamp(y + j, 0, _height - 1);
+      for (int i=0;i<w;i++) {
+        int sx = iClamp(x + i, 0, _width - 1);
+        out[0] = (uint8)(sx ^ sy);
+        out[1] = (uint8)(sx >> 4);
+        out[2] = (uint8)(sy >> 4);
+        out += 3;
+      }
+    }
+  }
+
+private:
+  int _width;
+  int _height;
+};
+
+/// A 1024x512 image in 128 texel tiles: 8x4 tiles at level 0 down to a
+/// single tile at level 3.
+VirtualTextureFileRef
+makeVirtualTextureFile()
+{
+  PatternTileSource source(1024, 512);
+  std::string vtexFile = testTempDirectory() + "/pattern.vtex";
+  std::string error;
+  bool built = VirtualTextureFile::build(source, vtexFile, 128, 4, error);
+  TEST_CHECK(built);
+  VirtualTextureFileRef file = VirtualTextureFile::open(vtexFile, error);
+  TEST_CHECK(file.notNull());
+  return file;
+}
+
+VirtualTextureView
+makeTextureView(double x0, double y0, double x1, double y1, int screenWidth, int screenHeight)
+{
+  VirtualTextureView view;
+  view.x0 = x0;
+  view.y0 = y0;
+  view.x1 = x1;
+  view.y1 = y1;
+  view.screenWidth = screenWidth;
+  view.screenHeight = screenHeight;
+  return view;
+}
+
+bool
+isResident(const VirtualTexture &vt, const VirtualTextureTile &tile)
+{
+  return vt.getCache().find(tile.key()) >= 0;
+}
+
+/// The feedback pass picks the level with about a texel per pixel and
+/// only the tiles of it on screen are read.
+void
+testVirtualTextureTileSelection()
+{
+  VirtualTextureFileRef file = makeVirtualTextureFile();
+  if (file.isNull()) {
+    return;
+  }
+  VirtualTextureRef vt = new VirtualTexture(file, 16, NULL);
+  TEST_CHECK_EQUAL(vt->info().numLevels, 4);
+
+  Array<VirtualTextureTile> tiles;
+  vt->computeNeededTiles(makeTextureView(0, 0, 1024, 512, 1024, 512), tiles);
+  TEST_CHECK_EQUAL(tiles.size(), 32);
+  tiles.fastClear();
+  vt->computeNeededTiles(makeTextureView(0, 0, 1024, 512, 256, 128), tiles);
+  TEST_CHECK_EQUAL(tiles.size(), 2);
+  TEST_CHECK_EQUAL(tiles[0].level, 2);
+  tiles.fastClear();
+  vt->computeNeededTiles(makeTextureView(0, 0, 1024, 512, 128, 64), tiles);
+  TEST_CHECK_EQUAL(tiles.size(), 1);
+  TEST_CHECK_EQUAL(tiles[0].level, 3);
+  // Views past the edges of the image only need the tiles inside it
+  tiles.fastClear();
+  vt->computeNeededTiles(makeTextureView(-500, -500, 100, 100, 600, 600), tiles);
+  TEST_CHECK_EQUAL(tiles.size(), 1);
+
+  // Zoomed in on the middle of the second row of tiles, at level 0
+  VirtualTextureView view = makeTextureView(300, 200, 500, 250, 200, 50);
+  tiles.fastClear();
+  vt->computeNeededTiles(view, tiles);
+  TEST_CHECK_EQUAL(tiles.size(), 2);
+  for (int i=0;i<tiles.size();i++) {
+    TEST_CHECK_EQUAL(tiles[i].level, 0);
+    TEST_CHECK_EQUAL(tiles[i].x, 2 + i);
+    TEST_CHECK_EQUAL(tiles[i].y, 1);
+  }
+
+  vt->update(view, 1);
+  // The coarsest tile and the two on screen, nothing else
+  TEST_CHECK_EQUAL(vt->numLoads(), 3);
+  TEST_CHECK_EQUAL(vt->getCache().numResident(), 3);
+  TEST_CHECK_EQUAL(vt->numPendingLoads(), 0);
+  TEST_CHECK(isResident(*vt, VirtualTextureTile(3, 0, 0)));
+  TEST_CHECK(isResident(*vt, VirtualTextureTile(0, 2, 1)));
+  TEST_CHECK(isResident(*vt, VirtualTextureTile(0, 3, 1)));
+  TEST_CHECK(!isResident(*vt, VirtualTextureTile(0, 1, 1)));
+
+  Array<VirtualTexture::DrawTile> drawTiles;
+  vt->getDrawTiles(view, drawTiles);
+  TEST_CHECK_EQUAL(drawTiles.size(), 2);
+  for (int i=0;i<drawTiles.size();i++) {
+    TEST_CHECK_EQUAL(drawTiles[i].level, 0);
+    TEST_CHECK_EQUAL(drawTiles[i].x0, (2 + i) * 128.0);
+    TEST_CHECK_EQUAL(drawTiles[i].y0, 128.0);
+  }
+
+  // The same view again reads nothing
+  vt->update(view, 2);
+  TEST_CHECK_EQUAL(vt->numLoads(), 3);
+}
+
+/// Until a tile is loaded the page table hands out the nearest coarser
+/// tile covering it, and draws the part of it that covers the tile.
+void
+testVirtualTextureFallback()
+{
+  VirtualTextureInfo info(1024, 512, 128, 4, 3);
+  VirtualTexturePageTable pageTable(info);
+  int resolvedLevel = -1;
+  TEST_CHECK_EQUAL(pageTable.resolve(0, 5, 2, resolvedLevel), -1);
+
+  pageTable.set(3, 0, 0, 0);
+  TEST_CHECK_EQUAL(pageTable.resolve(0, 5, 2, resolvedLevel), 0);
+  TEST_CHECK_EQUAL(resolvedLevel, 3);
+  // Level 1 tile 2,1 covers level 0 tiles 4-5,2-3
+  pageTable.set(1, 2, 1, 7);
+  TEST_CHECK_EQUAL(pageTable.resolve(0, 5, 2, resolvedLevel), 7);
+  TEST_CHECK_EQUAL(resolvedLevel, 1);
+  TEST_CHECK_EQUAL(pageTable.resolve(0, 4, 3, resolvedLevel), 7);
+  TEST_CHECK_EQUAL(resolvedLevel, 1);
+  TEST_CHECK_EQUAL(pageTable.resolve(0, 6, 2, resolvedLevel), 0);
+  TEST_CHECK_EQUAL(resolvedLevel, 3);
+  pageTable.set(0, 5, 2, 9);
+  TEST_CHECK_EQUAL(pageTable.resolve(0, 5, 2, resolvedLevel), 9);
+  TEST_CHECK_EQUAL(resolvedLevel, 0);
+  // A tile that is evicted falls back again
+  pageTable.set(1, 2, 1, -1);
+  TEST_CHECK_EQUAL(pageTable.resolve(0, 4, 3, resolvedLevel), 0);
+  TEST_CHECK_EQUAL(resolvedLevel, 3);
+
+  VirtualTextureFileRef file = makeVirtualTextureFile();
+  if (file.isNull()) {
+    return;
+  }
+  VirtualTextureRef vt = new VirtualTexture(file, 16, NULL);
+  VirtualTextureView view = makeTextureView(300, 200, 500, 250, 200, 50);
+
+  // With no uploads allowed only the coarsest tile, loaded up front, is
+  // there to draw
+  vt->update(view, 1, 0);
+  Array<VirtualTexture::DrawTile> drawTiles;
+  vt->getDrawTiles(view, drawTiles);
+  TEST_CHECK_EQUAL(drawTiles.size(), 2);
+  int coarsestSlot = vt->getCache().find(VirtualTextureTile(3, 0, 0).key());
+  TEST_CHECK(coarsestSlot >= 0);
+  double size = vt->cacheTextureSize();
+  int p = vt->info().paddedTileSize();
+  double slotU0 = ((coarsestSlot % vt->slotsPerRow()) * p + 4) / size;
+  double slotV0 = ((coarsestSlot / vt->slotsPerRow()) * p + 4) / size;
+  for (int i=0;i<drawTiles.size();i++) {
+    const VirtualTexture::DrawTile &dt = drawTiles[i];
+    TEST_CHECK_EQUAL(dt.level, 3);
+    // Level 0 tile 2+i,1 is the 16x16 texels of the level 3 tile at
+    // (2+i)*16,16
+    TEST_CHECK_CLOSE(dt.u0, slotU0 + (2 + i) * 16 / size, 1e-5);
+    TEST_CHECK_CLOSE(dt.u1, slotU0 + (3 + i) * 16 / size, 1e-5);
+    TEST_CHECK_CLOSE(dt.v0, slotV0 + 16 / size, 1e-5);
+    TEST_CHECK_CLOSE(dt.v1, slotV0 + 32 / size, 1e-5);
+  }
+
+  // Once they are uploaded the tiles themselves are drawn
+  vt->update(view, 2);
+  drawTiles.fastClear();
+  vt->getDrawTiles(view, drawTiles);
+  TEST_CHECK_EQUAL(drawTiles.size(), 2);
+  for (int i=0;i<drawTiles.size();i++) {
+    TEST_CHECK_EQUAL(drawTiles[i].level, 0);
+  }
+}
+
+/// The cache evicts the least recently used tile, never one used this
+/// frame or pinned.
+void
+testVirtualTextureEviction()
+{
+  VirtualTextureTileCache cache(4);
+  bool evicted;
+  uint64 evictedKey;
+  for (int i=0;i<4;i++) {
+    TEST_CHECK_EQUAL(cache.allocate(10 + i, 1 + i, evicted, evictedKey), i);
+    TEST_CHECK(!evicted);
+  }
+  TEST_CHECK_EQUAL(cache.numResident(), 4);
+
+  cache.touch(cache.find(10), 5);
+  // 11 and 12 are the oldest now
+  TEST_CHECK_EQUAL(cache.allocate(14, 6, evicted, evictedKey), 1);
+  TEST_CHECK(evicted);
+  TEST_CHECK_EQUAL(evictedKey, (uint64)11);
+  TEST_CHECK_EQUAL(cache.allocate(15, 6, evicted, evictedKey), 2);
+  TEST_CHECK_EQUAL(evictedKey, (uint64)12);
+  TEST_CHECK_EQUAL(cache.find(11), -1);
+  TEST_CHECK_EQUAL(cache.find(12), -1);
+
+  // 13 is the oldest but pinned
+  cache.pin(cache.find(13));
+  TEST_CHECK_EQUAL(cache.allocate(16, 7, evicted, evictedKey), 0);
+  TEST_CHECK_EQUAL(evictedKey, (uint64)10);
+  TEST_CHECK_EQUAL(cache.allocate(17, 7, evicted, evictedKey), 1);
+  TEST_CHECK_EQUAL(evictedKey, (uint64)14);
+  TEST_CHECK_EQUAL(cache.allocate(18, 7, evicted, evictedKey), 2);
+  TEST_CHECK_EQUAL(evictedKey, (uint64)15);
+  // Everything else was used in frame 7
+  TEST_CHECK_EQUAL(cache.allocate(19, 7, evicted, evictedKey), -1);
+  TEST_CHECK(!evicted);
+  TEST_CHECK_EQUAL(cache.find(13), 3);
+  TEST_CHECK_EQUAL(cache.numEvictions(), 5);
+
+  // Panning across the image one tile a frame through a cache with room
+  // for the coarsest tile and three others keeps the last three
+  VirtualTextureFileRef file = makeVirtualTextureFile();
+  if (file.isNull()) {
+    return;
+  }
+  VirtualTextureRef vt = new VirtualTexture(file, 4, NULL);
+  for (int f=0;f<8;f++) {
+    vt->update(makeTextureView(f * 128, 0, (f + 1) * 128, 128, 128, 128), f);
+    TEST_CHECK(isResident(*vt, VirtualTextureTile(3, 0, 0)));
+    for (int x=0;x<=f;x++) {
+      TEST_CHECK_EQUAL(isResident(*vt, VirtualTextureTile(0, x, 0)), x >= f - 2);
+    }
+    TEST_CHECK_EQUAL(vt->getCache().numEvictions(), iMax(0, f - 2));
+  }
+}
+
+/// Tiles read on the pool are uploaded by a later update(), on the
+/// thread calling it, with the texels from the file.
+void
+testVirtualTextureAsyncLoads()
+{
+  VirtualTextureFileRef file = makeVirtualTextureFile();
+  if (file.isNull()) {
+    return;
+  }
+  WorkerPoolRef pool = new WorkerPool(2);
+  VirtualTextureRef vt = new VirtualTexture(file, 64, pool.pointer());
+  size_t tileBytes = vt->info().tileBytes();
+
+  Array< Array<uint8> > slotTexels;
+  slotTexels.resize(vt->getCache().numSlots());
+  int numUploads = 0;
+  bool uploadedOffThread = false;
+  std::thread::id updateThread = std::this_thread::get_id();
+  vt->setUploadFunc([&](int slot, const uint8 *texels) {
+    slotTexels[slot].resize((int)tileBytes);
+    System::memcpy(slotTexels[slot].getCArray(), texels, tileBytes);
+    numUploads++;
+    uploadedOffThread = uploadedOffThread || (std::this_thread::get_id() != updateThread);
+  });
+
+  VirtualTextureView view = makeTextureView(0, 0, 1024, 512, 1024, 512);
+  Array<VirtualTextureTile> tiles;
+  vt->computeNeededTiles(view, tiles);
+  TEST_CHECK_EQUAL(tiles.size(), 32);
+
+  vt->update(view, 1);
+  vt->waitForLoads();
+  // Reads that finished after update() returned wait for the next one
+  vt->update(view, 2);
+  TEST_CHECK_EQUAL(vt->numPendingLoads(), 0);
+  TEST_CHECK_EQUAL(vt->numLoads(), 33);
+  TEST_CHECK_EQUAL(numUploads, 33);
+  TEST_CHECK(!uploadedOffThread);
+
+  Array<uint8> expected;
+  expected.resize((int)tileBytes);
+  for (int i=0;i<tiles.size();i++) {
+    int slot = vt->getCache().find(tiles[i].key());
+    TEST_CHECK(slot >= 0);
+    if (slot < 0) {
+      continue;
+    }
+    file->readTile(tiles[i].level, tiles[i].x, tiles[i].y, expected.getCArray());
+    TEST_CHECK(memcmp(slotTexels[slot].getCArray(), expected.getCArray(), tileBytes) == 0);
+  }
+
+  Array<VirtualTexture::DrawTile> drawTiles;
+  vt->getDrawTiles(view, drawTiles);
+  TEST_CHECK_EQUAL(drawTiles.size(), 32);
+  for (int i=0;i<drawTiles.size();i++) {
+    TEST_CHECK_EQUAL(drawTiles[i].level, 0);
+  }
+
+  // Destroying it with reads still going waits for them
+  VirtualTextureRef abandoned = new VirtualTexture(file, 64, pool.pointer());
+  abandoned->update(view, 1);
+  abandoned = NULL;
+}
+
+/** Stands in for OpenGL with display lists: commands go into the buffer
+    being captured, or straight to the screen when nothing is.  Replaying a
+    buffer draws its commands to the screen. */
+class CommandLogDevice : public CommandCaptureDevice
+{
+public:
+  CommandLogDevice() : numDestroyed(0), _nextID(1), _capturing(0) {}
+  virtual ~CommandLogDevice() {}
+
+  CommandBufferID createBuffer() {
+    CommandBufferID id = _nextID++;
+    _buffers.set(id, Array<int>());
+    return id;
+  }
+  void destroyBuffer(CommandBufferID id) {
+    _buffers.remove(id);
+    numDestroyed++;
+  }
+  void beginCapture(CommandBufferID id) {
+    _capturing = id;
+    _buffers[id].fastClear();
+  }
+  void endCapture(CommandBufferID id) { _capturing = 0; }
+  void replay(CommandBufferID id)     { screen.append(_buffers[id]); }
+
+  void issue(int command) {
+    if (_capturing) {
+      _buffers[_capturing].append(command);
+    }
+    else {
+      screen.append(command);
+    }
+  }
+  int numBuffers() const { return _buffers.size(); }
+
+  Array<int> screen;
+  int        numDestroyed;
+
+private:
+  CommandBufferID                 _nextID;
+  CommandBufferID                 _capturing;
+  Table<CommandBufferID, Array<int> > _buffers;
+};
+
+/// A draw callback whose output depends on its own data and on
+/// virtualToRoomSpace.
+class CommandDrawer
+{
+public:
+  CommandDrawer(CommandLogDevice *device) : value(1), numCalls(0), _device(device) {}
+
+  void draw(RenderDevice *rd, const CoordinateFrame &virtualToRoomSpace) {
+    numCalls++;
+    _device->issue(value);
+    _device->issue(iRound(virtualToRoomSpace.translation.x));
+    _device->issue(value * 2);
+  }
+
+  int value;
+  int numCalls;
+
+private:
+  CommandLogDevice *_device;
+};
+
+/// What drawing the callback directly puts on the screen.
+void
+directCommands(int value, const CoordinateFrame &virtualToRoomSpace, Array<int> &commands)
+{
+  commands.append(value);
+  commands.append(iRound(virtualToRoomSpace.translation.x));
+  commands.append(value * 2);
+}
+
+/// Draws callback id once and returns what reached the screen.
+void
+drawCommands(DrawCommandCache &cache, CommandLogDevice *device, int id, DrawMethodFunctor *f,
+             const CoordinateFrame &virtualToRoomSpace, Array<int> &commands)
+{
+  device->screen.fastClear();
+  cache.exec(id, f, NULL, virtualToRoomSpace);
+  commands = device->screen;
+}
+
+void
+testDrawCommandCache()
+{
+  CommandLogDevice *device = new CommandLogDevice();
+  DrawCommandCache cache;
+  cache.setDevice(device);
+  CommandDrawer drawer(device);
+  SpecificDrawMethodFunctor<CommandDrawer> f(&drawer, &CommandDrawer::draw);
+  CoordinateFrame here;
+  CoordinateFrame there(Vector3(3, 0, 0));
+  Array<int> drawn, expected;
+
+  // Not retained, the callback runs every time
+  drawCommands(cache, device, 1, &f, here, drawn);
+  drawCommands(cache, device, 1, &f, here, drawn);
+  directCommands(1, here, expected);
+  TEST_CHECK(sameElements(drawn, expected));
+  TEST_CHECK_EQUAL(drawer.numCalls, 2);
+  TEST_CHECK_EQUAL(device->numBuffers(), 0);
+
+  // Captured once, then replayed with the same output on every later eye
+  // and frame
+  cache.setRetained(1);
+  drawer.numCalls = 0;
+  drawCommands(cache, device, 1, &f, here, drawn);
+  TEST_CHECK(sameElements(drawn, expected));
+  for (int i=0;i<5;i++) {
+    drawCommands(cache, device, 1, &f, here, drawn);
+    TEST_CHECK(sameElements(drawn, expected));
+  }
+  TEST_CHECK_EQUAL(drawer.numCalls, 1);
+  TEST_CHECK_EQUAL(cache.getStats(1).numCaptures, 1);
+  TEST_CHECK_EQUAL(cache.getStats(1).numReplays, 5);
+
+  // Changing the data without marking it dirty keeps the old drawing,
+  // that is the contract for retained callbacks
+  drawer.value = 7;
+  drawCommands(cache, device, 1, &f, here, drawn);
+  TEST_CHECK(sameElements(drawn, expected));
+
+  // Marking it dirty captures again
+  cache.markDirty(1);
+  drawCommands(cache, device, 1, &f, here, drawn);
+  expected.fastClear();
+  directCommands(7, here, expected);
+  TEST_CHECK(sameElements(drawn, expected));
+  TEST_CHECK_EQUAL(drawer.numCalls, 2);
+
+  // So does a new virtualToRoomSpace, and the replays that follow match
+  drawCommands(cache, device, 1, &f, there, drawn);
+  drawCommands(cache, device, 1, &f, there, drawn);
+  expected.fastClear();
+  directCommands(7, there, expected);
+  TEST_CHECK(sameElements(drawn, expected));
+  TEST_CHECK_EQUAL(drawer.numCalls, 3);
+  TEST_CHECK_EQUAL(cache.getStats(1).numCaptures, 3);
+
+  // A new device throws the old buffers away and captures again
+  CommandLogDevice *newDevice = new CommandLogDevice();
+  cache.setDevice(newDevice);
+  CommandDrawer newDrawer(newDevice);
+  SpecificDrawMethodFunctor<CommandDrawer> newF(&newDrawer, &CommandDrawer::draw);
+  drawCommands(cache, newDevice, 1, &newF, there, drawn);
+  expected.fastClear();
+  directCommands(1, there, expected);
+  TEST_CHECK(sameElements(drawn, expected));
+  TEST_CHECK_EQUAL(newDrawer.numCalls, 1);
+  TEST_CHECK_EQUAL(newDevice->numBuffers(), 1);
+
+  // Removing the callback frees its buffer
+  cache.remove(1);
+  TEST_CHECK(!cache.isRetained(1));
+  TEST_CHECK_EQUAL(newDevice->numBuffers(), 0);
+  TEST_CHECK_EQUAL(newDevice->numDestroyed, 1);
+  TEST_CHECK_EQUAL(cache.getStats(1).numCaptures, 0);
+}
+
+} // end namespace
+
+
+void
+runRenderingTests()
+{
+  testDrawCommandCache();
+  testFrameGraphReplay();
+  testGfxMgrFrameGraph();
+  testVirtualTextureTileSelection();
+  testVirtualTextureFallback();
+  testVirtualTextureEviction();
+  testVirtualTextureAsyncLoads();
+  testFrustumCulling();
+  testHierarchicalZ();
+  testGfxMgrCullStats();
+  testFrameArenaWithoutPosing();
+  testFrameArenaPosedFrames();
+  testProfilerFrames();
+  testRenderQueueSort();
+  testRadixSort();
+}
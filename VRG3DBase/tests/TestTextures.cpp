@@ -0,0 +1,1141 @@
+#include "Test.H"
+#include "../include/BlockCompressor.H"
+#include "../include/GfxMgr.H"
+#include "../include/TextureAtlas.H"
+#include "../include/TextureCache.H"
+#include "../include/TextureLoader.H"
+#include "../include/TextureManifest.H"
+#include "../include/TextureRegistry.H"
+#include "../include/TextureResidency.H"
+#include "../include/WorkerPool.H"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace G3D;
+
+
+namespace {
+
+/// Loads nothing, just records what it was asked for.  Files whose name
+/// starts with "bad" fail to load.
+class FakeResidencyLoader : public TextureResidencyLoader
+{
+public:
+  FakeResidencyLoader(size_t bytesPerTexture) : _bytesPerTexture(bytesPerTexture) {}
+  virtual ~FakeResidencyLoader() {}
+
+  bool load(const TextureLoadRequest &request, TextureRef &tex, size_t &bytes) {
+    loads.append(request.filename);
+    if (beginsWith(request.filename, "bad")) {
+      return false;
+    }
+    bytes = _bytesPerTexture;
+    return true;
+  }
+
+  Array<std::string> loads;
+
+private:
+  size_t _bytesPerTexture;
+};
+
+TextureLoadRequest
+makeRequest(const std::string &filename)
+{
+  TextureLoadRequest request;
+  request.filename = filename;
+  request.keyName = filename;
+  return request;
+}
+
+
+void
+testResidencyLoadsOnFirstUse()
+{
+  FakeResidencyLoader *loader = new FakeResidencyLoader(1000);
+  TextureResidencyRef residency = new TextureResidency(loader, 0);
+  int a = residency->add(makeRequest("a.png"));
+  TEST_CHECK(!residency->isResident(a));
+  TEST_CHECK_EQUAL(loader->loads.size(), 0);
+
+  residency->setFrameNumber(1);
+  residency->get(a);
+  residency->get(a);
+  TEST_CHECK(residency->isResident(a));
+  TEST_CHECK_EQUAL(loader->loads.size(), 1);
+  TEST_CHECK_EQUAL(residency->residentBytes(), 1000);
+  TEST_CHECK_EQUAL(residency->lastUsedFrame(a), 1);
+
+  // A failed load is reported once and not retried every use
+  int bad = residency->add(makeRequest("bad.png"));
+  TEST_CHECK(residency->get(bad).isNull());
+  TEST_CHECK(residency->get(bad).isNull());
+  TEST_CHECK(!residency->isResident(bad));
+  TEST_CHECK_EQUAL(residency->numFailures(), 1);
+  TEST_CHECK_EQUAL(loader->loads.size(), 2);
+}
+
+void
+testResidencyBudgetEviction()
+{
+  FakeResidencyLoader *loader = new FakeResidencyLoader(1000);
+  TextureResidencyRef residency = new TextureResidency(loader, 2500);
+  int ids[4];
+  for (int i=0;i<4;i++) {
+    ids[i] = residency->add(makeRequest(format("texture%d.png", i)));
+  }
+
+  residency->setFrameNumber(1);
+  residency->get(ids[0]);
+  residency->get(ids[1]);
+  residency->setFrameNumber(2);
+  residency->get(ids[1]);
+  // Over budget, the least recently used texture goes
+  residency->get(ids[2]);
+  TEST_CHECK(!residency->isResident(ids[0]));
+  TEST_CHECK(residency->isResident(ids[1]));
+  TEST_CHECK(residency->isResident(ids[2]));
+  TEST_CHECK_EQUAL(residency->numEvictions(), 1);
+  TEST_CHECK(residency->residentBytes() <= 2500);
+
+  // Textures used this frame stay, even over budget
+  residency->setFrameNumber(3);
+  residency->get(ids[1]);
+  residency->get(ids[2]);
+  residency->get(ids[3]);
+  TEST_CHECK(residency->isResident(ids[1]));
+  TEST_CHECK(residency->isResident(ids[2]));
+  TEST_CHECK(residency->isResident(ids[3]));
+  TEST_CHECK_EQUAL(residency->residentBytes(), 3000);
+
+  // and are released once a later frame needs the room
+  residency->setFrameNumber(4);
+  residency->get(ids[0]);
+  TEST_CHECK(residency->isResident(ids[0]));
+  TEST_CHECK(!residency->isResident(ids[1]));
+  TEST_CHECK_EQUAL(residency->numLoads(), 5);
+  TEST_CHECK(residency->residentBytes() <= 2500);
+}
+
+/// GfxMgr feeds its residency the rendered frame number, so textures
+/// drawn every frame aren't evicted when nothing is posed.
+void
+testGfxMgrResidencyFrames()
+{
+  GfxMgrRef gfx = new GfxMgr(NULL, MinVR::ProjectionVRCameraRef());
+  TextureResidencyRef residency = gfx->getTextureResidency();
+  uint64 first = residency->getFrameNumber();
+  for (int i=0;i<10;i++) {
+    gfx->beginFrame();
+    gfx->endFrame();
+  }
+  TEST_CHECK_EQUAL(residency->getFrameNumber(), first + 10);
+
+  // A file that can't be decoded leaves the texture NULL
+  std::string filename = testTempDirectory() + "/corrupt.png";
+  writeWholeFile(filename, "not a png");
+  int id = residency->add(makeRequest(filename));
+  TEST_CHECK(residency->get(id).isNull());
+  TEST_CHECK_EQUAL(residency->numFailures(), 1);
+}
+
+/// Each keyname is interned to one id, in the order they are first seen.
+void
+testRegistryInterning()
+{
+  TextureRegistryRef registry = new TextureRegistry(new TextureResidency(new FakeResidencyLoader(1000), 0));
+  TEST_CHECK_EQUAL(registry->find("a.png"), -1);
+  TextureID a = registry->intern("a.png");
+  TextureID b = registry->intern("b.png");
+  TEST_CHECK_EQUAL(a, 0);
+  TEST_CHECK_EQUAL(b, 1);
+  TEST_CHECK_EQUAL(registry->intern("a.png"), a);
+  TEST_CHECK_EQUAL(registry->find("a.png"), a);
+  TEST_CHECK_EQUAL(registry->find("b.png"), b);
+  TEST_CHECK_EQUAL(registry->find("A.png"), -1);
+  TEST_CHECK_EQUAL(registry->keyName(b), "b.png");
+  TEST_CHECK_EQUAL(registry->numIDs(), 2);
+  // Interned before anything is stored under it
+  TEST_CHECK(!registry->isBound(a));
+  TEST_CHECK(registry->get(a).isNull());
+
+  Array<std::string> keyNames;
+  keyNames.append("c.png", "a.png");
+  keyNames.append("c.png", "d.png");
+  TextureID ids[4];
+  registry->intern(keyNames, ids);
+  TEST_CHECK_EQUAL(ids[0], 2);
+  TEST_CHECK_EQUAL(ids[1], a);
+  TEST_CHECK_EQUAL(ids[2], 2);
+  TEST_CHECK_EQUAL(ids[3], 3);
+  TEST_CHECK_EQUAL(registry->numIDs(), 4);
+}
+
+/// The reverse mapping follows a keyname that is given another texture,
+/// and forgets the texture it replaced.
+void
+testRegistryReverseLookup()
+{
+  FakeResidencyLoader *loader = new FakeResidencyLoader(1000);
+  TextureResidencyRef residency = new TextureResidency(loader, 0);
+  TextureRegistryRef registry = new TextureRegistry(residency);
+  TextureID a = registry->intern("a");
+  TextureID b = registry->intern("b");
+  int slotA = residency->add(makeRequest("a1.png"));
+  int slotB = residency->add(makeRequest("b.png"));
+  registry->bind(a, slotA);
+  registry->bind(b, slotB);
+  TEST_CHECK_EQUAL(registry->findBySlot(slotA), a);
+  TEST_CHECK_EQUAL(registry->findBySlot(slotB), b);
+  TEST_CHECK_EQUAL(registry->findBySlot(-1), -1);
+  TEST_CHECK_EQUAL(registry->findBySlot(1000), -1);
+  TEST_CHECK_EQUAL(registry->findTexture(TextureRef()), -1);
+
+  int slotA2 = residency->add(makeRequest("a2.png"));
+  registry->bind(a, slotA2);
+  TEST_CHECK_EQUAL(registry->findBySlot(slotA2), a);
+  TEST_CHECK_EQUAL(registry->findBySlot(slotA), -1);
+  TEST_CHECK(!residency->isValid(slotA));
+  TEST_CHECK_EQUAL(registry->findBySlot(slotB), b);
+  registry->get(a);
+  TEST_CHECK_EQUAL(loader->loads.size(), 1);
+  TEST_CHECK_EQUAL(loader->loads[0], "a2.png");
+
+  // Ids sharing a slot, like the images of an atlas: the slot stays with
+  // one that is still bound to it
+  TextureID c = registry->intern("c");
+  registry->bind(c, slotB);
+  int slotB2 = residency->add(makeRequest("b2.png"));
+  registry->bind(b, slotB2);
+  TEST_CHECK_EQUAL(registry->findBySlot(slotB), c);
+  TEST_CHECK_EQUAL(registry->findBySlot(slotB2), b);
+  TEST_CHECK(residency->isValid(slotB));
+  TextureID d = registry->intern("d");
+  registry->bind(d, slotB2);
+  TEST_CHECK_EQUAL(registry->findBySlot(slotB2), d);
+  registry->bind(d, -1);
+  TEST_CHECK_EQUAL(registry->findBySlot(slotB2), b);
+  TEST_CHECK(residency->isValid(slotB2));
+  registry->bind(c, -1);
+  TEST_CHECK_EQUAL(registry->findBySlot(slotB), -1);
+  TEST_CHECK(!residency->isValid(slotB));
+  TEST_CHECK(!registry->isBound(c));
+
+  Array<std::string> keyNames;
+  registry->getBoundKeyNames(keyNames);
+  TEST_CHECK_EQUAL(keyNames.size(), 2);
+  TEST_CHECK(keyNames.contains("a"));
+  TEST_CHECK(keyNames.contains("b"));
+}
+
+/// Batched lookups fill every entry of the caller's buffer, loading only
+/// the ids that have a texture.
+void
+testRegistryBatchedGet()
+{
+  FakeResidencyLoader *loader = new FakeResidencyLoader(1000);
+  TextureResidencyRef residency = new TextureResidency(loader, 0);
+  TextureRegistryRef registry = new TextureRegistry(residency);
+  for (int i=0;i<10;i++) {
+    TextureID id = registry->intern(format("key%d", i));
+    if ((i % 3) == 0) {
+      registry->bind(id, residency->add(makeRequest(format("texture%d.png", i))));
+    }
+  }
+
+  // Keys never interned, ids interned but unbound, and ids past the end
+  TextureID ids[] = {registry->find("key3"), registry->find("missing"), registry->find("key1"),
+                     registry->find("key9"), 100, registry->find("key0"), registry->intern("new")};
+  const int n = sizeof(ids) / sizeof(ids[0]);
+  TEST_CHECK_EQUAL(ids[1], -1);
+  TEST_CHECK_EQUAL(ids[6], 10);
+  TextureRef out[n];
+  registry->get(ids, n, out);
+  for (int i=0;i<n;i++) {
+    TEST_CHECK(out[i].isNull());
+  }
+  TEST_CHECK_EQUAL(loader->loads.size(), 3);
+  TEST_CHECK_EQUAL(loader->loads[0], "texture3.png");
+  TEST_CHECK_EQUAL(loader->loads[1], "texture9.png");
+  TEST_CHECK_EQUAL(loader->loads[2], "texture0.png");
+  for (int i=0;i<n;i++) {
+    bool bound = (i == 0) || (i == 3) || (i == 5);
+    TEST_CHECK_EQUAL(registry->isResident(ids[i]), bound);
+  }
+}
+
+/// A handle keeps its id, and follows its keyname, however many
+/// keynames are added after it.
+void
+testRegistryHandleStability()
+{
+  FakeResidencyLoader *loader = new FakeResidencyLoader(1000);
+  TextureResidencyRef residency = new TextureResidency(loader, 0);
+  TextureRegistryRef registry = new TextureRegistry(residency);
+  TextureID id = registry->intern("first");
+  TextureHandle handle(registry, id);
+  TEST_CHECK(handle.isNull());
+  registry->bind(id, residency->add(makeRequest("first.png")));
+  TEST_CHECK(handle.notNull());
+  TEST_CHECK(!handle.isResident());
+
+  for (int i=0;i<5000;i++) {
+    TextureID other = registry->intern(format("texture%d", i));
+    registry->bind(other, residency->add(makeRequest(format("texture%d.png", i))));
+  }
+  TEST_CHECK_EQUAL(handle.id(), id);
+  TEST_CHECK_EQUAL(registry->find("first"), id);
+  TEST_CHECK_EQUAL(registry->keyName(handle.id()), "first");
+  TEST_CHECK(handle.notNull());
+  handle.get();
+  TEST_CHECK(handle.isResident());
+  TEST_CHECK_EQUAL(loader->loads.size(), 1);
+  TEST_CHECK_EQUAL(loader->loads[0], "first.png");
+
+  // Copies share the id, and all see the texture stored under it next
+  TextureHandle copy = handle;
+  registry->bind(id, residency->add(makeRequest("second.png")));
+  TEST_CHECK(!handle.isResident());
+  copy.get();
+  TEST_CHECK(handle.isResident());
+  TEST_CHECK_EQUAL(loader->loads.size(), 2);
+  TEST_CHECK_EQUAL(loader->loads[1], "second.png");
+  TEST_CHECK(!handle.isAtlased());
+  TEST_CHECK_EQUAL(handle.uvScale().x, 1.0f);
+
+  registry->bind(id, -1);
+  TEST_CHECK(handle.isNull());
+  TEST_CHECK(copy.isNull());
+}
+
+/// Makes fake requests whose filename is their index.
+void
+makeRequests(int n, Array<TextureLoadRequest> &requests)
+{
+  for (int i=0;i<n;i++) {
+    requests.append(makeRequest(format("%d", i)));
+  }
+}
+
+/// A decoder that doesn't touch the disk: a 1x1 image holding the
+/// request's index, after a delay that makes early requests finish last.
+void
+fakeDecode(const TextureLoadRequest &request, DecodedTexture &decoded, int numRequests)
+{
+  int index = atoi(request.filename.c_str());
+  std::this_thread::sleep_for(std::chrono::microseconds(200 * (numRequests - index)));
+  decoded.data.allocate(TextureFormat::L8(), 1, 1, 1);
+  decoded.data.levelData(0)[0] = (uint8)index;
+  decoded.ok = true;
+}
+
+void
+testLoadPipelineOrder()
+{
+  const int numRequests = 40;
+  Array<TextureLoadRequest> requests;
+  makeRequests(numRequests, requests);
+  WorkerPoolRef pool = new WorkerPool(4);
+
+  TextureLoadPipeline pipeline(pool.pointer(), 6);
+  pipeline.setDecodeFunc([numRequests](const TextureLoadRequest &request, DecodedTexture &decoded) {
+      fakeDecode(request, decoded, numRequests);
+    });
+  pipeline.start(requests);
+
+  Array<int> uploaded;
+  bool inOrder = true;
+  while (!pipeline.isDone()) {
+    pipeline.update([&](DecodedTexture &decoded) {
+        int index = decoded.data.levelData(0)[0];
+        inOrder = inOrder && (decoded.request.filename == format("%d", index)) &&
+          (index == uploaded.size());
+        uploaded.append(index);
+      }, 3, true);
+  }
+  // Uploads come in request order even though the decodes finish in
+  // roughly the reverse order
+  TEST_CHECK(inOrder);
+  TEST_CHECK_EQUAL(uploaded.size(), numRequests);
+  TEST_CHECK_EQUAL(pipeline.numDecoded(), numRequests);
+  TEST_CHECK_CLOSE(pipeline.getProgress(), 100.0, 1e-9);
+}
+
+void
+testLoadPipelineCapacity()
+{
+  const int numRequests = 20;
+  const int capacity = 3;
+  Array<TextureLoadRequest> requests;
+  makeRequests(numRequests, requests);
+  WorkerPoolRef pool = new WorkerPool(4);
+
+  // Images are alive from the start of their decode until uploaded
+  std::atomic<int> live(0);
+  std::atomic<int> maxLive(0);
+  TextureLoadPipeline pipeline(pool.pointer(), capacity);
+  pipeline.setDecodeFunc([&](const TextureLoadRequest &request, DecodedTexture &decoded) {
+      int n = ++live;
+      int m = maxLive.load();
+      while ((n > m) && !maxLive.compare_exchange_weak(m, n)) {}
+      fakeDecode(request, decoded, numRequests);
+    });
+  pipeline.start(requests);
+
+  // With nothing uploaded the decoders stop once the queue is full
+  for (int i=0;(i<1000) && (pipeline.numDecoded() < capacity);i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  TEST_CHECK_EQUAL(pipeline.numDecoded(), capacity);
+
+  int numUploaded = 0;
+  while (!pipeline.isDone()) {
+    numUploaded += pipeline.update([&](DecodedTexture &decoded) { live--; }, 1, true);
+  }
+  TEST_CHECK_EQUAL(numUploaded, numRequests);
+  // The queue's slot is freed as an image is handed to upload, so the one
+  // being uploaded is the only one allowed over the capacity
+  TEST_CHECK(maxLive.load() <= capacity + 1);
+  TEST_CHECK_EQUAL(live.load(), 0);
+}
+
+void
+testLoadPipelineInline()
+{
+  Array<TextureLoadRequest> requests;
+  makeRequests(5, requests);
+  std::thread::id caller = std::this_thread::get_id();
+  bool onCaller = true;
+
+  // No pool: each image is decoded by update(), on its thread, as it's
+  // needed
+  TextureLoadPipeline pipeline(NULL, 2);
+  pipeline.setDecodeFunc([&](const TextureLoadRequest &request, DecodedTexture &decoded) {
+      onCaller = onCaller && (std::this_thread::get_id() == caller);
+      fakeDecode(request, decoded, 0);
+    });
+  pipeline.start(requests);
+  TEST_CHECK_EQUAL(pipeline.numDecoded(), 0);
+
+  Array<int> uploaded;
+  TextureLoadPipeline::UploadFunc upload = [&](DecodedTexture &decoded) {
+    uploaded.append(decoded.data.levelData(0)[0]);
+  };
+  TEST_CHECK_EQUAL(pipeline.update(upload, 2), 2);
+  TEST_CHECK_EQUAL(pipeline.numDecoded(), 2);
+  TEST_CHECK(!pipeline.isDone());
+  TEST_CHECK_EQUAL(pipeline.update(upload), 3);
+  TEST_CHECK(pipeline.isDone());
+  TEST_CHECK_EQUAL(pipeline.update(upload), 0);
+  TEST_CHECK(onCaller);
+  for (int i=0;i<uploaded.size();i++) {
+    TEST_CHECK_EQUAL(uploaded[i], i);
+  }
+}
+
+void
+testLoadPipelineDestructorWaits()
+{
+  const int numRequests = 10;
+  const int capacity = 4;
+  Array<TextureLoadRequest> requests;
+  makeRequests(numRequests, requests);
+  WorkerPoolRef pool = new WorkerPool(4);
+
+  std::atomic<int> numStarted(0);
+  std::atomic<int> numFinished(0);
+  {
+    TextureLoadPipeline pipeline(pool.pointer(), capacity);
+    pipeline.setDecodeFunc([&](const TextureLoadRequest &request, DecodedTexture &decoded) {
+        numStarted++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        fakeDecode(request, decoded, 0);
+        numFinished++;
+      });
+    pipeline.start(requests);
+    // Destroyed without uploading anything while decodes are running
+  }
+  // Every decode that was submitted had finished before the pipeline went
+  // away, and no more were started
+  TEST_CHECK_EQUAL(numFinished.load(), capacity);
+  pool->waitForAll();
+  TEST_CHECK_EQUAL(numStarted.load(), capacity);
+}
+
+/// A small image whose texels all hold value
+void
+makeCacheImage(uint8 value, TextureData &data)
+{
+  data.allocate(TextureFormat::RGB8(), 4, 4, 1);
+  memset(data.bytes(), value, data.totalSize());
+}
+
+void
+testCacheKeys()
+{
+  std::string filename = testTempDirectory() + "/cached.png";
+  writeWholeFile(filename, "first contents");
+  TextureLoadRequest request = makeRequest(filename);
+  request.format = "RGB_DXT1";
+  std::string key = TextureCache::computeKey(request, BlockCompressor::VERSION);
+  TEST_CHECK(!key.empty());
+  TEST_CHECK_EQUAL(TextureCache::computeKey(request, BlockCompressor::VERSION), key);
+
+  // A new BlockCompressor writes different texels, so it gets new entries
+  TEST_CHECK(TextureCache::computeKey(request, BlockCompressor::VERSION + 1) != key);
+
+  TextureLoadRequest brighter = request;
+  brighter.brightness = 0.5;
+  TEST_CHECK(TextureCache::computeKey(brighter, BlockCompressor::VERSION) != key);
+
+  TextureCacheRef cache = new TextureCache(testTempDirectory() + "/keycache", 1024 * 1024);
+  TextureData image;
+  makeCacheImage(7, image);
+  cache->store(key, image);
+  TextureData loaded;
+  TEST_CHECK(cache->load(key, loaded));
+  TEST_CHECK_EQUAL(loaded.totalSize(), image.totalSize());
+  TEST_CHECK(memcmp(loaded.bytes(), image.bytes(), image.totalSize()) == 0);
+  loaded.clear();
+
+  // Editing the source file, whatever its size and time stamp end up
+  // being, gives a key that misses
+  writeWholeFile(filename, "first contentz");
+  std::string sameSize = TextureCache::computeKey(request, BlockCompressor::VERSION);
+  TEST_CHECK(sameSize != key);
+  TEST_CHECK(!cache->load(sameSize, loaded));
+  writeWholeFile(filename, "much longer second contents");
+  std::string longer = TextureCache::computeKey(request, BlockCompressor::VERSION);
+  TEST_CHECK((longer != key) && (longer != sameSize));
+  TEST_CHECK(!cache->load(longer, loaded));
+
+  // Rewriting the original contents finds the old entry again
+  writeWholeFile(filename, "first contents");
+  TEST_CHECK_EQUAL(TextureCache::computeKey(request, BlockCompressor::VERSION), key);
+  TEST_CHECK(cache->load(key, loaded));
+  TEST_CHECK_EQUAL(cache->numHits(), 2);
+  TEST_CHECK_EQUAL(cache->numMisses(), 2);
+
+  // Missing files can't be keyed, so they are never cached
+  TEST_CHECK(TextureCache::computeKey(makeRequest(testTempDirectory() + "/missing.png")).empty());
+}
+
+void
+testCacheEviction()
+{
+  std::string dir = testTempDirectory() + "/lrucache";
+  TextureData image;
+  makeCacheImage(1, image);
+  // Room for two entries, each is a page of header plus the texels
+  int64 entrySize = 4096 + image.totalSize();
+  TextureCacheRef cache = new TextureCache(dir, 2 * entrySize + entrySize / 2);
+
+  TextureData loaded;
+  cache->store("a", image);
+  cache->store("b", image);
+  TEST_CHECK_EQUAL(cache->numEntries(), 2);
+  TEST_CHECK_EQUAL(cache->totalBytes(), 2 * entrySize);
+
+  // Using a makes b the least recently used
+  TEST_CHECK(cache->load("a", loaded));
+  loaded.clear();
+  cache->store("c", image);
+  TEST_CHECK_EQUAL(cache->numEvictions(), 1);
+  TEST_CHECK_EQUAL(cache->numEntries(), 2);
+  TEST_CHECK(!cache->load("b", loaded));
+  TEST_CHECK(cache->load("a", loaded));
+  loaded.clear();
+  TEST_CHECK(cache->load("c", loaded));
+  loaded.clear();
+
+  // Replacing an entry doesn't count it twice
+  cache->store("c", image);
+  TEST_CHECK_EQUAL(cache->totalBytes(), 2 * entrySize);
+  cache = NULL;
+
+  // A later run finds the entries left on disk, and a smaller budget
+  // trims them straight away
+  cache = new TextureCache(dir, 10 * entrySize);
+  TEST_CHECK_EQUAL(cache->numEntries(), 2);
+  TEST_CHECK(cache->load("a", loaded));
+  loaded.clear();
+  cache = NULL;
+  cache = new TextureCache(dir, entrySize);
+  TEST_CHECK_EQUAL(cache->numEntries(), 1);
+  TEST_CHECK_EQUAL(cache->numEvictions(), 1);
+}
+
+/// Packs w x h rectangles until the first that doesn't fit, checking
+/// that they stay inside the packer and never overlap, padding included.
+/// Returns the number packed.
+int
+packAndCheck(SkylinePacker &packer, const Array<Vector2int16> &sizes)
+{
+  int pad = packer.padding();
+  Array<uint8> covered;
+  covered.resize(packer.width() * packer.height());
+  System::memset(covered.getCArray(), 0, covered.size());
+
+  bool inside = true;
+  bool overlap = false;
+  int64 area = 0;
+  int n = 0;
+  for (;n<sizes.size();n++) {
+    int w = sizes[n].x;
+    int h = sizes[n].y;
+    int x, y;
+    if (!packer.pack(w, h, x, y)) {
+      break;
+    }
+    inside = inside && (x - pad >= 0) && (y - pad >= 0) &&
+      (x + w + pad <= packer.width()) && (y + h + pad <= packer.height());
+    if (!inside) {
+      break;
+    }
+    for (int j=y-pad;j<y+h+pad;j++) {
+      for (int i=x-pad;i<x+w+pad;i++) {
+        uint8 &c = covered[j * packer.width() + i];
+        overlap = overlap || (c != 0);
+        c = 1;
+      }
+    }
+    area += (int64)(w + 2*pad) * (int64)(h + 2*pad);
+  }
+  TEST_CHECK(inside);
+  TEST_CHECK(!overlap);
+  TEST_CHECK_EQUAL(packer.numPacked(), n);
+  TEST_CHECK_EQUAL(packer.usedArea(), area);
+  return n;
+}
+
+void
+testPackerOccupancy()
+{
+  // Equal squares tile the area exactly
+  {
+    SkylinePacker packer(256, 256, 2);
+    Array<Vector2int16> sizes;
+    for (int i=0;i<65;i++) {
+      sizes.append(Vector2int16(28, 28));
+    }
+    TEST_CHECK_EQUAL(packAndCheck(packer, sizes), 64);
+    TEST_CHECK_CLOSE(packer.occupancy(), 1.0, 1e-9);
+    packer.reset();
+    TEST_CHECK_EQUAL(packer.numPacked(), 0);
+    TEST_CHECK_EQUAL(packer.usedArea(), 0);
+  }
+
+  // Mixed sizes in the order they come, up to the first that doesn't fit
+  TestRandom random(35);
+  Array<Vector2int16> sizes;
+  for (int i=0;i<2000;i++) {
+    sizes.append(Vector2int16(random.integer(8, 64), random.integer(8, 64)));
+  }
+  SkylinePacker packer(1024, 1024, 2);
+  packAndCheck(packer, sizes);
+  TEST_CHECK(packer.occupancy() > 0.8);
+
+  // Tallest first, which is how atlases are filled, and skipping the ones
+  // that don't fit
+  sizes.sort([](const Vector2int16 &a, const Vector2int16 &b) { return a.y > b.y; });
+  packer.reset();
+  int x, y;
+  for (int i=0;i<sizes.size();i++) {
+    packer.pack(sizes[i].x, sizes[i].y, x, y);
+  }
+  TEST_CHECK(packer.occupancy() > 0.9);
+  TEST_CHECK(packer.occupancy() <= 1.0);
+}
+
+/// Every texel of image i holds (i, x, y)
+void
+makeAtlasImage(int i, int width, int height, TextureData &image)
+{
+  image.allocate(TextureFormat::RGB8(), width, height, 1);
+  uint8 *p = image.levelData(0);
+  for (int y=0;y<height;y++) {
+    for (int x=0;x<width;x++) {
+      p[0] = (uint8)i;
+      p[1] = (uint8)x;
+      p[2] = (uint8)y;
+      p += 3;
+    }
+  }
+}
+
+void
+testAtlasUVs()
+{
+  const int size = 128;
+  const int pad = 2;
+  TextureAtlasRef atlas = new TextureAtlas(TextureFormat::RGB8(), size, pad, true);
+  TEST_CHECK(TextureAtlas::canHold(TextureFormat::RGB8(), TextureFormat::RGB8()));
+  TEST_CHECK(!TextureAtlas::canHold(TextureFormat::RGB8(), TextureFormat::RGBA8()));
+  TEST_CHECK(!TextureAtlas::canHold(TextureFormat::RGB_DXT1(), TextureFormat::RGB_DXT1()));
+
+  int sizes[][2] = {{16, 16}, {7, 30}, {33, 5}, {1, 1}, {40, 40}, {12, 9}};
+  const int numImages = sizeof(sizes) / sizeof(sizes[0]);
+  for (int i=0;i<numImages;i++) {
+    TextureData image;
+    makeAtlasImage(i + 1, sizes[i][0], sizes[i][1], image);
+    TEST_CHECK(atlas->add(format("image%d", i), image));
+  }
+  TextureData tooBig;
+  makeAtlasImage(99, size, size, tooBig);
+  TEST_CHECK(!atlas->add("tooBig", tooBig));
+  atlas->finish();
+  TEST_CHECK_EQUAL(atlas->entries().size(), numImages);
+  TEST_CHECK_EQUAL(atlas->data().numLevels(), TextureData::numMipLevels(size, size));
+
+  // The centre of each image texel maps, through the UV transform, to the
+  // atlas texel holding it, and the padding repeats the nearest edge
+  const uint8 *texels = atlas->data().levelData(0);
+  for (int e=0;e<atlas->entries().size();e++) {
+    const TextureAtlas::Entry &entry = atlas->entries()[e];
+    TEST_CHECK_EQUAL(entry.keyName, format("image%d", e));
+    TEST_CHECK_EQUAL(entry.width, sizes[e][0]);
+    TEST_CHECK_EQUAL(entry.height, sizes[e][1]);
+    Vector2 scale, offset;
+    atlas->getUVTransform(entry, scale, offset);
+
+    bool uvsOk = true;
+    bool paddingOk = true;
+    for (int y=-pad;y<entry.height+pad;y++) {
+      for (int x=-pad;x<entry.width+pad;x++) {
+        Vector2 uv(((float)x + 0.5f) / entry.width, ((float)y + 0.5f) / entry.height);
+        Vector2 atlasUV = uv * scale + offset;
+        int ax = iFloor(atlasUV.x * size);
+        int ay = iFloor(atlasUV.y * size);
+        const uint8 *t = texels + (ay * size + ax) * 3;
+        bool ok = (t[0] == e + 1) && (t[1] == iClamp(x, 0, entry.width - 1)) &&
+          (t[2] == iClamp(y, 0, entry.height - 1));
+        if ((x >= 0) && (x < entry.width) && (y >= 0) && (y < entry.height)) {
+          uvsOk = uvsOk && ok && (ax == entry.x + x) && (ay == entry.y + y);
+        }
+        else {
+          paddingOk = paddingOk && ok;
+        }
+      }
+    }
+    TEST_CHECK(uvsOk);
+    TEST_CHECK(paddingOk);
+  }
+}
+
+/// Smooth gradients with a little noise and some hard edges, like
+/// bench/BenchTextures.cpp uses, so the PSNR is close to a photograph's.
+void
+makeCompressorImage(int width, int height, bool alpha, TestRandom &random, TextureData &data)
+{
+  data.allocate(alpha ? TextureFormat::RGBA8() : TextureFormat::RGB8(), width, height, 1);
+  int channels = alpha ? 4 : 3;
+  uint8 *p = data.levelData(0);
+  for (int y=0;y<height;y++) {
+    for (int x=0;x<width;x++) {
+      double u = (double)x / width;
+      double v = (double)y / height;
+      bool edge = ((x / 37) + (y / 29)) % 5 == 0;
+      double r = 0.5 + 0.5 * sin(u * 9.0 + v * 2.0);
+      double g = edge ? 0.1 : 0.5 + 0.5 * cos(v * 7.0);
+      double b = u * v;
+      p[0] = (uint8)iClamp((int)(r * 255.0) + random.integer(-6, 6), 0, 255);
+      p[1] = (uint8)iClamp((int)(g * 255.0) + random.integer(-6, 6), 0, 255);
+      p[2] = (uint8)iClamp((int)(b * 255.0) + random.integer(-6, 6), 0, 255);
+      if (alpha) {
+        p[3] = (uint8)iClamp((int)(u * 255.0), 0, 255);
+      }
+      p += channels;
+    }
+  }
+}
+
+/// Blocks of one color each, colors that 565 holds exactly, and alphas
+/// that BC2's 4 bits hold exactly.
+void
+makeExactImage(int width, int height, TestRandom &random, TextureData &data)
+{
+  data.allocate(TextureFormat::RGBA8(), width, height, 1);
+  for (int by=0;by<height;by+=4) {
+    for (int bx=0;bx<width;bx+=4) {
+      int r = random.integer(32);
+      int g = random.integer(64);
+      int b = random.integer(32);
+      uint8 texel[4] = {(uint8)((r << 3) | (r >> 2)), (uint8)((g << 2) | (g >> 4)),
+                        (uint8)((b << 3) | (b >> 2)), (uint8)(17 * random.integer(16))};
+      for (int y=by;y<iMin(by + 4, height);y++) {
+        for (int x=bx;x<iMin(bx + 4, width);x++) {
+          System::memcpy(data.levelData(0) + (y * width + x) * 4, texel, 4);
+        }
+      }
+    }
+  }
+}
+
+bool
+sameTexels(const TextureData &a, const TextureData &b)
+{
+  return (a.format() == b.format()) && (a.totalSize() == b.totalSize()) &&
+    (memcmp(a.bytes(), b.bytes(), a.totalSize()) == 0);
+}
+
+void
+testBlockCompressorRoundTrip()
+{
+  TestRandom random(36);
+  BlockCompressor::Encoder encoders[] = {BlockCompressor::ENCODER_FAST, BlockCompressor::ENCODER_SCALAR,
+                                         BlockCompressor::ENCODER_REFERENCE};
+  const TextureFormat *formats[] = {TextureFormat::RGB_DXT1(), TextureFormat::RGBA_DXT3()};
+
+  // Solid blocks of representable colors decode to exactly what went in
+  TextureData exact;
+  makeExactImage(32, 32, random, exact);
+  for (int f=0;f<2;f++) {
+    for (int e=0;e<3;e++) {
+      TextureData compressed, decoded;
+      BlockCompressor::compress(exact, formats[f], compressed, encoders[e]);
+      BlockCompressor::decompress(compressed, decoded);
+      TEST_CHECK_EQUAL(BlockCompressor::computePSNR(exact, compressed), inf());
+      // decompress() decodes exactly what computePSNR() reads
+      TEST_CHECK_EQUAL(BlockCompressor::computePSNR(compressed, decoded), inf());
+    }
+  }
+
+  // BC1 with alpha keeps only whether a texel is at least half opaque
+  {
+    TextureData compressed, decoded;
+    BlockCompressor::compress(exact, TextureFormat::RGBA_DXT1(), compressed);
+    BlockCompressor::decompress(compressed, decoded);
+    bool alphaOk = true;
+    for (int i=0;i<32*32;i++) {
+      uint8 a = decoded.levelData(0)[4*i+3];
+      alphaOk = alphaOk && (a == ((exact.levelData(0)[4*i+3] >= 128) ? 255 : 0));
+    }
+    TEST_CHECK(alphaOk);
+  }
+
+  // The SSE2 encoder gives the same blocks as the scalar one
+  TextureData rgba;
+  makeCompressorImage(64, 64, true, random, rgba);
+  const TextureFormat *allFormats[] = {TextureFormat::RGB_DXT1(), TextureFormat::RGBA_DXT1(),
+                                       TextureFormat::RGBA_DXT3(), TextureFormat::RGBA_DXT5()};
+  for (int f=0;f<4;f++) {
+    TEST_CHECK(BlockCompressor::canCompress(allFormats[f]));
+    TextureData fast, scalar;
+    BlockCompressor::compress(rgba, allFormats[f], fast, BlockCompressor::ENCODER_FAST);
+    BlockCompressor::compress(rgba, allFormats[f], scalar, BlockCompressor::ENCODER_SCALAR);
+    TEST_CHECK(sameTexels(fast, scalar));
+  }
+  TEST_CHECK(!BlockCompressor::canCompress(TextureFormat::RGB8()));
+
+  // Sizes that aren't a multiple of the block size, with their mip levels
+  TextureData odd;
+  makeCompressorImage(125, 67, false, random, odd);
+  TextureData oddMips;
+  oddMips.allocate(TextureFormat::RGB8(), 125, 67, TextureData::numMipLevels(125, 67));
+  System::memcpy(oddMips.levelData(0), odd.levelData(0), odd.levelSize(0));
+  oddMips.generateMipmaps();
+  TextureData compressed, decoded;
+  BlockCompressor::compress(oddMips, TextureFormat::RGB_DXT1(), compressed);
+  BlockCompressor::decompress(compressed, decoded);
+  TEST_CHECK_EQUAL(compressed.numLevels(), oddMips.numLevels());
+  TEST_CHECK_EQUAL(decoded.numLevels(), oddMips.numLevels());
+  TEST_CHECK((decoded.width() == 125) && (decoded.height() == 67));
+  TEST_CHECK_EQUAL(decoded.levelSize(0), (size_t)(125 * 67 * 4));
+  TEST_CHECK(BlockCompressor::computePSNR(odd, decoded) > 30.0);
+}
+
+void
+testBlockCompressorPSNR()
+{
+  // One level off in every channel
+  TextureData a, b;
+  a.allocate(TextureFormat::RGB8(), 16, 16, 1);
+  b.allocate(TextureFormat::RGB8(), 16, 16, 1);
+  System::memset(a.bytes(), 100, a.totalSize());
+  System::memset(b.bytes(), 101, b.totalSize());
+  TEST_CHECK_EQUAL(BlockCompressor::computePSNR(a, a), inf());
+  TEST_CHECK_CLOSE(BlockCompressor::computePSNR(a, b), 10.0 * log10(255.0 * 255.0), 1e-9);
+
+  TestRandom random(360);
+  TextureData rgb, rgba;
+  makeCompressorImage(256, 256, false, random, rgb);
+  makeCompressorImage(256, 256, true, random, rgba);
+  double bc1[3], bc3[3];
+  BlockCompressor::Encoder encoders[] = {BlockCompressor::ENCODER_FAST, BlockCompressor::ENCODER_SCALAR,
+                                         BlockCompressor::ENCODER_REFERENCE};
+  for (int e=0;e<3;e++) {
+    TextureData dst;
+    BlockCompressor::compress(rgb, TextureFormat::RGB_DXT1(), dst, encoders[e]);
+    bc1[e] = BlockCompressor::computePSNR(rgb, dst);
+    BlockCompressor::compress(rgba, TextureFormat::RGBA_DXT5(), dst, encoders[e]);
+    bc3[e] = BlockCompressor::computePSNR(rgba, dst);
+  }
+  // About 35.8 and 37.1 dB when the encoders were written
+  TEST_CHECK(bc1[0] > 34.0);
+  TEST_CHECK(bc3[0] > 35.0);
+  TEST_CHECK_EQUAL(bc1[0], bc1[1]);
+  TEST_CHECK_EQUAL(bc3[0], bc3[1]);
+  // The reference encoder is the one the others are measured against
+  TEST_CHECK(bc1[2] >= bc1[0]);
+  TEST_CHECK(bc3[2] >= bc3[0]);
+}
+
+bool
+sameRequests(const Array<TextureLoadRequest> &a, const Array<TextureLoadRequest> &b)
+{
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (int i=0;i<a.size();i++) {
+    if ((a[i].filename != b[i].filename) || (a[i].alphaFilename != b[i].alphaFilename) ||
+        (a[i].keyName != b[i].keyName) || (a[i].format != b[i].format) || !(a[i].wrap == b[i].wrap) ||
+        (a[i].interp != b[i].interp) || (a[i].dim != b[i].dim) || (a[i].brightness != b[i].brightness)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const char MANIFEST_TEXT[] =
+  "  file1.jpg background-image RGB8 CLAMP ;\n"
+  "\tfile2.jpg foreground-image;\r\n"
+  "file3.jpg,file3-alpha.jpg  myTextureWithAnAlpha ;"
+  " sky.png sky RGB_DXT1 TILE NEAREST_NO_MIPMAP DIM_2D 0.5 ;  ";
+
+void
+testManifestParse()
+{
+  Array<TextureLoadRequest> requests;
+  std::string error;
+  TEST_CHECK(TextureManifest::parse(MANIFEST_TEXT, requests, error));
+  TEST_CHECK(error.empty());
+  TEST_CHECK_EQUAL(requests.size(), 4);
+  if (requests.size() == 4) {
+    TEST_CHECK_EQUAL(requests[0].filename, "file1.jpg");
+    TEST_CHECK_EQUAL(requests[0].keyName, "background-image");
+    TEST_CHECK_EQUAL(requests[0].format, "RGB8");
+    TEST_CHECK(requests[0].wrap == WrapMode::CLAMP);
+    TEST_CHECK_EQUAL(requests[1].format, "AUTO");
+    TEST_CHECK(!requests[1].hasAlpha());
+    TEST_CHECK_EQUAL(requests[2].alphaFilename, "file3-alpha.jpg");
+    TEST_CHECK_EQUAL(requests[2].format, "RGBA8");
+    TEST_CHECK_EQUAL(requests[3].interp, Texture::NEAREST_NO_MIPMAP);
+    TEST_CHECK_EQUAL(requests[3].dim, Texture::DIM_2D);
+    TEST_CHECK_EQUAL(requests[3].brightness, 0.5);
+  }
+
+  // Nothing but whitespace is an empty list
+  requests.fastClear();
+  TEST_CHECK(TextureManifest::parse(" \n\t ", requests, error));
+  TEST_CHECK_EQUAL(requests.size(), 0);
+
+  // The binary form holds the same requests
+  Array<TextureLoadRequest> compiled;
+  std::string filename = testTempDirectory() + "/textures.vtm";
+  TEST_CHECK(TextureManifest::isBinaryManifestName(filename));
+  TEST_CHECK(TextureManifest::compile(MANIFEST_TEXT, filename, error));
+  TEST_CHECK(TextureManifest::readBinary(filename, compiled, error));
+  requests.fastClear();
+  TextureManifest::parse(MANIFEST_TEXT, requests, error);
+  TEST_CHECK(sameRequests(requests, compiled));
+}
+
+void
+testManifestMalformed()
+{
+  struct Case {
+    const char *text;
+    /// Entries that parsed before the bad one
+    int         numParsed;
+    /// The start of the error, which has the entry and offset
+    const char *error;
+  };
+  const Case cases[] = {
+    {"a.png",                          0, "LoadTextures entry 1, offset 5: Expected a keyname"},
+    {"a.png key",                      0, "LoadTextures entry 1, offset 9: Expected a ;"},
+    {"a.png key RGB8",                 0, "LoadTextures entry 1, offset 14: Expected a ;"},
+    {";",                              0, "LoadTextures entry 1, offset 0: Expected a filename"},
+    {"a.png ;",                        0, "LoadTextures entry 1, offset 6: Expected a keyname"},
+    {"a.png, key;",                    0, "LoadTextures entry 1, offset 10: Expected a keyname"},
+    {"a.png,;",                        0, "LoadTextures entry 1, offset 6: Expected a filename for the alpha"},
+    {"a.png key RGB9;",                0, "LoadTextures entry 1, offset 10: Invalid texture format: RGB9"},
+    {"a.png key RGB8 WRAP;",           0, "LoadTextures entry 1, offset 15: Invalid wrap mode: WRAP"},
+    {"a.png key RGB8 TILE LINEAR;",    0, "LoadTextures entry 1, offset 20: Invalid interpolation mode"},
+    {"a.png key RGB8 TILE NEAREST_MIPMAP DIM_3D;", 0, "LoadTextures entry 1, offset 35: Invalid dimension"},
+    {"a.png key RGB8 TILE NEAREST_MIPMAP DIM_2D 1.5x;", 0, "LoadTextures entry 1, offset 42: Invalid brightness"},
+    {"a.png key RGB8 TILE NEAREST_MIPMAP DIM_2D 1 2;", 0, "LoadTextures entry 1, offset 44: Unexpected 2 after"},
+    {"a.png key RGB8 , TILE;",         0, "LoadTextures entry 1, offset 15: Unexpected ,"},
+    {"a.png key; b.png key2 rgb8;",    1, "LoadTextures entry 2, offset 22: Invalid texture format: rgb8"},
+    {"a.png key; b.png key2; c.png",   2, "LoadTextures entry 3, offset 28: Expected a keyname"},
+    {"a.png key;; b.png key2;",        1, "LoadTextures entry 2, offset 10: Expected a filename"},
+  };
+
+  for (int i=0;i<(int)(sizeof(cases) / sizeof(cases[0]));i++) {
+    Array<TextureLoadRequest> requests;
+    std::string error;
+    bool ok = TextureManifest::parse(cases[i].text, requests, error);
+    bool matches = !ok && (requests.size() == cases[i].numParsed) && beginsWith(error, cases[i].error);
+    if (!matches) {
+      printf("  parsing \"%s\" gave \"%s\"\n", cases[i].text, error.c_str());
+    }
+    TEST_CHECK(matches);
+  }
+
+  // Names are compared whole, including any \0 in them
+  const char withNull[] = "a.png key RGB8\0X;";
+  Array<TextureLoadRequest> requests;
+  std::string error;
+  TEST_CHECK(!TextureManifest::parse(withNull, sizeof(withNull) - 1, requests, error));
+}
+
+void
+testManifestFuzz()
+{
+  std::string text = MANIFEST_TEXT;
+  Array<TextureLoadRequest> expected;
+  std::string error;
+  TextureManifest::parse(text, expected, error);
+
+  // Every prefix either parses to the entries it holds in full, or fails
+  // having kept just those entries
+  bool prefixesOk = true;
+  for (size_t n=0;n<=text.size();n++) {
+    Array<TextureLoadRequest> requests;
+    error = "";
+    bool ok = TextureManifest::parse(text.c_str(), n, requests, error);
+    int complete = 0;
+    for (size_t i=0;i<n;i++) {
+      complete += (text[i] == ';') ? 1 : 0;
+    }
+    bool onlyWhitespaceAfter = text.find_first_not_of(" \t\r\n", text.rfind(';', n - 1) + 1) >= n;
+    if (complete == 0) {
+      onlyWhitespaceAfter = text.find_first_not_of(" \t\r\n") >= n;
+    }
+    prefixesOk = prefixesOk && (ok == onlyWhitespaceAfter) && (requests.size() == complete) &&
+      (ok == error.empty());
+  }
+  TEST_CHECK(prefixesOk);
+
+  // Random edits never crash, keep what parsed before a failure and report
+  // where it was
+  TestRandom random(37);
+  const char alphabet[] = " \t\n;,.xRGB8TILEDIM_2D0";
+  bool mutationsOk = true;
+  int numFailed = 0;
+  for (int i=0;i<5000;i++) {
+    std::string mutated = text;
+    int numEdits = random.integer(1, 4);
+    for (int e=0;e<numEdits;e++) {
+      size_t at = random.integer((int)mutated.size());
+      char c = alphabet[random.integer((int)sizeof(alphabet))];
+      switch (random.integer(3)) {
+      case 0:
+        mutated[at] = c;
+        break;
+      case 1:
+        mutated.insert(at, 1, c);
+        break;
+      default:
+        mutated.erase(at, 1);
+        break;
+      }
+    }
+    Array<TextureLoadRequest> requests;
+    error = "";
+    if (TextureManifest::parse(mutated, requests, error)) {
+      // Whatever parsed must survive the binary form
+      Array<uint8> bytes;
+      Array<TextureLoadRequest> compiled;
+      TextureManifest::serialize(requests, bytes);
+      mutationsOk = mutationsOk && TextureManifest::deserialize(bytes.getCArray(), bytes.size(), compiled, error) &&
+        sameRequests(requests, compiled);
+    }
+    else {
+      numFailed++;
+      int entry = -1;
+      int offset = -1;
+      mutationsOk = mutationsOk && (sscanf(error.c_str(), "LoadTextures entry %d, offset %d:", &entry, &offset) == 2) &&
+        (entry == requests.size() + 1) && (offset >= 0) && (offset <= (int)mutated.size());
+    }
+  }
+  TEST_CHECK(mutationsOk);
+  TEST_CHECK(numFailed > 0);
+}
+
+void
+testManifestBinaryMalformed()
+{
+  Array<TextureLoadRequest> requests;
+  std::string error;
+  TextureManifest::parse(MANIFEST_TEXT, requests, error);
+  Array<uint8> bytes;
+  TextureManifest::serialize(requests, bytes);
+
+  // Every truncation is caught by the bounds checks
+  bool truncationsOk = true;
+  for (int n=0;n<bytes.size();n++) {
+    Array<TextureLoadRequest> read;
+    error = "";
+    truncationsOk = truncationsOk && !TextureManifest::deserialize(bytes.getCArray(), n, read, error) &&
+      !error.empty();
+  }
+  TEST_CHECK(truncationsOk);
+
+  Array<uint8> corrupt = bytes;
+  corrupt[0] = 'X';
+  TEST_CHECK(!TextureManifest::deserialize(corrupt.getCArray(), corrupt.size(), requests, error));
+  TEST_CHECK_EQUAL(error, "Not a pre-compiled texture manifest");
+
+  // A wrap mode past the end of the table, in the first entry's settings
+  // which follow its four strings
+  corrupt = bytes;
+  int codes = 16;
+  for (int s=0;s<4;s++) {
+    uint32 length;
+    System::memcpy(&length, corrupt.getCArray() + codes, sizeof(length));
+    codes += sizeof(length) + length;
+  }
+  corrupt[codes] = 200;
+  TEST_CHECK(!TextureManifest::deserialize(corrupt.getCArray(), corrupt.size(), requests, error));
+  TEST_CHECK_EQUAL(error, "Corrupt settings in texture manifest entry 1");
+
+  // A string length far past the end
+  corrupt = bytes;
+  corrupt[16] = 0xFF;
+  corrupt[19] = 0x7F;
+  TEST_CHECK(!TextureManifest::deserialize(corrupt.getCArray(), corrupt.size(), requests, error));
+  TEST_CHECK_EQUAL(error, "Truncated texture manifest at entry 1");
+
+  TEST_CHECK(!TextureManifest::readBinary(testTempDirectory() + "/missing.vtm", requests, error));
+}
+
+} // end namespace
+
+
+void
+runTextureTests()
+{
+  testManifestParse();
+  testManifestMalformed();
+  testManifestFuzz();
+  testManifestBinaryMalformed();
+  testBlockCompressorRoundTrip();
+  testBlockCompressorPSNR();
+  testPackerOccupancy();
+  testAtlasUVs();
+  testCacheKeys();
+  testCacheEviction();
+  testLoadPipelineOrder();
+  testLoadPipelineCapacity();
+  testLoadPipelineInline();
+  testLoadPipelineDestructorWaits();
+  testResidencyLoadsOnFirstUse();
+  testResidencyBudgetEviction();
+  testGfxMgrResidencyFrames();
+  testRegistryInterning();
+  testRegistryReverseLookup();
+  testRegistryBatchedGet();
+  testRegistryHandleStability();
+}